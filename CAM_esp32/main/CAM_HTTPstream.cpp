@@ -1,17 +1,29 @@
 #include "CAM_HTTPStream.hpp"
+#include "CAM_httpAsync.hpp"
 #include "esp_log.h"
+#include "esp_timer.h"
 #include <cstring>
+#include <algorithm>
 
 const char* HttpStreamManager::TAG = "HTTP_STREAM";
 
 // Global instance for static callback
 static HttpStreamManager* g_streamMgr = nullptr;
 
-HttpStreamManager::HttpStreamManager(EspCamera& cam)
-    : camera(cam), streamTaskHandle(nullptr), isStreaming(false), stopRequested(false) {
+HttpStreamManager::HttpStreamManager(FrameBroker& frameBroker, EspCamera& camera)
+    : broker(frameBroker), rate(camera), isStreaming(false), stopRequested(false) {
+    
+    rate.setTargetFps(STREAM_FPS);
+    
+    for (Client& client : clients) {
+        client = {};
+        client.consumer = -1;
+        client.fd = -1;
+    }
     
     mutex = xSemaphoreCreateMutex();
-    if (mutex == nullptr) {
+    clientsDone = xSemaphoreCreateBinary();
+    if (mutex == nullptr || clientsDone == nullptr) {
         ESP_LOGE(TAG, "Failed to create mutex");
     }
     
@@ -24,6 +36,9 @@ HttpStreamManager::~HttpStreamManager() {
     if (mutex != nullptr) {
         vSemaphoreDelete(mutex);
     }
+    if (clientsDone != nullptr) {
+        vSemaphoreDelete(clientsDone);
+    }
     
     g_streamMgr = nullptr;
 }
@@ -44,27 +59,6 @@ esp_err_t HttpStreamManager::start() {
     
     xSemaphoreGive(mutex);
     
-    // Tạo stream task
-    BaseType_t ret = xTaskCreate(
-        streamTaskFunc,
-        "http_stream",
-        8192,
-        this,
-        PRIORITY_STREAM_TASK,
-        &streamTaskHandle
-    );
-    
-    if (ret != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create stream task");
-        
-        if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            isStreaming = false;
-            xSemaphoreGive(mutex);
-        }
-        
-        return ESP_FAIL;
-    }
-    
     ESP_LOGI(TAG, "Stream started");
     return ESP_OK;
 }
@@ -74,23 +68,23 @@ esp_err_t HttpStreamManager::stop() {
         return ESP_FAIL;
     }
     
-    if (!isStreaming) {
-        xSemaphoreGive(mutex);
-        return ESP_OK;
-    }
-    
     stopRequested = true;
+    xSemaphoreTake(clientsDone, 0);
+    
+    // Đánh thức client đang chờ frame → thoát ngay, không đợi frame kế tiếp
+    uint8_t active = 0;
+    for (Client& client : clients) {
+        if (client.fd >= 0) {
+            broker.cancel(client.consumer);
+            active++;
+        }
+    }
     
     xSemaphoreGive(mutex);
     
-    // Đợi task kết thúc
-    if (streamTaskHandle != nullptr) {
-        vTaskDelay(pdMS_TO_TICKS(200));  // Give task time to stop
-        
-        if (streamTaskHandle != nullptr) {
-            vTaskDelete(streamTaskHandle);
-            streamTaskHandle = nullptr;
-        }
+    // Client cuối cùng rời đi sẽ give clientsDone
+    if (active > 0 && xSemaphoreTake(clientsDone, pdMS_TO_TICKS(STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "%u stream client(s) still sending", getClientCount());
     }
     
     if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
@@ -114,42 +108,106 @@ bool HttpStreamManager::isActive() const {
     return active;
 }
 
-void HttpStreamManager::streamTaskFunc(void* param) {
-    HttpStreamManager* self = static_cast<HttpStreamManager*>(param);
+uint8_t HttpStreamManager::getClientCount() const {
+    uint8_t count = 0;
+    
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        for (const Client& client : clients) {
+            if (client.fd >= 0) {
+                count++;
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
     
-    ESP_LOGI(TAG, "Stream task running");
+    return count;
+}
+
+std::vector<StreamClientStats> HttpStreamManager::getClientStats() const {
+    std::vector<StreamClientStats> result;
+    int64_t nowUs = esp_timer_get_time();
     
-    // Task này maintain state, actual streaming được xử lý trong handleStreamRequest
-    while (true) {
-        bool shouldStop = false;
-        
-        if (xSemaphoreTake(self->mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-            shouldStop = self->stopRequested;
-            xSemaphoreGive(self->mutex);
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        for (const Client& client : clients) {
+            if (client.fd < 0 || client.consumer < 0) {
+                continue;
+            }
+            BrokerConsumerStats consumer = broker.getStats(client.consumer);
+            StreamClientStats stats;
+            stats.fd = client.fd;
+            stats.frames = client.frames;
+            stats.bytes = client.bytes;
+            stats.dropped = consumer.dropped;
+            stats.fps = consumer.fps;
+            stats.targetFps = client.fps;
+            stats.connectedMs = (nowUs - client.startUs) / 1000;
+            result.push_back(stats);
         }
-        
-        if (shouldStop) {
-            ESP_LOGI(TAG, "Stop requested");
-            break;
+        xSemaphoreGive(mutex);
+    }
+    
+    return result;
+}
+
+esp_err_t HttpStreamManager::handleStreamRequest(httpd_req_t* req) {
+    ESP_LOGI(TAG, "Handling stream request");
+    
+    // Giữ 1 slot client
+    Client* client = nullptr;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        for (Client& slot : clients) {
+            if (slot.fd < 0) {
+                client = &slot;
+                client->fd = httpd_req_to_sockfd(req);
+                client->frames = 0;
+                client->bytes = 0;
+                client->startUs = esp_timer_get_time();
+                client->fps = STREAM_FPS;
+                client->paceStartUs = 0;
+                client->paceFrames = 0;
+                client->paceSendUs = 0;
+                client->paceCongested = 0;
+                client->paceHealthy = 0;
+                break;
+            }
         }
-        
-        vTaskDelay(pdMS_TO_TICKS(100));
+        xSemaphoreGive(mutex);
+    }
+    
+    if (client == nullptr) {
+        ESP_LOGW(TAG, "Too many stream clients (max %u)", MAX_CLIENTS);
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Too many stream clients");
+        return ESP_OK;
+    }
+    
+    // Frame dùng chung với recorder và các client khác; client chậm chỉ nhận frame mới nhất
+    client->consumer = broker.subscribe("stream", STREAM_FPS, QueueDropPolicy::DROP_OLDEST);
+    if (client->consumer < 0) {
+        releaseClient(*client);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
     }
     
-    ESP_LOGI(TAG, "Stream task ended");
+    // Request tách khỏi httpd worker → gửi trên task riêng, httpd nhận request khác ngay
+    esp_err_t ret = HttpAsync::run(req, "stream_client", 4096, PRIORITY_CLIENT_TASK,
+                                   [this, client](httpd_req_t* asyncReq) {
+        esp_err_t res = streamTo(asyncReq, *client);
+        releaseClient(*client);
+        return res;
+    });
     
-    // Task tự cleanup
-    self->streamTaskHandle = nullptr;
-    vTaskDelete(nullptr);
+    if (ret != ESP_OK) {
+        releaseClient(*client);
+    }
+    return ret;
 }
 
-esp_err_t HttpStreamManager::handleStreamRequest(httpd_req_t* req) {
-    camera_fb_t* fb = nullptr;
+esp_err_t HttpStreamManager::streamTo(httpd_req_t* req, Client& client) {
+    FrameHandle frame;      // Hủy (break/return) = trả buffer cho driver
     esp_err_t res = ESP_OK;
     char part_buf[64];
     
-    ESP_LOGI(TAG, "Handling stream request");
-    
     // Set HTTP headers
     res = httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
     if (res != ESP_OK) {
@@ -160,63 +218,141 @@ esp_err_t HttpStreamManager::handleStreamRequest(httpd_req_t* req) {
     
     // Stream loop
     while (true) {
-        // Check stop flag
-        bool shouldStop = false;
-        if (xSemaphoreTake(mutex, pdMS_TO_TICKS(10)) == pdTRUE) {
-            shouldStop = stopRequested;
-            xSemaphoreGive(mutex);
-        }
-        
-        if (shouldStop) {
-            ESP_LOGI(TAG, "Stream stopped by request");
+        // Broker decimate về STREAM_FPS → chỉ cần chờ frame kế tiếp. stop() → cancel → false ngay
+        if (!broker.acquire(client.consumer, frame, pdMS_TO_TICKS(FRAME_TIMEOUT_MS))) {
+            if (stopRequested) {
+                ESP_LOGI(TAG, "Stream stopped by request");
+            } else {
+                ESP_LOGE(TAG, "Camera capture failed");
+                res = ESP_FAIL;
+            }
             break;
         }
         
-        // Capture frame
-        fb = camera.captureFrame();
-        if (fb == nullptr) {
-            ESP_LOGE(TAG, "Camera capture failed");
-            res = ESP_FAIL;
-            break;
-        }
+        std::span<const uint8_t> jpeg = frame.data();
+        int64_t sendStartUs = esp_timer_get_time();
         
         // Send boundary
         res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
         if (res != ESP_OK) {
-            camera.returnFrameBuffer(fb);
             break;
         }
         
         // Send part header
-        size_t hlen = snprintf(part_buf, sizeof(part_buf), STREAM_PART, fb->len);
+        size_t hlen = snprintf(part_buf, sizeof(part_buf), STREAM_PART, jpeg.size());
         res = httpd_resp_send_chunk(req, part_buf, hlen);
         if (res != ESP_OK) {
-            camera.returnFrameBuffer(fb);
             break;
         }
         
         // Send JPEG data
-        res = httpd_resp_send_chunk(req, (const char*)fb->buf, fb->len);
+        res = httpd_resp_send_chunk(req, (const char*)jpeg.data(), jpeg.size());
         if (res != ESP_OK) {
-            camera.returnFrameBuffer(fb);
             break;
         }
         
-        camera.returnFrameBuffer(fb);
-        fb = nullptr;
+        // Send block = socket đầy → rate controller tăng nén, client này giảm fps
+        uint32_t sendUs = esp_timer_get_time() - sendStartUs;
+        rate.report(sendUs);
+        paceClient(client, sendUs);
         
-        // Frame rate control (~20 fps)
-        vTaskDelay(pdMS_TO_TICKS(50));
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            client.frames++;
+            client.bytes += strlen(STREAM_BOUNDARY) + hlen + jpeg.size();
+            xSemaphoreGive(mutex);
+        }
+        
+        // Trả frame ngay, không giữ trong lúc chờ frame kế tiếp
+        broker.release(client.consumer, frame);
     }
     
-    if (fb != nullptr) {
-        camera.returnFrameBuffer(fb);
-    }
+    broker.release(client.consumer, frame);
     
-    ESP_LOGI(TAG, "Stream handler ended");
+    if (res == ESP_OK) {
+        // Dừng chủ động → kết thúc chunked response cho client
+        httpd_resp_send_chunk(req, nullptr, 0);
+    } else {
+        // Client mất kết nối → đóng session, httpd không chờ request kế tiếp trên socket này
+        httpd_sess_trigger_close(req->handle, client.fd);
+    }
     return res;
 }
 
+// Chỉ task của client gọi → không cần mutex cho các field pace*
+void HttpStreamManager::paceClient(Client& client, uint32_t sendUs) {
+    int64_t nowUs = esp_timer_get_time();
+    if (client.paceStartUs == 0) {
+        client.paceStartUs = nowUs;
+    }
+    client.paceFrames++;
+    client.paceSendUs += sendUs;
+    if (nowUs - client.paceStartUs < PACE_WINDOW_US) {
+        return;
+    }
+    
+    uint64_t avgSendUs = client.paceSendUs / client.paceFrames;
+    uint64_t periodUs = 1000000 / client.fps;
+    client.paceStartUs = nowUs;
+    client.paceFrames = 0;
+    client.paceSendUs = 0;
+    
+    uint8_t fps = client.fps;
+    if (avgSendUs * 100 > periodUs * PACE_CONGESTED_PCT) {
+        client.paceHealthy = 0;
+        if (++client.paceCongested >= PACE_DOWN_WINDOWS) {
+            fps = std::max<uint8_t>(MIN_CLIENT_FPS, fps * 2 / 3);
+        }
+    } else if (avgSendUs * 100 < periodUs * PACE_HEALTHY_PCT) {
+        client.paceCongested = 0;
+        if (++client.paceHealthy >= PACE_UP_WINDOWS) {
+            fps = std::min<uint8_t>(STREAM_FPS, fps + 2);
+        }
+    } else {
+        client.paceCongested = 0;
+        client.paceHealthy = 0;
+    }
+    
+    if (fps != client.fps) {
+        ESP_LOGI(TAG, "Client %d pacing %u → %u fps (send %llu/%llu us)",
+                 client.fd, client.fps, fps, avgSendUs, periodUs);
+        broker.setFps(client.consumer, fps);
+        client.paceCongested = 0;
+        client.paceHealthy = 0;
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            client.fps = fps;
+            xSemaphoreGive(mutex);
+        }
+    }
+}
+
+void HttpStreamManager::releaseClient(Client& client) {
+    if (client.consumer >= 0) {
+        BrokerConsumerStats stats = broker.getStats(client.consumer);
+        ESP_LOGI(TAG, "Stream client %d ended: %lu frames, %llu KB (%.1f/%u fps, %lu dropped)",
+                 client.fd, client.frames, client.bytes / 1024, stats.fps, STREAM_FPS, stats.dropped);
+        broker.unsubscribe(client.consumer);
+    }
+    
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        client.consumer = -1;
+        client.fd = -1;
+        
+        bool last = true;
+        for (const Client& other : clients) {
+            last = last && other.fd < 0;
+        }
+        if (last) {
+            xSemaphoreGive(clientsDone);
+        }
+        xSemaphoreGive(mutex);
+        
+        // Không còn ai xem → recorder dùng lại cấu hình camera gốc
+        if (last) {
+            rate.reset();
+        }
+    }
+}
+
 esp_err_t HttpStreamManager::streamHandlerWrapper(httpd_req_t* req) {
     if (g_streamMgr == nullptr) {
         ESP_LOGE(TAG, "Stream manager not initialized");
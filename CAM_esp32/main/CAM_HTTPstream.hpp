@@ -1,35 +1,86 @@
 #ifndef HTTP_STREAM_HPP
 #define HTTP_STREAM_HPP
 
-#include "CAM_sensorRead.hpp"
+#include "CAM_frameBroker.hpp"
+#include "CAM_streamRate.hpp"
 #include "esp_http_server.h"
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
 #include "freertos/semphr.h"
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// Counter của 1 client /stream
+struct StreamClientStats {
+    int fd;                     // Socket của client
+    uint32_t frames;            // Frame đã gửi
+    uint64_t bytes;
+    uint32_t dropped;           // Frame bị bỏ vì client gửi chậm (broker mailbox)
+    float fps;
+    uint8_t targetFps;          // fps broker cấp cho client (pacing hạ khi client gửi không kịp)
+    uint32_t connectedMs;
+};
 
 // HTTP Stream Manager Class
+//   - Broadcast: capture 1 lần trong FrameBroker, mỗi client là 1 consumer mailbox (DROP_OLDEST)
+//   - Mỗi client gửi trên task riêng (HttpAsync) → client chậm chỉ bỏ frame của nó,
+//     không làm chậm client khác, httpd vẫn nhận request mới
+//   - stop(): cancel mailbox của từng client → thoát ngay, chờ client cuối qua semaphore
+//   - Client nghẽn: rate controller tăng nén (chung, không đổi frame size); riêng client đó
+//     còn bị giảm fps (pacing) khi gửi 1 frame lâu hơn chu kỳ frame của chính nó
 class HttpStreamManager {
 private:
-    EspCamera& camera;
-    TaskHandle_t streamTaskHandle;
+    struct Client {
+        int consumer;
+        int fd;                 // -1 = slot trống
+        uint32_t frames;
+        uint64_t bytes;
+        int64_t startUs;
+        
+        // Pacing riêng client (cùng ngưỡng/hysteresis với StreamRateController)
+        uint8_t fps;
+        int64_t paceStartUs;
+        uint32_t paceFrames;
+        uint64_t paceSendUs;
+        uint8_t paceCongested;
+        uint8_t paceHealthy;
+    };
+    
+    FrameBroker& broker;
+    StreamRateController rate;      // Hạ size/quality khi client gửi không kịp
     SemaphoreHandle_t mutex;
+    SemaphoreHandle_t clientsDone;  // Client cuối cùng kết thúc (stop() chờ)
     
     bool isStreaming;
-    bool stopRequested;
+    volatile bool stopRequested;
     
     static const char* TAG;
-    static constexpr uint8_t PRIORITY_STREAM_TASK = 6;  // High priority
+    static constexpr uint8_t PRIORITY_CLIENT_TASK = 5;  // = httpd, dưới broker capture không bị trễ
+    static constexpr uint8_t MAX_CLIENTS = 4;
+    static constexpr uint8_t STREAM_FPS = 20;
+    static constexpr uint32_t FRAME_TIMEOUT_MS = 2000;
+    static constexpr uint32_t STOP_TIMEOUT_MS = 1000;       // Client đang gửi dở 1 frame
+    static constexpr uint8_t MIN_CLIENT_FPS = 2;
+    static constexpr int64_t PACE_WINDOW_US = 1000000;
+    static constexpr uint32_t PACE_CONGESTED_PCT = 120;
+    static constexpr uint32_t PACE_HEALTHY_PCT = 50;
+    static constexpr uint8_t PACE_DOWN_WINDOWS = 2;
+    static constexpr uint8_t PACE_UP_WINDOWS = 5;
+    
+    Client clients[MAX_CLIENTS];
     
     // MJPEG stream constants
     static constexpr const char* STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=123456789000000000000987654321";
     static constexpr const char* STREAM_BOUNDARY = "\r\n--123456789000000000000987654321\r\n";
     static constexpr const char* STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %u\r\n\r\n";
     
-    static void streamTaskFunc(void* param);
+    esp_err_t streamTo(httpd_req_t* req, Client& client);
+    void releaseClient(Client& client);
+    void paceClient(Client& client, uint32_t sendUs);
     
 public:
-    explicit HttpStreamManager(EspCamera& cam);
+    HttpStreamManager(FrameBroker& frameBroker, EspCamera& camera);
     ~HttpStreamManager();
     
     // Disable copy
@@ -41,6 +92,16 @@ public:
     esp_err_t stop();
     bool isActive() const;
     
+    // Pacing: fps thực tế của từng client so với STREAM_FPS (frame bị bỏ khi client gửi chậm)
+    uint8_t getTargetFps() const { return STREAM_FPS; }
+    uint8_t getClientCount() const;
+    std::vector<StreamClientStats> getClientStats() const;
+    
+    // Adaptive quality: hold = true → giữ cấu hình camera gốc (vd. đang ghi recording)
+    void setRateHoldCheck(std::function<bool()> check) { rate.setHoldCheck(check); }
+    void holdRate() { rate.hold(); }
+    StreamRateStats getRateStats() const { return rate.getStats(); }
+    
     // HTTP handler - Được gọi từ HTTP server
     esp_err_t handleStreamRequest(httpd_req_t* req);
     
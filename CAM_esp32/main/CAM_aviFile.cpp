@@ -0,0 +1,488 @@
+#include "CAM_aviFile.hpp"
+#include "esp_log.h"
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+const char* AviWriter::TAG = "AVI_WRITER";
+const char* AviReader::TAG = "AVI_READER";
+
+static constexpr uint32_t AVIF_HASINDEX = 0x00000010;
+static constexpr uint32_t AVIIF_KEYFRAME = 0x00000010;
+
+// Little-endian helpers
+static inline void putU16(uint8_t*& p, uint16_t v) {
+    *p++ = v & 0xFF;
+    *p++ = (v >> 8) & 0xFF;
+}
+
+static inline void putU32(uint8_t*& p, uint32_t v) {
+    *p++ = v & 0xFF;
+    *p++ = (v >> 8) & 0xFF;
+    *p++ = (v >> 16) & 0xFF;
+    *p++ = (v >> 24) & 0xFF;
+}
+
+static inline void putFourcc(uint8_t*& p, const char* cc) {
+    memcpy(p, cc, 4);
+    p += 4;
+}
+
+static inline uint32_t getU32(const uint8_t* p) {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+// ==================== AVI Writer ====================
+
+AviWriter::AviWriter()
+    : file(nullptr), ioBuffer(nullptr), fps(0), width(0), height(0),
+      moviSize(4), maxFrameSize(0), broken(false) {}
+
+AviWriter::~AviWriter() {
+    close();
+    free(ioBuffer);
+}
+
+esp_err_t AviWriter::open(const std::string& filepath, uint8_t framesPerSec) {
+    if (file != nullptr) {
+        ESP_LOGE(TAG, "Already open: %s", path.c_str());
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    file = fopen(filepath.c_str(), "wb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to create: %s", filepath.c_str());
+        return ESP_FAIL;
+    }
+
+    // Buffer lớn để fwrite thành các write tuần tự lớn trên SD (giữ lại cho file sau)
+    if (ioBuffer == nullptr) {
+        ioBuffer = (char*)malloc(IO_BUFFER_SIZE);
+    }
+    if (ioBuffer != nullptr) {
+        setvbuf(file, ioBuffer, _IOFBF, IO_BUFFER_SIZE);
+    }
+
+    path = filepath;
+    fps = framesPerSec ? framesPerSec : 1;
+    width = 0;
+    height = 0;
+    moviSize = 4;
+    broken = false;
+    maxFrameSize = 0;
+    index.clear();
+
+    // Placeholder header, patched in close()
+    if (writeHeader() != ESP_OK) {
+        fclose(file);
+        file = nullptr;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t AviWriter::writeHeader() {
+    uint8_t hdr[HEADER_SIZE];
+    uint8_t* p = hdr;
+    uint32_t frames = index.size();
+    uint32_t idxSize = frames * 16;
+    bool finalized = frames > 0;
+
+    putFourcc(p, "RIFF");
+    putU32(p, finalized ? (HEADER_SIZE - 8 + moviSize - 4 + 8 + idxSize) : 0);
+    putFourcc(p, "AVI ");
+
+    putFourcc(p, "LIST");
+    putU32(p, 192);
+    putFourcc(p, "hdrl");
+
+    // avih
+    putFourcc(p, "avih");
+    putU32(p, 56);
+    putU32(p, 1000000 / fps);                 // dwMicroSecPerFrame
+    putU32(p, maxFrameSize * fps);            // dwMaxBytesPerSec
+    putU32(p, 0);                             // dwPaddingGranularity
+    putU32(p, AVIF_HASINDEX);                 // dwFlags
+    putU32(p, frames);                        // dwTotalFrames
+    putU32(p, 0);                             // dwInitialFrames
+    putU32(p, 1);                             // dwStreams
+    putU32(p, maxFrameSize);                  // dwSuggestedBufferSize
+    putU32(p, width);
+    putU32(p, height);
+    for (int i = 0; i < 4; i++) putU32(p, 0); // dwReserved
+
+    putFourcc(p, "LIST");
+    putU32(p, 116);
+    putFourcc(p, "strl");
+
+    // strh
+    putFourcc(p, "strh");
+    putU32(p, 56);
+    putFourcc(p, "vids");
+    putFourcc(p, "MJPG");
+    putU32(p, 0);                             // dwFlags
+    putU16(p, 0);                             // wPriority
+    putU16(p, 0);                             // wLanguage
+    putU32(p, 0);                             // dwInitialFrames
+    putU32(p, 1);                             // dwScale
+    putU32(p, fps);                           // dwRate
+    putU32(p, 0);                             // dwStart
+    putU32(p, frames);                        // dwLength
+    putU32(p, maxFrameSize);                  // dwSuggestedBufferSize
+    putU32(p, 0xFFFFFFFF);                    // dwQuality
+    putU32(p, 0);                             // dwSampleSize
+    putU16(p, 0);
+    putU16(p, 0);
+    putU16(p, width);
+    putU16(p, height);
+
+    // strf (BITMAPINFOHEADER)
+    putFourcc(p, "strf");
+    putU32(p, 40);
+    putU32(p, 40);
+    putU32(p, width);
+    putU32(p, height);
+    putU16(p, 1);                             // biPlanes
+    putU16(p, 24);                            // biBitCount
+    putFourcc(p, "MJPG");
+    putU32(p, (uint32_t)width * height * 3);  // biSizeImage
+    putU32(p, 0);
+    putU32(p, 0);
+    putU32(p, 0);
+    putU32(p, 0);
+
+    putFourcc(p, "LIST");
+    putU32(p, finalized ? moviSize : 0);      // 0 = chưa close, reader sẽ scan
+    putFourcc(p, "movi");
+
+    if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) {
+        ESP_LOGE(TAG, "Header write failed");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// Bỏ chunk ghi dở để header/idx1 chỉ mô tả các frame đã ghi trọn
+void AviWriter::rollbackFrame(uint32_t fileOffset) {
+    fflush(file);
+    if (fseek(file, fileOffset, SEEK_SET) != 0 || ftruncate(fileno(file), fileOffset) != 0) {
+        ESP_LOGE(TAG, "Cannot truncate %s to %lu, stop writing", path.c_str(), fileOffset);
+        broken = true;
+    }
+}
+
+esp_err_t AviWriter::writeFrame(const uint8_t* data, size_t len, uint16_t w, uint16_t h) {
+    if (file == nullptr || broken) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (width == 0) {
+        width = w;
+        height = h;
+    }
+
+    uint8_t chunkHdr[8];
+    uint8_t* p = chunkHdr;
+    putFourcc(p, "00dc");
+    putU32(p, len);
+
+    // RIFF chunks are word aligned
+    uint32_t chunkStart = HEADER_SIZE - 4 + moviSize;
+    if (fwrite(chunkHdr, 1, sizeof(chunkHdr), file) != sizeof(chunkHdr) ||
+        fwrite(data, 1, len, file) != len ||
+        ((len & 1) && fputc(0, file) == EOF)) {
+        ESP_LOGE(TAG, "Frame write failed (%u bytes)", len);
+        rollbackFrame(chunkStart);
+        return ESP_FAIL;
+    }
+
+    index.push_back({moviSize, (uint32_t)len});
+    moviSize += 8 + len + (len & 1);
+    if (len > maxFrameSize) {
+        maxFrameSize = len;
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t AviWriter::repeatLastFrame(uint32_t times) {
+    if (file == nullptr || broken || index.empty()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    // Chỉ thêm entry idx1 trỏ vào chunk cũ, không ghi thêm data
+    AviFrameRef last = index.back();
+    for (uint32_t i = 0; i < times; i++) {
+        index.push_back(last);
+    }
+    return ESP_OK;
+}
+
+esp_err_t AviWriter::writeIndex() {
+    uint8_t hdr[8];
+    uint8_t* p = hdr;
+    putFourcc(p, "idx1");
+    putU32(p, index.size() * 16);
+    if (fwrite(hdr, 1, sizeof(hdr), file) != sizeof(hdr)) {
+        return ESP_FAIL;
+    }
+
+    uint8_t entry[16];
+    for (const AviFrameRef& ref : index) {
+        p = entry;
+        putFourcc(p, "00dc");
+        putU32(p, AVIIF_KEYFRAME);
+        putU32(p, ref.offset);
+        putU32(p, ref.size);
+        if (fwrite(entry, 1, sizeof(entry), file) != sizeof(entry)) {
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+esp_err_t AviWriter::close() {
+    if (file == nullptr) {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = ESP_OK;
+
+    // broken: header giữ placeholder (moviSize = 0) → reader scan movi, dừng ở chunk cụt
+    if (broken) {
+        ret = ESP_FAIL;
+    } else if (!index.empty()) {
+        if (writeIndex() != ESP_OK) {
+            ESP_LOGE(TAG, "Index write failed: %s", path.c_str());
+            ret = ESP_FAIL;
+        } else {
+            fseek(file, 0, SEEK_SET);
+            ret = writeHeader();
+        }
+    }
+
+    fflush(file);
+    fsync(fileno(file));
+    fclose(file);
+    file = nullptr;
+
+    ESP_LOGI(TAG, "Closed %s: %lu frames, %lu bytes",
+             path.c_str(), (uint32_t)index.size(), moviSize);
+
+    // Giữ capacity của index cho recording kế tiếp
+    index.clear();
+    return ret;
+}
+
+// ==================== AVI Reader ====================
+
+AviReader::AviReader() : file(nullptr), usPerFrame(0), width(0), height(0) {}
+
+AviReader::~AviReader() {
+    close();
+}
+
+void AviReader::close() {
+    if (file != nullptr) {
+        fclose(file);
+        file = nullptr;
+    }
+    frames.clear();
+    frames.shrink_to_fit();
+}
+
+esp_err_t AviReader::open(const std::string& filepath) {
+    close();
+
+    file = fopen(filepath.c_str(), "rb");
+    if (file == nullptr) {
+        ESP_LOGE(TAG, "Failed to open: %s", filepath.c_str());
+        return ESP_FAIL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    uint32_t fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t hdr[AviWriter::HEADER_SIZE];
+    if (fileSize < sizeof(hdr) || fread(hdr, 1, sizeof(hdr), file) != sizeof(hdr) ||
+        memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "AVI ", 4) != 0 ||
+        memcmp(hdr + 24, "avih", 4) != 0) {
+        ESP_LOGE(TAG, "Not an AVI file: %s", filepath.c_str());
+        close();
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    usPerFrame = getU32(hdr + 32);
+    width = getU32(hdr + 64);
+    height = getU32(hdr + 68);
+
+    // Walk top-level chunks after hdrl to find 'movi' and 'idx1'
+    uint32_t pos = 20 + getU32(hdr + 16);
+    uint32_t moviStart = 0;
+    uint32_t moviEnd = fileSize;
+    uint32_t idxPos = 0;
+    uint32_t idxSize = 0;
+
+    while (pos + 12 <= fileSize) {
+        uint8_t ck[12];
+        fseek(file, pos, SEEK_SET);
+        if (fread(ck, 1, sizeof(ck), file) != sizeof(ck)) break;
+
+        uint32_t ckSize = getU32(ck + 4);
+        if (memcmp(ck, "LIST", 4) == 0 && memcmp(ck + 8, "movi", 4) == 0) {
+            moviStart = pos + 8;
+            if (ckSize == 0 || pos + 8 + ckSize > fileSize) {
+                // Recording chưa được close (mất nguồn) → phần còn lại là movi
+                moviEnd = fileSize;
+                break;
+            }
+            moviEnd = pos + 8 + ckSize;
+        } else if (memcmp(ck, "idx1", 4) == 0) {
+            idxPos = pos + 8;
+            idxSize = ckSize;
+        }
+
+        if (ckSize == 0) break;
+        pos += 8 + ckSize + (ckSize & 1);
+    }
+
+    if (moviStart == 0) {
+        ESP_LOGE(TAG, "No movi list: %s", filepath.c_str());
+        close();
+        return ESP_ERR_INVALID_RESPONSE;
+    }
+
+    esp_err_t ret = ESP_FAIL;
+    if (idxPos != 0 && idxSize >= 16) {
+        ret = loadIndex(moviStart, idxPos, idxSize);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGW(TAG, "No usable index, scanning: %s", filepath.c_str());
+        ret = scanMovi(moviStart, moviEnd);
+    }
+
+    if (ret != ESP_OK) {
+        close();
+        return ret;
+    }
+
+    if (usPerFrame == 0) {
+        usPerFrame = 100000;
+    }
+    return ESP_OK;
+}
+
+bool AviReader::isRepeat(uint32_t i) const {
+    return i > 0 && i < frames.size() && frames[i].offset == frames[i - 1].offset;
+}
+
+std::vector<uint32_t> AviReader::getUniqueFrames() const {
+    std::vector<uint32_t> unique;
+    unique.reserve(frames.size());
+    for (uint32_t i = 0; i < frames.size(); i++) {
+        if (!isRepeat(i)) {
+            unique.push_back(i);
+        }
+    }
+    return unique;
+}
+
+esp_err_t AviReader::loadIndex(uint32_t moviStart, uint32_t idxPos, uint32_t idxSize) {
+    uint32_t count = idxSize / 16;
+    frames.clear();
+    frames.reserve(count);
+
+    fseek(file, idxPos, SEEK_SET);
+
+    uint8_t entries[16 * 32];
+    uint32_t base = 0;
+    bool baseKnown = false;
+
+    while (count > 0) {
+        uint32_t batch = count < 32 ? count : 32;
+        if (fread(entries, 16, batch, file) != batch) {
+            return ESP_FAIL;
+        }
+        for (uint32_t i = 0; i < batch; i++) {
+            const uint8_t* e = entries + i * 16;
+            if (memcmp(e + 2, "dc", 2) != 0 && memcmp(e + 2, "db", 2) != 0) {
+                continue;
+            }
+            uint32_t off = getU32(e + 8);
+            // Offsets are relative to 'movi' fourcc, a few writers use absolute offsets
+            if (!baseKnown) {
+                base = (off >= moviStart) ? 0 : moviStart;
+                baseKnown = true;
+            }
+            frames.push_back({base + off + 8, getU32(e + 12)});
+        }
+        count -= batch;
+    }
+
+    return frames.empty() ? ESP_FAIL : ESP_OK;
+}
+
+esp_err_t AviReader::scanMovi(uint32_t moviStart, uint32_t moviEnd) {
+    frames.clear();
+
+    uint32_t pos = moviStart + 4;
+    while (pos + 8 <= moviEnd) {
+        uint8_t ck[8];
+        fseek(file, pos, SEEK_SET);
+        if (fread(ck, 1, sizeof(ck), file) != sizeof(ck)) break;
+
+        uint32_t ckSize = getU32(ck + 4);
+        if (pos + 8 + ckSize > moviEnd) break;   // frame cuối bị cắt
+
+        if (memcmp(ck + 2, "dc", 2) == 0 || memcmp(ck + 2, "db", 2) == 0) {
+            frames.push_back({pos + 8, ckSize});
+        }
+        pos += 8 + ckSize + (ckSize & 1);
+    }
+
+    return frames.empty() ? ESP_ERR_NOT_FOUND : ESP_OK;
+}
+
+esp_err_t AviReader::readFrame(uint32_t i, uint8_t* buf, size_t bufSize, size_t& outLen) {
+    if (file == nullptr || i >= frames.size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const AviFrameRef& ref = frames[i];
+    if (ref.size > bufSize) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (fseek(file, ref.offset, SEEK_SET) != 0 ||
+        fread(buf, 1, ref.size, file) != ref.size) {
+        ESP_LOGE(TAG, "Read failed at frame %lu", i);
+        return ESP_FAIL;
+    }
+
+    outLen = ref.size;
+    return ESP_OK;
+}
+
+esp_err_t AviReader::readFrameRange(uint32_t i, uint32_t pos, uint8_t* buf, size_t bufSize,
+                                    size_t& outLen) {
+    if (file == nullptr || i >= frames.size() || pos > frames[i].size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    const AviFrameRef& ref = frames[i];
+    size_t len = ref.size - pos;
+    if (len > bufSize) {
+        len = bufSize;
+    }
+
+    if (fseek(file, ref.offset + pos, SEEK_SET) != 0 ||
+        fread(buf, 1, len, file) != len) {
+        ESP_LOGE(TAG, "Read failed at frame %lu +%lu", i, pos);
+        return ESP_FAIL;
+    }
+
+    outLen = len;
+    return ESP_OK;
+}
@@ -0,0 +1,107 @@
+#ifndef CAM_AVI_FILE_HPP
+#define CAM_AVI_FILE_HPP
+
+#include "esp_err.h"
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// MJPEG AVI layout:
+//   RIFF 'AVI ' { LIST 'hdrl' {avih, LIST 'strl' {strh, strf}}, LIST 'movi' {00dc...}, idx1 }
+// Header được ghi placeholder lúc open() và patch lại lúc close().
+
+// Frame location inside an AVI file
+struct AviFrameRef {
+    uint32_t offset;    // Absolute file offset of JPEG data
+    uint32_t size;      // JPEG size in bytes
+};
+
+// AVI Writer Class (append-only, index written at close)
+class AviWriter {
+private:
+    FILE* file;
+    char* ioBuffer;
+    std::string path;
+
+    uint8_t fps;
+    uint16_t width;
+    uint16_t height;
+    uint32_t moviSize;          // Bytes after 'movi' fourcc
+    uint32_t maxFrameSize;
+    bool broken;                // Không cắt được frame ghi dở → ngừng ghi, giữ header placeholder
+    std::vector<AviFrameRef> index;   // offset relative to 'movi' fourcc
+
+    static const char* TAG;
+    static constexpr size_t IO_BUFFER_SIZE = 32 * 1024;
+
+    esp_err_t writeHeader();
+    esp_err_t writeIndex();
+    void rollbackFrame(uint32_t fileOffset);
+
+public:
+    static constexpr uint32_t HEADER_SIZE = 224;   // RIFF..'movi' fourcc
+
+    AviWriter();
+    ~AviWriter();
+
+    // Disable copy
+    AviWriter(const AviWriter&) = delete;
+    AviWriter& operator=(const AviWriter&) = delete;
+
+    esp_err_t open(const std::string& filepath, uint8_t framesPerSec);
+    esp_err_t writeFrame(const uint8_t* data, size_t len, uint16_t w, uint16_t h);
+    // Lặp lại frame trước trong index (giữ đúng thời gian thực khi bỏ frame). dwTotalFrames
+    // đếm cả entry lặp (= số slot), còn VideoInfo.frameCount chỉ đếm JPEG thật ghi vào movi
+    esp_err_t repeatLastFrame(uint32_t times);
+    esp_err_t close();
+
+    bool isOpen() const { return file != nullptr; }
+    uint32_t getFrameCount() const { return index.size(); }
+    uint32_t getDataSize() const { return moviSize; }
+};
+
+// AVI Reader Class (random access qua idx1, fallback scan 'movi' nếu file chưa close)
+class AviReader {
+private:
+    FILE* file;
+    uint32_t usPerFrame;
+    uint16_t width;
+    uint16_t height;
+    std::vector<AviFrameRef> frames;
+
+    static const char* TAG;
+
+    esp_err_t loadIndex(uint32_t moviStart, uint32_t idxPos, uint32_t idxSize);
+    esp_err_t scanMovi(uint32_t moviStart, uint32_t moviEnd);
+
+public:
+    AviReader();
+    ~AviReader();
+
+    // Disable copy
+    AviReader(const AviReader&) = delete;
+    AviReader& operator=(const AviReader&) = delete;
+
+    esp_err_t open(const std::string& filepath);
+    void close();
+
+    bool isOpen() const { return file != nullptr; }
+    uint32_t getFrameCount() const { return frames.size(); }
+    uint32_t getFrameIntervalUs() const { return usPerFrame; }
+    uint16_t getWidth() const { return width; }
+    uint16_t getHeight() const { return height; }
+    const AviFrameRef& getFrame(uint32_t i) const { return frames[i]; }
+
+    // Entry i chỉ lặp lại chunk của entry trước (AviWriter::repeatLastFrame giữ nhịp)
+    bool isRepeat(uint32_t i) const;
+    // Index các entry mang JPEG mới (bỏ entry lặp); khoảng giữa 2 phần tử = thời lượng hiển thị
+    std::vector<uint32_t> getUniqueFrames() const;
+
+    // Đọc frame thứ i vào buffer (bufSize >= getFrame(i).size)
+    esp_err_t readFrame(uint32_t i, uint8_t* buf, size_t bufSize, size_t& outLen);
+    // Đọc 1 đoạn của frame i bắt đầu từ pos (upload theo chunk, không cần buffer cả frame)
+    esp_err_t readFrameRange(uint32_t i, uint32_t pos, uint8_t* buf, size_t bufSize, size_t& outLen);
+};
+
+#endif // CAM_AVI_FILE_HPP
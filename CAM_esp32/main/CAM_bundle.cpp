@@ -0,0 +1,271 @@
+#include "CAM_bundle.hpp"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <algorithm>
+#include <cstring>
+
+static const char* TAG = "BUNDLE";
+
+static void putLe16(uint8_t* p, uint16_t v) {
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+}
+
+static void putLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+static void putLe64(uint8_t* p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (v >> (8 * i)) & 0xFF;
+    }
+}
+
+// ==================== Bundle Source ====================
+
+BundleSource::BundleSource()
+    : stage(Stage::HEADER), frame(0), framePos(0), crc(0), stagedLen(0), stagedPos(0),
+      position(0), totalBytes(0), frameIntervalUs(0) {}
+
+void BundleSource::finalize() {
+    totalBytes = HEADER_BYTES;
+    for (uint32_t size : frameSizes) {
+        totalBytes += FRAME_HEADER_BYTES + size + FRAME_TRAILER_BYTES;
+    }
+    seek(0);
+}
+
+void BundleSource::stageHeader() {
+    memset(staged, 0, HEADER_BYTES);
+    putLe32(staged, MAGIC);
+    putLe16(staged + 4, VERSION);
+    putLe16(staged + 6, HEADER_BYTES);
+    putLe32(staged + 8, frameSizes.size());
+    putLe32(staged + 12, frameIntervalUs);
+    strncpy((char*)staged + 16, name.c_str(), 15);
+    stagedLen = HEADER_BYTES;
+    stagedPos = 0;
+}
+
+void BundleSource::stageFrameHeader() {
+    putLe32(staged, frame);
+    putLe32(staged + 4, frameSizes[frame]);
+    putLe64(staged + 8, frameTimestampsUs.empty() ? (uint64_t)frame * frameIntervalUs
+                                                  : frameTimestampsUs[frame]);
+    stagedLen = FRAME_HEADER_BYTES;
+    stagedPos = 0;
+}
+
+void BundleSource::stageCrc() {
+    putLe32(staged, crc);
+    stagedLen = FRAME_TRAILER_BYTES;
+    stagedPos = 0;
+}
+
+// Chuyển sang phần kế tiếp của bundle
+void BundleSource::advance() {
+    switch (stage) {
+        case Stage::HEADER:
+        case Stage::FRAME_CRC:
+            if (stage == Stage::FRAME_CRC) {
+                frame++;
+            }
+            if (frame >= frameSizes.size()) {
+                stage = Stage::DONE;
+                return;
+            }
+            stage = Stage::FRAME_HEADER;
+            stageFrameHeader();
+            return;
+        case Stage::FRAME_HEADER:
+            stage = Stage::FRAME_DATA;
+            framePos = 0;
+            crc = 0;
+            return;
+        case Stage::FRAME_DATA:
+            stage = Stage::FRAME_CRC;
+            stageCrc();
+            return;
+        case Stage::DONE:
+            return;
+    }
+}
+
+esp_err_t BundleSource::read(uint8_t* dst, size_t cap, size_t& len) {
+    len = 0;
+
+    while (len < cap && stage != Stage::DONE) {
+        if (stage == Stage::FRAME_DATA) {
+            uint32_t remaining = frameSizes[frame] - framePos;
+            if (remaining == 0) {
+                advance();
+                continue;
+            }
+
+            size_t want = std::min<size_t>(cap - len, remaining);
+            size_t got = 0;
+            esp_err_t ret = readFrameData(frame, framePos, dst + len, want, got);
+            if (ret != ESP_OK || got == 0) {
+                ESP_LOGE(TAG, "Frame %lu read failed at %lu", frame, framePos);
+                return ret != ESP_OK ? ret : ESP_ERR_INVALID_SIZE;
+            }
+
+            crc = esp_rom_crc32_le(crc, dst + len, got);
+            framePos += got;
+            len += got;
+            position += got;
+            continue;
+        }
+
+        // Header/trailer nhỏ: copy từ staging
+        size_t n = std::min<size_t>(cap - len, stagedLen - stagedPos);
+        memcpy(dst + len, staged + stagedPos, n);
+        stagedPos += n;
+        len += n;
+        position += n;
+        if (stagedPos == stagedLen) {
+            advance();
+        }
+    }
+
+    return ESP_OK;
+}
+
+esp_err_t BundleSource::seek(size_t offset) {
+    if (offset > totalBytes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    stage = Stage::HEADER;
+    frame = 0;
+    position = 0;
+    stageHeader();
+
+    if (offset < HEADER_BYTES) {
+        stagedPos = offset;
+        position = offset;
+        return ESP_OK;
+    }
+
+    // Bỏ qua nguyên frame bằng tính toán; frame chứa offset được đọc lại từ đầu (cho CRC)
+    position = HEADER_BYTES;
+    while (frame < frameSizes.size()) {
+        size_t frameTotal = FRAME_HEADER_BYTES + frameSizes[frame] + FRAME_TRAILER_BYTES;
+        if (position + frameTotal > offset) {
+            break;
+        }
+        position += frameTotal;
+        frame++;
+    }
+
+    if (frame >= frameSizes.size()) {
+        stage = Stage::DONE;
+        return ESP_OK;
+    }
+
+    stage = Stage::FRAME_HEADER;
+    stageFrameHeader();
+
+    uint8_t scratch[256];
+    while (position < offset) {
+        size_t len = 0;
+        esp_err_t ret = read(scratch, std::min<size_t>(sizeof(scratch), offset - position), len);
+        if (ret != ESP_OK) {
+            return ret;
+        }
+        if (len == 0) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+    }
+
+    return ESP_OK;
+}
+
+// ==================== AVI Bundle ====================
+
+AviBundleSource::AviBundleSource(AviReader& avi, const std::string& recordingName)
+    : reader(avi) {
+    name = recordingName;
+    frameIntervalUs = reader.getFrameIntervalUs();
+    entries = reader.getUniqueFrames();
+    frameSizes.reserve(entries.size());
+    frameTimestampsUs.reserve(entries.size());
+    for (uint32_t entry : entries) {
+        frameSizes.push_back(reader.getFrame(entry).size);
+        frameTimestampsUs.push_back((uint64_t)entry * frameIntervalUs);
+    }
+    finalize();
+}
+
+esp_err_t AviBundleSource::readFrameData(uint32_t i, uint32_t pos, uint8_t* dst, size_t cap, size_t& len) {
+    return reader.readFrameRange(entries[i], pos, dst, cap, len);
+}
+
+// ==================== Folder Bundle ====================
+
+FolderBundleSource::~FolderBundleSource() {
+    if (current) {
+        fclose(current);
+    }
+}
+
+esp_err_t FolderBundleSource::open(const std::string& folderPath, const std::string& recordingName,
+                                   uint32_t intervalUs) {
+    DIR* dir = opendir(folderPath.c_str());
+    if (!dir) {
+        ESP_LOGE(TAG, "Failed to open dir: %s", folderPath.c_str());
+        return ESP_FAIL;
+    }
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strstr(entry->d_name, ".jpg") != nullptr) {
+            paths.push_back(folderPath + "/" + entry->d_name);
+        }
+    }
+    closedir(dir);
+
+    // Tên 0001.jpg... → sắp xếp theo tên = thứ tự capture
+    std::sort(paths.begin(), paths.end());
+
+    frameSizes.reserve(paths.size());
+    for (const std::string& path : paths) {
+        struct stat st;
+        if (stat(path.c_str(), &st) != 0) {
+            ESP_LOGE(TAG, "Failed to stat: %s", path.c_str());
+            return ESP_FAIL;
+        }
+        frameSizes.push_back(st.st_size);
+    }
+
+    name = recordingName;
+    frameIntervalUs = intervalUs;
+    finalize();
+    return ESP_OK;
+}
+
+esp_err_t FolderBundleSource::readFrameData(uint32_t i, uint32_t pos, uint8_t* dst, size_t cap,
+                                            size_t& len) {
+    // Giữ file của frame hiện tại mở giữa các chunk
+    if (current == nullptr || currentIndex != i) {
+        if (current) {
+            fclose(current);
+        }
+        current = fopen(paths[i].c_str(), "rb");
+        currentIndex = i;
+        if (current == nullptr) {
+            ESP_LOGE(TAG, "Failed to open: %s", paths[i].c_str());
+            return ESP_FAIL;
+        }
+    }
+
+    if (fseek(current, pos, SEEK_SET) != 0) {
+        return ESP_FAIL;
+    }
+    len = fread(dst, 1, cap, current);
+    return ESP_OK;
+}
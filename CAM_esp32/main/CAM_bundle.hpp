@@ -0,0 +1,109 @@
+#ifndef CAM_BUNDLE_HPP
+#define CAM_BUNDLE_HPP
+
+#include "CAM_uploader.hpp"
+#include "CAM_aviFile.hpp"
+#include "esp_err.h"
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Bundle: cả recording trong 1 request (Content-Type: application/x-cam-bundle), little-endian
+//   Header (32 byte) : "CAMB" | u16 version | u16 headerSize | u32 frameCount | u32 frameIntervalUs | char name[16]
+//   Mỗi frame        : u32 index | u32 length | u64 timestampUs (16 byte) + JPEG + u32 crc32(JPEG)
+// timestampUs tính từ đầu recording. Frame AVI lặp (giữ nhịp) chỉ gửi 1 lần, khoảng trống thể hiện
+// qua timestamp của frame kế tiếp → frameCount = số JPEG thật, không bằng dwTotalFrames.
+// Sinh trực tiếp từ layout trên thẻ (AVI hoặc folder JPEG), không tạo file tạm.
+// Receiver tham khảo: tools/bundle_receiver.py
+class BundleSource : public UploadSource {
+public:
+    static constexpr uint32_t MAGIC = 0x424D4143;   // "CAMB"
+    static constexpr uint16_t VERSION = 1;
+    static constexpr size_t HEADER_BYTES = 32;
+    static constexpr size_t FRAME_HEADER_BYTES = 16;
+    static constexpr size_t FRAME_TRAILER_BYTES = 4;
+    static constexpr const char* CONTENT_TYPE = "application/x-cam-bundle";
+
+private:
+    enum class Stage : uint8_t {
+        HEADER,
+        FRAME_HEADER,
+        FRAME_DATA,
+        FRAME_CRC,
+        DONE
+    };
+
+    Stage stage;
+    uint32_t frame;
+    uint32_t framePos;
+    uint32_t crc;
+    uint8_t staged[HEADER_BYTES];
+    uint8_t stagedLen;
+    uint8_t stagedPos;
+    size_t position;
+    size_t totalBytes;
+
+    void stageHeader();
+    void stageFrameHeader();
+    void stageCrc();
+    void advance();
+
+protected:
+    std::string name;
+    uint32_t frameIntervalUs;
+    std::vector<uint32_t> frameSizes;
+    std::vector<uint64_t> frameTimestampsUs;   // Rỗng → frame × frameIntervalUs
+
+    // Đọc 1 đoạn JPEG của frame i bắt đầu từ pos
+    virtual esp_err_t readFrameData(uint32_t i, uint32_t pos, uint8_t* dst, size_t cap, size_t& len) = 0;
+
+    // Gọi sau khi subclass điền frameSizes
+    void finalize();
+
+public:
+    BundleSource();
+
+    uint32_t getFrameCount() const { return frameSizes.size(); }
+
+    size_t size() const override { return totalBytes; }
+    esp_err_t read(uint8_t* dst, size_t cap, size_t& len) override;
+    esp_err_t seek(size_t offset) override;
+};
+
+// Bundle từ file AVI: kích thước frame lấy từ idx1, đọc thẳng từ movi, bỏ entry lặp
+class AviBundleSource : public BundleSource {
+private:
+    AviReader& reader;
+    std::vector<uint32_t> entries;   // Frame bundle i → entry idx1
+
+protected:
+    esp_err_t readFrameData(uint32_t i, uint32_t pos, uint8_t* dst, size_t cap, size_t& len) override;
+
+public:
+    AviBundleSource(AviReader& avi, const std::string& recordingName);
+};
+
+// Bundle từ folder JPEG (legacy): 0001.jpg, 0002.jpg... theo thứ tự tên
+class FolderBundleSource : public BundleSource {
+private:
+    std::vector<std::string> paths;
+    FILE* current;
+    uint32_t currentIndex;
+
+protected:
+    esp_err_t readFrameData(uint32_t i, uint32_t pos, uint8_t* dst, size_t cap, size_t& len) override;
+
+public:
+    FolderBundleSource() : current(nullptr), currentIndex(0) {}
+    ~FolderBundleSource() override;
+
+    // Disable copy
+    FolderBundleSource(const FolderBundleSource&) = delete;
+    FolderBundleSource& operator=(const FolderBundleSource&) = delete;
+
+    // intervalUs: khoảng cách frame (folder không lưu timestamp), 0 = không rõ
+    esp_err_t open(const std::string& folderPath, const std::string& recordingName, uint32_t intervalUs);
+};
+
+#endif // CAM_BUNDLE_HPP
@@ -0,0 +1,582 @@
+#include "CAM_catalog.hpp"
+#include "CAM_aviFile.hpp"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+const char* RecordingCatalog::TAG = "CATALOG";
+
+RecordingCatalog::RecordingCatalog()
+    : recordCount(0), bytesTotal(0), loaded(false) {
+
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+}
+
+RecordingCatalog::~RecordingCatalog() {
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+// ==================== Naming ====================
+
+bool RecordingCatalog::parseEntryName(const char* entryName, std::string& recordingName,
+                                      RecordingFormat& fmt) {
+    size_t len = strlen(entryName);
+    if (len == 14) {
+        fmt = RecordingFormat::JPEG_FOLDER;
+    } else if (len == 18 && strcmp(entryName + 14, ".avi") == 0) {
+        fmt = RecordingFormat::AVI;
+    } else {
+        return false;
+    }
+
+    for (size_t i = 0; i < 14; i++) {
+        if (entryName[i] < '0' || entryName[i] > '9') {
+            return false;
+        }
+    }
+
+    recordingName.assign(entryName, 14);
+    return true;
+}
+
+std::string RecordingCatalog::entryName(const CatalogEntry& entry) {
+    std::string name(entry.name);
+    if (entry.format == RecordingFormat::AVI) {
+        name += ".avi";
+    }
+    return name;
+}
+
+// ==================== RAM table ====================
+
+std::vector<CatalogEntry>::iterator RecordingCatalog::lowerBound(const char* name) {
+    return std::lower_bound(entries.begin(), entries.end(), name,
+        [](const CatalogEntry& e, const char* n) { return strcmp(e.name, n) < 0; });
+}
+
+std::vector<CatalogEntry>::const_iterator RecordingCatalog::lowerBound(const char* name) const {
+    return std::lower_bound(entries.begin(), entries.end(), name,
+        [](const CatalogEntry& e, const char* n) { return strcmp(e.name, n) < 0; });
+}
+
+void RecordingCatalog::upsertLocked(const CatalogEntry& entry) {
+    auto it = lowerBound(entry.name);
+    if (it != entries.end() && strcmp(it->name, entry.name) == 0) {
+        bytesTotal -= it->totalBytes;
+        *it = entry;
+    } else {
+        entries.insert(it, entry);
+    }
+    bytesTotal += entry.totalBytes;
+}
+
+bool RecordingCatalog::eraseLocked(const char* name) {
+    auto it = lowerBound(name);
+    if (it == entries.end() || strcmp(it->name, name) != 0) {
+        return false;
+    }
+    bytesTotal -= it->totalBytes;
+    entries.erase(it);
+    return true;
+}
+
+// ==================== Index file ====================
+
+void RecordingCatalog::encode(Record& rec, RecordOp op, const CatalogEntry& entry) {
+    memset(&rec, 0, sizeof(rec));
+    rec.magic = RECORD_MAGIC;
+    rec.op = (uint8_t)op;
+    rec.format = (uint8_t)entry.format;
+    rec.flags = entry.uploaded ? FLAG_UPLOADED : 0;
+    memcpy(rec.name, entry.name, sizeof(rec.name));
+    rec.name[sizeof(rec.name) - 1] = '\0';
+    rec.frameCount = entry.frameCount;
+    rec.totalBytes = entry.totalBytes;
+    rec.durationMs = entry.durationMs;
+    rec.crc = esp_rom_crc32_le(0, (const uint8_t*)&rec, offsetof(Record, crc));
+}
+
+esp_err_t RecordingCatalog::appendLocked(RecordOp op, const CatalogEntry& entry) {
+    Record rec;
+    encode(rec, op, entry);
+
+    FILE* f = fopen(indexPath.c_str(), "ab");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to open %s", indexPath.c_str());
+        return ESP_FAIL;
+    }
+
+    size_t written = fwrite(&rec, 1, sizeof(rec), f);
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+
+    if (written != sizeof(rec)) {
+        return ESP_FAIL;
+    }
+    recordCount++;
+
+    // File chỉ append → compact khi record thừa quá nhiều
+    if (recordCount > entries.size() * 2 + COMPACT_SLACK) {
+        return compactLocked();
+    }
+    return ESP_OK;
+}
+
+esp_err_t RecordingCatalog::compactLocked() {
+    std::string tmpPath = rootPath + "/catalog.tmp";
+
+    FILE* f = fopen(tmpPath.c_str(), "wb");
+    if (!f) {
+        ESP_LOGE(TAG, "Failed to create %s", tmpPath.c_str());
+        return ESP_FAIL;
+    }
+
+    bool ok = true;
+    Record rec;
+    for (const CatalogEntry& entry : entries) {
+        encode(rec, entry.complete ? RecordOp::ADD : RecordOp::BEGIN, entry);
+        if (fwrite(&rec, 1, sizeof(rec), f) != sizeof(rec)) {
+            ok = false;
+            break;
+        }
+    }
+
+    fflush(f);
+    fsync(fileno(f));
+    fclose(f);
+
+    if (!ok) {
+        ::remove(tmpPath.c_str());
+        return ESP_FAIL;
+    }
+
+    // FAT không rename đè được → xóa index cũ trước (load() tự nhận catalog.tmp)
+    ::remove(indexPath.c_str());
+    if (::rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+        ESP_LOGE(TAG, "Failed to replace index");
+        return ESP_FAIL;
+    }
+
+    recordCount = entries.size();
+    ESP_LOGI(TAG, "Compacted: %lu entries", recordCount);
+    return ESP_OK;
+}
+
+esp_err_t RecordingCatalog::loadIndexLocked() {
+    FILE* f = fopen(indexPath.c_str(), "rb");
+    if (!f) {
+        // Mất điện giữa remove() và rename() lúc compact
+        std::string tmpPath = rootPath + "/catalog.tmp";
+        if (::rename(tmpPath.c_str(), indexPath.c_str()) != 0) {
+            return ESP_ERR_NOT_FOUND;
+        }
+        f = fopen(indexPath.c_str(), "rb");
+        if (!f) {
+            return ESP_ERR_NOT_FOUND;
+        }
+    }
+
+    entries.clear();
+    bytesTotal = 0;
+    recordCount = 0;
+
+    esp_err_t ret = ESP_OK;
+    Record rec;
+    size_t n;
+    while ((n = fread(&rec, 1, sizeof(rec), f)) > 0) {
+        if (n != sizeof(rec) || rec.magic != RECORD_MAGIC ||
+            rec.crc != esp_rom_crc32_le(0, (const uint8_t*)&rec, offsetof(Record, crc)) ||
+            rec.name[sizeof(rec.name) - 1] != '\0') {
+            ESP_LOGW(TAG, "Corrupt record at %lu", recordCount);
+            ret = ESP_ERR_INVALID_CRC;
+            break;
+        }
+
+        CatalogEntry entry;
+        memcpy(entry.name, rec.name, sizeof(entry.name));
+        entry.format = (RecordingFormat)rec.format;
+        entry.uploaded = (rec.flags & FLAG_UPLOADED) != 0;
+        entry.frameCount = rec.frameCount;
+        entry.totalBytes = rec.totalBytes;
+        entry.durationMs = rec.durationMs;
+
+        switch ((RecordOp)rec.op) {
+            case RecordOp::BEGIN:
+                entry.complete = false;
+                upsertLocked(entry);
+                break;
+            case RecordOp::ADD:
+                entry.complete = true;
+                upsertLocked(entry);
+                break;
+            case RecordOp::REMOVE:
+                eraseLocked(entry.name);
+                break;
+            default:
+                ret = ESP_ERR_INVALID_CRC;
+                break;
+        }
+        if (ret != ESP_OK) break;
+        recordCount++;
+    }
+
+    fclose(f);
+    return ret;
+}
+
+bool RecordingCatalog::probeEntry(const std::string& dirName, CatalogEntry& entry) const {
+    std::string path = rootPath + "/" + dirName;
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+
+    entry.frameCount = 0;
+    entry.durationMs = 0;
+    entry.complete = true;
+    entry.totalBytes = diskBytes(path, entry.format, &entry.frameCount);
+
+    if (entry.format == RecordingFormat::AVI) {
+        // Đọc được cả file chưa close (fallback scan 'movi')
+        AviReader reader;
+        if (reader.open(path) == ESP_OK) {
+            entry.frameCount = reader.getFrameCount();
+            entry.durationMs = (uint64_t)entry.frameCount * reader.getFrameIntervalUs() / 1000;
+            reader.close();
+        }
+        return true;
+    }
+
+    return S_ISDIR(st.st_mode);
+}
+
+uint64_t RecordingCatalog::diskBytes(const std::string& path, RecordingFormat fmt, uint32_t* jpegCount) {
+    struct stat st;
+    if (fmt == RecordingFormat::AVI) {
+        return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+    }
+
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        return 0;
+    }
+
+    uint64_t bytes = 0;
+    uint32_t count = 0;
+    struct dirent* de;
+    while ((de = readdir(dir)) != nullptr) {
+        if (strstr(de->d_name, ".jpg") == nullptr) continue;
+
+        std::string filepath = path + "/" + de->d_name;
+        if (stat(filepath.c_str(), &st) == 0) {
+            count++;
+            bytes += st.st_size;
+        }
+    }
+    closedir(dir);
+
+    if (jpegCount) {
+        *jpegCount = count;
+    }
+    return bytes;
+}
+
+esp_err_t RecordingCatalog::rebuildLocked() {
+    ESP_LOGW(TAG, "Rebuilding catalog from %s", rootPath.c_str());
+
+    DIR* dir = opendir(rootPath.c_str());
+    if (!dir) {
+        return ESP_FAIL;
+    }
+
+    // Thu thập tên trước, probe sau (không stat trong lúc readdir)
+    std::vector<std::string> names;
+    struct dirent* de;
+    while ((de = readdir(dir)) != nullptr) {
+        std::string name;
+        RecordingFormat fmt;
+        if (parseEntryName(de->d_name, name, fmt)) {
+            names.push_back(de->d_name);
+        }
+    }
+    closedir(dir);
+
+    entries.clear();
+    entries.reserve(names.size());
+    bytesTotal = 0;
+
+    for (const std::string& dirName : names) {
+        CatalogEntry entry;
+        std::string name;
+        parseEntryName(dirName.c_str(), name, entry.format);
+        strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+
+        if (probeEntry(dirName, entry)) {
+            upsertLocked(entry);
+        }
+    }
+
+    ESP_LOGI(TAG, "Rebuilt: %u recordings, %llu bytes", entries.size(), bytesTotal);
+    return compactLocked();
+}
+
+// ==================== Public API ====================
+
+esp_err_t RecordingCatalog::load(const std::string& root) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    rootPath = root;
+    indexPath = root + "/catalog.bin";
+
+    esp_err_t ret = loadIndexLocked();
+    if (ret != ESP_OK) {
+        ret = rebuildLocked();
+    } else {
+        // Recording dở dang (mất điện khi đang ghi) → đọc lại từ file
+        bool fixed = false;
+        for (size_t i = 0; i < entries.size(); ) {
+            CatalogEntry& entry = entries[i];
+            if (entry.complete) {
+                i++;
+                continue;
+            }
+            fixed = true;
+            bytesTotal -= entry.totalBytes;
+            if (probeEntry(entryName(entry), entry)) {
+                bytesTotal += entry.totalBytes;
+                ESP_LOGW(TAG, "Recovered incomplete recording %s (%lu frames)",
+                         entry.name, entry.frameCount);
+                i++;
+            } else {
+                entries.erase(entries.begin() + i);
+            }
+        }
+
+        if (fixed || recordCount > entries.size() * 2 + COMPACT_SLACK) {
+            compactLocked();
+        }
+        ESP_LOGI(TAG, "Loaded: %u recordings, %llu bytes", entries.size(), bytesTotal);
+    }
+
+    loaded = (ret == ESP_OK);
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+esp_err_t RecordingCatalog::rebuild() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+    esp_err_t ret = rebuildLocked();
+    loaded = (ret == ESP_OK);
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+esp_err_t RecordingCatalog::begin(const std::string& name, RecordingFormat fmt) {
+    CatalogEntry entry;
+    strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+    entry.format = fmt;
+    entry.complete = false;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+    upsertLocked(entry);
+    esp_err_t ret = appendLocked(RecordOp::BEGIN, entry);
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+esp_err_t RecordingCatalog::add(const CatalogEntry& entry) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+    CatalogEntry done = entry;
+    done.complete = true;
+    upsertLocked(done);
+    esp_err_t ret = appendLocked(RecordOp::ADD, done);
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+esp_err_t RecordingCatalog::remove(const std::string& name) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    if (removing == name) {
+        removing.clear();
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    if (eraseLocked(name.c_str())) {
+        CatalogEntry entry;
+        strncpy(entry.name, name.c_str(), sizeof(entry.name) - 1);
+        ret = appendLocked(RecordOp::REMOVE, entry);
+    }
+
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+esp_err_t RecordingCatalog::setUploaded(const std::string& name) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    auto it = lowerBound(name.c_str());
+    if (it != entries.end() && name == it->name && it->complete) {
+        ret = ESP_OK;
+        if (!it->uploaded) {
+            it->uploaded = true;
+            CatalogEntry entry = *it;
+            ret = appendLocked(RecordOp::ADD, entry);
+        }
+    }
+
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+bool RecordingCatalog::pin(const std::string& name) {
+    bool ok = false;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        auto it = lowerBound(name.c_str());
+        if (it != entries.end() && name == it->name && removing != name) {
+            pinned.push_back(name);
+            ok = true;
+        }
+        xSemaphoreGive(mutex);
+    }
+    return ok;
+}
+
+void RecordingCatalog::unpin(const std::string& name) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        auto it = std::find(pinned.begin(), pinned.end(), name);
+        if (it != pinned.end()) {
+            pinned.erase(it);
+        }
+        xSemaphoreGive(mutex);
+    }
+}
+
+bool RecordingCatalog::beginRemove(const std::string& name) {
+    bool ok = false;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (std::find(pinned.begin(), pinned.end(), name) == pinned.end()) {
+            removing = name;
+            ok = true;
+        }
+        xSemaphoreGive(mutex);
+    }
+    return ok;
+}
+
+void RecordingCatalog::cancelRemove(const std::string& name) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (removing == name) {
+            removing.clear();
+        }
+        xSemaphoreGive(mutex);
+    }
+}
+
+bool RecordingCatalog::find(const std::string& name, CatalogEntry& entry) const {
+    bool found = false;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        auto it = lowerBound(name.c_str());
+        if (it != entries.end() && name == it->name) {
+            entry = *it;
+            found = true;
+        }
+        xSemaphoreGive(mutex);
+    }
+    return found;
+}
+
+bool RecordingCatalog::oldest(CatalogEntry& entry) const {
+    bool found = false;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        for (const CatalogEntry& e : entries) {
+            if (std::find(pinned.begin(), pinned.end(), e.name) == pinned.end()) {
+                entry = e;
+                found = true;
+                break;
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
+    return found;
+}
+
+std::vector<CatalogEntry> RecordingCatalog::list() const {
+    std::vector<CatalogEntry> result;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        result = entries;
+        xSemaphoreGive(mutex);
+    }
+    return result;
+}
+
+std::vector<CatalogEntry> RecordingCatalog::range(const std::string& fromName,
+                                                  const std::string& toName) const {
+    std::vector<CatalogEntry> result;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        auto first = lowerBound(fromName.c_str());
+        auto last = lowerBound(toName.c_str());
+        if (first < last) {
+            result.assign(first, last);
+        }
+        xSemaphoreGive(mutex);
+    }
+    return result;
+}
+
+std::vector<CatalogEntry> RecordingCatalog::pendingUploads() const {
+    std::vector<CatalogEntry> result;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        for (const CatalogEntry& entry : entries) {
+            if (entry.complete && !entry.uploaded) {
+                result.push_back(entry);
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
+    return result;
+}
+
+uint32_t RecordingCatalog::count() const {
+    uint32_t n = 0;
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        n = entries.size();
+        xSemaphoreGive(mutex);
+    }
+    return n;
+}
+
+uint64_t RecordingCatalog::totalBytes() const {
+    uint64_t bytes = 0;
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        bytes = bytesTotal;
+        xSemaphoreGive(mutex);
+    }
+    return bytes;
+}
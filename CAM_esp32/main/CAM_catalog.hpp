@@ -0,0 +1,131 @@
+#ifndef CAM_CATALOG_HPP
+#define CAM_CATALOG_HPP
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+
+// Recording layout on SD card
+enum class RecordingFormat : uint8_t {
+    JPEG_FOLDER = 0,    // Legacy: <name>/0001.jpg, 0002.jpg, ...
+    AVI                 // <name>.avi (MJPEG, 1 file / recording)
+};
+
+// 1 recording trong catalog (tên YYYYMMDDhhmmss = thời điểm bắt đầu)
+struct CatalogEntry {
+    char name[16];
+    RecordingFormat format;
+    bool complete;          // false = đang ghi (hoặc mất điện khi ghi)
+    bool uploaded;          // Server đã nhận đủ (readVideo hoặc background upload)
+    uint32_t frameCount;
+    uint32_t totalBytes;
+    uint32_t durationMs;
+
+    CatalogEntry() : name{}, format(RecordingFormat::AVI), complete(false), uploaded(false),
+                     frameCount(0), totalBytes(0), durationMs(0) {}
+};
+
+// Recording Catalog Class - index của các recording trên SD
+//   - File <root>/catalog.bin: append-only, mỗi record có CRC
+//   - RAM: vector sắp xếp theo tên (= theo thời gian) → tra cứu O(log n)
+// Chỉ quét lại thư mục khi file index không có hoặc bị hỏng.
+class RecordingCatalog {
+private:
+    enum class RecordOp : uint8_t {
+        BEGIN = 1,      // Recording bắt đầu ghi
+        ADD,            // Recording hoàn tất (hoặc cập nhật)
+        REMOVE
+    };
+
+    struct __attribute__((packed)) Record {
+        uint32_t magic;
+        uint8_t op;
+        uint8_t format;
+        uint16_t flags;     // FLAG_* (index cũ ghi 0)
+        char name[16];
+        uint32_t frameCount;
+        uint32_t totalBytes;
+        uint32_t durationMs;
+        uint32_t crc;       // CRC32 của các field phía trên
+    };
+    static_assert(sizeof(Record) == 40, "Catalog record layout changed");
+
+    std::string rootPath;
+    std::string indexPath;
+    std::vector<CatalogEntry> entries;     // Sorted theo name
+    std::vector<std::string> pinned;        // Đang được đọc (upload), mỗi lần pin 1 phần tử
+    std::string removing;                   // Đang bị xóa (beginRemove → remove/cancelRemove)
+    uint32_t recordCount;                   // Số record trong file index
+    uint64_t bytesTotal;
+    bool loaded;
+    SemaphoreHandle_t mutex;
+
+    static const char* TAG;
+    static constexpr uint32_t RECORD_MAGIC = 0x54414352;   // "RCAT"
+    static constexpr uint16_t FLAG_UPLOADED = 0x0001;
+    static constexpr uint32_t COMPACT_SLACK = 32;          // Record thừa trước khi compact
+
+    std::vector<CatalogEntry>::iterator lowerBound(const char* name);
+    std::vector<CatalogEntry>::const_iterator lowerBound(const char* name) const;
+    void upsertLocked(const CatalogEntry& entry);
+    bool eraseLocked(const char* name);
+
+    esp_err_t loadIndexLocked();
+    esp_err_t rebuildLocked();
+    esp_err_t compactLocked();
+    esp_err_t appendLocked(RecordOp op, const CatalogEntry& entry);
+    bool probeEntry(const std::string& dirName, CatalogEntry& entry) const;
+
+    static void encode(Record& rec, RecordOp op, const CatalogEntry& entry);
+
+public:
+    RecordingCatalog();
+    ~RecordingCatalog();
+
+    // Disable copy
+    RecordingCatalog(const RecordingCatalog&) = delete;
+    RecordingCatalog& operator=(const RecordingCatalog&) = delete;
+
+    // Load index (rebuild từ thư mục nếu thiếu/hỏng)
+    esp_err_t load(const std::string& root);
+    esp_err_t rebuild();
+    bool isLoaded() const { return loaded; }
+
+    // Cập nhật khi recording bắt đầu / hoàn tất / bị xóa
+    esp_err_t begin(const std::string& name, RecordingFormat fmt);
+    esp_err_t add(const CatalogEntry& entry);
+    esp_err_t remove(const std::string& name);
+    esp_err_t setUploaded(const std::string& name);
+
+    // Pin: recording đang được đọc, không được xóa. beginRemove (trước khi xóa file) thất bại
+    // nếu đang pin, pin thất bại nếu recording không còn hoặc đang bị xóa
+    bool pin(const std::string& name);
+    void unpin(const std::string& name);
+    bool beginRemove(const std::string& name);
+    void cancelRemove(const std::string& name);
+
+    bool find(const std::string& name, CatalogEntry& entry) const;
+    // Recording cũ nhất không bị pin (ứng viên cho retention)
+    bool oldest(CatalogEntry& entry) const;
+    std::vector<CatalogEntry> list() const;
+    // Recording có name trong [fromName, toName)
+    std::vector<CatalogEntry> range(const std::string& fromName, const std::string& toName) const;
+    // Recording hoàn tất chưa upload, cũ → mới
+    std::vector<CatalogEntry> pendingUploads() const;
+
+    uint32_t count() const;
+    uint64_t totalBytes() const;
+
+    // Tên entry trên SD: "YYYYMMDDhhmmss" (folder) hoặc "YYYYMMDDhhmmss.avi"
+    static bool parseEntryName(const char* entryName, std::string& recordingName,
+                               RecordingFormat& fmt);
+    static std::string entryName(const CatalogEntry& entry);
+    // Dung lượng trên SD (totalBytes): AVI = st_size (gồm header + idx1), folder = tổng .jpg.
+    // Dùng chung cho add() sau khi ghi và rebuild() → quota không nhảy sau reboot
+    static uint64_t diskBytes(const std::string& path, RecordingFormat fmt, uint32_t* jpegCount = nullptr);
+};
+
+#endif // CAM_CATALOG_HPP
@@ -0,0 +1,363 @@
+#include "CAM_download.hpp"
+#include "CAM_bundle.hpp"
+#include "CAM_httpAsync.hpp"
+#include "CAM_aviFile.hpp"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include <sys/stat.h>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstdlib>
+
+const char* DownloadManager::TAG = "DOWNLOAD";
+
+// Global instance for static callback
+static DownloadManager* g_downloadMgr = nullptr;
+
+DownloadManager::DownloadManager(VideoManager& manager)
+    : videoMgr(manager), stats() {
+
+    statsMutex = xSemaphoreCreateMutex();
+    if (statsMutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+
+    g_downloadMgr = this;
+}
+
+DownloadManager::~DownloadManager() {
+    g_downloadMgr = nullptr;
+
+    if (statsMutex) {
+        vSemaphoreDelete(statsMutex);
+    }
+}
+
+// "bytes=a-b" | "bytes=a-" | "bytes=-n" (1 đoạn). Nhiều đoạn → bỏ qua Range (RFC 9110 cho phép)
+bool DownloadManager::parseRange(const char* header, size_t total, ByteRange& range, bool& satisfiable) {
+    satisfiable = true;
+    if (strncmp(header, "bytes=", 6) != 0 || strchr(header, ',') != nullptr) {
+        return false;
+    }
+
+    const char* spec = header + 6;
+    const char* dash = strchr(spec, '-');
+    if (dash == nullptr) {
+        return false;
+    }
+
+    char* end = nullptr;
+    if (dash == spec) {
+        // Suffix: n byte cuối
+        unsigned long long suffix = strtoull(dash + 1, &end, 10);
+        if (end == dash + 1 || *end != '\0') {
+            return false;
+        }
+        if (suffix == 0 || total == 0) {
+            satisfiable = false;
+            return true;
+        }
+        range.start = total - std::min<unsigned long long>(suffix, total);
+        range.end = total - 1;
+        return true;
+    }
+
+    unsigned long long first = strtoull(spec, &end, 10);
+    if (end != dash) {
+        return false;
+    }
+    unsigned long long last = total ? total - 1 : 0;
+    if (dash[1] != '\0') {
+        last = strtoull(dash + 1, &end, 10);
+        if (*end != '\0' || last < first) {
+            return false;
+        }
+    }
+
+    if (first >= total) {
+        satisfiable = false;
+        return true;
+    }
+    range.start = first;
+    range.end = std::min<unsigned long long>(last, total - 1);
+    return true;
+}
+
+bool DownloadManager::etagMatches(const char* header, const char* etag) {
+    return strcmp(header, "*") == 0 || strstr(header, etag) != nullptr;
+}
+
+void DownloadManager::countRequest(bool partial, bool notModified, uint64_t bytes) {
+    if (xSemaphoreTake(statsMutex, portMAX_DELAY) == pdTRUE) {
+        stats.requests++;
+        if (partial) stats.partial++;
+        if (notModified) stats.notModified++;
+        stats.bytes += bytes;
+        xSemaphoreGive(statsMutex);
+    }
+}
+
+esp_err_t DownloadManager::sendBody(httpd_req_t* req, UploadSource& source, const ByteRange& range) {
+    // PSRAM đủ rộng cho chunk lớn; không có → chunk nhỏ trong RAM nội
+    size_t chunkBytes = CHUNK_BYTES_PSRAM;
+    uint8_t* buffer = (uint8_t*)heap_caps_malloc(chunkBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (buffer == nullptr) {
+        chunkBytes = CHUNK_BYTES_INTERNAL;
+        buffer = (uint8_t*)heap_caps_malloc(chunkBytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate download buffer");
+        return ESP_ERR_NO_MEM;
+    }
+
+    esp_err_t ret = source.seek(range.start);
+    size_t offset = range.start;
+    size_t remaining = range.end - range.start + 1;
+
+    while (ret == ESP_OK && remaining > 0) {
+        // Chunk đầu chỉ tới ranh giới chunkBytes → các lần đọc sau căn theo cluster
+        size_t want = std::min(remaining, chunkBytes - offset % chunkBytes);
+
+        // Source có thể trả từng đoạn nhỏ (bundle: header/JPEG/CRC) → gom đầy chunk
+        size_t filled = 0;
+        while (filled < want) {
+            size_t len = 0;
+            ret = source.read(buffer + filled, want - filled, len);
+            if (ret != ESP_OK) {
+                break;
+            }
+            if (len == 0) {
+                ret = ESP_ERR_INVALID_SIZE;     // File ngắn hơn lúc stat
+                break;
+            }
+            filled += len;
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGE(TAG, "Read failed at %u: %s", offset, esp_err_to_name(ret));
+            break;
+        }
+
+        ret = httpd_resp_send_chunk(req, (const char*)buffer, filled);
+        offset += filled;
+        remaining -= filled;
+    }
+
+    heap_caps_free(buffer);
+
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, nullptr, 0);
+    }
+    return ret;
+}
+
+esp_err_t DownloadManager::sendRecording(httpd_req_t* req, const std::string& name, bool bundle) {
+    std::string path;
+    bool isFolder = false;
+    if (videoMgr.resolveRecording(name, path, isFolder) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Recording not found");
+        return ESP_FAIL;
+    }
+
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "Recording not found");
+        return ESP_FAIL;
+    }
+
+    // Folder không có file liền → luôn ghép bundle
+    bundle = bundle || isFolder;
+
+    AviReader reader;
+    FileSource file;
+    std::unique_ptr<BundleSource> bundleSource;
+    UploadSource* source = nullptr;
+
+    if (!bundle) {
+        if (file.open(path) != ESP_OK) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        source = &file;
+    } else if (isFolder) {
+        uint32_t intervalUs = 0;
+        CatalogEntry entry;
+        if (videoMgr.findRecording(name, entry) && entry.frameCount > 0) {
+            intervalUs = (uint64_t)entry.durationMs * 1000 / entry.frameCount;
+        }
+
+        std::unique_ptr<FolderBundleSource> folder = std::make_unique<FolderBundleSource>();
+        if (folder->open(path, name, intervalUs) != ESP_OK) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        bundleSource = std::move(folder);
+        source = bundleSource.get();
+    } else {
+        if (reader.open(path) != ESP_OK) {
+            httpd_resp_send_500(req);
+            return ESP_FAIL;
+        }
+        bundleSource = std::make_unique<AviBundleSource>(reader, name);
+        source = bundleSource.get();
+    }
+
+    size_t total = source->size();
+
+    // ETag: recording đóng rồi không đổi; đang ghi → size/mtime đổi → ETag đổi
+    char etag[48];
+    snprintf(etag, sizeof(etag), "\"%x-%lx%s\"", total, (unsigned long)st.st_mtime, bundle ? "-b" : "");
+
+    // Giá trị header phải sống tới khi gửi response (httpd chỉ giữ con trỏ)
+    char header[128];
+    char contentRange[64];
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Accept-Ranges", "bytes");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (httpd_req_get_hdr_value_str(req, "If-None-Match", header, sizeof(header)) == ESP_OK &&
+        etagMatches(header, etag)) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        countRequest(false, true, 0);
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    ByteRange range = { 0, total ? total - 1 : 0 };
+    bool partial = false;
+
+    if (httpd_req_get_hdr_value_str(req, "Range", header, sizeof(header)) == ESP_OK) {
+        // If-Range lệch ETag → recording đã đổi, trả cả file thay vì ghép nhầm đoạn
+        char ifRange[48];
+        bool rangeValid = httpd_req_get_hdr_value_str(req, "If-Range", ifRange, sizeof(ifRange)) != ESP_OK ||
+                          strcmp(ifRange, etag) == 0;
+
+        bool satisfiable = true;
+        if (rangeValid && parseRange(header, total, range, satisfiable)) {
+            if (!satisfiable) {
+                snprintf(contentRange, sizeof(contentRange), "bytes */%u", total);
+                httpd_resp_set_hdr(req, "Content-Range", contentRange);
+                httpd_resp_set_status(req, "416 Range Not Satisfiable");
+                countRequest(false, false, 0);
+                return httpd_resp_send(req, nullptr, 0);
+            }
+            partial = true;
+        }
+    }
+
+    httpd_resp_set_type(req, bundle ? BundleSource::CONTENT_TYPE : AVI_CONTENT_TYPE);
+    if (partial) {
+        snprintf(contentRange, sizeof(contentRange), "bytes %u-%u/%u", range.start, range.end, total);
+        httpd_resp_set_hdr(req, "Content-Range", contentRange);
+        httpd_resp_set_status(req, "206 Partial Content");
+    }
+
+    if (total == 0) {
+        countRequest(false, false, 0);
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    ESP_LOGI(TAG, "GET %s%s bytes %u-%u/%u", name.c_str(), bundle ? " (bundle)" : "",
+             range.start, range.end, total);
+
+    esp_err_t ret = sendBody(req, *source, range);
+    countRequest(partial, false, ret == ESP_OK ? range.end - range.start + 1 : 0);
+    return ret;
+}
+
+esp_err_t DownloadManager::sendList(httpd_req_t* req) {
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    char line[160];
+    esp_err_t ret = httpd_resp_sendstr_chunk(req, "[");
+
+    bool first = true;
+    for (const VideoInfo& info : videoMgr.listVideos()) {
+        if (ret != ESP_OK) {
+            break;
+        }
+        snprintf(line, sizeof(line),
+                 "%s{\"name\":\"%s\",\"format\":\"%s\",\"frames\":%lu,\"bytes\":%lu,\"durationMs\":%lu}",
+                 first ? "" : ",", info.folderName.c_str(),
+                 info.format == RecordingFormat::AVI ? "avi" : "jpeg_folder",
+                 info.frameCount, info.totalSize, info.durationMs);
+        ret = httpd_resp_sendstr_chunk(req, line);
+        first = false;
+    }
+
+    if (ret == ESP_OK) {
+        ret = httpd_resp_sendstr_chunk(req, "]");
+    }
+    if (ret == ESP_OK) {
+        ret = httpd_resp_send_chunk(req, nullptr, 0);
+    }
+    return ret;
+}
+
+esp_err_t DownloadManager::handleRequest(httpd_req_t* req) {
+    return HttpAsync::run(req, "download_tx", 4096, PRIORITY_SENDER_TASK,
+                          [this](httpd_req_t* asyncReq) { return serve(asyncReq); });
+}
+
+esp_err_t DownloadManager::serve(httpd_req_t* req) {
+    // uri gồm cả query → tách tên recording trước '?'
+    const char* uri = req->uri;
+    size_t prefixLen = strlen(URI_PREFIX);
+    if (strncmp(uri, URI_PREFIX, prefixLen) != 0) {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    const char* rest = uri + prefixLen;
+    size_t restLen = strcspn(rest, "?");
+    if (restLen == 0 || (restLen == 1 && rest[0] == '/')) {
+        return sendList(req);
+    }
+    if (rest[0] != '/') {
+        httpd_resp_send_404(req);
+        return ESP_FAIL;
+    }
+
+    // Chỉ tên recording trong thư mục video, không nhận path tùy ý
+    std::string name(rest + 1, restLen - 1);
+    if (name.find('/') != std::string::npos || name.find("..") != std::string::npos) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid recording");
+        return ESP_FAIL;
+    }
+    // /recordings/<name>.avi cũng được (tên file trên thẻ)
+    if (name.size() > 4 && name.compare(name.size() - 4, 4, ".avi") == 0) {
+        name.resize(name.size() - 4);
+    }
+
+    bool bundle = false;
+    char query[64];
+    char value[16];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "format", value, sizeof(value)) == ESP_OK) {
+        bundle = strcmp(value, "bundle") == 0;
+    }
+
+    return sendRecording(req, name, bundle);
+}
+
+DownloadStats DownloadManager::getStats() const {
+    DownloadStats snapshot = {};
+
+    if (xSemaphoreTake(statsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        snapshot = stats;
+        xSemaphoreGive(statsMutex);
+    }
+
+    return snapshot;
+}
+
+esp_err_t DownloadManager::downloadHandlerWrapper(httpd_req_t* req) {
+    if (g_downloadMgr == nullptr) {
+        ESP_LOGE(TAG, "Download manager not initialized");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    return g_downloadMgr->handleRequest(req);
+}
@@ -0,0 +1,74 @@
+#ifndef CAM_DOWNLOAD_HPP
+#define CAM_DOWNLOAD_HPP
+
+#include "CAM_memorFunc.hpp"
+#include "CAM_uploader.hpp"
+#include "esp_http_server.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string>
+#include <cstdint>
+
+// Byte range của 1 response ([start, end] theo HTTP, end inclusive)
+struct ByteRange {
+    size_t start;
+    size_t end;
+};
+
+struct DownloadStats {
+    uint32_t requests;
+    uint32_t partial;           // 206 (Range)
+    uint32_t notModified;       // 304 (If-None-Match khớp ETag)
+    uint64_t bytes;
+};
+
+// Download Manager Class - server kéo recording thay vì camera đẩy (readVideo)
+//   GET /recordings                     → danh sách recording (JSON, từ catalog)
+//   GET /recordings/<name>              → file AVI nguyên bản, folder JPEG → bundle
+//   GET /recordings/<name>?format=bundle → luôn trả bundle (CAM_bundle.hpp)
+//   - Range (1 đoạn) → 206 + Content-Range: tải song song nhiều đoạn, tải tiếp khi đứt
+//   - ETag theo size + mtime; If-None-Match → 304, If-Range lệch → trả cả file
+//   - Đọc SD theo chunk lớn căn theo offset file → httpd_resp_send_chunk, buffer theo request
+class DownloadManager {
+private:
+    VideoManager& videoMgr;
+    SemaphoreHandle_t statsMutex;
+    DownloadStats stats;
+
+    static const char* TAG;
+    static constexpr const char* URI_PREFIX = "/recordings";
+    static constexpr size_t CHUNK_BYTES_PSRAM = 32 * 1024;     // = cluster FAT phổ biến
+    static constexpr size_t CHUNK_BYTES_INTERNAL = 8 * 1024;
+    static constexpr const char* AVI_CONTENT_TYPE = "video/x-msvideo";
+    static constexpr uint8_t PRIORITY_SENDER_TASK = 2;      // Tải hàng loạt, dưới write task
+
+    // Range header → false nếu không dùng được (nhiều đoạn, sai cú pháp) → trả cả file
+    static bool parseRange(const char* header, size_t total, ByteRange& range, bool& satisfiable);
+    static bool etagMatches(const char* header, const char* etag);
+
+    esp_err_t sendList(httpd_req_t* req);
+    esp_err_t sendRecording(httpd_req_t* req, const std::string& name, bool bundle);
+    esp_err_t sendBody(httpd_req_t* req, UploadSource& source, const ByteRange& range);
+    void countRequest(bool partial, bool notModified, uint64_t bytes);
+    esp_err_t serve(httpd_req_t* req);
+
+public:
+    explicit DownloadManager(VideoManager& manager);
+    ~DownloadManager();
+
+    // Disable copy
+    DownloadManager(const DownloadManager&) = delete;
+    DownloadManager& operator=(const DownloadManager&) = delete;
+
+    DownloadStats getStats() const;
+
+    // HTTP handler - Được gọi từ HTTP server (uri "/recordings*", match wildcard).
+    // Mỗi request gửi trên task riêng → nhiều Range song song, httpd worker không bị giữ
+    esp_err_t handleRequest(httpd_req_t* req);
+
+    // Static wrapper for HTTP server callback
+    static esp_err_t downloadHandlerWrapper(httpd_req_t* req);
+};
+
+#endif // CAM_DOWNLOAD_HPP
@@ -0,0 +1,387 @@
+#include "CAM_frameBroker.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <utility>
+
+const char* FrameBroker::TAG = "FRAME_BROKER";
+
+FrameBroker::FrameBroker(EspCamera& cam)
+    : camera(cam), taskHandle(nullptr), running(false) {
+
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        Consumer& c = consumers[i];
+        c.used = false;
+        c.name = "";
+        c.fps = 0;
+        c.nextDueUs = 0;
+        c.policy = QueueDropPolicy::DROP_OLDEST;
+        c.ready = xSemaphoreCreateBinary();
+        c.delivered = 0;
+        c.dropped = 0;
+        c.windowStartUs = 0;
+        c.windowFrames = 0;
+        c.fpsMeasured = 0.0f;
+        c.cancelled = false;
+        c.holding = false;
+    }
+
+    mutex = xSemaphoreCreateMutex();
+    callbackMutex = xSemaphoreCreateMutex();
+    wake = xSemaphoreCreateBinary();
+    taskDone = xSemaphoreCreateBinary();
+    if (mutex == nullptr || callbackMutex == nullptr || wake == nullptr || taskDone == nullptr) {
+        ESP_LOGE(TAG, "Failed to create semaphores");
+    }
+}
+
+FrameBroker::~FrameBroker() {
+    stop();
+
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        consumers[i].pending.reset();
+        if (consumers[i].ready) {
+            vSemaphoreDelete(consumers[i].ready);
+        }
+    }
+    if (mutex) vSemaphoreDelete(mutex);
+    if (callbackMutex) vSemaphoreDelete(callbackMutex);
+    if (wake) vSemaphoreDelete(wake);
+    if (taskDone) vSemaphoreDelete(taskDone);
+}
+
+esp_err_t FrameBroker::start() {
+    if (taskHandle != nullptr) {
+        return ESP_OK;
+    }
+
+    running = true;
+    xSemaphoreTake(taskDone, 0);
+
+    BaseType_t ret = xTaskCreate(
+        taskFunc,
+        "frame_broker",
+        4096,
+        this,
+        PRIORITY_BROKER_TASK,
+        &taskHandle
+    );
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create broker task");
+        running = false;
+        taskHandle = nullptr;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+void FrameBroker::stop() {
+    if (taskHandle == nullptr) {
+        return;
+    }
+
+    running = false;
+    xSemaphoreGive(wake);
+    if (xSemaphoreTake(taskDone, pdMS_TO_TICKS(2000)) != pdTRUE) {
+        ESP_LOGW(TAG, "Broker task did not stop in time");
+    }
+}
+
+// ==================== Consumers ====================
+
+int FrameBroker::subscribe(const char* name, uint8_t fps, QueueDropPolicy policy,
+                           FrameCallback callback) {
+    int id = -1;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return -1;
+    }
+
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        Consumer& c = consumers[i];
+        if (c.used) continue;
+
+        c.used = true;
+        c.name = name;
+        c.fps = fps;
+        c.nextDueUs = 0;
+        c.policy = policy;
+        c.callback = callback;
+        c.delivered = 0;
+        c.dropped = 0;
+        c.windowStartUs = 0;
+        c.windowFrames = 0;
+        c.fpsMeasured = 0.0f;
+        c.cancelled = false;
+        c.holding = false;
+        xSemaphoreTake(c.ready, 0);
+        id = i;
+        break;
+    }
+
+    xSemaphoreGive(mutex);
+
+    if (id < 0) {
+        ESP_LOGE(TAG, "No free consumer slot for %s", name);
+        return -1;
+    }
+
+    ESP_LOGI(TAG, "Consumer %d (%s) subscribed @ %u fps", id, name, fps);
+    xSemaphoreGive(wake);
+    return id;
+}
+
+void FrameBroker::unsubscribe(int id) {
+    if (id < 0 || id >= MAX_CONSUMERS) {
+        return;
+    }
+
+    // Frame chờ được trả về driver sau khi nhả mutex
+    FrameHandle dropped;
+
+    // Callback có thể đang chạy trong broker task → chờ xong
+    xSemaphoreTake(callbackMutex, portMAX_DELAY);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        Consumer& c = consumers[id];
+        dropped = std::move(c.pending);
+        c.callback = nullptr;
+        c.used = false;
+        c.fps = 0;
+        xSemaphoreGive(mutex);
+    }
+
+    xSemaphoreGive(callbackMutex);
+}
+
+void FrameBroker::setFps(int id, uint8_t fps) {
+    if (id < 0 || id >= MAX_CONSUMERS) {
+        return;
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (consumers[id].used && consumers[id].fps != fps) {
+            consumers[id].fps = fps;
+            consumers[id].nextDueUs = 0;
+        }
+        xSemaphoreGive(mutex);
+    }
+    xSemaphoreGive(wake);
+}
+
+void FrameBroker::release(int id, FrameHandle& frame) {
+    // esp_camera_fb_return ngoài lock
+    frame.reset();
+
+    if (id < 0 || id >= MAX_CONSUMERS) {
+        return;
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        consumers[id].holding = false;
+        xSemaphoreGive(mutex);
+    }
+}
+
+bool FrameBroker::acquire(int id, FrameHandle& frame, TickType_t wait) {
+    if (id < 0 || id >= MAX_CONSUMERS) {
+        return false;
+    }
+
+    Consumer& c = consumers[id];
+    TickType_t start = xTaskGetTickCount();
+
+    // Frame cũ của consumer (nếu còn) được trả trước khi nhận frame mới
+    release(id, frame);
+
+    while (true) {
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            if (!c.used || c.cancelled) {
+                xSemaphoreGive(mutex);
+                return false;
+            }
+            if (c.pending) {
+                frame = std::move(c.pending);
+                c.holding = true;
+                xSemaphoreGive(mutex);
+                return true;
+            }
+            xSemaphoreGive(mutex);
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait) {
+            return false;
+        }
+        xSemaphoreTake(c.ready, wait - elapsed);
+    }
+}
+
+void FrameBroker::cancel(int id) {
+    if (id < 0 || id >= MAX_CONSUMERS) {
+        return;
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        consumers[id].cancelled = consumers[id].used;
+        xSemaphoreGive(mutex);
+    }
+    xSemaphoreGive(consumers[id].ready);
+}
+
+bool FrameBroker::snapshot(FrameHandle& frame, TickType_t wait) {
+    int id = subscribe("snapshot", SNAPSHOT_FPS, QueueDropPolicy::DROP_OLDEST);
+    if (id < 0) {
+        return false;
+    }
+
+    bool ok = acquire(id, frame, wait);
+    unsubscribe(id);
+    return ok;
+}
+
+BrokerConsumerStats FrameBroker::getStats(int id) const {
+    BrokerConsumerStats stats = {};
+
+    if (id < 0 || id >= MAX_CONSUMERS) {
+        return stats;
+    }
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        stats.delivered = consumers[id].delivered;
+        stats.dropped = consumers[id].dropped;
+        stats.fps = consumers[id].fpsMeasured;
+        xSemaphoreGive(mutex);
+    }
+
+    return stats;
+}
+
+// ==================== Broker task ====================
+
+uint8_t FrameBroker::maxFpsLocked() const {
+    uint8_t fps = 0;
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        if (consumers[i].used && consumers[i].fps > fps) {
+            fps = consumers[i].fps;
+        }
+    }
+    return fps;
+}
+
+void FrameBroker::countDelivery(Consumer& c, int64_t nowUs) {
+    c.delivered++;
+    c.windowFrames++;
+    if (c.windowStartUs == 0) {
+        c.windowStartUs = nowUs;
+    } else if (nowUs - c.windowStartUs >= 1000000) {
+        c.fpsMeasured = c.windowFrames * 1000000.0f / (nowUs - c.windowStartUs);
+        c.windowStartUs = nowUs;
+        c.windowFrames = 0;
+    }
+}
+
+void FrameBroker::dispatch(const FrameHandle& frame) {
+    bool callbackDue[MAX_CONSUMERS] = {};
+    // Frame chờ bị thay thế: hủy sau khi nhả mutex (esp_camera_fb_return ngoài lock)
+    FrameHandle replaced[MAX_CONSUMERS];
+
+    int64_t captureUs = frame.timestampUs();
+    int64_t halfCaptureUs = pacer.getPeriodUs() / 2;
+
+    // Luôn chừa ≥1 buffer cho driver: consumer đang giữ 1 frame chỉ được thêm frame chờ khi pool còn chỗ
+    uint32_t maxHeld = camera.getFrameBufferCount();
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        Consumer& c = consumers[i];
+        if (!c.used || c.fps == 0) continue;
+
+        // Decimate về fps của consumer (dung sai nửa chu kỳ capture)
+        int64_t periodUs = 1000000 / c.fps;
+        if (captureUs + halfCaptureUs < c.nextDueUs) continue;
+        c.nextDueUs += periodUs;
+        if (c.nextDueUs <= captureUs) {
+            c.nextDueUs = captureUs + periodUs;
+        }
+
+        if (c.callback) {
+            callbackDue[i] = true;
+            countDelivery(c, captureUs);
+            continue;
+        }
+
+        if (c.pending) {
+            if (c.policy == QueueDropPolicy::DROP_NEWEST) {
+                c.dropped++;
+                continue;
+            }
+            replaced[i] = std::move(c.pending);
+            c.dropped++;
+        } else if (c.holding && FrameHandle::outstanding() >= maxHeld) {
+            // Chỉ consumer tự giữ frame cũ mới bị bỏ; consumer không giữ gì luôn nhận frame
+            // (1 consumer chậm không làm đói các consumer khác)
+            c.dropped++;
+            continue;
+        }
+
+        c.pending = frame.share();
+        countDelivery(c, captureUs);
+        xSemaphoreGive(c.ready);
+    }
+
+    xSemaphoreGive(mutex);
+
+    // Callback consumer chạy ngoài mutex (unsubscribe chờ qua callbackMutex)
+    xSemaphoreTake(callbackMutex, portMAX_DELAY);
+    for (int i = 0; i < MAX_CONSUMERS; i++) {
+        if (callbackDue[i] && consumers[i].used && consumers[i].callback) {
+            consumers[i].callback(frame);
+        }
+    }
+    xSemaphoreGive(callbackMutex);
+}
+
+void FrameBroker::taskFunc(void* param) {
+    FrameBroker* self = static_cast<FrameBroker*>(param);
+
+    ESP_LOGI(TAG, "Broker task started");
+
+    while (self->running) {
+        uint8_t fps = 0;
+        if (xSemaphoreTake(self->mutex, portMAX_DELAY) == pdTRUE) {
+            fps = self->maxFpsLocked();
+            xSemaphoreGive(self->mutex);
+        }
+
+        // Không ai cần frame → không capture
+        if (fps == 0) {
+            self->pacer.reset();
+            xSemaphoreTake(self->wake, pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (self->pacer.getTargetFps() != fps) {
+            self->pacer.setFps(fps);
+        }
+        self->pacer.waitNext();
+
+        // Handle của broker hết scope sau dispatch → consumer giữ share() riêng
+        FrameHandle frame = self->camera.captureFrame();
+        if (!frame) {
+            ESP_LOGE(TAG, "Capture failed (%lu frames held)", FrameHandle::outstanding());
+            continue;
+        }
+
+        self->dispatch(frame);
+    }
+
+    ESP_LOGI(TAG, "Broker task ended");
+    self->taskHandle = nullptr;
+    xSemaphoreGive(self->taskDone);
+    vTaskDelete(nullptr);
+}
@@ -0,0 +1,103 @@
+#ifndef CAM_FRAME_BROKER_HPP
+#define CAM_FRAME_BROKER_HPP
+
+#include "CAM_sensorRead.hpp"
+#include "CAM_framePacer.hpp"
+#include "CAM_frameQueue.hpp"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <cstdint>
+#include <functional>
+
+struct BrokerConsumerStats {
+    uint32_t delivered;
+    uint32_t dropped;       // Bỏ do consumer chưa xử lý xong (theo policy) hoặc pool đầy
+    float fps;              // fps nhận thực tế (cửa sổ ~1s)
+};
+
+// Frame Broker Class - capture mỗi frame 1 lần, chia cho nhiều consumer
+//   - Callback consumer: gọi đồng bộ trong broker task (phải nhanh, vd. copy vào FrameQueue)
+//   - Mailbox consumer: acquire() nhận FrameHandle, release() trả frame. Tối đa 1 frame chờ
+// Broker capture ở fps lớn nhất được yêu cầu, mỗi consumer được decimate về fps của nó.
+class FrameBroker {
+public:
+    using FrameCallback = std::function<void(const FrameHandle&)>;
+
+private:
+    struct Consumer {
+        bool used;
+        const char* name;
+        uint8_t fps;                // 0 = tạm dừng
+        int64_t nextDueUs;
+        QueueDropPolicy policy;     // Mailbox: DROP_OLDEST = luôn giữ frame mới nhất
+        FrameCallback callback;
+        FrameHandle pending;
+        SemaphoreHandle_t ready;
+        bool cancelled;             // cancel() → acquire trả false ngay, không chờ frame
+        bool holding;               // Đang giữ frame nhận từ acquire() (đến release/acquire kế tiếp)
+
+        uint32_t delivered;
+        uint32_t dropped;
+        int64_t windowStartUs;
+        uint32_t windowFrames;
+        float fpsMeasured;
+    };
+
+    static constexpr int MAX_CONSUMERS = 12;   // Recorder, snapshot, /stream ×4, RTSP ×2, /ws ×2, motion, ...
+
+    EspCamera& camera;
+    Consumer consumers[MAX_CONSUMERS];
+
+    FramePacer pacer;
+    TaskHandle_t taskHandle;
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t callbackMutex;    // unsubscribe chờ callback đang chạy
+    SemaphoreHandle_t wake;
+    SemaphoreHandle_t taskDone;
+    volatile bool running;
+
+    static const char* TAG;
+    static constexpr uint8_t PRIORITY_BROKER_TASK = 5;
+    static constexpr uint8_t SNAPSHOT_FPS = 30;
+
+    static void taskFunc(void* param);
+    void dispatch(const FrameHandle& frame);
+    uint8_t maxFpsLocked() const;
+    void countDelivery(Consumer& c, int64_t nowUs);
+
+public:
+    explicit FrameBroker(EspCamera& cam);
+    ~FrameBroker();
+
+    // Disable copy
+    FrameBroker(const FrameBroker&) = delete;
+    FrameBroker& operator=(const FrameBroker&) = delete;
+
+    esp_err_t start();
+    void stop();
+    bool isRunning() const { return taskHandle != nullptr; }
+
+    // Trả về consumer id (-1 = hết slot). callback == nullptr → mailbox consumer
+    int subscribe(const char* name, uint8_t fps, QueueDropPolicy policy,
+                  FrameCallback callback = nullptr);
+    void unsubscribe(int id);
+    void setFps(int id, uint8_t fps);
+
+    // Mailbox consumer: chờ frame kế tiếp (frame cũ trong handle được release trước)
+    bool acquire(int id, FrameHandle& frame, TickType_t wait);
+    // Trả frame về driver và bỏ trạng thái "đang giữ" của consumer
+    void release(int id, FrameHandle& frame);
+    // Đánh thức acquire đang chờ của consumer (dừng client), các acquire sau trả false
+    void cancel(int id);
+
+    // Lấy 1 frame mới (không cần subscribe)
+    bool snapshot(FrameHandle& frame, TickType_t wait);
+
+    BrokerConsumerStats getStats(int id) const;
+    uint8_t getCaptureFps() const { return pacer.getTargetFps(); }
+    float getAchievedFps() const { return pacer.getAchievedFps(); }
+};
+
+#endif // CAM_FRAME_BROKER_HPP
@@ -0,0 +1,59 @@
+#include "CAM_framePacer.hpp"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+FramePacer::FramePacer(uint8_t fps) {
+    setFps(fps);
+}
+
+void FramePacer::setFps(uint8_t fps) {
+    targetFps = fps ? fps : 1;
+    periodUs = 1000000 / targetFps;
+    reset();
+}
+
+void FramePacer::reset() {
+    nextDeadlineUs = 0;
+    windowStartUs = 0;
+    windowFrames = 0;
+    achievedFps = 0.0f;
+    totalFrames = 0;
+    skippedFrames = 0;
+}
+
+uint32_t FramePacer::waitNext() {
+    int64_t now = esp_timer_get_time();
+    uint32_t missed = 0;
+
+    if (nextDeadlineUs == 0) {
+        // Frame đầu tiên: chạy ngay
+        nextDeadlineUs = now;
+        windowStartUs = now;
+    } else if (now < nextDeadlineUs) {
+        // Ngủ tới deadline (làm tròn xuống tick, sai số < 1 tick không cộng dồn)
+        TickType_t ticks = (nextDeadlineUs - now) / (portTICK_PERIOD_MS * 1000);
+        if (ticks > 0) {
+            vTaskDelay(ticks);
+        }
+        now = esp_timer_get_time();
+    } else if (now - nextDeadlineUs >= periodUs) {
+        // Trễ hơn 1 chu kỳ → bỏ slot đã lỡ
+        missed = (now - nextDeadlineUs) / periodUs;
+        nextDeadlineUs += (int64_t)missed * periodUs;
+        skippedFrames += missed;
+    }
+
+    nextDeadlineUs += periodUs;
+    totalFrames++;
+    windowFrames++;
+
+    int64_t windowUs = now - windowStartUs;
+    if (windowUs >= FPS_WINDOW_US) {
+        achievedFps = windowFrames * 1000000.0f / windowUs;
+        windowStartUs = now;
+        windowFrames = 0;
+    }
+
+    return missed;
+}
@@ -0,0 +1,41 @@
+#ifndef CAM_FRAME_PACER_HPP
+#define CAM_FRAME_PACER_HPP
+
+#include <cstdint>
+
+// Frame Pacer Class - nhịp frame theo deadline tuyệt đối (esp_timer)
+// Deadline không phụ thuộc thời gian xử lý frame → không drift.
+// Khi trễ ≥ 1 chu kỳ, bỏ qua các slot đã lỡ thay vì dồn lag.
+class FramePacer {
+private:
+    uint8_t targetFps;
+    int64_t periodUs;
+    int64_t nextDeadlineUs;
+
+    // Đo fps thực tế theo cửa sổ ~1s
+    int64_t windowStartUs;
+    uint32_t windowFrames;
+    float achievedFps;
+
+    uint32_t totalFrames;
+    uint32_t skippedFrames;
+
+    static constexpr int64_t FPS_WINDOW_US = 1000000;
+
+public:
+    explicit FramePacer(uint8_t fps = 10);
+
+    void setFps(uint8_t fps);
+    void reset();
+
+    // Chờ tới slot kế tiếp. Trả về số slot bị bỏ qua do trễ
+    uint32_t waitNext();
+
+    uint8_t getTargetFps() const { return targetFps; }
+    int64_t getPeriodUs() const { return periodUs; }
+    float getAchievedFps() const { return achievedFps; }
+    uint32_t getFrameCount() const { return totalFrames; }
+    uint32_t getSkippedFrames() const { return skippedFrames; }
+};
+
+#endif // CAM_FRAME_PACER_HPP
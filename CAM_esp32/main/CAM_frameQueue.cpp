@@ -0,0 +1,277 @@
+#include "CAM_frameQueue.hpp"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "freertos/task.h"
+#include <cstring>
+
+const char* FrameQueue::TAG = "FRAME_QUEUE";
+
+FrameQueue::FrameQueue()
+    : buffer(nullptr), capacity(0), slots(nullptr), maxSlots(0), head(0), count(0),
+      frontBusy(false), nextSeq(0), maxDepth(0), pushedCount(0), droppedCount(0) {
+
+    mutex = xSemaphoreCreateMutex();
+    dataReady = xSemaphoreCreateBinary();
+    if (mutex == nullptr || dataReady == nullptr) {
+        ESP_LOGE(TAG, "Failed to create semaphores");
+    }
+}
+
+FrameQueue::~FrameQueue() {
+    heap_caps_free(buffer);
+    delete[] slots;
+
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+    if (dataReady) {
+        vSemaphoreDelete(dataReady);
+    }
+}
+
+esp_err_t FrameQueue::init(size_t capacityBytes, uint32_t maxFrames) {
+    if (buffer != nullptr) {
+        return ESP_OK;
+    }
+
+    // Ưu tiên PSRAM, fallback internal RAM
+    buffer = (uint8_t*)heap_caps_malloc(capacityBytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    bool inPsram = buffer != nullptr;
+    if (!inPsram) {
+        buffer = (uint8_t*)heap_caps_malloc(capacityBytes, MALLOC_CAP_8BIT);
+    }
+
+    if (buffer == nullptr) {
+        ESP_LOGE(TAG, "Failed to allocate %u bytes", capacityBytes);
+        return ESP_ERR_NO_MEM;
+    }
+
+    slots = new Slot[maxFrames];
+    capacity = capacityBytes;
+    maxSlots = maxFrames;
+    head = 0;
+    count = 0;
+
+    ESP_LOGI(TAG, "Initialized: %u KB in %s, max %lu frames",
+             capacityBytes / 1024, inPsram ? "PSRAM" : "internal RAM", maxFrames);
+    return ESP_OK;
+}
+
+bool FrameQueue::reserve(size_t footprint, size_t& pos) const {
+    if (count >= maxSlots) {
+        return false;
+    }
+
+    if (count == 0) {
+        pos = 0;
+        return footprint <= capacity;
+    }
+
+    const Slot& oldest = slots[head];
+    const Slot& newest = slots[(head + count - 1) % maxSlots];
+    size_t tailEnd = newest.offset + newest.footprint;
+
+    if (newest.offset >= oldest.offset) {
+        // Vùng dùng: [oldest, tailEnd) → còn trống ở cuối hoặc ở đầu buffer
+        if (capacity - tailEnd >= footprint) {
+            pos = tailEnd;
+            return true;
+        }
+        if (oldest.offset >= footprint) {
+            pos = 0;
+            return true;
+        }
+        return false;
+    }
+
+    // Đã wrap: vùng trống là [tailEnd, oldest)
+    if (oldest.offset - tailEnd >= footprint) {
+        pos = tailEnd;
+        return true;
+    }
+    return false;
+}
+
+void FrameQueue::dropOldestLocked() {
+    head = (head + 1) % maxSlots;
+    count--;
+    droppedCount++;
+}
+
+bool FrameQueue::push(const uint8_t* data, size_t len, uint16_t width, uint16_t height,
+                      int64_t captureUs, QueueDropPolicy policy) {
+    if (buffer == nullptr || len == 0) {
+        return false;
+    }
+
+    size_t footprint = (len + 3) & ~(size_t)3;
+    size_t pos = 0;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+
+    bool ok = reserve(footprint, pos);
+    // Không được bỏ frame consumer đang giữ
+    if (!ok && policy == QueueDropPolicy::DROP_OLDEST && !frontBusy) {
+        while (!ok && count > 0) {
+            dropOldestLocked();
+            ok = reserve(footprint, pos);
+        }
+    }
+
+    if (!ok) {
+        droppedCount++;
+        xSemaphoreGive(mutex);
+        return false;
+    }
+
+    // Copy ngoài mutex: consumer không bao giờ đọc vùng chưa publish
+    xSemaphoreGive(mutex);
+    memcpy(buffer + pos, data, len);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+
+    Slot& slot = slots[(head + count) % maxSlots];
+    slot.offset = pos;
+    slot.len = len;
+    slot.footprint = footprint;
+    slot.width = width;
+    slot.height = height;
+    slot.captureUs = captureUs;
+    slot.seq = nextSeq++;
+    count++;
+    pushedCount++;
+    if (count > maxDepth) {
+        maxDepth = count;
+    }
+
+    xSemaphoreGive(mutex);
+    xSemaphoreGive(dataReady);
+    return true;
+}
+
+bool FrameQueue::front(QueuedFrame& frame, TickType_t wait) {
+    if (buffer == nullptr) {
+        return false;
+    }
+
+    TickType_t start = xTaskGetTickCount();
+
+    while (true) {
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            if (count > 0) {
+                const Slot& slot = slots[head];
+                frame.data = buffer + slot.offset;
+                frame.len = slot.len;
+                frame.width = slot.width;
+                frame.height = slot.height;
+                frame.captureUs = slot.captureUs;
+                frame.seq = slot.seq;
+                frontBusy = true;
+                xSemaphoreGive(mutex);
+                return true;
+            }
+            xSemaphoreGive(mutex);
+        }
+
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait) {
+            return false;
+        }
+        xSemaphoreTake(dataReady, wait - elapsed);
+    }
+}
+
+void FrameQueue::pop() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    if (frontBusy && count > 0) {
+        head = (head + 1) % maxSlots;
+        count--;
+    }
+    frontBusy = false;
+
+    xSemaphoreGive(mutex);
+}
+
+void FrameQueue::release() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    frontBusy = false;
+    xSemaphoreGive(mutex);
+}
+
+uint32_t FrameQueue::trimOlderThan(int64_t cutoffUs) {
+    uint32_t trimmed = 0;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+
+    while (count > 0 && !frontBusy && slots[head].captureUs < cutoffUs) {
+        head = (head + 1) % maxSlots;
+        count--;
+        trimmed++;
+    }
+
+    xSemaphoreGive(mutex);
+    return trimmed;
+}
+
+void FrameQueue::clear() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    // Giữ lại frame consumer đang dùng
+    if (frontBusy && count > 0) {
+        count = 1;
+    } else {
+        head = 0;
+        count = 0;
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+uint32_t FrameQueue::size() const {
+    uint32_t n = 0;
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        n = count;
+        xSemaphoreGive(mutex);
+    }
+    return n;
+}
+
+FrameQueueStats FrameQueue::getStats() const {
+    FrameQueueStats stats = {};
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        stats.depth = count;
+        stats.maxDepth = maxDepth;
+        stats.pushed = pushedCount;
+        stats.dropped = droppedCount;
+        stats.capacity = capacity;
+        for (uint32_t i = 0; i < count; i++) {
+            stats.bytesUsed += slots[(head + i) % maxSlots].footprint;
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    return stats;
+}
+
+void FrameQueue::resetStats() {
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        maxDepth = count;
+        pushedCount = 0;
+        droppedCount = 0;
+        xSemaphoreGive(mutex);
+    }
+}
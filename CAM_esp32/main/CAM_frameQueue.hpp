@@ -0,0 +1,102 @@
+#ifndef CAM_FRAME_QUEUE_HPP
+#define CAM_FRAME_QUEUE_HPP
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <cstddef>
+#include <cstdint>
+
+// Frame đã copy vào queue (data trỏ vào ring buffer, hợp lệ tới khi pop())
+struct QueuedFrame {
+    const uint8_t* data;
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    int64_t captureUs;      // Timestamp lúc capture (esp_timer, since boot)
+    uint32_t seq;
+
+    QueuedFrame() : data(nullptr), len(0), width(0), height(0), captureUs(0), seq(0) {}
+};
+
+// Policy khi queue đầy
+enum class QueueDropPolicy {
+    DROP_NEWEST = 0,    // Bỏ frame mới (recording: giữ liên tục phần đã có)
+    DROP_OLDEST         // Bỏ frame cũ nhất (pre-roll: luôn giữ frame mới nhất)
+};
+
+struct FrameQueueStats {
+    uint32_t depth;
+    uint32_t maxDepth;
+    uint32_t pushed;
+    uint32_t dropped;
+    size_t bytesUsed;
+    size_t capacity;
+};
+
+// Frame Queue Class - bounded byte ring (PSRAM nếu có), 1 producer / 1 consumer
+class FrameQueue {
+private:
+    struct Slot {
+        size_t offset;
+        size_t len;
+        size_t footprint;   // len làm tròn 4 byte
+        uint16_t width;
+        uint16_t height;
+        int64_t captureUs;
+        uint32_t seq;
+    };
+
+    uint8_t* buffer;
+    size_t capacity;
+    Slot* slots;
+    uint32_t maxSlots;
+    uint32_t head;          // Slot cũ nhất
+    uint32_t count;
+    bool frontBusy;         // Consumer đang giữ frame đầu
+
+    uint32_t nextSeq;
+    uint32_t maxDepth;
+    uint32_t pushedCount;
+    uint32_t droppedCount;
+
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t dataReady;
+
+    static const char* TAG;
+
+    bool reserve(size_t footprint, size_t& pos) const;
+    void dropOldestLocked();
+
+public:
+    FrameQueue();
+    ~FrameQueue();
+
+    // Disable copy
+    FrameQueue(const FrameQueue&) = delete;
+    FrameQueue& operator=(const FrameQueue&) = delete;
+
+    esp_err_t init(size_t capacityBytes, uint32_t maxFrames);
+    bool isInitialized() const { return buffer != nullptr; }
+    size_t getCapacityBytes() const { return capacity; }
+    uint32_t getMaxFrames() const { return maxSlots; }
+
+    // Producer: copy frame vào ring. false = frame bị drop
+    bool push(const uint8_t* data, size_t len, uint16_t width, uint16_t height,
+              int64_t captureUs, QueueDropPolicy policy = QueueDropPolicy::DROP_NEWEST);
+
+    // Consumer: lấy frame cũ nhất (zero-copy), phải gọi pop() sau khi dùng xong
+    bool front(QueuedFrame& frame, TickType_t wait);
+    void pop();
+    void release();     // Trả lại frame đầu, không pop
+
+    // Bỏ các frame capture trước cutoffUs (pre-roll hết hạn, không tính là drop)
+    uint32_t trimOlderThan(int64_t cutoffUs);
+
+    void clear();
+    uint32_t size() const;
+    FrameQueueStats getStats() const;
+    void resetStats();
+};
+
+#endif // CAM_FRAME_QUEUE_HPP
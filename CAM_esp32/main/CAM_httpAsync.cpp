@@ -0,0 +1,54 @@
+#include "CAM_httpAsync.hpp"
+#include "esp_log.h"
+
+static const char* TAG = "HTTP_ASYNC";
+
+namespace HttpAsync {
+
+struct Job {
+    httpd_req_t* req;       // Bản copy async
+    Handler handler;
+};
+
+static void taskFunc(void* param) {
+    Job* job = static_cast<Job*>(param);
+
+    job->handler(job->req);
+    httpd_req_async_handler_complete(job->req);
+
+    delete job;
+    vTaskDelete(nullptr);
+}
+
+esp_err_t run(httpd_req_t* req, const char* taskName, uint32_t stackSize,
+              UBaseType_t priority, Handler handler) {
+    httpd_req_t* copy = nullptr;
+    if (httpd_req_async_handler_begin(req, &copy) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to detach request %s", req->uri);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    Job* job = new Job{ copy, std::move(handler) };
+
+    BaseType_t ret = xTaskCreate(
+        taskFunc,
+        taskName,
+        stackSize,
+        job,
+        priority,
+        nullptr
+    );
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create %s task", taskName);
+        httpd_resp_send_500(copy);
+        httpd_req_async_handler_complete(copy);
+        delete job;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+}
@@ -0,0 +1,21 @@
+#ifndef CAM_HTTP_ASYNC_HPP
+#define CAM_HTTP_ASYNC_HPP
+
+#include "esp_http_server.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <functional>
+
+// Handler chạy lâu (stream, playback, download) tách khỏi httpd worker:
+// httpd_req_async_handler_begin → task riêng chạy handler → httpd_req_async_handler_complete.
+// httpd worker trả về ngay, tiếp tục phục vụ các request khác.
+namespace HttpAsync {
+    using Handler = std::function<esp_err_t(httpd_req_t* req)>;
+
+    // ESP_OK = task đã chạy. Lỗi → đã trả 500 cho client
+    esp_err_t run(httpd_req_t* req, const char* taskName, uint32_t stackSize,
+                  UBaseType_t priority, Handler handler);
+}
+
+#endif // CAM_HTTP_ASYNC_HPP
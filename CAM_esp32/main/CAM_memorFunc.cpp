@@ -3,19 +3,22 @@
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
 #include "driver/sdmmc_host.h"
-#include "esp_http_client.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
-#include "freertos/timers.h"
+#include "esp_timer.h"
+#include "esp_psram.h"
 #include <sys/stat.h>
 #include <dirent.h>
+#include <unistd.h>
 #include <cstring>
 #include <ctime>
+#include <algorithm>
 
 
 const char* SdCardManager::TAG = "SD_CARD";
 const char* VideoManager::TAG = "VIDEO_MGR";
 const char* VideoWriteTimer::TAG = "WRITE_TIMER";
+const char* RecordingWriter::TAG = "REC_WRITER";
 
 // ==================== RtcTime Utils ====================
 
@@ -60,6 +63,28 @@ namespace RtcTimeUtils {
         return t1.second < t2.second;
     }
     
+    RtcTime addSeconds(const RtcTime& time, int64_t seconds) {
+        struct tm timeinfo = {};
+        timeinfo.tm_year = time.year - 1900;
+        timeinfo.tm_mon = time.month - 1;
+        timeinfo.tm_mday = time.day;
+        timeinfo.tm_hour = time.hour;
+        timeinfo.tm_min = time.minute;
+        timeinfo.tm_sec = time.second;
+        
+        time_t timestamp = mktime(&timeinfo) + seconds;
+        
+        struct tm* new_time = localtime(&timestamp);
+        return RtcTime(
+            new_time->tm_year + 1900,
+            new_time->tm_mon + 1,
+            new_time->tm_mday,
+            new_time->tm_hour,
+            new_time->tm_min,
+            new_time->tm_sec
+        );
+    }
+    
     bool isSameDay(const RtcTime& t1, const RtcTime& t2) {
         return t1.year == t2.year && t1.month == t2.month && t1.day == t2.day;
     }
@@ -120,6 +145,13 @@ esp_err_t SdCardManager::unmount() {
 }
 
 
+esp_err_t SdCardManager::getInfo(uint64_t& totalBytes, uint64_t& freeBytes) const {
+    if (!mounted) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return esp_vfs_fat_info(mountPoint.c_str(), &totalBytes, &freeBytes);
+}
+
 void SdCardManager::printInfo() const {
     if (!mounted || !card) return;
     
@@ -129,78 +161,222 @@ void SdCardManager::printInfo() const {
     ESP_LOGI(TAG, "Size: %llu MB", 
              ((uint64_t)card->csd.capacity) * card->csd.sector_size / (1024 * 1024));
     
-    //uint64_t total, free;
-    // if (getInfo(total, free) == ESP_OK) {
-    //     ESP_LOGI(TAG, "Free: %llu MB / %llu MB", 
-    //              free / (1024 * 1024), total / (1024 * 1024));
-    // }
+    uint64_t total, free;
+    if (getInfo(total, free) == ESP_OK) {
+        ESP_LOGI(TAG, "Free: %llu MB / %llu MB", 
+                 free / (1024 * 1024), total / (1024 * 1024));
+    }
+}
+
+// ==================== Recording Writer ====================
+
+RecordingWriter::RecordingWriter()
+    : format(RecordingFormat::AVI), frameCount(0), totalSize(0),
+      periodUs(100000), firstUs(0), nextSlot(0), repeatedFrames(0) {}
+
+RecordingWriter::~RecordingWriter() {
+    VideoInfo info;
+    close(info);
+}
+
+esp_err_t RecordingWriter::open(const std::string& rootPath, const std::string& recordingName,
+                                RecordingFormat fmt, uint8_t fps) {
+    if (isOpen()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    format = fmt;
+    name = recordingName;
+    frameCount = 0;
+    totalSize = 0;
+    periodUs = 1000000 / (fps ? fps : 1);
+    firstUs = 0;
+    nextSlot = 0;
+    repeatedFrames = 0;
+    
+    if (format == RecordingFormat::AVI) {
+        std::string aviPath = rootPath + "/" + name + ".avi";
+        if (avi.open(aviPath, fps) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        path = aviPath;
+    } else {
+        std::string folderPath = rootPath + "/" + name;
+        if (mkdir(folderPath.c_str(), 0755) == -1) {
+            ESP_LOGE(TAG, "Failed to create folder: %s", folderPath.c_str());
+            return ESP_FAIL;
+        }
+        path = folderPath;
+    }
+    
+    return ESP_OK;
+}
+
+esp_err_t RecordingWriter::writeFrame(const uint8_t* data, size_t len,
+                                      uint16_t width, uint16_t height,
+                                      int64_t captureUs) {
+    if (!isOpen()) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    if (format == RecordingFormat::AVI) {
+        // Slot bị bỏ (capture trễ / queue drop) → lặp frame trước để AVI đúng thời gian thực
+        if (frameCount == 0) {
+            firstUs = captureUs;
+        } else {
+            int64_t slot = (captureUs - firstUs + periodUs / 2) / periodUs;
+            if (slot > (int64_t)nextSlot) {
+                uint32_t gap = slot - nextSlot;
+                if (gap > MAX_REPEAT) gap = MAX_REPEAT;
+                avi.repeatLastFrame(gap);
+                repeatedFrames += gap;
+                nextSlot += gap;
+            }
+        }
+        
+        if (avi.writeFrame(data, len, width, height) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        nextSlot++;
+    } else {
+        char filename[256];
+        snprintf(filename, sizeof(filename), "%s/%04lu.jpg", 
+                 path.c_str(), frameCount + 1);
+        
+        FILE* file = fopen(filename, "wb");
+        if (!file) {
+            return ESP_FAIL;
+        }
+        size_t written = fwrite(data, 1, len, file);
+        fflush(file);
+        fclose(file);
+        
+        if (written != len) {
+            return ESP_FAIL;
+        }
+    }
+    
+    frameCount++;
+    totalSize += len;
+    return ESP_OK;
+}
+
+esp_err_t RecordingWriter::close(VideoInfo& info) {
+    if (!isOpen()) {
+        return ESP_OK;
+    }
+    
+    // Thời lượng theo timeline (AVI gồm cả frame lặp)
+    uint32_t slots = (format == RecordingFormat::AVI) ? avi.getFrameCount() : frameCount;
+    info.durationMs = (uint64_t)slots * periodUs / 1000;
+    
+    esp_err_t ret = ESP_OK;
+    if (format == RecordingFormat::AVI) {
+        ret = avi.close();
+    }
+    
+    info.folderName = name;
+    info.fullPath = path;
+    info.frameCount = frameCount;
+    info.totalSize = totalSize;
+    info.format = format;
+    
+    path.clear();
+    return ret;
 }
 
 // ==================== Video Write Timer ====================
 
 VideoWriteTimer::VideoWriteTimer(VideoManager& mgr)
-    : videoMgr(mgr), timerHandle(nullptr), isRunning(false), 
-      currentDurationMs(0), currentFps(0) {
+    : videoMgr(mgr), workerHandle(nullptr), isRunning(false), postRollMs(DEFAULT_POST_ROLL_MS) {
     
     mutex = xSemaphoreCreateMutex();
+    idleSignal = xSemaphoreCreateBinary();
+    cmdQueue = xQueueCreate(CMD_QUEUE_LEN, sizeof(RecorderCmd));
+    
+    if (mutex == nullptr || idleSignal == nullptr || cmdQueue == nullptr) {
+        ESP_LOGE(TAG, "Failed to create recorder resources");
+        return;
+    }
+    
+    // Recorder task cố định: không tạo/xóa task cho mỗi recording
+    BaseType_t ret = xTaskCreate(
+        workerTaskFunc,
+        "video_write",
+        8192,
+        this,
+        PRIORITY_WRITE_TASK,
+        &workerHandle
+    );
+    
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create recorder task");
+        workerHandle = nullptr;
+    }
 }
 
 VideoWriteTimer::~VideoWriteTimer() {
     stop();
+    
+    if (workerHandle != nullptr) {
+        xSemaphoreTake(idleSignal, 0);
+        if (sendCommand(RecorderCmdType::SHUTDOWN, portMAX_DELAY) == ESP_OK) {
+            xSemaphoreTake(idleSignal, pdMS_TO_TICKS(STOP_TIMEOUT_MS));
+        }
+    }
+    
+    if (cmdQueue) {
+        vQueueDelete(cmdQueue);
+    }
+    if (idleSignal) {
+        vSemaphoreDelete(idleSignal);
+    }
     if (mutex) {
         vSemaphoreDelete(mutex);
     }
 }
 
-void VideoWriteTimer::timerCallback(TimerHandle_t xTimer) {
-    VideoWriteTimer* self = static_cast<VideoWriteTimer*>(pvTimerGetTimerID(xTimer));
-    if (self) {
-        self->onTimeout();
+esp_err_t VideoWriteTimer::sendCommand(RecorderCmdType type, TickType_t wait,
+                                       const RtcTime& ts, uint32_t durationMs, uint8_t fps,
+                                       int64_t edgeUs) {
+    if (cmdQueue == nullptr || workerHandle == nullptr) {
+        return ESP_ERR_INVALID_STATE;
     }
+    
+    RecorderCmd cmd;
+    cmd.type = type;
+    cmd.timestamp = ts;
+    cmd.durationMs = durationMs;
+    cmd.fps = fps;
+    cmd.edgeUs = edgeUs;
+    
+    if (xQueueSend(cmdQueue, &cmd, wait) != pdTRUE) {
+        ESP_LOGW(TAG, "Recorder command queue full");
+        return ESP_ERR_TIMEOUT;
+    }
+    return ESP_OK;
 }
 
-void VideoWriteTimer::onTimeout() {
-    ESP_LOGI(TAG, "Timer timeout - stopping video write");
-    stop();
-}
-
-esp_err_t VideoWriteTimer::start(const RtcTime& ts, uint32_t durationMs, uint8_t fps) {
+esp_err_t VideoWriteTimer::start(const RtcTime& ts, uint32_t postRollMs, uint8_t fps, int64_t edgeUs) {
     if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
         return ESP_FAIL;
     }
     
+    if (postRollMs > 0) {
+        this->postRollMs = postRollMs;
+    }
+    
     if (isRunning) {
-        // Đang chạy → reset timer
-        ESP_LOGI(TAG, "Write already running, resetting timer");
+        // Đang ghi → kéo dài recording hiện tại (không tạo file mới)
+        ESP_LOGI(TAG, "Write already running, extending");
         xSemaphoreGive(mutex);
         return reset();
     }
     
-    // Bắt đầu mới
-    currentTimestamp = ts;
-    currentDurationMs = durationMs;
-    currentFps = fps;
+    // Bỏ tín hiệu idle cũ trước khi bắt đầu recording mới
+    xSemaphoreTake(idleSignal, 0);
     
-    // Tạo timer 10 giây
-    if (timerHandle == nullptr) {
-        timerHandle = xTimerCreate(
-            "write_timer",
-            pdMS_TO_TICKS(WRITE_TIMEOUT_MS),
-            pdFALSE,  // One-shot
-            this,
-            timerCallback
-        );
-        
-        if (timerHandle == nullptr) {
-            ESP_LOGE(TAG, "Failed to create timer");
-            xSemaphoreGive(mutex);
-            return ESP_FAIL;
-        }
-    }
-    
-    // Start timer
-    if (xTimerStart(timerHandle, 0) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to start timer");
+    if (sendCommand(RecorderCmdType::START, pdMS_TO_TICKS(100), ts, this->postRollMs, fps, edgeUs) != ESP_OK) {
         xSemaphoreGive(mutex);
         return ESP_FAIL;
     }
@@ -208,10 +384,8 @@ esp_err_t VideoWriteTimer::start(const RtcTime& ts, uint32_t durationMs, uint8_t
     isRunning = true;
     xSemaphoreGive(mutex);
     
-    ESP_LOGI(TAG, "Started write timer (10s timeout)");
-    
-    // Bắt đầu ghi video (async)
-    return startWriteTask();
+    ESP_LOGI(TAG, "Started recording (post-roll %lu ms)", this->postRollMs);
+    return ESP_OK;
 }
 
 esp_err_t VideoWriteTimer::reset() {
@@ -219,22 +393,16 @@ esp_err_t VideoWriteTimer::reset() {
         return ESP_FAIL;
     }
     
-    if (!isRunning || timerHandle == nullptr) {
+    if (!isRunning) {
         xSemaphoreGive(mutex);
         return ESP_ERR_INVALID_STATE;
     }
     
-    // Reset timer về 10s
-    if (xTimerReset(timerHandle, 0) != pdPASS) {
-        ESP_LOGE(TAG, "Failed to reset timer");
-        xSemaphoreGive(mutex);
-        return ESP_FAIL;
-    }
-    
+    uint32_t extendMs = postRollMs;
     xSemaphoreGive(mutex);
     
-    ESP_LOGI(TAG, "Timer reset - extending write time");
-    return ESP_OK;
+    // Recording kết thúc sau post-roll kể từ lần trigger này
+    return sendCommand(RecorderCmdType::EXTEND, pdMS_TO_TICKS(100), RtcTime(), extendMs);
 }
 
 esp_err_t VideoWriteTimer::stop() {
@@ -247,77 +415,159 @@ esp_err_t VideoWriteTimer::stop() {
         return ESP_OK;
     }
     
-    // Stop timer
-    if (timerHandle != nullptr) {
-        xTimerStop(timerHandle, 0);
-        xTimerDelete(timerHandle, 0);
-        timerHandle = nullptr;
-    }
+    xSemaphoreGive(mutex);
     
-    isRunning = false;
+    // Recorder dừng ở ranh giới frame kế tiếp, flush + close rồi báo idle
+    esp_err_t ret = sendCommand(RecorderCmdType::STOP, pdMS_TO_TICKS(100));
+    if (ret == ESP_OK &&
+        xSemaphoreTake(idleSignal, pdMS_TO_TICKS(STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Recorder did not stop in time");
+        ret = ESP_ERR_TIMEOUT;
+    }
     
-    xSemaphoreGive(mutex);
+    ESP_LOGI(TAG, "Recording stopped");
+    return ret;
+}
+
+esp_err_t VideoWriteTimer::discard() {
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return ESP_FAIL;
+    }
     
-    ESP_LOGI(TAG, "Write timer stopped");
+    if (!isRunning) {
+        xSemaphoreGive(mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
     
-    // Stop write task nếu đang chạy
-    stopWriteTask();
+    xSemaphoreGive(mutex);
     
-    return ESP_OK;
+    // Không chờ idle: gọi từ task verifier, recorder tự đóng + xóa ở ranh giới frame
+    return sendCommand(RecorderCmdType::DISCARD, pdMS_TO_TICKS(100));
 }
 
-esp_err_t VideoWriteTimer::startWriteTask() {
-    // Tạo task để ghi video
-    BaseType_t ret = xTaskCreate(
-        writeTaskFunc,
-        "video_write",
-        8192,
-        this,
-        PRIORITY_WRITE_TASK,
-        &writeTaskHandle
-    );
+bool VideoWriteTimer::handleCommand(const RecorderCmd& cmd, bool recording) {
+    switch (cmd.type) {
+        case RecorderCmdType::START:
+            if (recording) {
+                videoMgr.extendRecording(cmd.durationMs);
+                return true;
+            }
+            if (videoMgr.beginRecording(cmd.timestamp, cmd.durationMs, cmd.fps, cmd.edgeUs) != ESP_OK) {
+                ESP_LOGE(TAG, "Video write failed");
+                markIdle();
+                return false;
+            }
+            return true;
+            
+        case RecorderCmdType::EXTEND:
+            if (recording) {
+                videoMgr.extendRecording(cmd.durationMs);
+            }
+            return recording;
+            
+        case RecorderCmdType::STOP:
+            if (recording) {
+                finishRecording();
+            }
+            return false;
+            
+        case RecorderCmdType::DISCARD:
+            if (recording) {
+                discardRecording();
+            }
+            return false;
+            
+        default:
+            return recording;
+    }
+}
+
+void VideoWriteTimer::reportSegment(const VideoInfo& info) {
+    ESP_LOGI(TAG, "Video written: %s (%lu frames, %lu bytes)",
+             info.folderName.c_str(), info.frameCount, info.totalSize);
+    if(onVideoComplete) {
+        onVideoComplete(info.folderName);
+    }
+}
+
+void VideoWriteTimer::finishRecording() {
+    VideoInfo info;
+    if (videoMgr.endRecording(info) == ESP_OK) {
+        reportSegment(info);
+    } else {
+        ESP_LOGE(TAG, "Video write failed");
+    }
     
-    if (ret != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create write task");
-        return ESP_FAIL;
+    markIdle();
+}
+
+void VideoWriteTimer::discardRecording() {
+    // Không báo onVideoComplete: segment không tồn tại với MQTT/upload
+    VideoInfo info;
+    if (videoMgr.discardRecording(info) != ESP_OK) {
+        ESP_LOGE(TAG, "Video discard failed");
     }
     
-    return ESP_OK;
+    markIdle();
 }
 
-void VideoWriteTimer::stopWriteTask() {
-    if (writeTaskHandle != nullptr) {
-        vTaskDelete(writeTaskHandle);
-        writeTaskHandle = nullptr;
+void VideoWriteTimer::markIdle() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        isRunning = false;
+        xSemaphoreGive(mutex);
     }
+    xSemaphoreGive(idleSignal);
 }
 
-void VideoWriteTimer::writeTaskFunc(void* param) {
+void VideoWriteTimer::workerTaskFunc(void* param) {
     VideoWriteTimer* self = static_cast<VideoWriteTimer*>(param);
     
-    ESP_LOGI(TAG, "Write task started");
+    ESP_LOGI(TAG, "Recorder task started");
     
-    VideoInfo info;
-    esp_err_t ret = self->videoMgr.writeVideo(
-        self->currentTimestamp,
-        self->currentDurationMs,
-        self->currentFps,
-        info
-    );
+    bool recording = false;
+    RecorderCmd cmd;
     
-    if (ret == ESP_OK) {
-        ESP_LOGI(TAG, "Video written: %s (%lu frames, %lu bytes)",
-                 info.folderName.c_str(), info.frameCount, info.totalSize);
-        if(self->onVideoComplete) {
-            self->onVideoComplete(info.folderName);
+    while (true) {
+        // Idle: ngủ chờ lệnh. Đang ghi: xử lý lệnh giữa các frame
+        TickType_t wait = recording ? 0 : portMAX_DELAY;
+        while (xQueueReceive(self->cmdQueue, &cmd, wait) == pdTRUE) {
+            wait = 0;
+            
+            if (cmd.type == RecorderCmdType::SHUTDOWN) {
+                if (recording) {
+                    self->finishRecording();
+                }
+                ESP_LOGI(TAG, "Recorder task ended");
+                self->workerHandle = nullptr;
+                xSemaphoreGive(self->idleSignal);
+                vTaskDelete(nullptr);
+                return;
+            }
+            
+            recording = self->handleCommand(cmd, recording);
+        }
+        
+        if (!recording) {
+            continue;
+        }
+        
+        RecordStep step = self->videoMgr.stepRecording(pdMS_TO_TICKS(100));
+        if (step == RecordStep::DONE) {
+            self->finishRecording();
+            recording = false;
+        } else if (step == RecordStep::SEGMENT_FULL) {
+            // Đóng segment hiện tại, frame kế tiếp vào file mới
+            VideoInfo info;
+            esp_err_t ret = self->videoMgr.rolloverRecording(info);
+            if (info.frameCount > 0) {
+                self->reportSegment(info);
+            }
+            if (ret != ESP_OK && !self->videoMgr.isRecording()) {
+                self->markIdle();
+                recording = false;
+            }
         }
-    } else {
-        ESP_LOGE(TAG, "Video write failed");
     }
-    
-    // Task tự cleanup
-    self->writeTaskHandle = nullptr;
-    vTaskDelete(nullptr);
 }
 
 bool VideoWriteTimer::isActive() const {
@@ -331,8 +581,45 @@ bool VideoWriteTimer::isActive() const {
 
 // ==================== Video Manager ====================
 
-VideoManager::VideoManager(SdCardManager& sd, const std::string& root)
-    : sdCard(sd), rootPath(root) {}
+VideoManager::VideoManager(SdCardManager& sd, FrameBroker& frameBroker, const std::string& root)
+    : sdCard(sd), broker(frameBroker), rootPath(root), recordFormat(RecordingFormat::AVI),
+      uploadMode(UploadMode::PER_FRAME),
+      retention(catalog, sd.getMountPoint()),
+      uploader(std::string("http://") + SERVER_IP + ":" + std::to_string(SERVER_PORT)),
+      checkpoint("cursor"), bgCheckpoint("bg_cursor", true), scheduler(catalog, uploader),
+      avgFrameBytes(DEFAULT_FRAME_BYTES), discardedCount(0), discardedBytes(0),
+      activeStartUs(0), activeEndUs(0), activeSegmentEndUs(0), activeNextSegmentUs(0),
+      activeGrantedBytes(0), activePreRollFrames(0), activeEdgeUs(0), activeTriggerPending(false),
+      activeFps(10),
+      maxSegmentMs(DEFAULT_MAX_SEGMENT_MS),
+      captureConsumer(-1), lastFrameUs(0), recordingActive(false),
+      preRollPaused(false), recordFps(10), preRollMs(DEFAULT_PRE_ROLL_MS),
+      effectivePreRollMs(DEFAULT_PRE_ROLL_MS), preRollFps(10) {
+    
+    sdIoMutex = xSemaphoreCreateMutex();
+    statsMutex = xSemaphoreCreateMutex();
+    
+    // Retention không chờ SD: đang ghi thì bỏ qua, thử lại sau
+    retention.setDeleter([this](const CatalogEntry& entry) {
+        return deleteRecording(RecordingCatalog::entryName(entry), 0);
+    });
+    
+    scheduler.setUploader([this](const CatalogEntry& entry) {
+        return uploadRecording(entry);
+    });
+}
+
+VideoManager::~VideoManager() {
+    scheduler.stop();
+    retention.stop();
+    stopCapture();
+    if (sdIoMutex) {
+        vSemaphoreDelete(sdIoMutex);
+    }
+    if (statsMutex) {
+        vSemaphoreDelete(statsMutex);
+    }
+}
 
 esp_err_t VideoManager::init() {
     if (!sdCard.isMounted()) {
@@ -350,198 +637,863 @@ esp_err_t VideoManager::init() {
         ESP_LOGI(TAG, "Created root dir: %s", rootPath.c_str());
     }
     
+    // Catalog: load index (chỉ quét thư mục nếu index thiếu/hỏng)
+    if (catalog.load(rootPath) != ESP_OK) {
+        ESP_LOGW(TAG, "Catalog unavailable, listing will be empty");
+    }
+    retention.start();
+    
+    // Upload theo chunk: 2 buffer cố định, không cần RAM bằng cả file
+    if (uploader.init() != ESP_OK) {
+        ESP_LOGW(TAG, "Uploader unavailable, memory read disabled");
+    } else {
+        // Task chờ tới khi setBackgroundUpload(true)
+        scheduler.start();
+    }
+    
+    // Frame queue dùng lại cho mọi recording, cỡ theo pre-roll cấu hình
+    size_t queueBytes = QUEUE_BYTES_INTERNAL;
+    if (esp_psram_is_initialized()) {
+        uint64_t preRollBytes = (uint64_t)preRollMs * preRollFps / 1000 * (avgFrameBytes + QUEUE_FRAME_OVERHEAD);
+        queueBytes = std::clamp<uint64_t>(preRollBytes * 3 / 2, QUEUE_BYTES_PSRAM, QUEUE_BYTES_PSRAM_MAX);
+    }
+    esp_err_t ret = frameQueue.init(queueBytes, QUEUE_MAX_FRAMES);
+    if (ret != ESP_OK && queueBytes > QUEUE_BYTES_PSRAM) {
+        ret = frameQueue.init(QUEUE_BYTES_PSRAM, QUEUE_MAX_FRAMES);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Frame queue allocation failed");
+        return ESP_ERR_NO_MEM;
+    }
+    updatePreRollLimit();
+    
+    // Consumer của broker chạy liên tục để giữ pre-roll
+    return startCapture();
+}
+
+void VideoManager::setPreRoll(uint32_t durationMs, uint8_t fps) {
+    preRollMs = durationMs;
+    preRollFps = fps ? fps : 1;
+    ESP_LOGI(TAG, "Pre-roll: %lu ms @ %u fps", preRollMs, preRollFps);
+    updatePreRollLimit();
+    updateCaptureRate();
+}
+
+void VideoManager::updatePreRollLimit() {
+    uint32_t limitMs = preRollMs;
+    
+    // Chưa có queue (trước init) → giữ cấu hình, tính lại sau khi cấp phát
+    if (frameQueue.isInitialized() && preRollMs > 0) {
+        uint64_t frameBytes = avgFrameBytes + QUEUE_FRAME_OVERHEAD;
+        uint64_t frames = std::min<uint64_t>(frameQueue.getCapacityBytes() * 2 / 3 / frameBytes,
+                                             frameQueue.getMaxFrames() * 2 / 3);
+        limitMs = std::min<uint64_t>(preRollMs, frames * 1000 / preRollFps);
+    }
+    
+    if (limitMs == effectivePreRollMs) {
+        return;
+    }
+    effectivePreRollMs = limitMs;
+    
+    if (limitMs < preRollMs) {
+        ESP_LOGW(TAG, "Pre-roll limited to %lu of %lu ms (queue %u KB, ~%lu KB/frame @ %u fps)",
+                 limitMs, preRollMs, frameQueue.getCapacityBytes() / 1024, avgFrameBytes / 1024, preRollFps);
+    } else {
+        ESP_LOGI(TAG, "Pre-roll: %lu ms fits in queue", limitMs);
+    }
+}
+
+void VideoManager::setPreRollPaused(bool paused) {
+    preRollPaused = paused;
+    updateCaptureRate();
+}
+
+esp_err_t VideoManager::startCapture() {
+    if (captureConsumer >= 0) {
+        return ESP_OK;
+    }
+    
+    // Đang ghi: giữ liên tục (bỏ frame mới khi queue đầy). Callback tự chọn policy
+    captureConsumer = broker.subscribe("recorder", 0, QueueDropPolicy::DROP_NEWEST,
+                                       [this](const FrameHandle& frame) { onFrame(frame); });
+    if (captureConsumer < 0) {
+        ESP_LOGE(TAG, "Failed to subscribe to frame broker");
+        return ESP_FAIL;
+    }
+    
+    updateCaptureRate();
     return ESP_OK;
 }
 
-esp_err_t VideoManager::createFolder(const std::string& path) {
-    if (mkdir(path.c_str(), 0755) == -1) {
-        ESP_LOGE(TAG, "Failed to create folder: %s", path.c_str());
+void VideoManager::stopCapture() {
+    if (captureConsumer < 0) {
+        return;
+    }
+    
+    broker.unsubscribe(captureConsumer);
+    captureConsumer = -1;
+}
+
+bool VideoManager::captureWanted() const {
+    return recordingActive || (preRollMs > 0 && !preRollPaused);
+}
+
+void VideoManager::updateCaptureRate() {
+    if (captureConsumer < 0) {
+        return;
+    }
+    
+    uint8_t fps = 0;
+    if (captureWanted()) {
+        fps = recordingActive ? recordFps : preRollFps;
+    }
+    lastFrameUs = 0;
+    broker.setFps(captureConsumer, fps);
+}
+
+// Chạy trong broker task: chỉ copy vào queue, không đụng SD
+void VideoManager::onFrame(const FrameHandle& frame) {
+    int64_t startUs = esp_timer_get_time();
+    bool recording = recordingActive;
+    int64_t captureUs = frame.timestampUs();
+    
+    // Khoảng cách giữa 2 frame > 1.5 chu kỳ → slot bị bỏ (broker/camera không kịp)
+    uint32_t skips = 0;
+    if (recording && lastFrameUs > 0 && recordFps > 0) {
+        int64_t periodUs = 1000000 / recordFps;
+        int64_t gapUs = captureUs - lastFrameUs;
+        if (gapUs > periodUs + periodUs / 2) {
+            skips = (gapUs + periodUs / 2) / periodUs - 1;
+        }
+    }
+    lastFrameUs = captureUs;
+    
+    // Đang ghi: giữ liên tục, bỏ frame mới. Pre-roll: luôn giữ frame mới nhất
+    QueueDropPolicy policy = recording ? QueueDropPolicy::DROP_NEWEST
+                                       : QueueDropPolicy::DROP_OLDEST;
+    std::span<const uint8_t> jpeg = frame.data();
+    if (!frameQueue.push(jpeg.data(), jpeg.size(), frame.width(), frame.height(), captureUs, policy) &&
+        recording) {
+        ESP_LOGW(TAG, "Queue full, dropped frame");
+    }
+    
+    if (recording) {
+        int64_t captureCostUs = esp_timer_get_time() - startUs;
+        xSemaphoreTake(statsMutex, portMAX_DELAY);
+        stats.pacingSkips += skips;
+        stats.capture.add(captureCostUs);
+        xSemaphoreGive(statsMutex);
+    } else {
+        frameQueue.trimOlderThan(captureUs - (int64_t)effectivePreRollMs * 1000);
+    }
+}
+
+esp_err_t VideoManager::openSegment(const std::string& name, uint32_t durationMs) {
+    // Admission: xin quota trước khi ghi → rút ngắn/từ chối thay vì đầy thẻ giữa chừng
+    uint32_t wantedMs = durationMs;
+    if (maxSegmentMs > 0 && wantedMs > maxSegmentMs) {
+        wantedMs = maxSegmentMs;
+    }
+    uint64_t wantedBytes = estimateBytes(wantedMs);
+    uint64_t minBytes = estimateBytes(MIN_RECORDING_MS);
+    activeGrantedBytes = retention.admit(wantedBytes, minBytes);
+    if (activeGrantedBytes == 0) {
+        ESP_LOGW(TAG, "Storage quota full, recording refused");
+        return ESP_ERR_NO_MEM;
+    }
+    if (activeGrantedBytes < wantedBytes) {
+        ESP_LOGW(TAG, "Storage quota low, recording limited to %llu KB", activeGrantedBytes / 1024);
+    }
+    
+    if (activeWriter.open(rootPath, name, recordFormat, activeFps) != ESP_OK) {
+        retention.release(activeGrantedBytes);
+        activeGrantedBytes = 0;
         return ESP_FAIL;
     }
+    
+    ESP_LOGI(TAG, "Recording to: %s/%s%s", rootPath.c_str(), name.c_str(),
+             recordFormat == RecordingFormat::AVI ? ".avi" : "");
+    catalog.begin(name, recordFormat);
+    
+    activeName = name;
+    activeSegmentEndUs = 0;     // Đặt theo frame đầu tiên của segment
+    frameQueue.resetStats();
+    xSemaphoreTake(statsMutex, portMAX_DELAY);
+    stats = PipelineStats();
+    stats.targetFps = activeFps;
+    xSemaphoreGive(statsMutex);
     return ESP_OK;
 }
 
-esp_err_t VideoManager::writeVideo(const RtcTime& timestamp, 
-                                   uint32_t durationMs, 
-                                   uint8_t fps,
-                                   VideoInfo& videoInfo) {
+esp_err_t VideoManager::closeSegment(VideoInfo& videoInfo) {
+    esp_err_t ret = activeWriter.close(videoInfo);
+    
+    xSemaphoreTake(statsMutex, portMAX_DELAY);
+    stats.queue = frameQueue.getStats();
+    stats.achievedFps = broker.getStats(captureConsumer).fps;
+    stats.repeatedFrames = activeWriter.getRepeatedFrames();
+    PipelineStats segment = stats;
+    xSemaphoreGive(statsMutex);
+    videoInfo.droppedFrames = segment.queue.dropped;
+    
+    CatalogEntry entry;
+    strncpy(entry.name, activeName.c_str(), sizeof(entry.name) - 1);
+    entry.format = videoInfo.format;
+    entry.frameCount = videoInfo.frameCount;
+    // Cùng định nghĩa với rebuild(): dung lượng file thật (AVI gồm header + idx1), không phải payload
+    entry.totalBytes = RecordingCatalog::diskBytes(videoInfo.fullPath, videoInfo.format);
+    entry.durationMs = videoInfo.durationMs;
+    catalog.add(entry);
+    scheduler.notify();
+    
+    retention.release(activeGrantedBytes);
+    activeGrantedBytes = 0;
+    if (videoInfo.frameCount > 0) {
+        avgFrameBytes = videoInfo.totalSize / videoInfo.frameCount;
+        updatePreRollLimit();   // Frame thực tế lớn/nhỏ hơn ước lượng → pre-roll chứa được thay đổi
+    }
+    
+    ESP_LOGI(TAG, "Recording completed: %lu frames (%lu pre-roll), %lu bytes, %lu dropped",
+             videoInfo.frameCount, activePreRollFrames, videoInfo.totalSize, videoInfo.droppedFrames);
+    ESP_LOGI(TAG, "Pipeline: queue max %lu, capture %lu/%lu us, wait %lu/%lu us, write %lu/%lu us (avg/max)",
+             segment.queue.maxDepth,
+             segment.capture.avgUs(), segment.capture.maxUs,
+             segment.queueWait.avgUs(), segment.queueWait.maxUs,
+             segment.write.avgUs(), segment.write.maxUs);
+    ESP_LOGI(TAG, "Trigger → first frame: %lu/%lu us (avg/max, %lu events)",
+             segment.trigger.avgUs(), segment.trigger.maxUs, segment.trigger.samples);
+    ESP_LOGI(TAG, "Pacing: %.1f/%u fps, %lu slots skipped, %lu frames repeated",
+             segment.achievedFps, segment.targetFps, segment.pacingSkips, segment.repeatedFrames);
+    
+    activePreRollFrames = 0;
+    return ret;
+}
+
+esp_err_t VideoManager::beginRecording(const RtcTime& timestamp, uint32_t durationMs, uint8_t fps,
+                                      int64_t edgeUs) {
+    if (activeWriter.isOpen()) {
+        return ESP_ERR_INVALID_STATE;
+    }
     
     if (!sdCard.isMounted()) {
         ESP_LOGE(TAG, "SD card not mounted");
         return ESP_ERR_INVALID_STATE;
     }
     
-    // Check free space
-    uint64_t free;
+    if (!frameQueue.isInitialized() || startCapture() != ESP_OK) {
+        ESP_LOGE(TAG, "Capture pipeline not running");
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    activeFps = fps ? fps : 1;
+    
+    // Sensor về quality ghi ngay, không chờ rate controller của stream
+    if (recordingPrepare) {
+        recordingPrepare();
+    }
+    
+    // Giữ SD suốt recording (mọi segment): retention không xóa file trong lúc này
+    xSemaphoreTake(sdIoMutex, portMAX_DELAY);
+    
+    esp_err_t ret = openSegment(RtcTimeUtils::toFolderName(timestamp), durationMs + effectivePreRollMs);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(sdIoMutex);
+        return ret;
+    }
+    
+    // Chuyển queue sang chế độ recording; frame pre-roll còn hạn được ghi trước
+    int64_t triggerUs = esp_timer_get_time();
+    activeStartTime = timestamp;
+    activeStartUs = triggerUs;
+    activeEndUs = triggerUs + (int64_t)durationMs * 1000;
+    
+    recordFps = activeFps;
+    recordingActive = true;
+    updateCaptureRate();
+    frameQueue.trimOlderThan(triggerUs - (int64_t)effectivePreRollMs * 1000);
+    activePreRollFrames = frameQueue.size();
+    
+    activeEdgeUs = edgeUs > 0 ? edgeUs : triggerUs;
+    activeTriggerPending = true;
+    ESP_LOGD(TAG, "Trigger → recording start: %lld us", triggerUs - activeEdgeUs);
+    
+    return ESP_OK;
+}
+
+void VideoManager::extendRecording(uint32_t durationMs) {
+    if (!activeWriter.isOpen()) {
+        return;
+    }
+    
+    int64_t endUs = esp_timer_get_time() + (int64_t)durationMs * 1000;
+    if (endUs <= activeEndUs) {
+        return;
+    }
+    
+    // Xin thêm quota cho phần kéo dài (không đủ thì recording dừng ở quota cũ)
+    uint64_t extraBytes = estimateBytes((endUs - activeEndUs) / 1000);
+    uint64_t granted = retention.admit(extraBytes, 0);
+    activeGrantedBytes += granted;
+    activeEndUs = endUs;
+}
+
+RecordStep VideoManager::stepRecording(TickType_t wait) {
+    if (!activeWriter.isOpen()) {
+        return RecordStep::DONE;
+    }
+    
+    // SD writer stage: ghi 1 frame/lần → caller có thể dừng đúng ranh giới frame
+    QueuedFrame frame;
+    if (!frameQueue.front(frame, wait)) {
+        return esp_timer_get_time() < activeEndUs ? RecordStep::CONTINUE : RecordStep::DONE;
+    }
+    
+    // Frame sau endUs để lại làm pre-roll cho lần sau
+    if (frame.captureUs >= activeEndUs) {
+        frameQueue.release();
+        return RecordStep::DONE;
+    }
+    
+    // Segment đủ dài → frame này mở segment mới (không mất frame)
+    if (activeSegmentEndUs > 0 && frame.captureUs >= activeSegmentEndUs) {
+        activeNextSegmentUs = frame.captureUs;
+        frameQueue.release();
+        return RecordStep::SEGMENT_FULL;
+    }
+    
+    // Hết quota được cấp → kết thúc sớm, file vẫn hợp lệ
+    if (activeWriter.getTotalSize() + frame.len > activeGrantedBytes) {
+        ESP_LOGW(TAG, "Storage quota reached, stopping recording early");
+        frameQueue.release();
+        return RecordStep::DONE;
+    }
+    
+    if (activeSegmentEndUs == 0 && maxSegmentMs > 0) {
+        activeSegmentEndUs = frame.captureUs + (int64_t)maxSegmentMs * 1000;
+    }
+    
+    // Frame đầu tiên capture sau cạnh PIR (frame pre-roll đứng trước trong queue)
+    if (activeTriggerPending && frame.captureUs >= activeEdgeUs) {
+        activeTriggerPending = false;
+        xSemaphoreTake(statsMutex, portMAX_DELAY);
+        stats.trigger.add(frame.captureUs - activeEdgeUs);
+        xSemaphoreGive(statsMutex);
+        ESP_LOGI(TAG, "Trigger → first frame: %lld us", frame.captureUs - activeEdgeUs);
+    }
+    
+    int64_t startUs = esp_timer_get_time();
+    
+    if (activeWriter.writeFrame(frame.data, frame.len, frame.width, frame.height,
+                                frame.captureUs) != ESP_OK) {
+        ESP_LOGW(TAG, "Write failed at frame %lu", frame.seq);
+    }
+    
+    int64_t doneUs = esp_timer_get_time();
+    xSemaphoreTake(statsMutex, portMAX_DELAY);
+    stats.queueWait.add(startUs - frame.captureUs);
+    stats.write.add(doneUs - startUs);
+    xSemaphoreGive(statsMutex);
+    frameQueue.pop();
+    return RecordStep::CONTINUE;
+}
 
+esp_err_t VideoManager::rolloverRecording(VideoInfo& closedInfo) {
+    if (!activeWriter.isOpen()) {
+        return ESP_ERR_INVALID_STATE;
+    }
     
-    // Create folder
-    std::string folderName = RtcTimeUtils::toFolderName(timestamp);
-    std::string folderPath = rootPath + "/" + folderName;
+    // recordingActive giữ nguyên → capture vẫn đẩy frame vào queue trong lúc đổi file
+    esp_err_t ret = closeSegment(closedInfo);
     
-    if (createFolder(folderPath) != ESP_OK) {
+    // Tên segment mới = thời điểm frame đầu tiên của nó
+    int64_t offsetSec = (activeNextSegmentUs - activeStartUs) / 1000000;
+    RtcTime segmentTime = RtcTimeUtils::addSeconds(activeStartTime, offsetSec);
+    std::string name = RtcTimeUtils::toFolderName(segmentTime);
+    
+    int64_t remainingMs = (activeEndUs - esp_timer_get_time()) / 1000;
+    if (openSegment(name, remainingMs > 0 ? (uint32_t)remainingMs : 0) != ESP_OK) {
+        ESP_LOGE(TAG, "Segment rollover failed, recording stopped");
+        recordingActive = false;
+        updateCaptureRate();
+        xSemaphoreGive(sdIoMutex);
         return ESP_FAIL;
     }
     
-    ESP_LOGI(TAG, "Recording to: %s", folderPath.c_str());
+    ESP_LOGI(TAG, "Segment rollover: %s → %s", closedInfo.folderName.c_str(), name.c_str());
+    return ret;
+}
+
+esp_err_t VideoManager::endRecording(VideoInfo& videoInfo) {
+    if (!activeWriter.isOpen()) {
+        return ESP_ERR_INVALID_STATE;
+    }
     
-    uint32_t totalFrames = (durationMs * fps) / 1000;
-    uint32_t delayMs = 1000 / fps;
-    uint32_t frameCount = 0;
-    uint32_t totalSize = 0;
+    recordingActive = false;
+    updateCaptureRate();
+    esp_err_t ret = closeSegment(videoInfo);
+    xSemaphoreGive(sdIoMutex);
+    return ret;
+}
+
+esp_err_t VideoManager::discardRecording(VideoInfo& videoInfo) {
+    if (!activeWriter.isOpen()) {
+        return ESP_ERR_INVALID_STATE;
+    }
     
-    // Capture frames
-    for (uint32_t i = 0; i < totalFrames; i++) {
-        camera_fb_t* fb = esp_camera_fb_get();
-        if (!fb) {
-            ESP_LOGE(TAG, "Capture failed at frame %lu", i);
-            continue;
-        }
-        
-        char filename[256];
-        snprintf(filename, sizeof(filename), "%s/%04lu.jpg", 
-                 folderPath.c_str(), i + 1);
-        
-        FILE* file = fopen(filename, "wb");
-        if (file) {
-            size_t written = fwrite(fb->buf, 1, fb->len, file);
-            fflush(file);
-            fclose(file);
-            
-            if (written == fb->len) {
-                frameCount++;
-                totalSize += fb->len;
-            }
-        }
-        
-        esp_camera_fb_return(fb);
-        vTaskDelay(pdMS_TO_TICKS(delayMs));
+    recordingActive = false;
+    updateCaptureRate();
+    activeWriter.close(videoInfo);
+    
+    // Vẫn giữ sdIoMutex từ beginRecording → xóa trực tiếp, không qua deleteRecording()
+    CatalogEntry entry = {};
+    strncpy(entry.name, activeName.c_str(), sizeof(entry.name) - 1);
+    entry.format = videoInfo.format;
+    std::string path = rootPath + "/" + RecordingCatalog::entryName(entry);
+    
+    esp_err_t ret;
+    if (entry.format == RecordingFormat::AVI) {
+        ret = (remove(path.c_str()) == 0) ? ESP_OK : ESP_FAIL;
+    } else {
+        ret = deleteFolder(path);
     }
+    catalog.remove(activeName);
     
-   // sync();
+    retention.release(activeGrantedBytes);
+    activeGrantedBytes = 0;
+    activePreRollFrames = 0;
+    discardedCount++;
+    discardedBytes += videoInfo.totalSize;
     
-    videoInfo.folderName = folderName;
-    videoInfo.fullPath = folderPath;
-    videoInfo.frameCount = frameCount;
-    videoInfo.totalSize = totalSize;
+    ESP_LOGI(TAG, "Recording discarded: %s (%lu frames, %lu bytes)",
+             activeName.c_str(), videoInfo.frameCount, videoInfo.totalSize);
     
-    ESP_LOGI(TAG, "Recording completed: %lu frames, %lu bytes", frameCount, totalSize);
+    xSemaphoreGive(sdIoMutex);
+    return ret;
+}
+
+void VideoManager::setMaxSegmentMs(uint32_t durationMs) {
+    if (durationMs > 0 && durationMs < MIN_SEGMENT_MS) {
+        durationMs = MIN_SEGMENT_MS;
+    }
+    maxSegmentMs = durationMs;
+    ESP_LOGI(TAG, "Max segment: %lu ms", maxSegmentMs);
+}
 
+uint64_t VideoManager::estimateBytes(uint32_t durationMs) const {
+    uint64_t frameBytes = avgFrameBytes + QUEUE_FRAME_OVERHEAD;
+    return (uint64_t)durationMs * activeFps / 1000 * frameBytes;
+}
+
+esp_err_t VideoManager::writeVideo(const RtcTime& timestamp, 
+                                   uint32_t durationMs, 
+                                   uint8_t fps,
+                                   VideoInfo& videoInfo) {
+    esp_err_t ret = beginRecording(timestamp, durationMs, fps);
+    if (ret != ESP_OK) {
+        return ret;
+    }
     
+    while (true) {
+        RecordStep step = stepRecording(pdMS_TO_TICKS(100));
+        if (step == RecordStep::DONE) {
+            break;
+        }
+        if (step == RecordStep::SEGMENT_FULL && rolloverRecording(videoInfo) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+    
+    // videoInfo = segment cuối
+    return endRecording(videoInfo);
+}
+
+PipelineStats VideoManager::getPipelineStats() const {
+    PipelineStats snapshot;
+    if (xSemaphoreTake(statsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        snapshot = stats;
+        xSemaphoreGive(statsMutex);
+    }
+    snapshot.queue = frameQueue.getStats();
+    snapshot.achievedFps = broker.getStats(captureConsumer).fps;
+    return snapshot;
+}
+
+esp_err_t VideoManager::resolveRecording(const std::string& name, std::string& path, bool& isFolder) const {
+    // Chấp nhận folder path, .avi path hoặc chỉ tên recording
+    path = name;
+    if (path.find('/') == std::string::npos) {
+        path = rootPath + "/" + path;
+    }
+    
+    isFolder = false;
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0) {
+        isFolder = S_ISDIR(st.st_mode);
+    } else if (stat((path + ".avi").c_str(), &st) == 0) {
+        path += ".avi";
+    } else {
+        return ESP_ERR_NOT_FOUND;
+    }
     return ESP_OK;
 }
 
 esp_err_t VideoManager::readVideo(const std::string& folderPath) {
     ESP_LOGI(TAG, "Reading video from: %s", folderPath.c_str());
     
+    std::string path;
+    bool isFolder = false;
+    if (resolveRecording(folderPath, path, isFolder) != ESP_OK) {
+        // Recording đã bị xóa → bỏ checkpoint, không resume mãi
+        checkpoint.clear(path);
+        checkpoint.clear(path + ".avi");
+        
+        ESP_LOGE(TAG, "Recording not found: %s", folderPath.c_str());
+        return ESP_FAIL;
+    }
+    
+    // Pin như upload nền (recording ngoài catalog thì đọc không pin)
+    std::string name = path.substr(path.rfind('/') + 1);
+    name = name.substr(0, name.rfind('.'));
+    bool pinned = catalog.pin(name);
+    
+    // Upload nền (nếu đang chạy) nhường kết nối ở frame/range kế tiếp
+    scheduler.beginForeground();
+    esp_err_t ret = isFolder ? readFolderVideo(path, false) : readAviVideo(path, false);
+    scheduler.endForeground();
+    
+    if (pinned) {
+        catalog.unpin(name);
+    }
+    return ret;
+}
+
+esp_err_t VideoManager::uploadRecording(const CatalogEntry& entry) {
+    // Pin suốt lần upload: retention (OLDEST_FIRST trùng với recording cũ nhất) bỏ qua file này
+    if (!catalog.pin(entry.name)) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    
+    std::string path = rootPath + "/" + RecordingCatalog::entryName(entry);
+    esp_err_t ret = (entry.format == RecordingFormat::JPEG_FOLDER) ? readFolderVideo(path, true)
+                                                                   : readAviVideo(path, true);
+    catalog.unpin(entry.name);
+    return ret;
+}
+
+esp_err_t VideoManager::readFolderVideo(const std::string& folderPath, bool background) {
+    std::string name = folderPath.substr(folderPath.rfind('/') + 1);
+    
+    if (uploadMode == UploadMode::BUNDLE) {
+        // Folder không lưu timestamp → suy ra từ thời lượng trong catalog
+        uint32_t intervalUs = 0;
+        CatalogEntry entry;
+        if (catalog.find(name, entry) && entry.frameCount > 0) {
+            intervalUs = (uint64_t)entry.durationMs * 1000 / entry.frameCount;
+        }
+        
+        FolderBundleSource source;
+        if (source.open(folderPath, name, intervalUs) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        return uploadBundle(source, folderPath, name, background);
+    }
+    
     DIR* dir = opendir(folderPath.c_str());
     if (!dir) {
         ESP_LOGE(TAG, "Failed to open dir: %s", folderPath.c_str());
         return ESP_FAIL;
     }
     
-    uint32_t fileCount = 0;
-    uint32_t successCount = 0;
+    // Sắp xếp theo tên (0001.jpg...) → frame index giữ nguyên giữa các lần resume
+    std::vector<std::string> files;
     struct dirent* entry;
-    
     while ((entry = readdir(dir)) != nullptr) {
-        if (strstr(entry->d_name, ".jpg") == nullptr) {
-            continue;
+        if (strstr(entry->d_name, ".jpg") != nullptr) {
+            files.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+    
+    return uploadFrames(folderPath, name, files.size(), background,
+                        [&](uint32_t i, const std::vector<UploadHeader>& headers) {
+        std::string filepath = folderPath + "/" + files[i];
+        FileSource source;
+        if (source.open(filepath) != ESP_OK) {
+            return ESP_FAIL;
         }
+        return uploader.upload(source, UPLOAD_ENDPOINT, "image/jpeg", filepath, headers);
+    });
+}
+
+esp_err_t VideoManager::readAviVideo(const std::string& aviPath, bool background) {
+    AviReader reader;
+    if (reader.open(aviPath) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    
+    std::string name = aviPath.substr(aviPath.rfind('/') + 1);
+    name = name.substr(0, name.rfind('.'));
+    
+    if (uploadMode == UploadMode::BUNDLE) {
+        AviBundleSource source(reader, name);
+        return uploadBundle(source, aviPath, name, background);
+    }
+    
+    // Entry idx1 lặp (giữ nhịp) không gửi lại: frame = JPEG thật, khoảng trống đi theo
+    // X-Timestamp / X-Frame-Duration (ms từ đầu recording, như playback)
+    std::vector<uint32_t> entries = reader.getUniqueFrames();
+    uint32_t intervalUs = reader.getFrameIntervalUs();
+    
+    return uploadFrames(aviPath, name, entries.size(), background,
+                        [&](uint32_t i, const std::vector<UploadHeader>& headers) {
+        uint32_t entry = entries[i];
+        uint32_t next = (i + 1 < entries.size()) ? entries[i + 1] : reader.getFrameCount();
         
-        fileCount++;
+        std::vector<UploadHeader> frameHeaders = headers;
+        frameHeaders.push_back({"X-Timestamp", std::to_string((uint64_t)entry * intervalUs / 1000)});
+        frameHeaders.push_back({"X-Frame-Duration", std::to_string((uint64_t)(next - entry) * intervalUs / 1000)});
         
-        std::string filepath = folderPath + "/" + entry->d_name;
+        // Đọc thẳng từ movi theo chunk, không malloc theo kích thước frame
+        AviFrameSource source(reader, entry);
         
-        if (uploadFile(filepath) == ESP_OK) {
-            successCount++;
+        char label[32];
+        snprintf(label, sizeof(label), "frame %04lu", i + 1);
+        return uploader.upload(source, UPLOAD_ENDPOINT, "image/jpeg", aviPath + " " + label, frameHeaders);
+    });
+}
+
+esp_err_t VideoManager::uploadFrames(const std::string& path, const std::string& name,
+                                     uint32_t frameCount, bool background, const FrameSender& send) {
+    const uint8_t mode = (uint8_t)UploadMode::PER_FRAME;
+    UploadCheckpoint& ckpt = background ? bgCheckpoint : checkpoint;
+    
+    // Frame [0, acked) đã được server trả 2xx
+    uint32_t acked = 0;
+    if (ckpt.find(path, mode, frameCount, acked)) {
+        ESP_LOGI(TAG, "Resuming %s at frame %lu/%lu", path.c_str(), acked + 1, frameCount);
+    }
+    uint32_t first = acked;
+    uint32_t saved = acked;
+    uint32_t successCount = 0;
+    uint32_t failStreak = 0;
+    bool yielded = false;
+    
+    // 1 kết nối keep-alive cho cả recording; nhịp gửi do socket (hoặc token bucket nếu upload
+    // nền / đang stream) quyết định, không delay cố định
+    UploadStats before = uploader.getStats();
+    int64_t startUs = esp_timer_get_time();
+    if (uploader.beginSession(scheduler.rateFor(background)) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    
+    std::vector<UploadHeader> headers = {{"X-Recording", name}, {"X-Frame-Index", ""}};
+    
+    for (uint32_t i = first; i < frameCount; i++) {
+        if (background && scheduler.shouldYield()) {
+            yielded = true;
+            break;
         }
+        headers[1].value = std::to_string(i);
         
-        vTaskDelay(pdMS_TO_TICKS(100));
+        if (send(i, headers) == ESP_OK) {
+            successCount++;
+            failStreak = 0;
+            
+            // Cursor chỉ tiến qua đoạn liên tục: frame lỗi ở giữa được gửi lại khi resume
+            if (acked == i) {
+                acked++;
+            }
+            if (acked - saved >= CHECKPOINT_FRAMES) {
+                ckpt.save(path, mode, frameCount, acked);
+                saved = acked;
+            }
+        } else if (++failStreak >= MAX_UPLOAD_FAIL_STREAK) {
+            ESP_LOGE(TAG, "Upload aborted after %lu consecutive failures", failStreak);
+            break;
+        }
     }
     
-    closedir(dir);
+    uploader.endSession();
     
-    ESP_LOGI(TAG, "Upload completed: %lu/%lu files", successCount, fileCount);
+    if (acked == frameCount) {
+        ckpt.clear(path);
+        catalog.setUploaded(name);
+    } else {
+        ckpt.save(path, mode, frameCount, acked);
+        ESP_LOGW(TAG, "Upload checkpoint: %s at frame %lu/%lu", path.c_str(), acked + 1, frameCount);
+    }
     
-    return (successCount == fileCount) ? ESP_OK : ESP_FAIL;
+    logUploadSummary(before, startUs, successCount, frameCount - first);
+    
+    if (acked == frameCount) {
+        return ESP_OK;
+    }
+    return yielded ? ESP_ERR_NOT_FINISHED : ESP_FAIL;
 }
 
-esp_err_t VideoManager::uploadFile(const std::string& filepath) {
-    FILE* file = fopen(filepath.c_str(), "rb");
-    if (!file) {
-        ESP_LOGE(TAG, "Failed to open: %s", filepath.c_str());
-        return ESP_FAIL;
+esp_err_t VideoManager::uploadBundle(BundleSource& source, const std::string& path,
+                                     const std::string& name, bool background) {
+    const uint8_t mode = (uint8_t)UploadMode::BUNDLE;
+    UploadCheckpoint& ckpt = background ? bgCheckpoint : checkpoint;
+    uint32_t total = source.size();
+    uint32_t frames = source.getFrameCount();
+    
+    // Byte [0, offset) đã được server ack
+    uint32_t offset = 0;
+    bool resumed = ckpt.find(path, mode, total, offset);
+    if (resumed) {
+        ESP_LOGI(TAG, "Resuming %s at byte %lu/%lu", path.c_str(), offset, total);
     }
     
-    fseek(file, 0, SEEK_END);
-    long fileSize = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    // Bundle gửi theo range trên 1 kết nối: mỗi range server trả X-Upload-Ack = số byte đã lưu
+    RangeSource range(source);
+    std::vector<UploadHeader> headers = {
+        {"X-Upload-Id", name},
+        {"X-Upload-Total", std::to_string(total)},
+        {"X-Upload-Offset", ""}
+    };
+    uint32_t failStreak = 0;
+    bool probe = resumed;
+    bool yielded = false;
     
-    uint8_t* buffer = (uint8_t*)malloc(fileSize);
-    if (!buffer) {
-        fclose(file);
+    UploadStats before = uploader.getStats();
+    int64_t startUs = esp_timer_get_time();
+    if (uploader.beginSession(scheduler.rateFor(background)) != ESP_OK) {
         return ESP_FAIL;
     }
     
-    fread(buffer, 1, fileSize, file);
-    fclose(file);
-    
-    char url[128];
-    snprintf(url, sizeof(url), "http://%s:%d%s", SERVER_IP, SERVER_PORT, UPLOAD_ENDPOINT);
-    
-    esp_http_client_config_t config = {};
-    config.url = url;
-    config.method = HTTP_METHOD_POST;
-    config.timeout_ms = 10000;
-    
-    esp_http_client_handle_t client = esp_http_client_init(&config);
-    esp_http_client_set_header(client, "Content-Type", "image/jpeg");
-    esp_http_client_set_post_field(client, (const char*)buffer, fileSize);
+    while (offset < total) {
+        if (background && scheduler.shouldYield()) {
+            yielded = true;
+            break;
+        }
+        
+        // Resume: request rỗng trước → server báo offset thật (có thể hơn checkpoint nếu ack bị mất)
+        size_t len = probe ? 0 : std::min<size_t>(BUNDLE_RANGE_BYTES, total - offset);
+        probe = false;
+        
+        if (range.select(offset, len) != ESP_OK) {
+            ESP_LOGE(TAG, "Bundle seek failed at %lu", offset);
+            break;
+        }
+        
+        headers[2].value = std::to_string(offset);
+        char label[48];
+        snprintf(label, sizeof(label), "%s @%lu+%u", name.c_str(), offset, len);
+        
+        UploadResult result = {0, -1};
+        esp_err_t ret = uploader.upload(range, BUNDLE_ENDPOINT, BundleSource::CONTENT_TYPE, label,
+                                        headers, &result);
+        
+        // Server quyết định offset (kể cả 409 khi offset lệch); không có ack thì tin 2xx
+        uint32_t next = offset;
+        if (result.ackBytes >= 0 && result.ackBytes <= (int64_t)total) {
+            next = result.ackBytes;
+        } else if (ret == ESP_OK) {
+            next = offset + len;
+        }
+        
+        if (next != offset) {
+            offset = next;
+            failStreak = 0;
+            ckpt.save(path, mode, total, offset);
+        } else if (ret == ESP_OK && len == 0) {
+            failStreak = 0;
+        } else if (++failStreak >= MAX_UPLOAD_FAIL_STREAK) {
+            ESP_LOGE(TAG, "Upload aborted after %lu consecutive failures", failStreak);
+            break;
+        }
+    }
     
-    esp_err_t ret = esp_http_client_perform(client);
+    uploader.endSession();
     
-    if (ret == ESP_OK) {
-        int status = esp_http_client_get_status_code(client);
-        ESP_LOGI(TAG, "Uploaded: %s - Status: %d", filepath.c_str(), status);
+    bool done = (offset >= total);
+    if (done) {
+        ckpt.clear(path);
+        catalog.setUploaded(name);
+    } else {
+        ESP_LOGW(TAG, "Upload checkpoint: %s at byte %lu/%lu", path.c_str(), offset, total);
     }
     
-    esp_http_client_cleanup(client);
-    free(buffer);
+    logUploadSummary(before, startUs, done ? frames : 0, frames);
     
-    return ret;
+    if (done) {
+        return ESP_OK;
+    }
+    return yielded ? ESP_ERR_NOT_FINISHED : ESP_FAIL;
+}
+
+void VideoManager::logUploadSummary(const UploadStats& before, int64_t startUs,
+                                    uint32_t successCount, uint32_t totalCount) const {
+    UploadStats after = uploader.getStats();
+    uint64_t bytes = after.bytes - before.bytes;
+    int64_t elapsedMs = (esp_timer_get_time() - startUs) / 1000;
+    uint32_t kbps = elapsedMs > 0 ? (uint32_t)(bytes * 1000 / 1024 / elapsedMs) : 0;
+    
+    ESP_LOGI(TAG, "Upload completed: %lu/%lu in %lld ms (%llu KB, %lu KB/s, %lu connections)",
+             successCount, totalCount, elapsedMs, bytes / 1024, kbps,
+             after.connects - before.connects);
 }
 
 esp_err_t VideoManager::deleteOldVideos(const RtcTime& currentTime, uint32_t daysOld) {
     RtcTime threshold = RtcTimeUtils::daysAgo(currentTime, daysOld);
+    std::string thresholdName = RtcTimeUtils::toFolderName(threshold);
     
-    DIR* dir = opendir(rootPath.c_str());
-    if (!dir) {
-        return ESP_FAIL;
-    }
+    // Catalog sắp xếp theo thời gian → lấy thẳng các recording cũ hơn threshold
+    std::vector<CatalogEntry> expired = catalog.range("", thresholdName);
     
-    struct dirent* entry;
     uint32_t deletedCount = 0;
-    
-    while ((entry = readdir(dir)) != nullptr) {
-        if (strlen(entry->d_name) != 14) continue;
-        
-        std::string folderPath = rootPath + "/" + entry->d_name;
-        
-        // Compare with threshold
-        if (std::string(entry->d_name) < RtcTimeUtils::toFolderName(threshold)) {
-            if (deleteFolder(folderPath) == ESP_OK) {
-                deletedCount++;
-            }
+    for (const CatalogEntry& entry : expired) {
+        if (deleteRecording(RecordingCatalog::entryName(entry)) == ESP_OK) {
+            deletedCount++;
         }
     }
     
-    closedir(dir);
-    
-    ESP_LOGI(TAG, "Deleted %lu old folders", deletedCount);
+    ESP_LOGI(TAG, "Deleted %lu old recordings", deletedCount);
     return ESP_OK;
 }
 
+esp_err_t VideoManager::deleteRecording(const std::string& entryName, TickType_t wait) {
+    std::string path = rootPath + "/" + entryName;
+    
+    std::string name;
+    RecordingFormat fmt;
+    if (!RecordingCatalog::parseEntryName(entryName.c_str(), name, fmt)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    if (xSemaphoreTake(sdIoMutex, wait) != pdTRUE) {
+        return ESP_ERR_TIMEOUT;
+    }
+    
+    // Đang upload (pin) → không xóa file đang đọc
+    if (!catalog.beginRemove(name)) {
+        xSemaphoreGive(sdIoMutex);
+        ESP_LOGW(TAG, "%s is being uploaded, not deleted", entryName.c_str());
+        return ESP_ERR_INVALID_STATE;
+    }
+    
+    esp_err_t ret;
+    if (fmt == RecordingFormat::AVI) {
+        ret = (remove(path.c_str()) == 0) ? ESP_OK : ESP_FAIL;
+    } else {
+        ret = deleteFolder(path);
+    }
+    
+    // File đã mất thì cũng bỏ khỏi catalog
+    struct stat st;
+    if (ret == ESP_OK || stat(path.c_str(), &st) != 0) {
+        catalog.remove(name);
+        bgCheckpoint.clear(path);   // Cursor theo recording không còn dùng tới
+    } else {
+        catalog.cancelRemove(name);
+    }
+    
+    xSemaphoreGive(sdIoMutex);
+    return ret;
+}
+
 esp_err_t VideoManager::deleteFolder(const std::string& path) {
     DIR* dir = opendir(path.c_str());
     if (!dir) return ESP_FAIL;
@@ -562,22 +1514,30 @@ esp_err_t VideoManager::deleteFolder(const std::string& path) {
     return ESP_OK;
 }
 
+VideoInfo VideoManager::toVideoInfo(const CatalogEntry& entry) const {
+    VideoInfo info;
+    info.folderName = entry.name;
+    info.fullPath = rootPath + "/" + RecordingCatalog::entryName(entry);
+    info.frameCount = entry.frameCount;
+    info.totalSize = entry.totalBytes;
+    info.durationMs = entry.durationMs;
+    info.format = entry.format;
+    return info;
+}
+
 std::vector<VideoInfo> VideoManager::listVideos() {
     std::vector<VideoInfo> videos;
-    
-    DIR* dir = opendir(rootPath.c_str());
-    if (!dir) return videos;
-    
-    struct dirent* entry;
-    while ((entry = readdir(dir)) != nullptr) {
-        if (strlen(entry->d_name) == 14) {
-            VideoInfo info;
-            info.folderName = entry->d_name;
-            info.fullPath = rootPath + "/" + entry->d_name;
-            videos.push_back(info);
-        }
+    for (const CatalogEntry& entry : catalog.list()) {
+        videos.push_back(toVideoInfo(entry));
     }
-    
-    closedir(dir);
     return videos;
-}
\ No newline at end of file
+}
+
+std::vector<VideoInfo> VideoManager::listVideos(const RtcTime& from, const RtcTime& to) {
+    std::vector<VideoInfo> videos;
+    for (const CatalogEntry& entry : catalog.range(RtcTimeUtils::toFolderName(from),
+                                                   RtcTimeUtils::toFolderName(to))) {
+        videos.push_back(toVideoInfo(entry));
+    }
+    return videos;
+}
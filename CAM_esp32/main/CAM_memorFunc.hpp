@@ -2,9 +2,19 @@
 #define CAM_MEMOR_FUNC_HPP
 
 #include "CAM_sensorRead.hpp"  // Dùng RtcTime từ đây
+#include "CAM_aviFile.hpp"
+#include "CAM_frameQueue.hpp"
+#include "CAM_frameBroker.hpp"
+#include "CAM_catalog.hpp"
+#include "CAM_retention.hpp"
+#include "CAM_uploader.hpp"
+#include "CAM_bundle.hpp"
+#include "CAM_uploadCheckpoint.hpp"
+#include "CAM_uploadScheduler.hpp"
 #include "esp_err.h"
 #include "esp_camera.h"
 #include "sdmmc_cmd.h"
+#include "freertos/queue.h"
 #include <string>
 #include <vector>
 #include <cstdint>
@@ -14,18 +24,108 @@
 namespace RtcTimeUtils {
     std::string toFolderName(const RtcTime& time);
     RtcTime daysAgo(const RtcTime& time, uint32_t days);
+    RtcTime addSeconds(const RtcTime& time, int64_t seconds);
     bool isOlderThan(const RtcTime& t1, const RtcTime& t2);
     bool isSameDay(const RtcTime& t1, const RtcTime& t2);
 }
 
 // Video information
 struct VideoInfo {
-    std::string folderName;
-    std::string fullPath;
+    std::string folderName;     // Recording name (YYYYMMDDhhmmss)
+    std::string fullPath;       // Folder path hoặc .avi path
+    uint32_t frameCount;        // JPEG thật (AVI: không gồm entry lặp giữ nhịp)
+    uint32_t totalSize;
+    uint32_t droppedFrames;
+    uint32_t durationMs;        // AVI: số slot (dwTotalFrames) × chu kỳ frame
+    RecordingFormat format;
+    
+    VideoInfo() : frameCount(0), totalSize(0), droppedFrames(0), durationMs(0),
+                  format(RecordingFormat::JPEG_FOLDER) {}
+};
+
+// Kết quả 1 bước ghi recording
+enum class RecordStep {
+    CONTINUE = 0,
+    SEGMENT_FULL,       // Segment đạt max length → rolloverRecording()
+    DONE                // Hết thời lượng / hết quota
+};
+
+// Cách readVideo gửi recording lên server
+enum class UploadMode : uint8_t {
+    PER_FRAME = 0,      // 1 POST image/jpeg mỗi frame (UPLOAD_ENDPOINT)
+    BUNDLE              // Cả recording trong 1 POST (BUNDLE_ENDPOINT, xem CAM_bundle.hpp)
+};
+
+// Latency accumulator (1 writer task / stage)
+struct LatencyStat {
+    uint32_t samples;
+    uint64_t totalUs;
+    uint32_t maxUs;
+    
+    LatencyStat() : samples(0), totalUs(0), maxUs(0) {}
+    
+    void add(int64_t us) {
+        uint32_t v = us > 0 ? (uint32_t)us : 0;
+        samples++;
+        totalUs += v;
+        if (v > maxUs) maxUs = v;
+    }
+    uint32_t avgUs() const { return samples ? (uint32_t)(totalUs / samples) : 0; }
+};
+
+// Capture → SD writer pipeline statistics
+struct PipelineStats {
+    FrameQueueStats queue;
+    LatencyStat capture;    // esp_camera_fb_get + copy vào queue
+    LatencyStat queueWait;  // capture → bắt đầu ghi SD
+    LatencyStat write;      // ghi 1 frame xuống SD
+    LatencyStat trigger;    // Cạnh PIR (ISR) → frame đầu tiên capture sau cạnh đó
+    uint8_t targetFps;
+    float achievedFps;      // fps capture thực tế (FramePacer)
+    uint32_t pacingSkips;   // slot bị bỏ do capture trễ
+    uint32_t repeatedFrames;    // frame lặp trong AVI index để bù slot bị bỏ
+    
+    PipelineStats() : targetFps(0), achievedFps(0.0f), pacingSkips(0), repeatedFrames(0) {}
+};
+
+// Recording Writer Class - ghi frame vào recording theo format đã chọn
+class RecordingWriter {
+private:
+    RecordingFormat format;
+    std::string name;
+    std::string path;
+    AviWriter avi;
     uint32_t frameCount;
     uint32_t totalSize;
     
-    VideoInfo() : frameCount(0), totalSize(0) {}
+    // Timeline AVI: slot = (captureUs - firstUs) / periodUs
+    int64_t periodUs;
+    int64_t firstUs;
+    uint32_t nextSlot;
+    uint32_t repeatedFrames;
+    
+    static constexpr uint32_t MAX_REPEAT = 50;
+    
+    static const char* TAG;
+    
+public:
+    RecordingWriter();
+    ~RecordingWriter();
+    
+    // Disable copy
+    RecordingWriter(const RecordingWriter&) = delete;
+    RecordingWriter& operator=(const RecordingWriter&) = delete;
+    
+    esp_err_t open(const std::string& rootPath, const std::string& recordingName,
+                   RecordingFormat fmt, uint8_t fps);
+    esp_err_t writeFrame(const uint8_t* data, size_t len, uint16_t width, uint16_t height,
+                         int64_t captureUs);
+    esp_err_t close(VideoInfo& info);
+    
+    bool isOpen() const { return !path.empty(); }
+    uint32_t getFrameCount() const { return frameCount; }
+    uint32_t getTotalSize() const { return totalSize; }
+    uint32_t getRepeatedFrames() const { return repeatedFrames; }
 };
 
 // SD Card Manager Class
@@ -48,8 +148,9 @@ public:
     esp_err_t mount();
     esp_err_t unmount();
     bool isMounted() const { return mounted; }
+    const std::string& getMountPoint() const { return mountPoint; }
     
-   // esp_err_t getInfo(uint64_t& totalBytes, uint64_t& freeBytes) const;
+    esp_err_t getInfo(uint64_t& totalBytes, uint64_t& freeBytes) const;
     void printInfo() const;
 };
 
@@ -57,63 +158,235 @@ public:
 class VideoManager {
 private:
     SdCardManager& sdCard;
+    FrameBroker& broker;
     std::string rootPath;
+    RecordingFormat recordFormat;
+    UploadMode uploadMode;
+    RecordingCatalog catalog;
+    StorageRetention retention;
+    HttpUploader uploader;
+    UploadCheckpoint checkpoint;    // Upload dở dang (NVS) → resume thay vì gửi lại từ đầu
+    UploadCheckpoint bgCheckpoint;  // Upload nền: 1 cursor mỗi recording (readVideo không ghi đè)
+    UploadScheduler scheduler;
+    SemaphoreHandle_t sdIoMutex;    // Recording đang ghi ↔ xóa recording
+    uint32_t avgFrameBytes;         // Ước lượng dung lượng cho admit()
+    uint32_t discardedCount;        // Recording bị bỏ (motion không xác nhận)
+    uint64_t discardedBytes;
+    
+    // Recording đang ghi (chỉ recorder task truy cập, writer dùng lại giữa các recording)
+    RecordingWriter activeWriter;
+    std::string activeName;
+    RtcTime activeStartTime;
+    int64_t activeStartUs;
+    int64_t activeEndUs;            // Hết motion + post-roll
+    int64_t activeSegmentEndUs;     // Frame đầu segment + maxSegmentMs
+    int64_t activeNextSegmentUs;
+    uint64_t activeGrantedBytes;
+    uint32_t activePreRollFrames;
+    int64_t activeEdgeUs;           // Thời điểm cạnh PIR (ISR) của recording này
+    bool activeTriggerPending;      // Chưa gặp frame đầu tiên sau cạnh
+    std::function<void()> recordingPrepare;
+    uint8_t activeFps;
+    uint32_t maxSegmentMs;
+    
+    // Broker → SD writer pipeline. Khi không ghi, frameQueue là pre-roll ring
+    FrameQueue frameQueue;
+    int captureConsumer;            // Consumer id trên FrameBroker (-1 = chưa subscribe)
+    int64_t lastFrameUs;
+    volatile bool recordingActive;
+    volatile bool preRollPaused;
+    volatile uint8_t recordFps;
+    uint32_t preRollMs;             // Cấu hình (setPreRoll)
+    uint32_t effectivePreRollMs;    // Phần queue chứa được
+    uint8_t preRollFps;
+    PipelineStats stats;            // Broker task (capture) + recorder task + đọc từ task khác
+    SemaphoreHandle_t statsMutex;
     
     static const char* TAG;
     static constexpr const char* SERVER_IP = "192.168.1.200";
     static constexpr int SERVER_PORT = 80;
     static constexpr const char* UPLOAD_ENDPOINT = "/upload";
+    static constexpr const char* BUNDLE_ENDPOINT = "/upload/bundle";
+    static constexpr uint32_t MAX_UPLOAD_FAIL_STREAK = 3;      // Mạng mất → dừng batch sớm
+    static constexpr uint32_t CHECKPOINT_FRAMES = 10;          // PER_FRAME: ghi NVS mỗi N frame
+    static constexpr size_t BUNDLE_RANGE_BYTES = 256 * 1024;   // BUNDLE: 1 request + 1 ack mỗi range
+    
+    // Queue theo pre-roll (preRollMs × fps × avgFrameBytes) trong [MIN, MAX]; pre-roll dùng ≤ 2/3,
+    // phần còn lại đệm frame chờ ghi SD. Không đủ → pre-roll bị giới hạn (effectivePreRollMs)
+    static constexpr size_t QUEUE_BYTES_PSRAM = 1536 * 1024;       // Tối thiểu / fallback
+    static constexpr size_t QUEUE_BYTES_PSRAM_MAX = 2560 * 1024;
+    static constexpr size_t QUEUE_BYTES_INTERNAL = 96 * 1024;      // 1-2 frame UXGA → gần như không có pre-roll
+    static constexpr uint32_t QUEUE_FRAME_OVERHEAD = 32;           // Chunk header + idx1 entry (cả estimateBytes)
+    static constexpr uint32_t QUEUE_MAX_FRAMES = 48;
     
-    esp_err_t createFolder(const std::string& path);
+    static constexpr uint32_t DEFAULT_PRE_ROLL_MS = 3000;
+    static constexpr uint32_t DEFAULT_FRAME_BYTES = 80 * 1024;  // UXGA q10
+    static constexpr uint32_t MIN_RECORDING_MS = 2000;          // Ngắn hơn → từ chối
+    static constexpr uint32_t DEFAULT_MAX_SEGMENT_MS = 60000;
+    static constexpr uint32_t MIN_SEGMENT_MS = 5000;
+    
+    esp_err_t startCapture();
+    void stopCapture();
+    bool captureWanted() const;
+    void updateCaptureRate();
+    void updatePreRollLimit();
+    void onFrame(const FrameHandle& frame);
+    
+    uint64_t estimateBytes(uint32_t durationMs) const;
+    esp_err_t openSegment(const std::string& name, uint32_t durationMs);
+    esp_err_t closeSegment(VideoInfo& videoInfo);
     esp_err_t deleteFolder(const std::string& path);
-    esp_err_t uploadFile(const std::string& filepath);
+    // wait: thời gian chờ SD rảnh (recording đang ghi) → ESP_ERR_TIMEOUT
+    esp_err_t deleteRecording(const std::string& entryName, TickType_t wait = portMAX_DELAY);
+    // Gửi 1 frame (headers: X-Recording/X-Frame-Index để server bỏ frame trùng khi resume)
+    using FrameSender = std::function<esp_err_t(uint32_t index, const std::vector<UploadHeader>& headers)>;
+    // background: upload nền (checkpoint riêng, giới hạn tốc độ, nhường readVideo → ESP_ERR_NOT_FINISHED)
+    esp_err_t uploadFrames(const std::string& path, const std::string& name, uint32_t frameCount,
+                           bool background, const FrameSender& send);
+    esp_err_t uploadBundle(BundleSource& source, const std::string& path, const std::string& name,
+                           bool background);
+    esp_err_t uploadRecording(const CatalogEntry& entry);
+    void logUploadSummary(const UploadStats& before, int64_t startUs,
+                          uint32_t successCount, uint32_t totalCount) const;
+    esp_err_t readFolderVideo(const std::string& folderPath, bool background);
+    esp_err_t readAviVideo(const std::string& aviPath, bool background);
+    VideoInfo toVideoInfo(const CatalogEntry& entry) const;
     
 public:
-    explicit VideoManager(SdCardManager& sd, const std::string& root = "/sdcard/videos");
-    ~VideoManager() = default;
+    VideoManager(SdCardManager& sd, FrameBroker& frameBroker,
+                 const std::string& root = "/sdcard/videos");
+    ~VideoManager();
     
     esp_err_t init();
     
+    void setRecordingFormat(RecordingFormat fmt) { recordFormat = fmt; }
+    RecordingFormat getRecordingFormat() const { return recordFormat; }
+    
+    void setUploadMode(UploadMode mode) { uploadMode = mode; }
+    UploadMode getUploadMode() const { return uploadMode; }
+    
+    // Pre-roll: giữ N ms frame gần nhất, ghi vào đầu recording kế tiếp (0 = tắt)
+    void setPreRoll(uint32_t durationMs, uint8_t fps);
+    uint32_t getPreRollMs() const { return preRollMs; }
+    void setPreRollPaused(bool paused);
+    
+    // Quota lưu trữ (0 = toàn bộ thẻ). Vượt high watermark → xóa cũ nhất tới low watermark
+    void setStorageQuota(uint64_t quotaBytes, uint8_t highPct = 90, uint8_t lowPct = 80) {
+        retention.setQuota(quotaBytes, highPct, lowPct);
+    }
+    RetentionStats getRetentionStats() const { return retention.getStats(); }
+    uint32_t getDiscardedCount() const { return discardedCount; }
+    uint64_t getDiscardedBytes() const { return discardedBytes; }
+    
     // Main functions
+    // Recording theo bước (recorder task): begin → step... (rollover) → end
+    // edgeUs: esp_timer lúc cạnh PIR (0 = lúc gọi) → đo độ trễ trigger → frame đầu tiên
+    esp_err_t beginRecording(const RtcTime& timestamp, uint32_t durationMs, uint8_t fps, int64_t edgeUs = 0);
+    void extendRecording(uint32_t durationMs);     // Kéo dài tới now + durationMs
+    RecordStep stepRecording(TickType_t wait);      // Ghi ≤1 frame
+    esp_err_t rolloverRecording(VideoInfo& closedInfo);  // Đóng segment, mở segment kế tiếp
+    esp_err_t endRecording(VideoInfo& videoInfo);   // Flush + close + catalog
+    esp_err_t discardRecording(VideoInfo& videoInfo);   // Close + xóa segment đang ghi, không catalog/upload
+    
+    // Độ dài tối đa 1 file khi motion kéo dài (0 = không chia)
+    void setMaxSegmentMs(uint32_t durationMs);
+    uint32_t getMaxSegmentMs() const { return maxSegmentMs; }
+    bool isRecording() const { return activeWriter.isOpen(); }
+    
+    // Gọi đồng bộ trong beginRecording: trả sensor về quality ghi (stream có thể đang nén mạnh).
+    // Frame size không đổi theo stream → pre-roll luôn ghi được nguyên vẹn
+    void setRecordingPrepare(std::function<void()> hook) { recordingPrepare = hook; }
+    
+    // Ghi đồng bộ trọn 1 recording
     esp_err_t writeVideo(const RtcTime& timestamp, 
                         uint32_t durationMs, 
                         uint8_t fps,
                         VideoInfo& videoInfo);
     
+    // folderPath: folder/.avi path hoặc tên recording.
+    // Lỗi giữa chừng → lần gọi sau cho cùng recording tiếp tục từ checkpoint
     esp_err_t readVideo(const std::string& folderPath);
+    // Tên/path recording → path thật trên SD (folder hoặc .avi). ESP_ERR_NOT_FOUND nếu không còn
+    esp_err_t resolveRecording(const std::string& name, std::string& path, bool& isFolder) const;
+    bool findRecording(const std::string& name, CatalogEntry& entry) const { return catalog.find(name, entry); }
+    // Upload dở dang (mất mạng/reboot) cần gọi lại readVideo(path)
+    bool getPendingUpload(std::string& path) { return checkpoint.pending(path); }
+    
+    // Upload nền recording hoàn tất chưa upload: rateBps khi rảnh, interactiveRateBps khi
+    // live stream chạy (0 = không giới hạn). readVideo luôn được ưu tiên
+    void setBackgroundUpload(bool enabled, UploadOrder order = UploadOrder::OLDEST_FIRST,
+                             uint32_t rateBps = 64 * 1024, uint32_t interactiveRateBps = 16 * 1024) {
+        scheduler.configure(enabled, order, rateBps, interactiveRateBps);
+    }
+    // Có client live (stream/ws/RTSP) → giới hạn upload; recording đang ghi cũng tính là interactive
+    void setViewerCheck(std::function<bool()> hasViewers) {
+        scheduler.setInteractiveCheck([this, hasViewers]() {
+            return isRecording() || (hasViewers && hasViewers());
+        });
+    }
+    UploadSchedulerStats getUploadSchedulerStats() const { return scheduler.getStats(); }
 
     esp_err_t deleteOldVideos(const RtcTime& currentTime, uint32_t daysOld = 3);
 
-    // Utility functions
+    // Utility functions (tra cứu qua catalog, không quét thư mục)
     std::vector<VideoInfo> listVideos();
+    std::vector<VideoInfo> listVideos(const RtcTime& from, const RtcTime& to);
+    uint32_t getVideoCount() const { return catalog.count(); }
+    uint64_t getVideoBytes() const { return catalog.totalBytes(); }
+    esp_err_t rebuildCatalog() { return catalog.rebuild(); }
+    PipelineStats getPipelineStats() const;
   //  bool videoExists(const std::string& folderName) const;
    // std::string getVideoPath(const std::string& folderName) const;
 };
 
-// Video Write Timer Class (PIR-triggered with auto-timeout)
+// Lệnh gửi cho recorder task
+enum class RecorderCmdType {
+    START = 0,
+    EXTEND,
+    STOP,
+    DISCARD,                    // Motion không xác nhận → bỏ segment đang ghi
+    SHUTDOWN
+};
+
+struct RecorderCmd {
+    RecorderCmdType type;
+    RtcTime timestamp;
+    uint32_t durationMs;
+    uint8_t fps;
+    int64_t edgeUs;             // START: thời điểm cạnh PIR từ ISR (0 = không có)
+};
+
+// Video Write Timer Class (PIR-triggered, độ dài theo motion)
+// 1 recorder task cố định nhận START/EXTEND/STOP qua queue, dừng tại ranh giới frame.
+// Recording kết thúc sau post-roll kể từ lần PIR cuối; dài quá max segment → sang file mới.
 class VideoWriteTimer {
 private:
     VideoManager& videoMgr;
-    TimerHandle_t timerHandle;
-    TaskHandle_t writeTaskHandle;
+    TaskHandle_t workerHandle;
+    QueueHandle_t cmdQueue;
     SemaphoreHandle_t mutex;
+    SemaphoreHandle_t idleSignal;       // Recording đã đóng file xong
     
     bool isRunning;
-    RtcTime currentTimestamp;
-    uint32_t currentDurationMs;
-    uint8_t currentFps;
+    uint32_t postRollMs;
     
     static const char* TAG;
-    static constexpr uint32_t WRITE_TIMEOUT_MS = 10000;  // 10 seconds
+    static constexpr uint32_t DEFAULT_POST_ROLL_MS = 10000;  // 10 seconds
+    static constexpr uint32_t STOP_TIMEOUT_MS = 5000;    // Chờ flush + close
     static constexpr uint8_t PRIORITY_WRITE_TASK = 3;     // Low priority
+    static constexpr uint32_t CMD_QUEUE_LEN = 8;
     
-    static void timerCallback(TimerHandle_t xTimer);
-    static void writeTaskFunc(void* param);
+    static void workerTaskFunc(void* param);
     std::function<void(const std::string&)> onVideoComplete;
     
-    void onTimeout();
-    esp_err_t startWriteTask();
-    void stopWriteTask();
+    esp_err_t sendCommand(RecorderCmdType type, TickType_t wait,
+                          const RtcTime& ts = RtcTime(), uint32_t durationMs = 0, uint8_t fps = 0,
+                          int64_t edgeUs = 0);
+    bool handleCommand(const RecorderCmd& cmd, bool recording);
+    void finishRecording();
+    void discardRecording();
+    void reportSegment(const VideoInfo& info);
+    void markIdle();
     
     
 public:
@@ -128,9 +401,12 @@ public:
     }
     
     // Main control functions
-    esp_err_t start(const RtcTime& timestamp, uint32_t durationMs, uint8_t fps);
-    esp_err_t reset();  // Called when PIR triggers again
+    // postRollMs: thời gian ghi thêm sau lần PIR cuối, KHÔNG phải tổng độ dài (0 = giữ giá trị hiện tại)
+    // edgeUs: timestamp cạnh PIR từ ISR (PirSensor::waitForMotion) để đo độ trễ trigger
+    esp_err_t start(const RtcTime& timestamp, uint32_t postRollMs, uint8_t fps, int64_t edgeUs = 0);
+    esp_err_t reset();  // Called when PIR triggers again → kéo dài thêm post-roll
     esp_err_t stop();
+    esp_err_t discard();  // Dừng ngay và xóa segment đang ghi (PIR trigger giả)
     
     bool isActive() const;
 
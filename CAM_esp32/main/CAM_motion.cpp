@@ -0,0 +1,432 @@
+#include "CAM_motion.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "jpeg_decoder.h"
+#include <cstdlib>
+#include <algorithm>
+
+const char* MotionVerifier::TAG = "MOTION";
+
+// RGB565 → luma (BT.601, 8 bit)
+static inline uint8_t grayOf(uint16_t pixel) {
+    uint32_t r = pixel >> 11;
+    uint32_t g = (pixel >> 5) & 0x3F;
+    uint32_t b = pixel & 0x1F;
+    return (r * 616 + g * 600 + b * 232) >> 8;
+}
+
+MotionVerifier::MotionVerifier(FrameBroker& frameBroker)
+    : broker(frameBroker), consumer(-1), taskHandle(nullptr), running(false),
+      rgb(nullptr), background(nullptr), capacity(0), width(0), height(0), warmupFrames(0),
+      armed(false), armEdgeUs(0), armFrames(0), hitFrames(0), fps(0),
+      decodeTotalUs(0), analyzeTotalUs(0), costUs(0), stats() {
+
+    mutex = xSemaphoreCreateMutex();
+    taskDone = xSemaphoreCreateBinary();
+    if (mutex == nullptr || taskDone == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+}
+
+MotionVerifier::~MotionVerifier() {
+    stop();
+
+    heap_caps_free(rgb);
+    heap_caps_free(background);
+    if (taskDone) {
+        vSemaphoreDelete(taskDone);
+    }
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+esp_err_t MotionVerifier::start() {
+    if (taskHandle != nullptr) {
+        return ESP_OK;
+    }
+
+    fps = IDLE_FPS;
+    consumer = broker.subscribe("motion", fps, QueueDropPolicy::DROP_OLDEST);
+    if (consumer < 0) {
+        ESP_LOGE(TAG, "No free broker slot");
+        return ESP_ERR_NO_MEM;
+    }
+
+    running = true;
+    xSemaphoreTake(taskDone, 0);
+
+    // Core 1: decode không tranh CPU với WiFi/lwIP và httpd
+    if (xTaskCreatePinnedToCore(taskFunc, "motion_verify", 4096, this, PRIORITY_VERIFY_TASK,
+                                &taskHandle, VERIFY_CORE) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create verify task");
+        running = false;
+        taskHandle = nullptr;
+        broker.unsubscribe(consumer);
+        consumer = -1;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Motion verifier started (core %d, idle %u fps, armed %u fps)",
+             (int)VERIFY_CORE, IDLE_FPS, ARMED_FPS);
+    return ESP_OK;
+}
+
+void MotionVerifier::stop() {
+    if (taskHandle == nullptr) {
+        return;
+    }
+
+    running = false;
+    broker.cancel(consumer);
+    if (xSemaphoreTake(taskDone, pdMS_TO_TICKS(STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Verify task did not stop");
+        return;
+    }
+    taskHandle = nullptr;
+
+    broker.unsubscribe(consumer);
+    consumer = -1;
+    ESP_LOGI(TAG, "Motion verifier stopped");
+}
+
+void MotionVerifier::taskFunc(void* param) {
+    MotionVerifier* self = static_cast<MotionVerifier*>(param);
+    self->loop();
+
+    xSemaphoreGive(self->taskDone);
+    vTaskDelete(nullptr);
+}
+
+void MotionVerifier::loop() {
+    while (running) {
+        FrameHandle frame;
+        if (!broker.acquire(consumer, frame, pdMS_TO_TICKS(FRAME_TIMEOUT_MS))) {
+            // Không có frame vẫn phải kết luận khi hết cửa sổ xác nhận
+            judge(nullptr);
+            continue;
+        }
+        process(frame);
+        broker.release(consumer, frame);
+    }
+}
+
+// ==================== Analysis ====================
+
+esp_err_t MotionVerifier::ensureBuffers(size_t pixels) {
+    if (pixels <= capacity) {
+        return ESP_OK;
+    }
+
+    heap_caps_free(rgb);
+    heap_caps_free(background);
+    rgb = (uint16_t*)heap_caps_malloc(pixels * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    background = (uint16_t*)heap_caps_malloc(pixels * sizeof(uint16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (rgb == nullptr || background == nullptr) {
+        heap_caps_free(rgb);
+        heap_caps_free(background);
+        rgb = nullptr;
+        background = nullptr;
+        capacity = 0;
+        width = 0;
+        ESP_LOGE(TAG, "Failed to allocate %u pixel buffers", pixels);
+        return ESP_ERR_NO_MEM;
+    }
+
+    capacity = pixels;
+    width = 0;      // Nền cũ không còn
+    return ESP_OK;
+}
+
+esp_err_t MotionVerifier::decode(const FrameHandle& frame, uint16_t& outWidth, uint16_t& outHeight) {
+    size_t pixels = (size_t)(frame.width() / SCALE) * (frame.height() / SCALE);
+    if (pixels == 0 || ensureBuffers(pixels) != ESP_OK) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    std::span<const uint8_t> jpeg = frame.data();
+
+    // tjpgd ở 1/8 chỉ lấy hệ số DC của mỗi block 8×8, bỏ qua IDCT
+    esp_jpeg_image_cfg_t cfg = {};
+    cfg.indata = const_cast<uint8_t*>(jpeg.data());
+    cfg.indata_size = jpeg.size();
+    cfg.outbuf = (uint8_t*)rgb;
+    cfg.outbuf_size = capacity * sizeof(uint16_t);
+    cfg.out_format = JPEG_IMAGE_FORMAT_RGB565;
+    cfg.out_scale = JPEG_IMAGE_SCALE_1_8;
+
+    esp_jpeg_image_output_t img = {};
+    esp_err_t ret = esp_jpeg_decode(&cfg, &img);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    outWidth = img.width;
+    outHeight = img.height;
+    return ESP_OK;
+}
+
+MotionResult MotionVerifier::analyze(int64_t captureUs, bool learn) {
+    MotionResult result = {};
+    result.captureUs = captureUs;
+
+    uint16_t blocksX = width / BLOCK;
+    uint16_t blocksY = height / BLOCK;
+    result.totalBlocks = blocksX * blocksY;
+    blockChanged.resize(result.totalBlocks);
+
+    uint16_t minX = blocksX, minY = blocksY, maxX = 0, maxY = 0;
+    const uint32_t changeThreshold = BLOCK * BLOCK * BLOCK_CHANGE_PCT;
+
+    // Lượt 1: gray (ghi đè buffer RGB), đếm pixel lệch nền trong từng block
+    for (uint16_t by = 0; by < blocksY; by++) {
+        for (uint16_t bx = 0; bx < blocksX; bx++) {
+            uint32_t changed = 0;
+            for (uint8_t y = 0; y < BLOCK; y++) {
+                size_t row = (size_t)(by * BLOCK + y) * width + bx * BLOCK;
+                for (uint8_t x = 0; x < BLOCK; x++) {
+                    uint8_t gray = grayOf(rgb[row + x]);
+                    rgb[row + x] = gray;
+                    if (!learn && abs((int)gray - (background[row + x] >> 8)) > PIXEL_DIFF) {
+                        changed++;
+                    }
+                }
+            }
+
+            bool blockHit = changed * 100 > changeThreshold;
+            blockChanged[by * blocksX + bx] = blockHit;
+            if (blockHit) {
+                result.changedBlocks++;
+                minX = std::min(minX, bx);
+                minY = std::min(minY, by);
+                maxX = std::max(maxX, bx);
+                maxY = std::max(maxY, by);
+            }
+        }
+    }
+
+    if (result.changedBlocks > 0) {
+        const uint16_t blockPx = BLOCK * SCALE;
+        result.x0 = minX * blockPx;
+        result.y0 = minY * blockPx;
+        result.x1 = (maxX + 1) * blockPx;
+        result.y1 = (maxY + 1) * blockPx;
+    }
+
+    // Cả khung đổi cùng lúc (đèn bật, mây, IR cut) → không phải vật di chuyển
+    result.lighting = result.changedBlocks * 100 > result.totalBlocks * LIGHTING_PCT;
+    bool relearn = learn || result.lighting;
+
+    // Lượt 2: cập nhật nền
+    for (uint16_t by = 0; by < blocksY; by++) {
+        for (uint16_t bx = 0; bx < blocksX; bx++) {
+            uint8_t shift = blockChanged[by * blocksX + bx] ? BG_SHIFT_CHANGED : BG_SHIFT;
+            for (uint8_t y = 0; y < BLOCK; y++) {
+                size_t row = (size_t)(by * BLOCK + y) * width + bx * BLOCK;
+                for (uint8_t x = 0; x < BLOCK; x++) {
+                    int32_t target = (int32_t)rgb[row + x] << 8;
+                    if (relearn) {
+                        background[row + x] = target;
+                    } else {
+                        int32_t bg = background[row + x];
+                        background[row + x] = bg + ((target - bg) >> shift);
+                    }
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+void MotionVerifier::process(const FrameHandle& frame) {
+    int64_t startUs = esp_timer_get_time();
+    uint16_t w = 0, h = 0;
+    esp_err_t ret = decode(frame, w, h);
+    int64_t decodedUs = esp_timer_get_time();
+
+    if (ret != ESP_OK) {
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            stats.decodeErrors++;
+            xSemaphoreGive(mutex);
+        }
+        judge(nullptr);
+        return;
+    }
+
+    // Đổi độ phân giải (lần đầu, đổi cấu hình camera) → nền cũ không dùng được
+    bool learn = (w != width || h != height);
+    if (learn) {
+        width = w;
+        height = h;
+        warmupFrames = 0;
+    }
+
+    MotionResult result = analyze(frame.timestampUs(), learn);
+    int64_t doneUs = esp_timer_get_time();
+    bool ready = warmupFrames >= WARMUP_FRAMES;
+    if (!ready) {
+        warmupFrames++;
+    }
+
+    uint32_t decodeUs = decodedUs - startUs;
+    uint32_t analyzeUs = doneUs - decodedUs;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        stats.frames++;
+        decodeTotalUs += decodeUs;
+        analyzeTotalUs += analyzeUs;
+        stats.decodeMaxUs = std::max(stats.decodeMaxUs, decodeUs);
+        stats.analyzeMaxUs = std::max(stats.analyzeMaxUs, analyzeUs);
+        if (decodeUs + analyzeUs > FRAME_BUDGET_US) {
+            stats.overBudget++;
+        }
+        if (result.lighting) {
+            stats.lightingResets++;
+        }
+        stats.last = result;
+        costUs = costUs ? (costUs * 7 + decodeUs + analyzeUs) / 8 : decodeUs + analyzeUs;
+
+        uint8_t wanted = budgetFpsLocked();
+        if (wanted != fps) {
+            fps = wanted;
+            broker.setFps(consumer, fps);
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    judge(ready ? &result : nullptr, learn || result.lighting);
+}
+
+// ==================== Verdict ====================
+
+uint8_t MotionVerifier::budgetFpsLocked() const {
+    uint8_t wanted = armed ? ARMED_FPS : IDLE_FPS;
+    if (costUs == 0) {
+        return wanted;
+    }
+
+    // fps × chi phí 1 frame ≤ CPU_SHARE_PCT của 1 core
+    uint32_t maxFps = 1000000UL * CPU_SHARE_PCT / 100 / costUs;
+    return (uint8_t)std::max<uint32_t>(1, std::min<uint32_t>(wanted, maxFps));
+}
+
+void MotionVerifier::arm(int64_t edgeUs) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    if (!armed) {
+        armed = true;
+        armEdgeUs = edgeUs ? edgeUs : esp_timer_get_time();
+        armFrames = 0;
+        hitFrames = 0;
+        fps = budgetFpsLocked();
+        broker.setFps(consumer, fps);
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+void MotionVerifier::judge(const MotionResult* result, bool relearned) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    if (!armed) {
+        xSemaphoreGive(mutex);
+        return;
+    }
+
+    bool decided = false;
+    bool confirmed = false;
+
+    // Nền vừa reset → warmup ăn vào cửa sổ, chạy hết cửa sổ sẽ bác oan sự kiện thật
+    if (relearned) {
+        decided = true;
+        confirmed = true;
+    }
+
+    // Chỉ frame chụp sau cạnh PIR mới nói được gì về lần trigger này
+    if (!decided && result && result->captureUs >= armEdgeUs) {
+        armFrames++;
+        if (!result->lighting && result->changedBlocks >= MIN_BLOCKS) {
+            if (++hitFrames >= CONFIRM_FRAMES) {
+                decided = true;
+                confirmed = true;
+            }
+        } else {
+            hitFrames = 0;
+        }
+    }
+
+    if (!decided && esp_timer_get_time() - armEdgeUs >= (int64_t)VERIFY_WINDOW_MS * 1000) {
+        decided = true;
+        // Không phân tích được frame nào (camera dừng, lỗi decode) → giữ recording
+        confirmed = (armFrames == 0);
+    }
+
+    MotionResult last = result ? *result : stats.last;
+    VerdictCallback notify;
+    if (decided) {
+        armed = false;
+        if (confirmed) {
+            stats.confirmed++;
+        } else {
+            stats.rejected++;
+        }
+        fps = budgetFpsLocked();
+        broker.setFps(consumer, fps);
+        notify = onVerdict;
+    }
+
+    xSemaphoreGive(mutex);
+
+    if (!decided) {
+        return;
+    }
+
+    if (relearned) {
+        ESP_LOGW(TAG, "Background relearned during verification, keeping recording");
+    } else if (confirmed && armFrames == 0) {
+        ESP_LOGW(TAG, "No frame analyzed in %lu ms, keeping recording", VERIFY_WINDOW_MS);
+    } else if (confirmed) {
+        ESP_LOGI(TAG, "Motion confirmed: %u/%u blocks, bbox (%u,%u)-(%u,%u), %u frames",
+                 last.changedBlocks, last.totalBlocks, last.x0, last.y0, last.x1, last.y1, armFrames);
+    } else {
+        ESP_LOGW(TAG, "PIR trigger rejected: no pixel change in %lu ms (%u frames)",
+                 VERIFY_WINDOW_MS, armFrames);
+    }
+
+    if (notify) {
+        notify(confirmed, last);
+    }
+}
+
+bool MotionVerifier::isArmed() const {
+    bool active = false;
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        active = armed;
+        xSemaphoreGive(mutex);
+    }
+    return active;
+}
+
+MotionStats MotionVerifier::getStats() const {
+    MotionStats result = {};
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        result = stats;
+        if (stats.frames > 0) {
+            result.decodeAvgUs = decodeTotalUs / stats.frames;
+            result.analyzeAvgUs = analyzeTotalUs / stats.frames;
+        }
+        result.fps = fps;
+        xSemaphoreGive(mutex);
+    }
+
+    if (consumer >= 0) {
+        result.dropped = broker.getStats(consumer).dropped;
+    }
+    return result;
+}
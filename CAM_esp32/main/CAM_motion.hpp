@@ -0,0 +1,136 @@
+#ifndef CAM_MOTION_HPP
+#define CAM_MOTION_HPP
+
+#include "CAM_frameBroker.hpp"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// Kết quả phân tích 1 frame (toạ độ bbox theo độ phân giải gốc của JPEG)
+struct MotionResult {
+    uint16_t changedBlocks;
+    uint16_t totalBlocks;
+    uint16_t x0, y0, x1, y1;    // Bounding box các block thay đổi (x1/y1 không gồm)
+    bool lighting;              // Quá nhiều block đổi cùng lúc → coi là đổi ánh sáng, học lại nền
+    int64_t captureUs;
+};
+
+struct MotionStats {
+    uint32_t frames;            // Frame đã phân tích
+    uint32_t decodeAvgUs;       // esp_jpeg 1/8 → RGB565
+    uint32_t decodeMaxUs;
+    uint32_t analyzeAvgUs;      // Gray + so nền + cập nhật nền
+    uint32_t analyzeMaxUs;
+    uint32_t overBudget;        // Frame tốn hơn FRAME_BUDGET_US
+    uint32_t decodeErrors;
+    uint32_t dropped;           // Broker bỏ (mailbox DROP_OLDEST, verifier chậm hơn fps)
+    uint8_t fps;                // fps phân tích hiện tại (đã giới hạn theo CPU)
+    uint32_t confirmed;
+    uint32_t rejected;
+    uint32_t lightingResets;
+    MotionResult last;
+};
+
+// Motion Verifier Class - xác nhận cạnh PIR bằng thay đổi pixel thật
+//   - Mailbox consumer của FrameBroker, task ghim core 1 (camera/WiFi/httpd chạy core 0)
+//   - Decode JPEG ở 1/8 (esp_jpeg/tjpgd chỉ giải DC → rẻ hơn decode đầy đủ nhiều) → grayscale
+//   - Nền: trung bình trượt từng pixel (Q8), block đang đổi học chậm hơn để vật đứng yên
+//     không bị "nuốt" vào nền ngay
+//   - Block 8×8 pixel (= 64×64 ở ảnh gốc) đổi khi > BLOCK_CHANGE_PCT pixel lệch nền > PIXEL_DIFF
+//   - Rảnh: IDLE_FPS để nền theo kịp ánh sáng. arm() sau cạnh PIR: ARMED_FPS tới khi
+//     CONFIRM_FRAMES frame liên tiếp có ≥ MIN_BLOCKS block đổi (confirmed) hoặc hết
+//     VERIFY_WINDOW_MS (rejected). Không phân tích được frame nào trong cửa sổ, hoặc nền bị
+//     học lại trong lúc chờ kết luận → confirmed (fail-open, không xóa recording thật)
+//   - Ngân sách CPU: fps phân tích ≤ CPU_SHARE_PCT của core 1 theo chi phí trung bình đo được
+class MotionVerifier {
+public:
+    using VerdictCallback = std::function<void(bool confirmed, const MotionResult& result)>;
+
+private:
+    FrameBroker& broker;
+    int consumer;
+    TaskHandle_t taskHandle;
+    SemaphoreHandle_t taskDone;
+    SemaphoreHandle_t mutex;
+    volatile bool running;
+    VerdictCallback onVerdict;
+
+    // Buffer ở 1/8 (chỉ dùng trong task verifier)
+    uint16_t* rgb;              // Output esp_jpeg
+    uint16_t* background;       // Gray << 8
+    size_t capacity;            // Pixel
+    std::vector<uint8_t> blockChanged;
+    uint16_t width;             // Kích thước ở 1/8 của nền hiện tại (0 = chưa có nền)
+    uint16_t height;
+    uint8_t warmupFrames;
+
+    bool armed;
+    int64_t armEdgeUs;
+    uint8_t armFrames;          // Frame sau cạnh đã phân tích được
+    uint8_t hitFrames;          // Frame motion liên tiếp
+    uint8_t fps;
+
+    uint64_t decodeTotalUs;
+    uint64_t analyzeTotalUs;
+    uint32_t costUs;            // Trung bình trượt decode + analyze, để chọn fps
+    MotionStats stats;
+
+    static const char* TAG;
+    static constexpr uint8_t IDLE_FPS = 1;
+    static constexpr uint8_t ARMED_FPS = 5;
+    static constexpr uint8_t BLOCK = 8;                 // Pixel ở 1/8
+    static constexpr uint8_t SCALE = 8;
+    static constexpr uint8_t PIXEL_DIFF = 24;
+    static constexpr uint8_t BLOCK_CHANGE_PCT = 25;
+    static constexpr uint8_t LIGHTING_PCT = 60;
+    static constexpr uint8_t BG_SHIFT = 4;              // Học nền 1/16 mỗi frame
+    static constexpr uint8_t BG_SHIFT_CHANGED = 6;      // Block đang đổi: 1/64
+    static constexpr uint8_t WARMUP_FRAMES = 2;
+    static constexpr uint16_t MIN_BLOCKS = 2;
+    static constexpr uint8_t CONFIRM_FRAMES = 2;
+    static constexpr uint32_t VERIFY_WINDOW_MS = 3000;
+    static constexpr uint32_t FRAME_BUDGET_US = 60000;
+    static constexpr uint8_t CPU_SHARE_PCT = 30;
+    static constexpr uint32_t FRAME_TIMEOUT_MS = 1000;
+    static constexpr uint32_t STOP_TIMEOUT_MS = 2000;
+    static constexpr uint8_t PRIORITY_VERIFY_TASK = 2;  // Dưới recorder (3)
+    static constexpr BaseType_t VERIFY_CORE = (portNUM_PROCESSORS > 1) ? 1 : 0;
+
+    static void taskFunc(void* param);
+
+    void loop();
+    void process(const FrameHandle& frame);
+    esp_err_t ensureBuffers(size_t pixels);
+    esp_err_t decode(const FrameHandle& frame, uint16_t& outWidth, uint16_t& outHeight);
+    MotionResult analyze(int64_t captureUs, bool learn);
+    // result == nullptr: không phân tích được (lỗi decode, chưa có nền, không có frame)
+    // relearned: nền vừa học lại (đổi kích thước, ánh sáng) → cửa sổ không còn đủ frame để bác
+    void judge(const MotionResult* result, bool relearned = false);
+    uint8_t budgetFpsLocked() const;
+
+public:
+    explicit MotionVerifier(FrameBroker& frameBroker);
+    ~MotionVerifier();
+
+    // Disable copy
+    MotionVerifier(const MotionVerifier&) = delete;
+    MotionVerifier& operator=(const MotionVerifier&) = delete;
+
+    esp_err_t start();
+    void stop();
+
+    // Gọi từ task verifier khi có kết luận cho lần arm() hiện tại
+    void setOnVerdict(VerdictCallback callback) { onVerdict = callback; }
+
+    // Bắt đầu xác nhận cho cạnh PIR edgeUs (chỉ dùng frame capture sau cạnh)
+    void arm(int64_t edgeUs);
+    bool isArmed() const;
+
+    MotionStats getStats() const;
+};
+
+#endif // CAM_MOTION_HPP
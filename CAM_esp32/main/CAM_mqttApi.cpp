@@ -115,6 +115,15 @@ void MqttApiManager::mqttEventHandler(void* handler_args, esp_event_base_t base,
             
             // Publish initial status
             self->publishStatus(STATUS_OFF, self->topicStreamPub);
+            
+            // Upload bị ngắt (mất mạng/reboot) → tự chạy tiếp từ checkpoint
+            {
+                std::string pendingPath;
+                if (self->videoMgr.getPendingUpload(pendingPath)) {
+                    ESP_LOGI(TAG, "Resuming upload: %s", pendingPath.c_str());
+                    self->startMemoryRead(pendingPath);
+                }
+            }
             break;
             
         case MQTT_EVENT_DISCONNECTED:
@@ -172,13 +181,7 @@ esp_err_t MqttApiManager::startStream() {
         return ESP_FAIL;
     }
     
-    // Check if memory task is running
-    if (memoryState == TaskState::RUNNING) {
-        ESP_LOGW(TAG, "Cannot start stream: memory task running");
-        xSemaphoreGive(resourceMutex);
-        return ESP_ERR_INVALID_STATE;
-    }
-    
+    // Memory upload chạy song song: bị giới hạn tốc độ khi có client xem (setViewerCheck)
     if (streamState == TaskState::RUNNING) {
         ESP_LOGI(TAG, "Stream already running");
         xSemaphoreGive(resourceMutex);
@@ -188,8 +191,7 @@ esp_err_t MqttApiManager::startStream() {
     streamState = TaskState::RUNNING;
     xSemaphoreGive(resourceMutex);
     
-    // Block write task
-    blockWriteVideo();
+    // Stream và recording dùng chung frame từ broker → không cần chặn write task
     
     // Set resource bit
     xEventGroupSetBits(resourceEventGroup, RESOURCE_STREAM_ACTIVE_BIT);
@@ -205,7 +207,6 @@ esp_err_t MqttApiManager::startStream() {
             streamState = TaskState::IDLE;
             xSemaphoreGive(resourceMutex);
         }
-        unblockWriteVideo();
         xEventGroupClearBits(resourceEventGroup, RESOURCE_STREAM_ACTIVE_BIT);
     }
     
@@ -233,9 +234,6 @@ esp_err_t MqttApiManager::stopStream() {
         xSemaphoreGive(resourceMutex);
     }
     
-    // Unblock write task
-    unblockWriteVideo();
-    
     // Clear resource bit
     xEventGroupClearBits(resourceEventGroup, RESOURCE_STREAM_ACTIVE_BIT);
     
@@ -250,14 +248,7 @@ esp_err_t MqttApiManager::startMemoryRead(const std::string& videoPath) {
         return ESP_FAIL;
     }
     
-    // Check if stream is running
-    if (streamState == TaskState::RUNNING) {
-        ESP_LOGW(TAG, "Cannot start memory: stream running");
-        publishStatus(STATUS_OFF, topicStreamPub);  // Notify stream interrupted
-        xSemaphoreGive(resourceMutex);
-        return ESP_ERR_INVALID_STATE;
-    }
-    
+    // Stream đang chạy không chặn memory: upload tự giới hạn tốc độ để nhường live view
     if (memoryState == TaskState::RUNNING) {
         ESP_LOGW(TAG, "Memory task already running");
         xSemaphoreGive(resourceMutex);
@@ -269,8 +260,7 @@ esp_err_t MqttApiManager::startMemoryRead(const std::string& videoPath) {
     
     xSemaphoreGive(resourceMutex);
     
-    // Block write task
-    blockWriteVideo();
+    // Không chặn ghi: recording đang đọc được pin trong catalog, PIR vẫn ghi bình thường
     
     // Set resource bit
     xEventGroupSetBits(resourceEventGroup, RESOURCE_MEMORY_ACTIVE_BIT);
@@ -293,7 +283,6 @@ esp_err_t MqttApiManager::startMemoryRead(const std::string& videoPath) {
             xSemaphoreGive(resourceMutex);
         }
         
-        unblockWriteVideo();
         xEventGroupClearBits(resourceEventGroup, RESOURCE_MEMORY_ACTIVE_BIT);
         publishStatus(STATUS_FAIL, topicMemoryPub);
         return ESP_FAIL;
@@ -327,9 +316,6 @@ void MqttApiManager::memoryTaskFunc(void* param) {
         xSemaphoreGive(self->resourceMutex);
     }
     
-    // Unblock write task
-    self->unblockWriteVideo();
-    
     // Clear resource bit
     xEventGroupClearBits(self->resourceEventGroup, RESOURCE_MEMORY_ACTIVE_BIT);
     
@@ -364,6 +350,9 @@ esp_err_t MqttApiManager::publishFolderName(const std::string& folderName) {
 void MqttApiManager::blockWriteVideo() {
     xEventGroupSetBits(resourceEventGroup, RESOURCE_WRITE_BLOCKED_BIT);
     
+    // Nhường camera/SD cho stream hoặc memory task
+    videoMgr.setPreRollPaused(true);
+    
     if (xSemaphoreTake(resourceMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
         writeState = TaskState::BLOCKED;
         xSemaphoreGive(resourceMutex);
@@ -374,6 +363,7 @@ void MqttApiManager::blockWriteVideo() {
 
 void MqttApiManager::unblockWriteVideo() {
     xEventGroupClearBits(resourceEventGroup, RESOURCE_WRITE_BLOCKED_BIT);
+    videoMgr.setPreRollPaused(false);
     
     if (xSemaphoreTake(resourceMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
         writeState = TaskState::IDLE;
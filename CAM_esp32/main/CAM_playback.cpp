@@ -0,0 +1,453 @@
+#include "CAM_playback.hpp"
+#include "CAM_httpAsync.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <dirent.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+
+const char* PlaybackManager::TAG = "PLAYBACK";
+
+// Global instance for static callback
+static PlaybackManager* g_playbackMgr = nullptr;
+
+// ==================== Playback Clips ====================
+
+UploadSource* AviClip::openFrame(uint32_t i) {
+    if (i >= reader.getFrameCount()) {
+        return nullptr;
+    }
+    current = std::make_unique<AviFrameSource>(reader, i);
+    return current.get();
+}
+
+esp_err_t FolderClip::open(const std::string& path, uint32_t frameIntervalUs) {
+    DIR* dir = opendir(path.c_str());
+    if (!dir) {
+        ESP_LOGE("PLAYBACK", "Failed to open dir: %s", path.c_str());
+        return ESP_FAIL;
+    }
+
+    folder = path;
+    files.clear();
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strstr(entry->d_name, ".jpg") != nullptr) {
+            files.push_back(entry->d_name);
+        }
+    }
+    closedir(dir);
+    std::sort(files.begin(), files.end());
+
+    intervalUs = frameIntervalUs;
+    return ESP_OK;
+}
+
+UploadSource* FolderClip::openFrame(uint32_t i) {
+    if (i >= files.size()) {
+        return nullptr;
+    }
+    current = std::make_unique<FileSource>();
+    if (current->open(folder + "/" + files[i]) != ESP_OK) {
+        current.reset();
+    }
+    return current.get();
+}
+
+// ==================== Playback Manager ====================
+
+PlaybackManager::PlaybackManager(VideoManager& manager)
+    : videoMgr(manager), readerHandle(nullptr), abortRead(false), jobSkipped(0), stats() {
+
+    for (int i = 0; i < 2; i++) {
+        chunks[i] = {};
+    }
+
+    freeQueue = xQueueCreate(2, sizeof(uint8_t));
+    fullQueue = xQueueCreate(2, sizeof(uint8_t));
+    jobQueue = xQueueCreate(1, sizeof(Job));
+    mutex = xSemaphoreCreateMutex();
+    statsMutex = xSemaphoreCreateMutex();
+    if (freeQueue == nullptr || fullQueue == nullptr || jobQueue == nullptr ||
+        mutex == nullptr || statsMutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create queues");
+    }
+
+    g_playbackMgr = this;
+}
+
+PlaybackManager::~PlaybackManager() {
+    g_playbackMgr = nullptr;
+
+    if (readerHandle != nullptr) {
+        Job stop = {};
+        xQueueSend(jobQueue, &stop, portMAX_DELAY);
+        for (int i = 0; i < 20 && readerHandle != nullptr; i++) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        heap_caps_free(chunks[i].data);
+    }
+    if (freeQueue) vQueueDelete(freeQueue);
+    if (fullQueue) vQueueDelete(fullQueue);
+    if (jobQueue) vQueueDelete(jobQueue);
+    if (mutex) vSemaphoreDelete(mutex);
+    if (statsMutex) vSemaphoreDelete(statsMutex);
+}
+
+esp_err_t PlaybackManager::init() {
+    if (readerHandle != nullptr) {
+        return ESP_OK;
+    }
+
+    // RAM nội: httpd copy từ đây sang lwIP, 2 x 8 KB cố định (không theo kích thước frame)
+    for (int i = 0; i < 2; i++) {
+        chunks[i].data = (uint8_t*)heap_caps_malloc(CHUNK_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (chunks[i].data == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u byte chunk", CHUNK_BYTES);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    BaseType_t ret = xTaskCreate(
+        readerTaskFunc,
+        "playback_read",
+        4096,
+        this,
+        PRIORITY_READER_TASK,
+        &readerHandle
+    );
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create reader task");
+        readerHandle = nullptr;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+void PlaybackManager::readerTaskFunc(void* param) {
+    PlaybackManager* self = static_cast<PlaybackManager*>(param);
+
+    ESP_LOGI(TAG, "Reader task started");
+
+    while (true) {
+        Job job = {};
+        if (xQueueReceive(self->jobQueue, &job, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (job.clip == nullptr) {
+            break;
+        }
+        self->readJob(job);
+    }
+
+    ESP_LOGI(TAG, "Reader task ended");
+    self->readerHandle = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void PlaybackManager::readJob(const Job& job) {
+    PlaybackClip* clip = job.clip;
+    uint32_t count = clip->frameCount();
+    int64_t scaledUs = (int64_t)(job.intervalUs / job.speed);
+    if (scaledUs < 1) {
+        scaledUs = 1;
+    }
+
+    uint32_t i = job.startFrame;
+    uint32_t lastSent = 0;
+    bool sentAny = false;
+    esp_err_t err = ESP_OK;
+    uint8_t idx = 0;
+
+    while (!abortRead && i < count) {
+        // Frame lặp (AVI giữ nhịp) → client đang hiển thị đúng ảnh này, chỉ cần chờ
+        if (sentAny && i == lastSent + 1) {
+            while (i < count && clip->isRepeat(i)) {
+                i++;
+            }
+            if (i >= count) {
+                break;
+            }
+        }
+
+        // Trễ ≥ 1 frame (speed cao, SD/WiFi chậm) → nhảy tới frame đúng giờ, không dồn lag
+        int64_t deadlineUs = job.startUs + (int64_t)(i - job.startFrame) * scaledUs;
+        int64_t lateUs = esp_timer_get_time() - deadlineUs;
+        if (sentAny && lateUs >= scaledUs) {
+            uint32_t skip = std::min<int64_t>(lateUs / scaledUs, count - 1 - i);
+            i += skip;
+            jobSkipped += skip;
+            deadlineUs += skip * scaledUs;
+        }
+
+        UploadSource* source = clip->openFrame(i);
+        if (source == nullptr) {
+            err = ESP_FAIL;
+            break;
+        }
+        size_t frameSize = source->size();
+        if (frameSize == 0) {
+            i++;
+            continue;
+        }
+
+        // Đọc trước vào chunk trống trong lúc handler gửi chunk còn lại
+        size_t done = 0;
+        while (!abortRead && done < frameSize) {
+            xQueueReceive(freeQueue, &idx, portMAX_DELAY);
+
+            Chunk& chunk = chunks[idx];
+            chunk.frame = i;
+            chunk.frameSize = (done == 0) ? frameSize : 0;
+            chunk.deadlineUs = deadlineUs;
+            chunk.err = source->read(chunk.data, CHUNK_BYTES, chunk.len);
+            if (chunk.err == ESP_OK && chunk.len == 0) {
+                chunk.err = ESP_ERR_INVALID_SIZE;     // File ngắn hơn index
+            }
+            if (chunk.err != ESP_OK) {
+                chunk.len = 0;
+                xQueueSend(fullQueue, &idx, portMAX_DELAY);
+                return;     // Chunk rỗng = marker kết thúc (kèm lỗi)
+            }
+
+            done += chunk.len;
+            xQueueSend(fullQueue, &idx, portMAX_DELAY);
+        }
+
+        lastSent = i;
+        sentAny = true;
+        i++;
+    }
+
+    // Hết clip hoặc handler đã dừng: marker kết thúc để handler thoát vòng chờ
+    xQueueReceive(freeQueue, &idx, portMAX_DELAY);
+    chunks[idx].len = 0;
+    chunks[idx].err = err;
+    xQueueSend(fullQueue, &idx, portMAX_DELAY);
+}
+
+esp_err_t PlaybackManager::openClip(const std::string& name, std::unique_ptr<PlaybackClip>& clip) {
+    std::string path;
+    bool isFolder = false;
+    if (videoMgr.resolveRecording(name, path, isFolder) != ESP_OK) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (isFolder) {
+        uint32_t intervalUs = DEFAULT_INTERVAL_US;
+        CatalogEntry entry;
+        if (videoMgr.findRecording(name, entry) && entry.frameCount > 0 && entry.durationMs > 0) {
+            intervalUs = (uint64_t)entry.durationMs * 1000 / entry.frameCount;
+        }
+
+        std::unique_ptr<FolderClip> folder = std::make_unique<FolderClip>();
+        if (folder->open(path, intervalUs) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        clip = std::move(folder);
+        return ESP_OK;
+    }
+
+    std::unique_ptr<AviClip> avi = std::make_unique<AviClip>();
+    if (avi->open(path) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    clip = std::move(avi);
+    return ESP_OK;
+}
+
+esp_err_t PlaybackManager::play(httpd_req_t* req, PlaybackClip& clip, uint32_t startFrame,
+                                uint32_t intervalUs, float speed) {
+    esp_err_t res = httpd_resp_set_type(req, STREAM_CONTENT_TYPE);
+    if (res != ESP_OK) {
+        return res;
+    }
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    xQueueReset(freeQueue);
+    xQueueReset(fullQueue);
+    for (uint8_t i = 0; i < 2; i++) {
+        xQueueSend(freeQueue, &i, 0);
+    }
+    abortRead = false;
+    jobSkipped = 0;
+
+    Job job = { &clip, startFrame, intervalUs, speed, esp_timer_get_time() };
+    xQueueSend(jobQueue, &job, portMAX_DELAY);
+
+    uint32_t frames = 0;
+    uint32_t stallUs = 0;
+    char part_buf[128];
+
+    // Luôn nhận tới marker kết thúc → reader không bao giờ còn giữ clip sau khi trả về
+    while (true) {
+        uint8_t idx = 0;
+        int64_t waitStartUs = esp_timer_get_time();
+        xQueueReceive(fullQueue, &idx, portMAX_DELAY);
+        if (frames > 0) {
+            stallUs += esp_timer_get_time() - waitStartUs;
+        }
+
+        Chunk& chunk = chunks[idx];
+        if (chunk.len == 0) {
+            if (chunk.err != ESP_OK && res == ESP_OK) {
+                ESP_LOGE(TAG, "Read failed at frame %lu: %s", chunk.frame, esp_err_to_name(chunk.err));
+                res = chunk.err;
+            }
+            break;
+        }
+
+        if (res == ESP_OK && chunk.frameSize != 0) {
+            // Chờ tới deadline của frame (trong lúc đó reader đọc trước chunk kế tiếp)
+            int64_t waitUs = chunk.deadlineUs - esp_timer_get_time();
+            if (waitUs > 0) {
+                vTaskDelay(pdMS_TO_TICKS(waitUs / 1000));
+            }
+
+            res = httpd_resp_send_chunk(req, STREAM_BOUNDARY, strlen(STREAM_BOUNDARY));
+            if (res == ESP_OK) {
+                uint64_t timestampMs = (uint64_t)chunk.frame * intervalUs / 1000;
+                size_t hlen = snprintf(part_buf, sizeof(part_buf), STREAM_PART,
+                                       chunk.frameSize, chunk.frame, timestampMs);
+                res = httpd_resp_send_chunk(req, part_buf, hlen);
+            }
+            frames++;
+        }
+
+        if (res == ESP_OK) {
+            res = httpd_resp_send_chunk(req, (const char*)chunk.data, chunk.len);
+        }
+        if (res != ESP_OK) {
+            abortRead = true;   // Client đóng kết nối → reader dừng ở chunk kế tiếp
+        }
+
+        xQueueSend(freeQueue, &idx, portMAX_DELAY);
+    }
+
+    // Hết clip: kết thúc multipart + chunked response
+    if (res == ESP_OK) {
+        httpd_resp_send_chunk(req, STREAM_END, strlen(STREAM_END));
+        httpd_resp_send_chunk(req, nullptr, 0);
+    }
+
+    if (xSemaphoreTake(statsMutex, portMAX_DELAY) == pdTRUE) {
+        stats.frames += frames;
+        stats.skipped += jobSkipped;
+        stats.readStallUs += stallUs;
+        xSemaphoreGive(statsMutex);
+    }
+
+    ESP_LOGI(TAG, "Playback ended: %lu frames, %lu skipped, %lu ms read stall",
+             frames, jobSkipped, stallUs / 1000);
+    return res;
+}
+
+esp_err_t PlaybackManager::handlePlaybackRequest(httpd_req_t* req) {
+    return HttpAsync::run(req, "playback_tx", 4096, PRIORITY_SENDER_TASK,
+                          [this](httpd_req_t* asyncReq) { return servePlayback(asyncReq); });
+}
+
+esp_err_t PlaybackManager::servePlayback(httpd_req_t* req) {
+    char query[128] = {};
+    char value[48] = {};
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) != ESP_OK ||
+        httpd_query_key_value(query, "folder", value, sizeof(value)) != ESP_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Missing folder");
+        return ESP_FAIL;
+    }
+
+    // Chỉ tên recording trong thư mục video, không nhận path tùy ý
+    std::string name = value;
+    if (name.empty() || name.find('/') != std::string::npos || name.find("..") != std::string::npos) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Invalid folder");
+        return ESP_FAIL;
+    }
+
+    float speed = 1.0f;
+    if (httpd_query_key_value(query, "speed", value, sizeof(value)) == ESP_OK) {
+        speed = std::clamp(strtof(value, nullptr), MIN_SPEED, MAX_SPEED);
+    }
+
+    // Chunk dùng chung → 1 playback mỗi lần
+    if (xSemaphoreTake(mutex, 0) != pdTRUE) {
+        httpd_resp_set_status(req, "503 Service Unavailable");
+        httpd_resp_sendstr(req, "Playback busy");
+        return ESP_OK;
+    }
+
+    std::unique_ptr<PlaybackClip> clip;
+    esp_err_t ret = openClip(name, clip);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(mutex);
+        httpd_resp_send_err(req, ret == ESP_ERR_NOT_FOUND ? HTTPD_404_NOT_FOUND : HTTPD_500_INTERNAL_SERVER_ERROR,
+                            "Recording unavailable");
+        return ESP_FAIL;
+    }
+
+    if (clip->frameIntervalUs() == 0) {
+        // AVI chưa close (header placeholder) → không có fps
+        ESP_LOGW(TAG, "No frame rate for %s, assuming %lu us", name.c_str(), DEFAULT_INTERVAL_US);
+    }
+    uint32_t intervalUs = clip->frameIntervalUs() ? clip->frameIntervalUs() : DEFAULT_INTERVAL_US;
+
+    // Seek: frame=<index> hoặc t=<giây>
+    uint32_t startFrame = 0;
+    if (httpd_query_key_value(query, "frame", value, sizeof(value)) == ESP_OK) {
+        startFrame = strtoul(value, nullptr, 10);
+    } else if (httpd_query_key_value(query, "t", value, sizeof(value)) == ESP_OK) {
+        startFrame = (uint32_t)(std::max(strtof(value, nullptr), 0.0f) * 1000000 / intervalUs);
+    }
+
+    if (startFrame >= clip->frameCount()) {
+        xSemaphoreGive(mutex);
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Start beyond end of recording");
+        return ESP_FAIL;
+    }
+
+    if (readerHandle == nullptr) {
+        xSemaphoreGive(mutex);
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Playback %s from frame %lu/%lu at %.2fx", name.c_str(), startFrame,
+             clip->frameCount(), speed);
+
+    if (xSemaphoreTake(statsMutex, portMAX_DELAY) == pdTRUE) {
+        stats.sessions++;
+        xSemaphoreGive(statsMutex);
+    }
+
+    ret = play(req, *clip, startFrame, intervalUs, speed);
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+PlaybackStats PlaybackManager::getStats() const {
+    PlaybackStats snapshot = {};
+
+    if (xSemaphoreTake(statsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        snapshot = stats;
+        xSemaphoreGive(statsMutex);
+    }
+
+    return snapshot;
+}
+
+esp_err_t PlaybackManager::playbackHandlerWrapper(httpd_req_t* req) {
+    if (g_playbackMgr == nullptr) {
+        ESP_LOGE(TAG, "Playback manager not initialized");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    return g_playbackMgr->handlePlaybackRequest(req);
+}
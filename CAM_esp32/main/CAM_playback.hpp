@@ -0,0 +1,149 @@
+#ifndef CAM_PLAYBACK_HPP
+#define CAM_PLAYBACK_HPP
+
+#include "CAM_memorFunc.hpp"
+#include "CAM_uploader.hpp"
+#include "CAM_aviFile.hpp"
+#include "esp_http_server.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Recording trên SD nhìn như dãy frame JPEG có nhịp cố định
+class PlaybackClip {
+public:
+    virtual ~PlaybackClip() = default;
+    virtual uint32_t frameCount() const = 0;
+    virtual uint32_t frameIntervalUs() const = 0;
+    // Source đọc tuần tự frame i (hợp lệ tới lần gọi kế tiếp)
+    virtual UploadSource* openFrame(uint32_t i) = 0;
+    // Frame i chỉ lặp lại frame trước (AVI giữ nhịp khi bỏ frame) → không cần gửi lại
+    virtual bool isRepeat(uint32_t i) const { return false; }
+};
+
+// Recording dạng AVI: frame đọc thẳng từ movi qua idx1
+class AviClip : public PlaybackClip {
+private:
+    AviReader reader;
+    std::unique_ptr<AviFrameSource> current;
+
+public:
+    esp_err_t open(const std::string& path) { return reader.open(path); }
+
+    uint32_t frameCount() const override { return reader.getFrameCount(); }
+    uint32_t frameIntervalUs() const override { return reader.getFrameIntervalUs(); }
+    UploadSource* openFrame(uint32_t i) override;
+    bool isRepeat(uint32_t i) const override { return reader.isRepeat(i); }
+};
+
+// Recording dạng folder JPEG: 0001.jpg... theo thứ tự tên
+class FolderClip : public PlaybackClip {
+private:
+    std::string folder;
+    std::vector<std::string> files;
+    uint32_t intervalUs;
+    std::unique_ptr<FileSource> current;
+
+public:
+    FolderClip() : intervalUs(0) {}
+
+    // intervalUs: folder không lưu timestamp → lấy từ catalog (thời lượng / số frame)
+    esp_err_t open(const std::string& path, uint32_t frameIntervalUs);
+
+    uint32_t frameCount() const override { return files.size(); }
+    uint32_t frameIntervalUs() const override { return intervalUs; }
+    UploadSource* openFrame(uint32_t i) override;
+};
+
+struct PlaybackStats {
+    uint32_t sessions;
+    uint32_t frames;            // Frame đã gửi
+    uint32_t skipped;           // Bỏ để giữ nhịp (speed cao hoặc client chậm)
+    uint32_t readStallUs;       // Sender phải chờ SD
+};
+
+// Playback Manager Class - /playback?folder=<name>&speed=<x>&t=<s>
+//   - Phát lại recording trên SD dạng multipart MJPEG (cùng format /stream)
+//   - httpd worker chỉ tách request (HttpAsync) → gửi trên task "playback_tx" (PRIORITY_SENDER_TASK)
+//   - Reader task đọc trước frame kế tiếp vào 2 chunk cố định trong lúc sender gửi chunk kia
+//   - Nhịp theo deadline tuyệt đối (interval / speed); trễ ≥ 1 frame → bỏ frame thay vì dồn lag
+//   - Reader chạy ưu tiên thấp hơn write task → không chặn recording
+//   - Seek: t = giây (hoặc frame = index) bắt đầu; client seek bằng request mới
+class PlaybackManager {
+private:
+    struct Chunk {
+        uint8_t* data;
+        size_t len;             // 0 = hết clip (hoặc lỗi, xem err)
+        esp_err_t err;
+        uint32_t frame;         // Frame chứa chunk này
+        uint32_t frameSize;     // != 0 → chunk đầu tiên của frame
+        int64_t deadlineUs;     // Thời điểm gửi frame (chunk đầu tiên)
+    };
+
+    struct Job {
+        PlaybackClip* clip;     // nullptr = dừng task
+        uint32_t startFrame;
+        uint32_t intervalUs;
+        float speed;
+        int64_t startUs;
+    };
+
+    VideoManager& videoMgr;
+    Chunk chunks[2];
+    QueueHandle_t freeQueue;    // Index chunk trống → reader
+    QueueHandle_t fullQueue;    // Index chunk đã đọc → handler
+    QueueHandle_t jobQueue;
+    SemaphoreHandle_t mutex;    // 1 playback mỗi lần (dùng chung chunk)
+    SemaphoreHandle_t statsMutex;
+    TaskHandle_t readerHandle;
+    volatile bool abortRead;
+    uint32_t jobSkipped;
+    PlaybackStats stats;
+
+    static const char* TAG;
+    static constexpr size_t CHUNK_BYTES = 8 * 1024;
+    static constexpr uint8_t PRIORITY_READER_TASK = 2;      // Dưới write task (3)
+    static constexpr uint8_t PRIORITY_SENDER_TASK = 4;      // Phần lớn thời gian chờ deadline
+    static constexpr uint32_t DEFAULT_INTERVAL_US = 100000; // Không rõ fps → 10 fps
+    static constexpr float MIN_SPEED = 0.25f;
+    static constexpr float MAX_SPEED = 16.0f;
+
+    // MJPEG stream constants (giống HttpStreamManager)
+    static constexpr const char* STREAM_CONTENT_TYPE = "multipart/x-mixed-replace;boundary=123456789000000000000987654321";
+    static constexpr const char* STREAM_BOUNDARY = "\r\n--123456789000000000000987654321\r\n";
+    static constexpr const char* STREAM_END = "\r\n--123456789000000000000987654321--\r\n";
+    static constexpr const char* STREAM_PART = "Content-Type: image/jpeg\r\nContent-Length: %lu\r\nX-Frame-Index: %lu\r\nX-Timestamp: %llu\r\n\r\n";
+
+    static void readerTaskFunc(void* param);
+    void readJob(const Job& job);
+    esp_err_t openClip(const std::string& name, std::unique_ptr<PlaybackClip>& clip);
+    esp_err_t play(httpd_req_t* req, PlaybackClip& clip, uint32_t startFrame,
+                   uint32_t intervalUs, float speed);
+    esp_err_t servePlayback(httpd_req_t* req);
+
+public:
+    explicit PlaybackManager(VideoManager& manager);
+    ~PlaybackManager();
+
+    // Disable copy
+    PlaybackManager(const PlaybackManager&) = delete;
+    PlaybackManager& operator=(const PlaybackManager&) = delete;
+
+    esp_err_t init();
+
+    PlaybackStats getStats() const;
+
+    // HTTP handler - Được gọi từ HTTP server, phát trên task riêng (httpd worker trả về ngay)
+    esp_err_t handlePlaybackRequest(httpd_req_t* req);
+
+    // Static wrapper for HTTP server callback
+    static esp_err_t playbackHandlerWrapper(httpd_req_t* req);
+};
+
+#endif // CAM_PLAYBACK_HPP
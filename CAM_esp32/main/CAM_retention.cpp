@@ -0,0 +1,270 @@
+#include "CAM_retention.hpp"
+#include "esp_log.h"
+#include "esp_vfs_fat.h"
+
+const char* StorageRetention::TAG = "RETENTION";
+
+StorageRetention::StorageRetention(RecordingCatalog& cat, const std::string& mount_point)
+    : catalog(cat), mountPoint(mount_point), quotaBytes(0), budgetBytes(0), reservedBytes(0),
+      highPct(90), lowPct(80), evictedCount(0), evictedBytes(0), refusedCount(0),
+      shortenedCount(0), taskHandle(nullptr), running(false) {
+
+    mutex = xSemaphoreCreateMutex();
+    kick = xSemaphoreCreateBinary();
+    if (mutex == nullptr || kick == nullptr) {
+        ESP_LOGE(TAG, "Failed to create semaphores");
+    }
+}
+
+StorageRetention::~StorageRetention() {
+    stop();
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+    if (kick) {
+        vSemaphoreDelete(kick);
+    }
+}
+
+void StorageRetention::setQuota(uint64_t quota, uint8_t highWatermarkPct, uint8_t lowWatermarkPct) {
+    if (highWatermarkPct > 100) highWatermarkPct = 100;
+    if (lowWatermarkPct >= highWatermarkPct) lowWatermarkPct = highWatermarkPct / 2;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        quotaBytes = quota;
+        highPct = highWatermarkPct;
+        lowPct = lowWatermarkPct;
+        xSemaphoreGive(mutex);
+    }
+
+    refresh();
+    notify();
+}
+
+esp_err_t StorageRetention::refresh() {
+    uint64_t total = 0;
+    uint64_t freeBytes = 0;
+    esp_err_t ret = esp_vfs_fat_info(mountPoint.c_str(), &total, &freeBytes);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    // File đang ghi chưa vào catalog → free space lúc này không khớp với used
+    if (reservedBytes > 0) {
+        xSemaphoreGive(mutex);
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    if (ret == ESP_OK) {
+        uint64_t recordings = catalog.totalBytes();
+        uint64_t available = recordings + freeBytes;
+        available = available > FS_RESERVE_BYTES ? available - FS_RESERVE_BYTES : 0;
+        budgetBytes = (quotaBytes > 0 && quotaBytes < available) ? quotaBytes : available;
+
+        ESP_LOGI(TAG, "Budget %llu MB (recordings %llu MB, free %llu MB / %llu MB)",
+                 budgetBytes / (1024 * 1024), recordings / (1024 * 1024),
+                 freeBytes / (1024 * 1024), total / (1024 * 1024));
+    } else {
+        // Không đọc được FAT: chỉ áp quota cấu hình (0 = không giới hạn)
+        budgetBytes = quotaBytes;
+        ESP_LOGW(TAG, "esp_vfs_fat_info failed: %s", esp_err_to_name(ret));
+    }
+
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+uint64_t StorageRetention::usedLocked() const {
+    return catalog.totalBytes() + reservedBytes;
+}
+
+uint64_t StorageRetention::admit(uint64_t wantedBytes, uint64_t minBytes) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return 0;
+    }
+
+    uint64_t granted = wantedBytes;
+    if (budgetBytes > 0) {
+        uint64_t used = usedLocked();
+        uint64_t headroom = used < budgetBytes ? budgetBytes - used : 0;
+
+        if (headroom < minBytes) {
+            granted = 0;
+            refusedCount++;
+        } else if (headroom < wantedBytes) {
+            granted = headroom;
+            shortenedCount++;
+        }
+    }
+    reservedBytes += granted;
+
+    xSemaphoreGive(mutex);
+
+    // Gần đầy → dọn trước cho recording kế tiếp
+    notify();
+    return granted;
+}
+
+void StorageRetention::release(uint64_t grantedBytes) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        reservedBytes = reservedBytes > grantedBytes ? reservedBytes - grantedBytes : 0;
+        xSemaphoreGive(mutex);
+    }
+    notify();
+}
+
+void StorageRetention::notify() {
+    if (kick) {
+        xSemaphoreGive(kick);
+    }
+}
+
+esp_err_t StorageRetention::start() {
+    if (taskHandle != nullptr) {
+        return ESP_OK;
+    }
+
+    refresh();
+
+    running = true;
+    BaseType_t ret = xTaskCreate(
+        taskFunc,
+        "retention",
+        4096,
+        this,
+        PRIORITY_RETENTION_TASK,
+        &taskHandle
+    );
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create retention task");
+        running = false;
+        taskHandle = nullptr;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+void StorageRetention::stop() {
+    if (taskHandle == nullptr) {
+        return;
+    }
+
+    running = false;
+    notify();
+
+    // Task tự thoát sau bước xóa hiện tại
+    for (int i = 0; i < 50 && taskHandle != nullptr; i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    if (taskHandle != nullptr) {
+        ESP_LOGW(TAG, "Retention task did not stop in time");
+    }
+}
+
+void StorageRetention::evictRound() {
+    if (!deleter) {
+        return;
+    }
+
+    uint64_t high = 0;
+    uint64_t low = 0;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+    if (budgetBytes == 0 || usedLocked() <= budgetBytes * highPct / 100) {
+        xSemaphoreGive(mutex);
+        return;
+    }
+    high = budgetBytes * highPct / 100;
+    low = budgetBytes * lowPct / 100;
+    xSemaphoreGive(mutex);
+
+    ESP_LOGI(TAG, "Above high watermark (%llu MB), evicting to %llu MB",
+             high / (1024 * 1024), low / (1024 * 1024));
+
+    // Mỗi vòng chỉ xóa vài recording, giãn cách → không chiếm SD lâu
+    for (uint32_t n = 0; n < EVICT_MAX_PER_ROUND && running; n++) {
+        uint64_t used = 0;
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            used = usedLocked();
+            xSemaphoreGive(mutex);
+        }
+        if (used <= low) {
+            return;
+        }
+
+        CatalogEntry oldest;
+        if (!catalog.oldest(oldest) || !oldest.complete) {
+            return;
+        }
+
+        esp_err_t ret = deleter(oldest);
+        if (ret == ESP_ERR_TIMEOUT || ret == ESP_ERR_INVALID_STATE) {
+            // Đang ghi recording → đợi, không tranh SD. Vừa bị pin (upload) → oldest() bỏ qua nó
+            vTaskDelay(pdMS_TO_TICKS(BUSY_RETRY_MS));
+            continue;
+        }
+        if (ret != ESP_OK) {
+            ESP_LOGW(TAG, "Evict %s failed: %s", oldest.name, esp_err_to_name(ret));
+            return;
+        }
+
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            evictedCount++;
+            evictedBytes += oldest.totalBytes;
+            xSemaphoreGive(mutex);
+        }
+        ESP_LOGI(TAG, "Evicted %s (%lu KB)", oldest.name, oldest.totalBytes / 1024);
+
+        vTaskDelay(pdMS_TO_TICKS(EVICT_STEP_MS));
+    }
+
+    // Chưa xuống tới low watermark → vòng kế tiếp chạy ngay
+    notify();
+}
+
+void StorageRetention::taskFunc(void* param) {
+    StorageRetention* self = static_cast<StorageRetention*>(param);
+
+    ESP_LOGI(TAG, "Retention task started");
+
+    TickType_t lastRefresh = xTaskGetTickCount();
+
+    while (self->running) {
+        xSemaphoreTake(self->kick, pdMS_TO_TICKS(POLL_INTERVAL_MS));
+        if (!self->running) {
+            break;
+        }
+
+        // Đồng bộ lại với FAT định kỳ (bù sai số cluster slack)
+        if (xTaskGetTickCount() - lastRefresh >= pdMS_TO_TICKS(REFRESH_INTERVAL_MS) &&
+            self->refresh() != ESP_ERR_INVALID_STATE) {
+            lastRefresh = xTaskGetTickCount();
+        }
+
+        self->evictRound();
+    }
+
+    ESP_LOGI(TAG, "Retention task ended");
+    self->taskHandle = nullptr;
+    vTaskDelete(nullptr);
+}
+
+RetentionStats StorageRetention::getStats() const {
+    RetentionStats stats = {};
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        stats.budgetBytes = budgetBytes;
+        stats.usedBytes = usedLocked();
+        stats.evictedCount = evictedCount;
+        stats.evictedBytes = evictedBytes;
+        stats.refusedCount = refusedCount;
+        stats.shortenedCount = shortenedCount;
+        xSemaphoreGive(mutex);
+    }
+
+    return stats;
+}
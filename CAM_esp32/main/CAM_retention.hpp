@@ -0,0 +1,95 @@
+#ifndef CAM_RETENTION_HPP
+#define CAM_RETENTION_HPP
+
+#include "CAM_catalog.hpp"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <string>
+#include <cstdint>
+#include <functional>
+
+struct RetentionStats {
+    uint64_t budgetBytes;       // Dung lượng được phép dùng cho recording
+    uint64_t usedBytes;         // Catalog + phần đã reserve cho recording đang ghi
+    uint32_t evictedCount;
+    uint64_t evictedBytes;
+    uint32_t refusedCount;      // Recording bị từ chối (hết quota)
+    uint32_t shortenedCount;    // Recording bị rút ngắn cho vừa quota
+};
+
+// Storage Retention Class - quota theo dung lượng + xóa recording cũ nhất
+//   - used = catalog.totalBytes() + reserve của recording đang ghi (cập nhật tăng dần)
+//   - used > high watermark → task ưu tiên thấp xóa dần tới low watermark
+//   - Recording mới được admit() trước: rút ngắn hoặc từ chối thay vì lỗi giữa chừng
+class StorageRetention {
+public:
+    // Xóa 1 recording. Trả ESP_ERR_TIMEOUT nếu SD đang bận ghi (thử lại sau)
+    using Deleter = std::function<esp_err_t(const CatalogEntry&)>;
+
+private:
+    RecordingCatalog& catalog;
+    std::string mountPoint;
+    Deleter deleter;
+
+    uint64_t quotaBytes;        // 0 = tự tính từ dung lượng thẻ
+    uint64_t budgetBytes;
+    uint64_t reservedBytes;
+    uint8_t highPct;
+    uint8_t lowPct;
+
+    uint32_t evictedCount;
+    uint64_t evictedBytes;
+    uint32_t refusedCount;
+    uint32_t shortenedCount;
+
+    TaskHandle_t taskHandle;
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t kick;
+    volatile bool running;
+
+    static const char* TAG;
+    static constexpr uint8_t PRIORITY_RETENTION_TASK = 1;      // Thấp hơn write task
+    static constexpr uint32_t POLL_INTERVAL_MS = 60000;
+    static constexpr uint32_t EVICT_STEP_MS = 500;             // Giãn cách giữa 2 lần xóa
+    static constexpr uint32_t BUSY_RETRY_MS = 2000;
+    static constexpr uint32_t EVICT_MAX_PER_ROUND = 8;
+    static constexpr uint32_t REFRESH_INTERVAL_MS = 10 * 60 * 1000;
+    static constexpr uint64_t FS_RESERVE_BYTES = 64ULL * 1024 * 1024;   // Chừa cho FS/file khác
+
+    static void taskFunc(void* param);
+    void evictRound();
+    uint64_t usedLocked() const;
+
+public:
+    StorageRetention(RecordingCatalog& cat, const std::string& mount_point);
+    ~StorageRetention();
+
+    // Disable copy
+    StorageRetention(const StorageRetention&) = delete;
+    StorageRetention& operator=(const StorageRetention&) = delete;
+
+    void setDeleter(Deleter fn) { deleter = fn; }
+
+    // quota = 0 → dùng toàn bộ thẻ (trừ FS_RESERVE_BYTES)
+    void setQuota(uint64_t quota, uint8_t highWatermarkPct = 90, uint8_t lowWatermarkPct = 80);
+
+    esp_err_t start();
+    void stop();
+
+    // Đọc lại free space từ FAT (chỉ gọi khi không có recording đang ghi)
+    esp_err_t refresh();
+
+    // Xin dung lượng cho recording mới: trả về số byte được cấp (0 = từ chối)
+    uint64_t admit(uint64_t wantedBytes, uint64_t minBytes);
+    // Recording kết thúc: trả phần reserve (byte thực tế đã vào catalog)
+    void release(uint64_t grantedBytes);
+
+    // Đánh thức task (vd. sau khi recording kết thúc)
+    void notify();
+
+    RetentionStats getStats() const;
+};
+
+#endif // CAM_RETENTION_HPP
@@ -0,0 +1,979 @@
+#include "CAM_rtsp.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include <sys/time.h>
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+#include <strings.h>
+#include <algorithm>
+
+const char* RtspServer::TAG = "RTSP";
+
+static constexpr uint32_t NTP_UNIX_OFFSET = 2208988800UL;     // 1900 → 1970
+
+static inline void put16(uint8_t* p, uint16_t v) {
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static inline void put32(uint8_t* p, uint32_t v) {
+    p[0] = v >> 24;
+    p[1] = (v >> 16) & 0xFF;
+    p[2] = (v >> 8) & 0xFF;
+    p[3] = v & 0xFF;
+}
+
+static bool sendAll(int fd, const void* data, size_t len) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (len > 0) {
+        int sent = send(fd, p, len, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        len -= sent;
+    }
+    return true;
+}
+
+RtspServer::RtspServer(FrameBroker& frameBroker)
+    : broker(frameBroker), listenFd(-1), serverTask(nullptr), running(false) {
+
+    mutex = xSemaphoreCreateMutex();
+    serverDone = xSemaphoreCreateBinary();
+    if (mutex == nullptr || serverDone == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+
+    for (Session& session : sessions) {
+        memset(&session, 0, sizeof(session));
+        session.owner = this;
+        session.state = SessionState::FREE;
+        session.ctrlFd = -1;
+        session.rtpFd = -1;
+        session.rtcpFd = -1;
+        session.consumer = -1;
+        session.txDone = xSemaphoreCreateBinary();
+        session.sendMutex = xSemaphoreCreateMutex();
+    }
+}
+
+RtspServer::~RtspServer() {
+    stop();
+
+    for (Session& session : sessions) {
+        if (session.txDone) {
+            vSemaphoreDelete(session.txDone);
+        }
+        if (session.sendMutex) {
+            vSemaphoreDelete(session.sendMutex);
+        }
+    }
+    if (serverDone) {
+        vSemaphoreDelete(serverDone);
+    }
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+// ==================== Server ====================
+
+esp_err_t RtspServer::start() {
+    if (serverTask != nullptr) {
+        return ESP_OK;
+    }
+
+    listenFd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listenFd < 0) {
+        ESP_LOGE(TAG, "Failed to create socket: errno %d", errno);
+        return ESP_FAIL;
+    }
+
+    int reuse = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(RTSP_PORT);
+
+    if (bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+        listen(listenFd, MAX_SESSIONS) != 0) {
+        ESP_LOGE(TAG, "Failed to listen on port %u: errno %d", RTSP_PORT, errno);
+        close(listenFd);
+        listenFd = -1;
+        return ESP_FAIL;
+    }
+
+    running = true;
+    xSemaphoreTake(serverDone, 0);
+
+    if (xTaskCreate(serverTaskFunc, "rtsp_srv", 6144, this, PRIORITY_SERVER_TASK, &serverTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create server task");
+        running = false;
+        serverTask = nullptr;
+        close(listenFd);
+        listenFd = -1;
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "RTSP server started on port %u", RTSP_PORT);
+    return ESP_OK;
+}
+
+void RtspServer::stop() {
+    if (serverTask == nullptr) {
+        return;
+    }
+
+    // Server task thoát ở lần select() kế tiếp (timeout 1 s), tự đóng mọi session
+    running = false;
+    if (xSemaphoreTake(serverDone, pdMS_TO_TICKS(STOP_TIMEOUT_MS * MAX_SESSIONS + 1000)) != pdTRUE) {
+        ESP_LOGE(TAG, "Server task did not stop");
+        return;
+    }
+    serverTask = nullptr;
+
+    ESP_LOGI(TAG, "RTSP server stopped");
+}
+
+void RtspServer::serverTaskFunc(void* param) {
+    RtspServer* server = static_cast<RtspServer*>(param);
+    server->serverLoop();
+
+    xSemaphoreGive(server->serverDone);
+    vTaskDelete(nullptr);
+}
+
+void RtspServer::serverLoop() {
+    while (running) {
+        fd_set readSet;
+        FD_ZERO(&readSet);
+        FD_SET(listenFd, &readSet);
+        int maxFd = listenFd;
+
+        for (Session& session : sessions) {
+            if (session.state == SessionState::FREE) {
+                continue;
+            }
+            FD_SET(session.ctrlFd, &readSet);
+            maxFd = std::max(maxFd, session.ctrlFd);
+            if (session.rtcpFd >= 0) {
+                FD_SET(session.rtcpFd, &readSet);
+                maxFd = std::max(maxFd, session.rtcpFd);
+            }
+        }
+
+        struct timeval timeout = { 1, 0 };
+        int ready = select(maxFd + 1, &readSet, nullptr, nullptr, &timeout);
+        if (ready < 0) {
+            ESP_LOGW(TAG, "select failed: errno %d", errno);
+            vTaskDelay(pdMS_TO_TICKS(100));
+            continue;
+        }
+
+        if (ready > 0 && FD_ISSET(listenFd, &readSet)) {
+            acceptClient();
+        }
+
+        int64_t nowUs = esp_timer_get_time();
+        for (Session& session : sessions) {
+            if (session.state == SessionState::FREE) {
+                continue;
+            }
+
+            if (ready > 0 && FD_ISSET(session.ctrlFd, &readSet)) {
+                receive(session);
+                if (session.state == SessionState::FREE) {
+                    continue;
+                }
+            }
+
+            // RTCP receiver report (UDP) chỉ dùng làm keepalive
+            if (ready > 0 && session.rtcpFd >= 0 && FD_ISSET(session.rtcpFd, &readSet)) {
+                uint8_t report[128];
+                if (recv(session.rtcpFd, report, sizeof(report), 0) > 0) {
+                    session.lastActivityUs = nowUs;
+                }
+            }
+
+            // Interleaved: kết nối TCP còn sống là đủ. UDP: client phải gửi RTCP/request định kỳ
+            bool tcpPlaying = session.tcp && session.state == SessionState::PLAYING;
+            if (session.txFailed ||
+                (!tcpPlaying && nowUs - session.lastActivityUs > (int64_t)SESSION_TIMEOUT_S * 1000000)) {
+                ESP_LOGW(TAG, "Session %08lX %s", session.id, session.txFailed ? "send failed" : "timed out");
+                closeSession(session);
+            }
+        }
+    }
+
+    for (Session& session : sessions) {
+        if (session.state != SessionState::FREE) {
+            closeSession(session);
+        }
+    }
+    close(listenFd);
+    listenFd = -1;
+}
+
+void RtspServer::acceptClient() {
+    struct sockaddr_in peer = {};
+    socklen_t peerLen = sizeof(peer);
+    int fd = accept(listenFd, (struct sockaddr*)&peer, &peerLen);
+    if (fd < 0) {
+        return;
+    }
+
+    Session* session = nullptr;
+    for (Session& candidate : sessions) {
+        if (candidate.state == SessionState::FREE) {
+            session = &candidate;
+            break;
+        }
+    }
+    if (session == nullptr) {
+        ESP_LOGW(TAG, "Session limit reached (%u), rejecting %s", MAX_SESSIONS, inet_ntoa(peer.sin_addr));
+        close(fd);
+        return;
+    }
+
+    int noDelay = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+    struct timeval sendTimeout = { SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        session->ctrlFd = fd;
+        session->id = esp_random();
+        session->lastActivityUs = esp_timer_get_time();
+        session->rxLen = 0;
+        session->tcp = false;
+        session->txStop = false;
+        session->txFailed = false;
+        session->frames = 0;
+        session->packets = 0;
+        session->bytes = 0;
+        session->sendErrors = 0;
+        session->state = SessionState::CONNECTED;
+        xSemaphoreGive(mutex);
+    }
+
+    ESP_LOGI(TAG, "Client %s connected (session %08lX)", inet_ntoa(peer.sin_addr), session->id);
+}
+
+void RtspServer::receive(Session& session) {
+    size_t space = sizeof(session.rxBuf) - 1 - session.rxLen;
+    int received = space > 0 ? recv(session.ctrlFd, session.rxBuf + session.rxLen, space, 0) : 0;
+    if (received <= 0) {
+        if (space == 0) {
+            ESP_LOGW(TAG, "Session %08lX: request too large", session.id);
+        }
+        closeSession(session);
+        return;
+    }
+    session.rxLen += received;
+    session.lastActivityUs = esp_timer_get_time();
+
+    while (session.rxLen > 0) {
+        size_t consumed;
+
+        if (session.rxBuf[0] == '$') {
+            // RTCP interleaved từ client ('$' kênh len16) → bỏ qua
+            if (session.rxLen < 4) {
+                return;
+            }
+            consumed = 4 + (((uint8_t)session.rxBuf[2] << 8) | (uint8_t)session.rxBuf[3]);
+            if (consumed > sizeof(session.rxBuf) - 1) {
+                ESP_LOGW(TAG, "Session %08lX: interleaved packet too large", session.id);
+                closeSession(session);
+                return;
+            }
+            if (session.rxLen < consumed) {
+                return;
+            }
+        } else {
+            session.rxBuf[session.rxLen] = '\0';
+            char* end = strstr(session.rxBuf, "\r\n\r\n");
+            if (end == nullptr) {
+                return;
+            }
+
+            // Giữ "\r\n" của header cuối, cắt phần body
+            end[2] = '\0';
+            size_t headerLen = end + 4 - session.rxBuf;
+
+            char value[16];
+            size_t bodyLen = 0;
+            if (getHeader(session.rxBuf, "Content-Length", value, sizeof(value))) {
+                bodyLen = strtoul(value, nullptr, 10);
+            }
+            consumed = headerLen + bodyLen;
+            if (consumed > sizeof(session.rxBuf) - 1) {
+                closeSession(session);
+                return;
+            }
+            if (session.rxLen < consumed) {
+                end[2] = '\r';
+                return;
+            }
+
+            handleRequest(session, session.rxBuf);
+            if (session.state == SessionState::FREE) {
+                return;
+            }
+        }
+
+        memmove(session.rxBuf, session.rxBuf + consumed, session.rxLen - consumed);
+        session.rxLen -= consumed;
+    }
+}
+
+bool RtspServer::getHeader(const char* request, const char* name, char* value, size_t len) {
+    size_t nameLen = strlen(name);
+
+    for (const char* line = strstr(request, "\r\n"); line != nullptr; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, name, nameLen) != 0 || line[nameLen] != ':') {
+            continue;
+        }
+
+        const char* start = line + nameLen + 1;
+        while (*start == ' ') {
+            start++;
+        }
+        const char* stop = strstr(start, "\r\n");
+        size_t valueLen = stop ? stop - start : strlen(start);
+        if (valueLen >= len) {
+            valueLen = len - 1;
+        }
+        memcpy(value, start, valueLen);
+        value[valueLen] = '\0';
+        return true;
+    }
+
+    return false;
+}
+
+// ==================== RTSP methods ====================
+
+void RtspServer::handleRequest(Session& session, char* request) {
+    char method[16];
+    char url[128];
+    if (sscanf(request, "%15s %127s", method, url) != 2) {
+        sendResponse(session, 0, "400 Bad Request");
+        return;
+    }
+
+    char value[128];
+    int cseq = getHeader(request, "CSeq", value, sizeof(value)) ? atoi(value) : 0;
+
+    ESP_LOGD(TAG, "Session %08lX: %s %s", session.id, method, url);
+
+    if (strcmp(method, "OPTIONS") == 0) {
+        sendResponse(session, cseq, "200 OK",
+                     "Public: OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN, GET_PARAMETER\r\n");
+    } else if (strcmp(method, "DESCRIBE") == 0) {
+        handleDescribe(session, cseq, url);
+    } else if (strcmp(method, "SETUP") == 0) {
+        if (!getHeader(request, "Transport", value, sizeof(value))) {
+            sendResponse(session, cseq, "461 Unsupported Transport");
+            return;
+        }
+        handleSetup(session, cseq, value);
+    } else if (strcmp(method, "PLAY") == 0) {
+        handlePlay(session, cseq, url);
+    } else if (strcmp(method, "PAUSE") == 0) {
+        if (session.state < SessionState::READY) {
+            sendResponse(session, cseq, "455 Method Not Valid in This State");
+            return;
+        }
+        stopPlaying(session);
+        sendResponse(session, cseq, "200 OK");
+    } else if (strcmp(method, "TEARDOWN") == 0) {
+        sendResponse(session, cseq, "200 OK");
+        closeSession(session);
+    } else if (strcmp(method, "GET_PARAMETER") == 0 || strcmp(method, "SET_PARAMETER") == 0) {
+        // Keepalive của client
+        sendResponse(session, cseq, "200 OK");
+    } else {
+        sendResponse(session, cseq, "501 Not Implemented");
+    }
+}
+
+void RtspServer::sendResponse(Session& session, int cseq, const char* status,
+                              const char* headers, const char* body) {
+    char response[1024];
+    int len = snprintf(response, sizeof(response), "RTSP/1.0 %s\r\nCSeq: %d\r\nServer: ESP32-CAM\r\n",
+                       status, cseq);
+
+    if (session.state >= SessionState::READY) {
+        len += snprintf(response + len, sizeof(response) - len, "Session: %08lX;timeout=%lu\r\n",
+                        session.id, SESSION_TIMEOUT_S);
+    }
+    if (headers) {
+        len += snprintf(response + len, sizeof(response) - len, "%s", headers);
+    }
+    if (body) {
+        len += snprintf(response + len, sizeof(response) - len, "Content-Length: %u\r\n\r\n%s",
+                        strlen(body), body);
+    } else {
+        len += snprintf(response + len, sizeof(response) - len, "\r\n");
+    }
+
+    if (len >= (int)sizeof(response)) {
+        ESP_LOGE(TAG, "Response too large");
+        return;
+    }
+
+    if (session.txFailed) {
+        return;
+    }
+
+    // Interleaved: không chen vào giữa 1 gói RTP đang gửi. Chờ có giới hạn: tx task của client
+    // không đọc có thể giữ mutex tới SEND_TIMEOUT_MS/gói → không được chặn server task (mọi session)
+    if (xSemaphoreTake(session.sendMutex, pdMS_TO_TICKS(RESPONSE_LOCK_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Session %08lX: connection congested, closing", session.id);
+        session.txFailed = true;    // Server loop đóng session sau request này
+        return;
+    }
+    bool ok = sendAll(session.ctrlFd, response, len);
+    xSemaphoreGive(session.sendMutex);
+
+    if (!ok) {
+        ESP_LOGW(TAG, "Session %08lX: failed to send response", session.id);
+    }
+}
+
+void RtspServer::handleDescribe(Session& session, int cseq, const char* url) {
+    struct sockaddr_in local = {};
+    socklen_t localLen = sizeof(local);
+    getsockname(session.ctrlFd, (struct sockaddr*)&local, &localLen);
+
+    char sdp[384];
+    snprintf(sdp, sizeof(sdp),
+             "v=0\r\n"
+             "o=- %lu 1 IN IP4 %s\r\n"
+             "s=ESP32-CAM\r\n"
+             "c=IN IP4 0.0.0.0\r\n"
+             "t=0 0\r\n"
+             "a=control:*\r\n"
+             "a=range:npt=0-\r\n"
+             "m=video 0 RTP/AVP %u\r\n"
+             "a=rtpmap:%u JPEG/90000\r\n"
+             "a=framerate:%u\r\n"
+             "a=control:track0\r\n",
+             session.id, inet_ntoa(local.sin_addr), RTP_PAYLOAD_JPEG, RTP_PAYLOAD_JPEG, RTSP_FPS);
+
+    // Content-Base có '/' cuối → client ghép "track0" thành URL của track
+    size_t urlLen = strlen(url);
+    const char* slash = (urlLen > 0 && url[urlLen - 1] == '/') ? "" : "/";
+    char headers[192];
+    snprintf(headers, sizeof(headers), "Content-Type: application/sdp\r\nContent-Base: %s%s\r\n", url, slash);
+
+    sendResponse(session, cseq, "200 OK", headers, sdp);
+}
+
+void RtspServer::handleSetup(Session& session, int cseq, const char* transport) {
+    if (session.state == SessionState::PLAYING) {
+        sendResponse(session, cseq, "455 Method Not Valid in This State");
+        return;
+    }
+    if (strstr(transport, "multicast")) {
+        sendResponse(session, cseq, "461 Unsupported Transport");
+        return;
+    }
+
+    char headers[160];
+    uint32_t ssrc = esp_random();
+
+    if (strstr(transport, "RTP/AVP/TCP") || strstr(transport, "interleaved=")) {
+        unsigned rtpChannel = 0;
+        unsigned rtcpChannel = 1;
+        const char* interleaved = strstr(transport, "interleaved=");
+        if (interleaved) {
+            sscanf(interleaved, "interleaved=%u-%u", &rtpChannel, &rtcpChannel);
+        }
+
+        session.tcp = true;
+        session.rtpChannel = rtpChannel;
+        session.rtcpChannel = rtcpChannel;
+        snprintf(headers, sizeof(headers), "Transport: RTP/AVP/TCP;unicast;interleaved=%u-%u;ssrc=%08lX\r\n",
+                 rtpChannel, rtcpChannel, ssrc);
+    } else {
+        unsigned clientRtp = 0;
+        unsigned clientRtcp = 0;
+        const char* ports = strstr(transport, "client_port=");
+        if (ports == nullptr || sscanf(ports, "client_port=%u-%u", &clientRtp, &clientRtcp) < 1) {
+            sendResponse(session, cseq, "461 Unsupported Transport");
+            return;
+        }
+        if (clientRtcp == 0) {
+            clientRtcp = clientRtp + 1;
+        }
+
+        if (session.rtpFd < 0 &&
+            openUdpPair(session, RTP_PORT_BASE + 2 * (&session - sessions)) != ESP_OK) {
+            sendResponse(session, cseq, "500 Internal Server Error");
+            return;
+        }
+
+        // RTP gửi về địa chỉ của kết nối RTSP
+        struct sockaddr_in peer = {};
+        socklen_t peerLen = sizeof(peer);
+        getpeername(session.ctrlFd, (struct sockaddr*)&peer, &peerLen);
+        session.rtpPeer = peer;
+        session.rtpPeer.sin_port = htons(clientRtp);
+        session.rtcpPeer = peer;
+        session.rtcpPeer.sin_port = htons(clientRtcp);
+
+        session.tcp = false;
+        snprintf(headers, sizeof(headers),
+                 "Transport: RTP/AVP;unicast;client_port=%u-%u;server_port=%u-%u;ssrc=%08lX\r\n",
+                 clientRtp, clientRtcp, session.serverPort, session.serverPort + 1, ssrc);
+    }
+
+    session.ssrc = ssrc;
+    session.timestampBase = esp_random();
+    session.seq = esp_random() & 0xFFFF;
+    session.state = SessionState::READY;
+
+    sendResponse(session, cseq, "200 OK", headers);
+    ESP_LOGI(TAG, "Session %08lX: SETUP %s", session.id, session.tcp ? "TCP interleaved" : "UDP");
+}
+
+void RtspServer::handlePlay(Session& session, int cseq, const char* url) {
+    if (session.state < SessionState::READY) {
+        sendResponse(session, cseq, "455 Method Not Valid in This State");
+        return;
+    }
+    if (session.state == SessionState::PLAYING) {
+        sendResponse(session, cseq, "200 OK");
+        return;
+    }
+
+    if (session.packet == nullptr) {
+        session.packet = (uint8_t*)heap_caps_malloc(4 + RTP_PACKET_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    }
+    session.consumer = session.packet ? broker.subscribe("rtsp", RTSP_FPS, QueueDropPolicy::DROP_OLDEST) : -1;
+    if (session.consumer < 0) {
+        ESP_LOGW(TAG, "Session %08lX: no frame consumer available", session.id);
+        sendResponse(session, cseq, "503 Service Unavailable");
+        return;
+    }
+
+    char headers[256];
+    size_t urlLen = strlen(url);
+    bool trackUrl = strstr(url, "track0") != nullptr;
+    snprintf(headers, sizeof(headers), "Range: npt=0.000-\r\nRTP-Info: url=%.*s%s;seq=%u;rtptime=%lu\r\n",
+             (int)(urlLen > 0 && url[urlLen - 1] == '/' ? urlLen - 1 : urlLen), url,
+             trackUrl ? "" : "/track0", session.seq, rtpTimestamp(session, esp_timer_get_time()));
+
+    // Response trước gói RTP đầu tiên (interleaved dùng chung socket)
+    sendResponse(session, cseq, "200 OK", headers);
+
+    session.txStop = false;
+    session.txFailed = false;
+    session.lastSrUs = 0;
+    xSemaphoreTake(session.txDone, 0);
+    session.state = SessionState::PLAYING;
+
+    if (xTaskCreate(txTaskFunc, "rtsp_tx", 4096, &session, PRIORITY_TX_TASK, &session.txTask) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create tx task");
+        broker.unsubscribe(session.consumer);
+        session.consumer = -1;
+        session.txTask = nullptr;
+        session.state = SessionState::READY;
+        return;
+    }
+
+    ESP_LOGI(TAG, "Session %08lX: PLAY", session.id);
+}
+
+void RtspServer::stopPlaying(Session& session) {
+    if (session.state != SessionState::PLAYING) {
+        return;
+    }
+
+    // Đánh thức acquire đang chờ → tx task thoát sau frame đang gửi
+    session.txStop = true;
+    broker.cancel(session.consumer);
+    if (xSemaphoreTake(session.txDone, pdMS_TO_TICKS(STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGE(TAG, "Session %08lX: tx task did not stop", session.id);
+    }
+
+    broker.unsubscribe(session.consumer);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        session.consumer = -1;
+        session.txTask = nullptr;
+        session.state = SessionState::READY;
+        xSemaphoreGive(mutex);
+    }
+}
+
+void RtspServer::closeSession(Session& session) {
+    stopPlaying(session);
+
+    ESP_LOGI(TAG, "Session %08lX closed: %lu frames, %lu packets, %llu KB, %lu send errors",
+             session.id, session.frames, session.packets, session.bytes / 1024, session.sendErrors);
+
+    close(session.ctrlFd);
+    if (session.rtpFd >= 0) {
+        close(session.rtpFd);
+    }
+    if (session.rtcpFd >= 0) {
+        close(session.rtcpFd);
+    }
+    heap_caps_free(session.packet);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        session.ctrlFd = -1;
+        session.rtpFd = -1;
+        session.rtcpFd = -1;
+        session.packet = nullptr;
+        session.rxLen = 0;
+        session.state = SessionState::FREE;
+        xSemaphoreGive(mutex);
+    }
+}
+
+esp_err_t RtspServer::openUdpPair(Session& session, uint16_t port) {
+    int fds[2] = { -1, -1 };
+
+    for (int i = 0; i < 2; i++) {
+        fds[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+        struct sockaddr_in addr = {};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(port + i);
+
+        if (fds[i] < 0 || bind(fds[i], (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+            ESP_LOGE(TAG, "Failed to bind UDP port %u: errno %d", port + i, errno);
+            for (int fd : fds) {
+                if (fd >= 0) {
+                    close(fd);
+                }
+            }
+            return ESP_FAIL;
+        }
+    }
+
+    session.rtpFd = fds[0];
+    session.rtcpFd = fds[1];
+    session.serverPort = port;
+    return ESP_OK;
+}
+
+// ==================== RTP/JPEG ====================
+
+void RtspServer::txTaskFunc(void* param) {
+    Session* session = static_cast<Session*>(param);
+    session->owner->txLoop(*session);
+
+    xSemaphoreGive(session->txDone);
+    vTaskDelete(nullptr);
+}
+
+void RtspServer::txLoop(Session& session) {
+    while (!session.txStop) {
+        FrameHandle frame;
+        if (!broker.acquire(session.consumer, frame, pdMS_TO_TICKS(FRAME_TIMEOUT_MS))) {
+            continue;
+        }
+
+        if (sendFrame(session, frame) != ESP_OK) {
+            session.txFailed = true;
+            broker.release(session.consumer, frame);
+            return;
+        }
+        broker.release(session.consumer, frame);
+
+        int64_t nowUs = esp_timer_get_time();
+        if (nowUs - session.lastSrUs >= RTCP_INTERVAL_US) {
+            sendSenderReport(session);
+            session.lastSrUs = nowUs;
+        }
+    }
+}
+
+uint32_t RtspServer::rtpTimestamp(const Session& session, int64_t timeUs) const {
+    // 90 kHz, bắt đầu từ offset ngẫu nhiên (RFC 3550)
+    return session.timestampBase + (uint32_t)((uint64_t)timeUs * 9 / 100);
+}
+
+bool RtspServer::parseJpeg(const uint8_t* data, size_t len, RtpJpegFrame& out) {
+    if (len < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+    out = {};
+    bool haveFrame = false;
+    size_t pos = 2;
+
+    while (pos + 4 <= len) {
+        if (data[pos] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = data[pos + 1];
+        if (marker == 0xFF) {
+            pos++;          // Fill byte
+            continue;
+        }
+
+        size_t segLen = (data[pos + 2] << 8) | data[pos + 3];
+        if (segLen < 2 || pos + 2 + segLen > len) {
+            return false;
+        }
+        const uint8_t* seg = data + pos + 4;
+        size_t segBytes = segLen - 2;
+
+        if (marker == 0xDB) {
+            // DQT: có thể chứa nhiều bảng, chỉ nhận bảng 8-bit
+            for (size_t q = 0; q < segBytes; q += 65) {
+                uint8_t precision = seg[q] >> 4;
+                uint8_t id = seg[q] & 0x0F;
+                if (precision != 0 || q + 65 > segBytes) {
+                    return false;
+                }
+                if (id < 2) {
+                    out.qtables[id] = seg + q + 1;
+                }
+            }
+        } else if (marker == 0xC0) {
+            // SOF0: 3 thành phần, Y 2x1 (4:2:2) hoặc 2x2 (4:2:0), Cb/Cr 1x1
+            if (segBytes < 15 || seg[5] != 3 || seg[10] != 0x11 || seg[13] != 0x11) {
+                return false;
+            }
+            out.height = (seg[1] << 8) | seg[2];
+            out.width = (seg[3] << 8) | seg[4];
+            if (seg[7] == 0x21) {
+                out.type = 0;
+            } else if (seg[7] == 0x22) {
+                out.type = 1;
+            } else {
+                return false;
+            }
+            haveFrame = true;
+        } else if (marker >= 0xC1 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) {
+            return false;   // Progressive / lossless / arithmetic
+        } else if (marker == 0xDD) {
+            if (segBytes < 2) {
+                return false;
+            }
+            out.restartInterval = (seg[0] << 8) | seg[1];
+        } else if (marker == 0xDA) {
+            // Scan tới EOI (buffer driver có thể có padding sau EOI)
+            size_t start = pos + 2 + segLen;
+            size_t end = len;
+            size_t limit = len > start + 1024 ? len - 1024 : start;
+            for (size_t e = len; e >= limit + 2; e--) {
+                if (data[e - 2] == 0xFF && data[e - 1] == 0xD9) {
+                    end = e - 2;
+                    break;
+                }
+            }
+
+            // Width/height gửi theo đơn vị 8 pixel trong 1 byte
+            if (!haveFrame || out.qtables[0] == nullptr || out.width > 2040 || out.height > 2040 ||
+                end <= start) {
+                return false;
+            }
+            if (out.qtables[1] == nullptr) {
+                out.qtables[1] = out.qtables[0];
+            }
+            if (out.restartInterval) {
+                out.type |= 64;
+            }
+            out.scan = data + start;
+            out.scanLen = end - start;
+            return true;
+        }
+
+        pos += 2 + segLen;
+    }
+
+    return false;
+}
+
+bool RtspServer::sendPacket(Session& session, bool rtcp, size_t len) {
+    if (session.tcp) {
+        // '$' kênh len16 + gói, chung socket với response RTSP
+        session.packet[0] = '$';
+        session.packet[1] = rtcp ? session.rtcpChannel : session.rtpChannel;
+        put16(session.packet + 2, len);
+
+        xSemaphoreTake(session.sendMutex, portMAX_DELAY);
+        bool ok = sendAll(session.ctrlFd, session.packet, len + 4);
+        xSemaphoreGive(session.sendMutex);
+        return ok;
+    }
+
+    const struct sockaddr_in& peer = rtcp ? session.rtcpPeer : session.rtpPeer;
+    int sent = sendto(rtcp ? session.rtcpFd : session.rtpFd, session.packet, len, 0,
+                      (const struct sockaddr*)&peer, sizeof(peer));
+    return sent == (int)len;
+}
+
+esp_err_t RtspServer::sendFrame(Session& session, const FrameHandle& frame) {
+    RtpJpegFrame jpeg;
+    if (!parseJpeg(frame.data().data(), frame.size(), jpeg)) {
+        ESP_LOGW(TAG, "Frame not packetizable (RFC 2435 needs baseline YUV420/422), skipped");
+        return ESP_OK;
+    }
+
+    uint32_t timestamp = rtpTimestamp(session, frame.timestampUs());
+    uint8_t* packet = session.packet + (session.tcp ? 4 : 0);
+    uint32_t packets = 0;
+    uint64_t bytes = 0;
+    size_t offset = 0;
+
+    while (offset < jpeg.scanLen) {
+        // RTP header: V=2, PT=26, marker ở gói cuối của frame
+        packet[0] = 0x80;
+        packet[1] = RTP_PAYLOAD_JPEG;
+        put16(packet + 2, session.seq);
+        put32(packet + 4, timestamp);
+        put32(packet + 8, session.ssrc);
+        uint8_t* p = packet + 12;
+
+        // JPEG header: offset 24-bit, type, Q = 255 (bảng lượng tử in-band), width/8, height/8
+        p[0] = 0;
+        p[1] = (offset >> 16) & 0xFF;
+        p[2] = (offset >> 8) & 0xFF;
+        p[3] = offset & 0xFF;
+        p[4] = jpeg.type;
+        p[5] = 255;
+        p[6] = jpeg.width / 8;
+        p[7] = jpeg.height / 8;
+        p += 8;
+
+        if (jpeg.restartInterval) {
+            // F = L = 1, count = 0x3FFF → cắt gói ở bất kỳ đâu
+            put16(p, jpeg.restartInterval);
+            p[2] = 0xFF;
+            p[3] = 0xFF;
+            p += 4;
+        }
+
+        if (offset == 0) {
+            p[0] = 0;           // MBZ
+            p[1] = 0;           // Precision: 8-bit
+            put16(p + 2, 128);
+            memcpy(p + 4, jpeg.qtables[0], 64);
+            memcpy(p + 68, jpeg.qtables[1], 64);
+            p += 132;
+        }
+
+        size_t room = RTP_PACKET_BYTES - (p - packet);
+        size_t chunk = std::min(room, jpeg.scanLen - offset);
+        memcpy(p, jpeg.scan + offset, chunk);
+        p += chunk;
+        offset += chunk;
+        if (offset == jpeg.scanLen) {
+            packet[1] |= 0x80;
+        }
+
+        size_t len = p - packet;
+        if (!sendPacket(session, false, len)) {
+            if (session.tcp) {
+                return ESP_FAIL;
+            }
+            // UDP hết pbuf / WiFi nghẽn: frame này đã hỏng, bỏ phần còn lại
+            if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+                session.sendErrors++;
+                xSemaphoreGive(mutex);
+            }
+            break;
+        }
+
+        session.seq++;
+        packets++;
+        bytes += len;
+    }
+
+    session.lastRtpTimestamp = timestamp;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        session.frames++;
+        session.packets += packets;
+        session.bytes += bytes;
+        xSemaphoreGive(mutex);
+    }
+
+    return ESP_OK;
+}
+
+void RtspServer::sendSenderReport(Session& session) {
+    // RTCP SR: ánh xạ RTP timestamp ↔ wallclock (NTP) cho client đồng bộ / ghi thời gian
+    struct timeval now;
+    gettimeofday(&now, nullptr);
+    uint32_t ntpSec = (uint32_t)now.tv_sec + NTP_UNIX_OFFSET;
+    uint32_t ntpFrac = (uint32_t)(((uint64_t)now.tv_usec << 32) / 1000000);
+
+    uint8_t* p = session.packet + (session.tcp ? 4 : 0);
+    p[0] = 0x80;
+    p[1] = 200;                 // PT = SR
+    put16(p + 2, 6);            // Độ dài (word 32-bit) - 1
+    put32(p + 4, session.ssrc);
+    put32(p + 8, ntpSec);
+    put32(p + 12, ntpFrac);
+    put32(p + 16, rtpTimestamp(session, esp_timer_get_time()));
+    put32(p + 20, session.packets);
+    put32(p + 24, (uint32_t)session.bytes);
+
+    if (!sendPacket(session, true, 28) && session.tcp) {
+        session.txFailed = true;
+    }
+}
+
+// ==================== Stats ====================
+
+uint8_t RtspServer::getPlayingCount() const {
+    uint8_t count = 0;
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        for (const Session& session : sessions) {
+            if (session.state == SessionState::PLAYING) {
+                count++;
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    return count;
+}
+
+std::vector<RtspSessionStats> RtspServer::getSessionStats() const {
+    std::vector<RtspSessionStats> result;
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return result;
+    }
+
+    for (const Session& session : sessions) {
+        if (session.state == SessionState::FREE) {
+            continue;
+        }
+
+        RtspSessionStats stats = {};
+        stats.id = session.id;
+        stats.tcp = session.tcp;
+        stats.playing = session.state == SessionState::PLAYING;
+        stats.frames = session.frames;
+        stats.packets = session.packets;
+        stats.bytes = session.bytes;
+        stats.sendErrors = session.sendErrors;
+        if (session.consumer >= 0) {
+            stats.dropped = broker.getStats(session.consumer).dropped;
+        }
+        result.push_back(stats);
+    }
+
+    xSemaphoreGive(mutex);
+    return result;
+}
@@ -0,0 +1,164 @@
+#ifndef CAM_RTSP_HPP
+#define CAM_RTSP_HPP
+
+#include "CAM_frameBroker.hpp"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "lwip/sockets.h"
+#include <vector>
+#include <cstdint>
+
+// Counter của 1 session RTSP
+struct RtspSessionStats {
+    uint32_t id;
+    bool tcp;                   // RTP interleaved trên kết nối RTSP (false = UDP)
+    bool playing;
+    uint32_t frames;
+    uint32_t packets;
+    uint64_t bytes;
+    uint32_t dropped;           // Frame bị bỏ (broker mailbox, client chậm)
+    uint32_t sendErrors;        // UDP: hết pbuf → bỏ phần còn lại của frame
+};
+
+// JPEG baseline đã tách cho RFC 2435 (con trỏ vào buffer driver)
+struct RtpJpegFrame {
+    const uint8_t* scan;        // Entropy-coded data sau SOS, không gồm EOI
+    size_t scanLen;
+    const uint8_t* qtables[2];  // Luma, chroma (64 byte, 8-bit, zigzag như DQT)
+    uint16_t width;
+    uint16_t height;
+    uint16_t restartInterval;   // DRI, 0 = không có
+    uint8_t type;               // 0 = 4:2:2, 1 = 4:2:0 (+64 nếu có restart marker)
+};
+
+// RTSP Server Class - MJPEG cho NVR (RTSP/1.0, RTP/JPEG RFC 2435)
+//   rtsp://[ESP32_IP]:554/  (path bất kỳ, 1 track video)
+//   - Server task: accept + parse request (OPTIONS, DESCRIBE, SETUP, PLAY, PAUSE, TEARDOWN,
+//     GET_PARAMETER) cho mọi kết nối qua select()
+//   - Transport: RTP/AVP (UDP, client_port) hoặc RTP/AVP/TCP (interleaved trên kết nối RTSP)
+//   - Mỗi session PLAY là 1 consumer mailbox của FrameBroker + task gửi riêng (như /stream):
+//     client chậm chỉ bỏ frame của nó. UDP mất gói → mất frame đó, không làm nghẽn frame sau
+//   - RTP timestamp 90 kHz từ fb->timestamp (không phải lúc gửi), RTCP SR mỗi 5 s
+//   - Quantization table gửi in-band (Q = 255) → đổi quality (CAM_streamRate) không cần SETUP lại
+class RtspServer {
+private:
+    enum class SessionState : uint8_t {
+        FREE,
+        CONNECTED,              // Có kết nối RTSP, chưa SETUP
+        READY,                  // Đã SETUP
+        PLAYING
+    };
+
+    struct Session {
+        RtspServer* owner;
+        SessionState state;
+        int ctrlFd;
+        uint32_t id;
+        int64_t lastActivityUs;
+
+        // Buffer request RTSP (có thể chứa gói '$' RTCP interleaved từ client)
+        char rxBuf[1024];
+        size_t rxLen;
+
+        bool tcp;
+        uint8_t rtpChannel;
+        uint8_t rtcpChannel;
+        int rtpFd;              // UDP
+        int rtcpFd;
+        struct sockaddr_in rtpPeer;
+        struct sockaddr_in rtcpPeer;
+        uint16_t serverPort;
+
+        uint32_t ssrc;
+        uint32_t timestampBase;
+        uint16_t seq;
+        uint32_t lastRtpTimestamp;
+        int64_t lastSrUs;
+
+        int consumer;
+        TaskHandle_t txTask;
+        SemaphoreHandle_t txDone;
+        SemaphoreHandle_t sendMutex;    // TCP: RTP interleaved và response RTSP chung socket
+        volatile bool txStop;
+        volatile bool txFailed;         // TCP send lỗi → server task đóng session
+
+        uint8_t* packet;                // '$' header + 1 gói RTP (cấp khi PLAY)
+
+        uint32_t frames;
+        uint32_t packets;
+        uint64_t bytes;
+        uint32_t sendErrors;
+    };
+
+    FrameBroker& broker;
+    int listenFd;
+    TaskHandle_t serverTask;
+    SemaphoreHandle_t serverDone;
+    SemaphoreHandle_t mutex;            // Bảo vệ counter/state khi đọc stats
+    volatile bool running;
+
+    static const char* TAG;
+    static constexpr uint16_t RTSP_PORT = 554;
+    static constexpr uint16_t RTP_PORT_BASE = 5000;    // Session i: 5000 + 2i (RTP), +1 (RTCP)
+    static constexpr uint8_t MAX_SESSIONS = 2;
+    static constexpr uint8_t RTSP_FPS = 15;
+    static constexpr size_t RTP_PACKET_BYTES = 1400;   // < MTU WiFi, không phân mảnh IP
+    static constexpr uint8_t RTP_PAYLOAD_JPEG = 26;
+    static constexpr uint32_t SESSION_TIMEOUT_S = 60;
+    static constexpr int64_t RTCP_INTERVAL_US = 5000000;
+    static constexpr uint32_t FRAME_TIMEOUT_MS = 2000;
+    static constexpr uint32_t SEND_TIMEOUT_MS = 2000;   // TCP: client không đọc → đóng session
+    static constexpr uint32_t STOP_TIMEOUT_MS = SEND_TIMEOUT_MS + 1000;  // Tx có thể đang block trong send
+    static constexpr uint32_t RESPONSE_LOCK_MS = 200;   // Response chờ gói RTP interleaved đang gửi
+    static constexpr uint8_t PRIORITY_SERVER_TASK = 4;
+    static constexpr uint8_t PRIORITY_TX_TASK = 5;      // = /stream client
+
+    Session sessions[MAX_SESSIONS];
+
+    static void serverTaskFunc(void* param);
+    static void txTaskFunc(void* param);
+
+    void serverLoop();
+    void acceptClient();
+    void receive(Session& session);
+    void handleRequest(Session& session, char* request);
+    void sendResponse(Session& session, int cseq, const char* status,
+                      const char* headers = nullptr, const char* body = nullptr);
+
+    void handleDescribe(Session& session, int cseq, const char* url);
+    void handleSetup(Session& session, int cseq, const char* transport);
+    void handlePlay(Session& session, int cseq, const char* url);
+    void stopPlaying(Session& session);
+    void closeSession(Session& session);
+
+    void txLoop(Session& session);
+    esp_err_t sendFrame(Session& session, const FrameHandle& frame);
+    bool sendPacket(Session& session, bool rtcp, size_t len);
+    void sendSenderReport(Session& session);
+    uint32_t rtpTimestamp(const Session& session, int64_t timeUs) const;
+
+    static esp_err_t openUdpPair(Session& session, uint16_t port);
+    static bool getHeader(const char* request, const char* name, char* value, size_t len);
+
+public:
+    explicit RtspServer(FrameBroker& frameBroker);
+    ~RtspServer();
+
+    // Disable copy
+    RtspServer(const RtspServer&) = delete;
+    RtspServer& operator=(const RtspServer&) = delete;
+
+    esp_err_t start();
+    void stop();
+    bool isRunning() const { return serverTask != nullptr; }
+
+    std::vector<RtspSessionStats> getSessionStats() const;
+    uint8_t getPlayingCount() const;
+
+    // RFC 2435: tách JPEG baseline (DQT, SOF0, DRI, SOS) → false nếu không đóng gói được
+    static bool parseJpeg(const uint8_t* data, size_t len, RtpJpegFrame& out);
+};
+
+#endif // CAM_RTSP_HPP
@@ -1,10 +1,19 @@
 #include "CAM_sensorRead.hpp"
+#include "esp_timer.h"
+#include "esp_attr.h"
 
 const char* SensorManager::TAG = "SENSOR_MANAGER";
 
 // ==================== PIR Sensor ====================
 
-PirSensor::PirSensor(gpio_num_t gpio_pin) : pin(gpio_pin) {}
+PirSensor::PirSensor(gpio_num_t gpio_pin)
+    : pin(gpio_pin), notifyTask(nullptr), edgeUs(0), lastTriggerUs(0), edgePending(false), stats() {
+    portMUX_INITIALIZE(&lock);
+}
+
+PirSensor::~PirSensor() {
+    disableInterrupt();
+}
 
 esp_err_t PirSensor::init() {
     gpio_config_t io_conf = {};
@@ -25,6 +34,119 @@ bool PirSensor::detectMotion() const {
     return gpio_get_level(pin) == 1;
 }
 
+void IRAM_ATTR PirSensor::isrHandler(void* arg) {
+    PirSensor* self = static_cast<PirSensor*>(arg);
+    int64_t nowUs = esp_timer_get_time();
+    
+    taskENTER_CRITICAL_ISR(&self->lock);
+    self->stats.edges++;
+    bool accept = self->lastTriggerUs == 0 || nowUs - self->lastTriggerUs >= (int64_t)HOLDOFF_MS * 1000;
+    if (accept) {
+        self->edgeUs = nowUs;
+        self->lastTriggerUs = nowUs;
+        self->edgePending = true;
+    } else {
+        self->stats.heldOff++;
+    }
+    taskEXIT_CRITICAL_ISR(&self->lock);
+    
+    // Cạnh trong hold-off vẫn đánh thức task: PIR hạ rồi lên lại < 2 s phải kéo dài recording
+    if (self->notifyTask == nullptr) {
+        return;
+    }
+    
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(self->notifyTask, &woken);
+    portYIELD_FROM_ISR(woken);
+}
+
+esp_err_t PirSensor::enableInterrupt(TaskHandle_t task) {
+    notifyTask = task;
+    
+    // Camera driver có thể đã cài ISR service → ESP_ERR_INVALID_STATE là bình thường
+    esp_err_t ret = gpio_install_isr_service(0);
+    if (ret != ESP_OK && ret != ESP_ERR_INVALID_STATE) {
+        ESP_LOGE("PIR", "Failed to install ISR service: %s", esp_err_to_name(ret));
+        notifyTask = nullptr;
+        return ret;
+    }
+    
+    gpio_set_intr_type(pin, GPIO_INTR_POSEDGE);
+    ret = gpio_isr_handler_add(pin, isrHandler, this);
+    if (ret != ESP_OK) {
+        ESP_LOGE("PIR", "Failed to add ISR handler: %s", esp_err_to_name(ret));
+        notifyTask = nullptr;
+        return ret;
+    }
+    gpio_intr_enable(pin);
+    
+    ESP_LOGI("PIR", "Edge interrupt enabled (debounce %lu ms, hold-off %lu ms)", DEBOUNCE_MS, HOLDOFF_MS);
+    return ESP_OK;
+}
+
+void PirSensor::disableInterrupt() {
+    if (notifyTask == nullptr) {
+        return;
+    }
+    
+    gpio_intr_disable(pin);
+    gpio_isr_handler_remove(pin);
+    gpio_set_intr_type(pin, GPIO_INTR_DISABLE);
+    notifyTask = nullptr;
+}
+
+bool PirSensor::waitForMotion(TickType_t wait, int64_t& motionEdgeUs) {
+    if (ulTaskNotifyTake(pdTRUE, wait) == 0) {
+        return false;
+    }
+    
+    taskENTER_CRITICAL(&lock);
+    bool pending = edgePending;
+    edgePending = false;
+    int64_t edge = edgeUs;
+    taskEXIT_CRITICAL(&lock);
+    
+    // Chỉ có cạnh trong hold-off → không phải trigger mới, không đụng edgeUs/counter
+    if (!pending) {
+        return false;
+    }
+    
+    int64_t nowUs = esp_timer_get_time();
+    uint32_t wakeUs = nowUs - edge;
+    
+    // Debounce: xung thật giữ mức cao; chỉ chờ phần còn lại của DEBOUNCE_MS kể từ cạnh
+    int64_t remainUs = edge + (int64_t)DEBOUNCE_MS * 1000 - nowUs;
+    if (remainUs > 0) {
+        vTaskDelay(pdMS_TO_TICKS((remainUs + 999) / 1000));
+    }
+    bool valid = detectMotion();
+    
+    taskENTER_CRITICAL(&lock);
+    if (wakeUs > stats.maxWakeUs) {
+        stats.maxWakeUs = wakeUs;
+    }
+    if (valid) {
+        stats.triggers++;
+    } else {
+        // Nhiễu không được tính là trigger → không chặn cạnh thật kế tiếp
+        stats.glitches++;
+        lastTriggerUs = 0;
+    }
+    taskEXIT_CRITICAL(&lock);
+    
+    if (valid) {
+        motionEdgeUs = edge;
+    }
+    return valid;
+}
+
+PirStats PirSensor::getStats() const {
+    taskENTER_CRITICAL(&lock);
+    PirStats snapshot = stats;
+    taskEXIT_CRITICAL(&lock);
+    return snapshot;
+}
+
 // ==================== RTC DS3231 ====================
 
 RtcDS3231::RtcDS3231(gpio_num_t scl, gpio_num_t sda, i2c_port_t port)
@@ -178,7 +300,7 @@ void EspCamera::setupDefaultConfig() {
     #if CONFIG_ESP32_SPIRAM_SUPPORT
         config.frame_size = FRAMESIZE_UXGA;
         config.jpeg_quality = 10;
-        config.fb_count = 2;
+        config.fb_count = 3;    // 1 frame có thể bị stream giữ trong lúc gửi
         config.fb_location = CAMERA_FB_IN_PSRAM;
         config.grab_mode = CAMERA_GRAB_LATEST;
     #else
@@ -199,18 +321,12 @@ esp_err_t EspCamera::init() {
     return ret;
 }
 
-camera_fb_t* EspCamera::captureFrame() {
+FrameHandle EspCamera::captureFrame() {
     if (!initialized) {
         ESP_LOGE("CAMERA", "Not initialized");
-        return nullptr;
-    }
-    return esp_camera_fb_get();
-}
-
-void EspCamera::returnFrameBuffer(camera_fb_t* fb) {
-    if (fb != nullptr) {
-        esp_camera_fb_return(fb);
+        return FrameHandle();
     }
+    return FrameHandle::adopt(esp_camera_fb_get());
 }
 
 void EspCamera::setFrameSize(framesize_t size) {
@@ -225,6 +341,123 @@ void EspCamera::setFrameBufferCount(uint8_t count) {
     config.fb_count = count;
 }
 
+esp_err_t EspCamera::applySettings(framesize_t size, uint8_t quality) {
+    if (!initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (size > config.frame_size) {
+        ESP_LOGE("CAMERA", "Frame size %d exceeds init size %d", size, config.frame_size);
+        return ESP_ERR_INVALID_ARG;
+    }
+    
+    sensor_t* sensor = esp_camera_sensor_get();
+    if (sensor == nullptr) {
+        return ESP_FAIL;
+    }
+    
+    if (sensor->status.framesize != size && sensor->set_framesize(sensor, size) != 0) {
+        ESP_LOGE("CAMERA", "set_framesize(%d) failed", size);
+        return ESP_FAIL;
+    }
+    if (sensor->status.quality != quality && sensor->set_quality(sensor, quality) != 0) {
+        ESP_LOGE("CAMERA", "set_quality(%u) failed", quality);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// ==================== Frame Handle ====================
+
+FrameHandle::Slot FrameHandle::slots[FrameHandle::MAX_SLOTS] = {};
+portMUX_TYPE FrameHandle::lock = portMUX_INITIALIZER_UNLOCKED;
+uint32_t FrameHandle::outstandingCount = 0;
+uint32_t FrameHandle::peakCount = 0;
+
+FrameHandle FrameHandle::adopt(camera_fb_t* fb) {
+    if (fb == nullptr) {
+        return FrameHandle();
+    }
+    
+    Slot* found = nullptr;
+    portENTER_CRITICAL(&lock);
+    for (int i = 0; i < MAX_SLOTS; i++) {
+        if (slots[i].fb == nullptr) {
+            found = &slots[i];
+            found->fb = fb;
+            found->refs = 1;
+            outstandingCount++;
+            if (outstandingCount > peakCount) {
+                peakCount = outstandingCount;
+            }
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&lock);
+    
+    if (found == nullptr) {
+        // Không thể xảy ra khi MAX_SLOTS > fb_count; trả ngay để driver không bị kẹt
+        ESP_LOGE("CAMERA", "Frame handle slots exhausted");
+        esp_camera_fb_return(fb);
+        return FrameHandle();
+    }
+    return FrameHandle(found);
+}
+
+FrameHandle& FrameHandle::operator=(FrameHandle&& other) noexcept {
+    if (this != &other) {
+        reset();
+        slot = other.slot;
+        other.slot = nullptr;
+    }
+    return *this;
+}
+
+FrameHandle FrameHandle::share() const {
+    if (slot == nullptr) {
+        return FrameHandle();
+    }
+    
+    portENTER_CRITICAL(&lock);
+    slot->refs++;
+    portEXIT_CRITICAL(&lock);
+    return FrameHandle(slot);
+}
+
+void FrameHandle::reset() {
+    if (slot == nullptr) {
+        return;
+    }
+    
+    camera_fb_t* toReturn = nullptr;
+    portENTER_CRITICAL(&lock);
+    if (--slot->refs == 0) {
+        toReturn = slot->fb;
+        slot->fb = nullptr;
+        outstandingCount--;
+    }
+    portEXIT_CRITICAL(&lock);
+    slot = nullptr;
+    
+    // Handle cuối cùng → trả buffer cho driver (ngoài critical section)
+    if (toReturn != nullptr) {
+        esp_camera_fb_return(toReturn);
+    }
+}
+
+uint32_t FrameHandle::outstanding() {
+    portENTER_CRITICAL(&lock);
+    uint32_t count = outstandingCount;
+    portEXIT_CRITICAL(&lock);
+    return count;
+}
+
+uint32_t FrameHandle::peakOutstanding() {
+    portENTER_CRITICAL(&lock);
+    uint32_t count = peakCount;
+    portEXIT_CRITICAL(&lock);
+    return count;
+}
+
 // ==================== Sensor Manager ====================
 
 SensorManager::SensorManager() 
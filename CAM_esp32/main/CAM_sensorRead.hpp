@@ -9,6 +9,7 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include <cstdint>
+#include <span>
 
 // RTC Time structure
 struct RtcTime {
@@ -25,17 +26,52 @@ struct RtcTime {
         : year(y), month(m), day(d), hour(h), minute(min), second(s) {}
 };
 
+struct PirStats {
+    uint32_t edges;             // Cạnh lên nhận trong ISR
+    uint32_t heldOff;           // Bỏ qua vì còn trong hold-off sau trigger trước
+    uint32_t glitches;          // Xung ngắn hơn DEBOUNCE_MS (nhiễu)
+    uint32_t triggers;          // Motion hợp lệ trả về cho task
+    uint32_t maxWakeUs;         // ISR → task được đánh thức (lớn nhất)
+};
+
 // PIR Sensor Class
+//   - detectMotion(): đọc mức (poll)
+//   - enableInterrupt(task): ISR cạnh lên ghi timestamp + task notification, task ngủ giữa
+//     các event thay vì poll. Hold-off HOLDOFF_MS sau mỗi trigger (PIR tự retrigger),
+//     debounce trong waitForMotion(): mức phải còn cao DEBOUNCE_MS sau cạnh
 class PirSensor {
 private:
     gpio_num_t pin;
+    TaskHandle_t notifyTask;
+    mutable portMUX_TYPE lock;  // ISR ↔ task (int64 không ghi atomic)
+    int64_t edgeUs;             // Cạnh được nhận gần nhất (esp_timer trong ISR)
+    int64_t lastTriggerUs;      // Mốc hold-off
+    bool edgePending;           // Có cạnh được nhận chưa xử lý (cạnh trong hold-off chỉ đánh thức task)
+    PirStats stats;
+    
+    static constexpr uint32_t DEBOUNCE_MS = 30;
+    static constexpr uint32_t HOLDOFF_MS = 2000;
+    
+    static void isrHandler(void* arg);
     
 public:
     explicit PirSensor(gpio_num_t gpio_pin = GPIO_NUM_13);
-    ~PirSensor() = default;
+    ~PirSensor();
+    
+    // Disable copy
+    PirSensor(const PirSensor&) = delete;
+    PirSensor& operator=(const PirSensor&) = delete;
     
     esp_err_t init();
     bool detectMotion() const;
+    
+    // Ngắt cạnh lên → notify task (task gọi waitForMotion)
+    esp_err_t enableInterrupt(TaskHandle_t task);
+    void disableInterrupt();
+    // Chờ motion đã debounce; edgeUs = thời điểm cạnh trong ISR.
+    // false = timeout, nhiễu, hoặc cạnh trong hold-off (task vẫn thức để kéo dài recording)
+    bool waitForMotion(TickType_t wait, int64_t& edgeUs);
+    PirStats getStats() const;
 };
 
 // RTC (DS3231) Class
@@ -64,6 +100,65 @@ public:
     esp_err_t setTime(const RtcTime& time);
 };
 
+// Frame Handle Class - giữ 1 buffer của camera driver (RAII)
+//   - Move-only; share() tạo thêm handle tới cùng buffer (refcount, không copy)
+//   - Handle cuối cùng bị hủy → esp_camera_fb_return() tự động, mọi error path đều an toàn
+//   - outstanding(): số buffer driver đang bị giữ → pool exhaustion đo được
+class FrameHandle {
+private:
+    struct Slot {
+        camera_fb_t* fb;
+        uint32_t refs;
+    };
+    
+    static constexpr int MAX_SLOTS = 8;     // > fb_count lớn nhất
+    static Slot slots[MAX_SLOTS];
+    static portMUX_TYPE lock;
+    static uint32_t outstandingCount;
+    static uint32_t peakCount;
+    
+    Slot* slot;
+    
+    explicit FrameHandle(Slot* s) : slot(s) {}
+    
+public:
+    FrameHandle() : slot(nullptr) {}
+    ~FrameHandle() { reset(); }
+    
+    // Move-only
+    FrameHandle(const FrameHandle&) = delete;
+    FrameHandle& operator=(const FrameHandle&) = delete;
+    FrameHandle(FrameHandle&& other) noexcept : slot(other.slot) { other.slot = nullptr; }
+    FrameHandle& operator=(FrameHandle&& other) noexcept;
+    
+    // Nhận quyền sở hữu buffer từ esp_camera_fb_get() (nullptr → handle rỗng)
+    static FrameHandle adopt(camera_fb_t* fb);
+    
+    FrameHandle share() const;
+    void reset();
+    
+    explicit operator bool() const { return slot != nullptr; }
+    const camera_fb_t* get() const { return slot ? slot->fb : nullptr; }
+    
+    // Zero-copy view vào buffer JPEG của driver (hợp lệ tới khi handle bị hủy)
+    std::span<const uint8_t> data() const {
+        return slot ? std::span<const uint8_t>(slot->fb->buf, slot->fb->len)
+                    : std::span<const uint8_t>();
+    }
+    size_t size() const { return slot ? slot->fb->len : 0; }
+    uint16_t width() const { return slot ? slot->fb->width : 0; }
+    uint16_t height() const { return slot ? slot->fb->height : 0; }
+    
+    // Thời điểm capture (esp_timer, µs since boot)
+    int64_t timestampUs() const {
+        return slot ? (int64_t)slot->fb->timestamp.tv_sec * 1000000 + slot->fb->timestamp.tv_usec : 0;
+    }
+    
+    // Debug: buffer đang bị giữ hiện tại / lớn nhất từ lúc boot
+    static uint32_t outstanding();
+    static uint32_t peakOutstanding();
+};
+
 // Camera Class
 class EspCamera {
 private:
@@ -77,13 +172,20 @@ public:
     ~EspCamera();
     
     esp_err_t init();
-    camera_fb_t* captureFrame();
-    void returnFrameBuffer(camera_fb_t* fb);
+    FrameHandle captureFrame();
+    uint8_t getFrameBufferCount() const { return config.fb_count; }
     
     // Configuration methods
     void setFrameSize(framesize_t size);
     void setJpegQuality(uint8_t quality);
     void setFrameBufferCount(uint8_t count);
+    
+    // Cấu hình lúc init (buffer cấp theo frame_size này → runtime chỉ được ≤)
+    framesize_t getFrameSize() const { return config.frame_size; }
+    uint8_t getJpegQuality() const { return config.jpeg_quality; }
+    
+    // Đổi frame size / quality khi đang chạy (sensor register, có hiệu lực từ frame kế tiếp)
+    esp_err_t applySettings(framesize_t size, uint8_t quality);
 };
 
 // Sensor Manager Class (kết hợp tất cả sensors)
@@ -0,0 +1,247 @@
+#include "CAM_snapshot.hpp"
+#include "CAM_httpAsync.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <cstring>
+
+const char* SnapshotCache::TAG = "SNAPSHOT";
+
+// Global instance for static callback
+static SnapshotCache* g_snapshotCache = nullptr;
+
+CachedFrame::~CachedFrame() {
+    heap_caps_free(data);
+}
+
+SnapshotCache::SnapshotCache(FrameBroker& frameBroker)
+    : broker(frameBroker), consumer(-1), seq(0), lastRequestUs(0), paused(false), stats() {
+
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+
+    g_snapshotCache = this;
+}
+
+SnapshotCache::~SnapshotCache() {
+    g_snapshotCache = nullptr;
+    stop();
+
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+esp_err_t SnapshotCache::start() {
+    if (consumer >= 0) {
+        return ESP_OK;
+    }
+
+    // Bắt đầu ở trạng thái idle: chưa ai hỏi thì không cần capture
+    consumer = broker.subscribe("snapshot", 0, QueueDropPolicy::DROP_OLDEST,
+                                [this](const FrameHandle& frame) { onFrame(frame); });
+    if (consumer < 0) {
+        return ESP_FAIL;
+    }
+    paused = true;
+    return ESP_OK;
+}
+
+void SnapshotCache::stop() {
+    if (consumer >= 0) {
+        broker.unsubscribe(consumer);
+        consumer = -1;
+    }
+}
+
+std::shared_ptr<CachedFrame> SnapshotCache::store(const FrameHandle& frame) {
+    std::shared_ptr<CachedFrame> cached;
+
+    // Dùng lại buffer của cache trước nếu không request nào còn giữ (spare không bao giờ được
+    // trao cho request → use_count chỉ có thể giảm)
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (spare && spare.use_count() == 1) {
+            cached = std::move(spare);
+        }
+        xSemaphoreGive(mutex);
+    }
+    if (!cached) {
+        cached = std::make_shared<CachedFrame>();
+    }
+
+    size_t len = frame.size();
+    if (cached->capacity < len) {
+        // Dư 25% để frame sau lớn hơn một chút không phải cấp lại
+        size_t capacity = len + len / 4;
+        heap_caps_free(cached->data);
+        cached->data = (uint8_t*)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+        if (cached->data == nullptr) {
+            cached->data = (uint8_t*)heap_caps_malloc(capacity, MALLOC_CAP_8BIT);
+        }
+        cached->capacity = cached->data ? capacity : 0;
+        if (cached->data == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u byte snapshot", capacity);
+            return nullptr;
+        }
+    }
+
+    memcpy(cached->data, frame.data().data(), len);
+    cached->len = len;
+    cached->captureUs = frame.timestampUs();
+    cached->width = frame.width();
+    cached->height = frame.height();
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        cached->seq = ++seq;
+        spare = std::move(latest);
+        latest = cached;
+        stats.updates++;
+        xSemaphoreGive(mutex);
+    }
+
+    return cached;
+}
+
+// Broker task: chỉ copy (~1 ms cho frame UXGA trong PSRAM), buffer driver trả ngay sau callback
+void SnapshotCache::onFrame(const FrameHandle& frame) {
+    if (esp_timer_get_time() - lastRequestUs > (int64_t)IDLE_MS * 1000) {
+        if (!paused) {
+            paused = true;
+            broker.setFps(consumer, 0);
+            ESP_LOGI(TAG, "Idle, cache paused");
+        }
+        return;
+    }
+
+    store(frame);
+}
+
+std::shared_ptr<CachedFrame> SnapshotCache::current() const {
+    std::shared_ptr<CachedFrame> cached;
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        cached = latest;
+        xSemaphoreGive(mutex);
+    }
+
+    return cached;
+}
+
+std::shared_ptr<CachedFrame> SnapshotCache::capture() {
+    FrameHandle frame;
+    if (!broker.snapshot(frame, pdMS_TO_TICKS(FRESH_TIMEOUT_MS))) {
+        return nullptr;
+    }
+
+    // Copy rồi trả buffer driver trước khi gửi qua mạng
+    std::shared_ptr<CachedFrame> cached = store(frame);
+    frame.reset();
+    return cached;
+}
+
+esp_err_t SnapshotCache::serve(httpd_req_t* req) {
+    int64_t nowUs = esp_timer_get_time();
+    lastRequestUs = nowUs;
+
+    if (paused && consumer >= 0) {
+        paused = false;
+        broker.setFps(consumer, CACHE_FPS);
+    }
+
+    bool fresh = false;
+    char query[32];
+    char value[8];
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "fresh", value, sizeof(value)) == ESP_OK) {
+        fresh = strcmp(value, "1") == 0 || strcmp(value, "true") == 0;
+    }
+
+    std::shared_ptr<CachedFrame> cached = current();
+    if (!fresh && cached && nowUs - cached->captureUs > (int64_t)MAX_AGE_MS * 1000) {
+        fresh = true;   // Cache cũ (vừa hết idle) → không trả ảnh cũ
+    }
+    if (fresh || !cached) {
+        cached = capture();
+        if (!cached) {
+            ESP_LOGE(TAG, "Snapshot capture failed");
+            httpd_resp_set_status(req, "503 Service Unavailable");
+            httpd_resp_sendstr(req, "Camera busy");
+            return ESP_FAIL;
+        }
+    }
+
+    // Header value phải sống tới khi gửi response
+    char etag[16];
+    char age[12];
+    char ageMs[12];
+    char timestamp[24];
+    char header[64];
+
+    int64_t ageUs = esp_timer_get_time() - cached->captureUs;
+    snprintf(etag, sizeof(etag), "\"%lu\"", cached->seq);
+    snprintf(age, sizeof(age), "%lld", ageUs / 1000000);
+    snprintf(ageMs, sizeof(ageMs), "%lld", ageUs / 1000);
+    snprintf(timestamp, sizeof(timestamp), "%lld", cached->captureUs);
+
+    bool notModified = !fresh &&
+        httpd_req_get_hdr_value_str(req, "If-None-Match", header, sizeof(header)) == ESP_OK &&
+        strstr(header, etag) != nullptr;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        stats.requests++;
+        if (fresh) {
+            stats.fresh++;
+        } else if (notModified) {
+            stats.notModified++;
+        } else {
+            stats.cacheHits++;
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control", "no-cache");
+    httpd_resp_set_hdr(req, "Age", age);
+    httpd_resp_set_hdr(req, "X-Frame-Age-Ms", ageMs);
+    httpd_resp_set_hdr(req, "X-Timestamp", timestamp);
+    httpd_resp_set_hdr(req, "Access-Control-Allow-Origin", "*");
+
+    if (notModified) {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, nullptr, 0);
+    }
+
+    httpd_resp_set_type(req, "image/jpeg");
+    httpd_resp_set_hdr(req, "Content-Disposition", "inline; filename=capture.jpg");
+
+    // cached giữ buffer sống trong lúc gửi, cache có thể đã được thay bằng frame mới hơn
+    return httpd_resp_send(req, (const char*)cached->data, cached->len);
+}
+
+esp_err_t SnapshotCache::handleCaptureRequest(httpd_req_t* req) {
+    return HttpAsync::run(req, "capture_tx", 4096, PRIORITY_SENDER_TASK,
+                          [this](httpd_req_t* asyncReq) { return serve(asyncReq); });
+}
+
+SnapshotStats SnapshotCache::getStats() const {
+    SnapshotStats snapshot = {};
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        snapshot = stats;
+        xSemaphoreGive(mutex);
+    }
+
+    return snapshot;
+}
+
+esp_err_t SnapshotCache::captureHandlerWrapper(httpd_req_t* req) {
+    if (g_snapshotCache == nullptr) {
+        ESP_LOGE(TAG, "Snapshot cache not initialized");
+        httpd_resp_send_500(req);
+        return ESP_FAIL;
+    }
+
+    return g_snapshotCache->handleCaptureRequest(req);
+}
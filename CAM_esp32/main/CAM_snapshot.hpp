@@ -0,0 +1,89 @@
+#ifndef CAM_SNAPSHOT_HPP
+#define CAM_SNAPSHOT_HPP
+
+#include "CAM_frameBroker.hpp"
+#include "esp_http_server.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <memory>
+#include <cstdint>
+
+// 1 JPEG đã copy khỏi buffer driver (PSRAM), dùng chung giữa các request qua shared_ptr
+struct CachedFrame {
+    uint8_t* data;
+    size_t len;
+    size_t capacity;
+    int64_t captureUs;          // esp_timer lúc capture
+    uint32_t seq;               // Tăng mỗi lần cập nhật (ETag)
+    uint16_t width;
+    uint16_t height;
+
+    CachedFrame() : data(nullptr), len(0), capacity(0), captureUs(0), seq(0), width(0), height(0) {}
+    ~CachedFrame();
+
+    // Disable copy
+    CachedFrame(const CachedFrame&) = delete;
+    CachedFrame& operator=(const CachedFrame&) = delete;
+};
+
+struct SnapshotStats {
+    uint32_t requests;
+    uint32_t cacheHits;         // Trả từ cache (không capture)
+    uint32_t fresh;             // Phải chờ frame mới (?fresh=1 hoặc cache quá cũ)
+    uint32_t notModified;       // 304 (If-None-Match khớp frame đang cache)
+    uint32_t updates;           // Số lần cache được cập nhật từ broker
+};
+
+// Snapshot Cache Class - /capture?fresh=1
+//   - Callback consumer của FrameBroker ở CACHE_FPS: copy frame vào cache rồi trả buffer ngay
+//     → không giữ frame buffer của driver, không tranh với recorder
+//   - Request đồng thời dùng chung 1 CachedFrame (shared_ptr), không capture thêm
+//   - Không có request trong IDLE_MS → tạm dừng consumer; request kế tiếp thấy cache cũ → chờ frame mới
+//   - Header: Age, X-Frame-Age-Ms, X-Timestamp, ETag (seq) → If-None-Match = 304
+class SnapshotCache {
+private:
+    FrameBroker& broker;
+    int consumer;
+    std::shared_ptr<CachedFrame> latest;
+    std::shared_ptr<CachedFrame> spare;     // Cache trước, dùng lại khi không request nào còn giữ
+    uint32_t seq;
+    volatile int64_t lastRequestUs;
+    volatile bool paused;                   // Idle → consumer fps 0, broker không capture cho cache
+    SemaphoreHandle_t mutex;
+    SnapshotStats stats;
+
+    static const char* TAG;
+    static constexpr uint8_t CACHE_FPS = 2;
+    static constexpr uint32_t MAX_AGE_MS = 2000;        // Cũ hơn → chờ frame mới
+    static constexpr uint32_t IDLE_MS = 30000;
+    static constexpr uint32_t FRESH_TIMEOUT_MS = 2000;
+    static constexpr uint8_t PRIORITY_SENDER_TASK = 4;
+
+    void onFrame(const FrameHandle& frame);
+    std::shared_ptr<CachedFrame> store(const FrameHandle& frame);
+    std::shared_ptr<CachedFrame> current() const;
+    std::shared_ptr<CachedFrame> capture();
+    esp_err_t serve(httpd_req_t* req);
+
+public:
+    explicit SnapshotCache(FrameBroker& frameBroker);
+    ~SnapshotCache();
+
+    // Disable copy
+    SnapshotCache(const SnapshotCache&) = delete;
+    SnapshotCache& operator=(const SnapshotCache&) = delete;
+
+    esp_err_t start();
+    void stop();
+
+    SnapshotStats getStats() const;
+
+    // HTTP handler - Được gọi từ HTTP server
+    esp_err_t handleCaptureRequest(httpd_req_t* req);
+
+    // Static wrapper for HTTP server callback
+    static esp_err_t captureHandlerWrapper(httpd_req_t* req);
+};
+
+#endif // CAM_SNAPSHOT_HPP
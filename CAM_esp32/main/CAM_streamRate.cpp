@@ -0,0 +1,164 @@
+#include "CAM_streamRate.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+const char* StreamRateController::TAG = "STREAM_RATE";
+
+// Các mức hạ dần sau cấu hình gốc: chỉ tăng nén, giữ nguyên độ phân giải
+static const uint8_t QUALITY_LADDER[] = { 15, 20, 28, 36, 45 };
+
+StreamRateController::StreamRateController(EspCamera& cam)
+    : camera(cam), level(0), budgetUs(0), windowStartUs(0), windowFrames(0), windowSendUs(0),
+      avgSendUs(0), congestedWindows(0), healthyWindows(0), lastChangeUs(0),
+      downgrades(0), upgrades(0), held(false) {
+
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+
+    buildLevels();
+}
+
+StreamRateController::~StreamRateController() {
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+void StreamRateController::buildLevels() {
+    // Mức 0 = cấu hình init, các mức sau nén mạnh hơn mức trước, cùng frame size
+    levels.clear();
+    framesize_t size = camera.getFrameSize();
+    levels.push_back({ size, camera.getJpegQuality() });
+
+    for (uint8_t quality : QUALITY_LADDER) {
+        if (quality > levels.back().quality) {
+            levels.push_back({ size, quality });
+        }
+    }
+}
+
+void StreamRateController::applyLocked(uint8_t newLevel) {
+    const StreamRateLevel& target = levels[newLevel];
+    if (camera.applySettings(target.frameSize, target.quality) != ESP_OK) {
+        return;
+    }
+
+    if (newLevel > level) {
+        downgrades++;
+    } else if (newLevel < level) {
+        upgrades++;
+    }
+    ESP_LOGI(TAG, "Level %u → %u (quality %u, send %lu/%lu us)",
+             level, newLevel, target.quality, avgSendUs, budgetUs);
+
+    level = newLevel;
+    lastChangeUs = esp_timer_get_time();
+    congestedWindows = 0;
+    healthyWindows = 0;
+}
+
+void StreamRateController::evaluateLocked(int64_t nowUs) {
+    avgSendUs = windowFrames ? windowSendUs / windowFrames : 0;
+    windowStartUs = nowUs;
+    windowFrames = 0;
+    windowSendUs = 0;
+
+    // Recorder dùng cùng sensor → không hạ quality giữa recording
+    held = holdCheck && holdCheck();
+    if (held) {
+        if (level != 0) {
+            applyLocked(0);
+        }
+        return;
+    }
+
+    if (budgetUs == 0 || nowUs - lastChangeUs < SETTLE_US) {
+        return;
+    }
+
+    if (avgSendUs * 100 > budgetUs * CONGESTED_PCT) {
+        healthyWindows = 0;
+        if (++congestedWindows >= DOWNGRADE_WINDOWS && level + 1 < (int)levels.size()) {
+            applyLocked(level + 1);
+        }
+    } else if (avgSendUs * 100 < budgetUs * HEALTHY_PCT) {
+        congestedWindows = 0;
+        if (++healthyWindows >= UPGRADE_WINDOWS && level > 0) {
+            applyLocked(level - 1);
+        }
+    } else {
+        // Vùng giữa: giữ nguyên mức, không dao động
+        congestedWindows = 0;
+        healthyWindows = 0;
+    }
+}
+
+void StreamRateController::report(uint32_t sendUs) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    if (windowStartUs == 0) {
+        windowStartUs = nowUs;
+    }
+
+    windowFrames++;
+    windowSendUs += sendUs;
+    if (nowUs - windowStartUs >= WINDOW_US) {
+        evaluateLocked(nowUs);
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+void StreamRateController::reset() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    if (level != 0) {
+        applyLocked(0);
+    }
+    windowStartUs = 0;
+    windowFrames = 0;
+    windowSendUs = 0;
+    congestedWindows = 0;
+    healthyWindows = 0;
+
+    xSemaphoreGive(mutex);
+}
+
+void StreamRateController::hold() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    held = true;
+    if (level != 0) {
+        applyLocked(0);
+    }
+
+    xSemaphoreGive(mutex);
+}
+
+StreamRateStats StreamRateController::getStats() const {
+    StreamRateStats stats = {};
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        stats.level = level;
+        stats.levelCount = levels.size();
+        stats.frameSize = levels[level].frameSize;
+        stats.quality = levels[level].quality;
+        stats.avgSendUs = avgSendUs;
+        stats.budgetUs = budgetUs;
+        stats.downgrades = downgrades;
+        stats.upgrades = upgrades;
+        stats.held = held;
+        xSemaphoreGive(mutex);
+    }
+
+    return stats;
+}
@@ -0,0 +1,97 @@
+#ifndef CAM_STREAM_RATE_HPP
+#define CAM_STREAM_RATE_HPP
+
+#include "CAM_sensorRead.hpp"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// 1 mức chất lượng stream (JPEG quality, quality số lớn = nén mạnh). frameSize luôn = cấu hình
+// init: sensor dùng chung với recorder, pre-roll, RTSP, /ws, /capture và motion verifier
+struct StreamRateLevel {
+    framesize_t frameSize;
+    uint8_t quality;
+};
+
+struct StreamRateStats {
+    uint8_t level;              // 0 = cấu hình gốc
+    uint8_t levelCount;
+    framesize_t frameSize;
+    uint8_t quality;
+    uint32_t avgSendUs;         // Thời gian gửi 1 frame (cửa sổ gần nhất)
+    uint32_t budgetUs;          // = chu kỳ frame của stream
+    uint32_t downgrades;
+    uint32_t upgrades;
+    bool held;                  // Đang ghi recording → giữ cấu hình gốc
+};
+
+// Stream Rate Controller - chỉnh JPEG quality theo backpressure của client stream
+//   - Không đổi frame size: mọi consumer khác của sensor giữ kích thước ổn định. Client vẫn
+//     chậm ở quality thấp nhất → giảm fps riêng client đó (HttpStreamManager pacing)
+//   - Mỗi frame: thời gian httpd_resp_send_chunk bị block (lwIP không cho biết byte chờ trong
+//     socket → send block = TCP window đầy = backlog)
+//   - Mỗi cửa sổ 1 s: send trung bình > 1.2 × chu kỳ frame → nghẽn, < 0.5 × → rảnh
+//   - Hysteresis: 2 cửa sổ nghẽn liên tiếp → xuống 1 mức, 5 cửa sổ rảnh → lên 1 mức,
+//     sau mỗi lần đổi chờ 3 s (frame đầu sau khi đổi size thường chậm)
+//   - Camera dùng chung với recorder: đang ghi hoặc hết client → về cấu hình gốc
+class StreamRateController {
+private:
+    EspCamera& camera;
+    std::function<bool()> holdCheck;
+    std::vector<StreamRateLevel> levels;
+    uint8_t level;
+    uint32_t budgetUs;
+
+    int64_t windowStartUs;
+    uint32_t windowFrames;
+    uint64_t windowSendUs;
+    uint32_t avgSendUs;
+    uint8_t congestedWindows;
+    uint8_t healthyWindows;
+    int64_t lastChangeUs;
+    uint32_t downgrades;
+    uint32_t upgrades;
+    bool held;
+
+    SemaphoreHandle_t mutex;
+
+    static const char* TAG;
+    static constexpr int64_t WINDOW_US = 1000000;
+    static constexpr int64_t SETTLE_US = 3000000;
+    static constexpr uint32_t CONGESTED_PCT = 120;
+    static constexpr uint32_t HEALTHY_PCT = 50;
+    static constexpr uint8_t DOWNGRADE_WINDOWS = 2;
+    static constexpr uint8_t UPGRADE_WINDOWS = 5;
+
+    void buildLevels();
+    void evaluateLocked(int64_t nowUs);
+    void applyLocked(uint8_t newLevel);
+
+public:
+    explicit StreamRateController(EspCamera& cam);
+    ~StreamRateController();
+
+    // Disable copy
+    StreamRateController(const StreamRateController&) = delete;
+    StreamRateController& operator=(const StreamRateController&) = delete;
+
+    // Chu kỳ frame mục tiêu của stream (ngân sách gửi 1 frame)
+    void setTargetFps(uint8_t fps) { budgetUs = fps ? 1000000 / fps : 0; }
+    // true → không hạ chất lượng (vd. recorder đang ghi)
+    void setHoldCheck(std::function<bool()> check) { holdCheck = check; }
+
+    // Client stream báo sau mỗi frame
+    void report(uint32_t sendUs);
+    // Hết client stream → trả camera về cấu hình gốc
+    void reset();
+    // Recorder sắp ghi: về quality gốc ngay (không chờ cửa sổ report kế tiếp), giữ tới khi
+    // holdCheck() hết true
+    void hold();
+
+    StreamRateStats getStats() const;
+};
+
+#endif // CAM_STREAM_RATE_HPP
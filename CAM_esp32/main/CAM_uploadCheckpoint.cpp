@@ -0,0 +1,181 @@
+#include "CAM_uploadCheckpoint.hpp"
+#include "esp_log.h"
+#include "nvs.h"
+#include <cstring>
+
+const char* UploadCheckpoint::TAG = "UPLOAD_CKPT";
+
+UploadCheckpoint::UploadCheckpoint(const char* nvsKey, bool keyPerRecording)
+    : nvsNamespace(keyPerRecording ? NVS_NAMESPACE_RECORDING : NVS_NAMESPACE),
+      perRecording(keyPerRecording), key(nvsKey), cursor(), loaded(false), valid(false) {
+    mutex = xSemaphoreCreateMutex();
+    if (mutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+}
+
+UploadCheckpoint::~UploadCheckpoint() {
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+}
+
+void UploadCheckpoint::selectLocked(const std::string& path) {
+    if (!perRecording) {
+        return;
+    }
+
+    // Tên recording (YYYYMMDDhhmmss, ≤ 15 ký tự = giới hạn key NVS)
+    std::string name = path.substr(path.rfind('/') + 1);
+    name = name.substr(0, name.rfind('.')).substr(0, 15);
+    if (name != key) {
+        key = name;
+        loaded = false;
+        valid = false;
+    }
+}
+
+void UploadCheckpoint::loadLocked() {
+    if (loaded) {
+        return;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(nvsNamespace, NVS_READONLY, &handle);
+    if (ret != ESP_OK) {
+        // Namespace chưa có = chưa từng checkpoint. NVS chưa init → thử lại lần sau
+        loaded = (ret == ESP_ERR_NVS_NOT_FOUND);
+        return;
+    }
+
+    size_t len = sizeof(cursor);
+    ret = nvs_get_blob(handle, key.c_str(), &cursor, &len);
+    nvs_close(handle);
+
+    loaded = true;
+    valid = (ret == ESP_OK && len == sizeof(cursor) && cursor.path[0] != '\0');
+    if (valid) {
+        cursor.path[sizeof(cursor.path) - 1] = '\0';
+        ESP_LOGI(TAG, "Pending upload: %s (%lu/%lu)", cursor.path, cursor.next, cursor.total);
+    }
+}
+
+esp_err_t UploadCheckpoint::eraseLocked() {
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(nvsNamespace, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    nvs_erase_key(handle, key.c_str());
+    ret = nvs_commit(handle);
+    nvs_close(handle);
+
+    valid = false;
+    return ret;
+}
+
+bool UploadCheckpoint::find(const std::string& path, uint8_t mode, uint32_t total, uint32_t& next) {
+    bool found = false;
+    next = 0;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return false;
+    }
+
+    selectLocked(path);
+    loadLocked();
+    if (valid && path == cursor.path) {
+        // Đổi mode hoặc recording đã khác (total lệch) → cursor vô nghĩa
+        if (cursor.mode == mode && cursor.total == total && cursor.next < total) {
+            next = cursor.next;
+            found = true;
+        } else {
+            ESP_LOGW(TAG, "Stale checkpoint for %s, starting over", cursor.path);
+        }
+    }
+
+    xSemaphoreGive(mutex);
+    return found;
+}
+
+esp_err_t UploadCheckpoint::save(const std::string& path, uint8_t mode, uint32_t total, uint32_t next) {
+    if (path.size() >= sizeof(cursor.path)) {
+        ESP_LOGW(TAG, "Path too long for checkpoint: %s", path.c_str());
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    selectLocked(path);
+
+    // Không đổi → không ghi flash
+    if (valid && path == cursor.path && cursor.mode == mode &&
+        cursor.total == total && cursor.next == next) {
+        xSemaphoreGive(mutex);
+        return ESP_OK;
+    }
+
+    nvs_handle_t handle;
+    esp_err_t ret = nvs_open(nvsNamespace, NVS_READWRITE, &handle);
+    if (ret != ESP_OK) {
+        xSemaphoreGive(mutex);
+        ESP_LOGE(TAG, "Failed to open NVS");
+        return ret;
+    }
+
+    UploadCursor updated = {};
+    strncpy(updated.path, path.c_str(), sizeof(updated.path) - 1);
+    updated.mode = mode;
+    updated.total = total;
+    updated.next = next;
+
+    ret = nvs_set_blob(handle, key.c_str(), &updated, sizeof(updated));
+    if (ret == ESP_OK) {
+        ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+
+    if (ret == ESP_OK) {
+        cursor = updated;
+        loaded = true;
+        valid = true;
+    }
+
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+esp_err_t UploadCheckpoint::clear(const std::string& path) {
+    esp_err_t ret = ESP_OK;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    selectLocked(path);
+    loadLocked();
+    if (valid && path == cursor.path) {
+        ret = eraseLocked();
+    }
+
+    xSemaphoreGive(mutex);
+    return ret;
+}
+
+bool UploadCheckpoint::pending(std::string& path) {
+    bool found = false;
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        loadLocked();
+        if (valid) {
+            path = cursor.path;
+            found = true;
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    return found;
+}
@@ -0,0 +1,61 @@
+#ifndef CAM_UPLOAD_CHECKPOINT_HPP
+#define CAM_UPLOAD_CHECKPOINT_HPP
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include <string>
+#include <cstdint>
+
+// Con trỏ upload lưu trong NVS (blob, giữ qua mất mạng/reboot)
+struct UploadCursor {
+    char path[64];      // Recording path (folder hoặc .avi) như readVideo chuẩn hóa
+    uint8_t mode;       // UploadMode
+    uint32_t total;     // PER_FRAME: số frame, BUNDLE: số byte bundle
+    uint32_t next;      // PER_FRAME: frame kế tiếp, BUNDLE: byte server đã ack
+};
+
+// Upload Checkpoint Class - 1 upload dở dang mỗi slot (key NVS)
+//   - readVideo tiếp tục từ cursor nếu cùng path/mode/total (recording không đổi)
+//   - Recording khác → ghi đè cursor cũ
+//   - perRecording: mỗi recording 1 key (= tên recording, namespace riêng) → upload nền
+//     nhường rồi chuyển sang recording khác không làm mất cursor của recording trước
+//   - Đọc NVS lần đầu dùng (NVS init cùng WiFi, sau VideoManager::init)
+class UploadCheckpoint {
+private:
+    const char* nvsNamespace;
+    bool perRecording;
+    std::string key;            // Key NVS của cursor đang cache
+    UploadCursor cursor;
+    bool loaded;
+    bool valid;
+    SemaphoreHandle_t mutex;
+
+    static const char* TAG;
+    static constexpr const char* NVS_NAMESPACE = "upload_ckpt";
+    static constexpr const char* NVS_NAMESPACE_RECORDING = "upload_rec";
+
+    // perRecording: đổi key (và cache) theo recording của path
+    void selectLocked(const std::string& path);
+    void loadLocked();
+    esp_err_t eraseLocked();
+
+public:
+    explicit UploadCheckpoint(const char* nvsKey, bool keyPerRecording = false);
+    ~UploadCheckpoint();
+
+    // Disable copy
+    UploadCheckpoint(const UploadCheckpoint&) = delete;
+    UploadCheckpoint& operator=(const UploadCheckpoint&) = delete;
+
+    // Vị trí tiếp tục (false → upload từ đầu)
+    bool find(const std::string& path, uint8_t mode, uint32_t total, uint32_t& next);
+    esp_err_t save(const std::string& path, uint8_t mode, uint32_t total, uint32_t next);
+    // Xóa cursor của path (upload xong hoặc recording không còn)
+    esp_err_t clear(const std::string& path);
+
+    // Upload dở dang cần chạy tiếp (sau khi có mạng lại). perRecording: chỉ cursor đang cache
+    bool pending(std::string& path);
+};
+
+#endif // CAM_UPLOAD_CHECKPOINT_HPP
@@ -0,0 +1,290 @@
+#include "CAM_uploadScheduler.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <algorithm>
+
+const char* UploadScheduler::TAG = "UPLOAD_SCHED";
+
+UploadScheduler::UploadScheduler(RecordingCatalog& cat, HttpUploader& up)
+    : catalog(cat), uploader(up), lastPollUs(0), order(UploadOrder::OLDEST_FIRST), backgroundBps(0),
+      interactiveBps(0), enabled(false), interactive(false), backgroundActive(false),
+      foregroundCount(0), uploadedCount(0), failedCount(0), yieldCount(0),
+      lastFailedAttempts(0), backoffMs(0), taskHandle(nullptr), running(false) {
+
+    mutex = xSemaphoreCreateMutex();
+    kick = xSemaphoreCreateBinary();
+    if (mutex == nullptr || kick == nullptr) {
+        ESP_LOGE(TAG, "Failed to create semaphores");
+    }
+}
+
+UploadScheduler::~UploadScheduler() {
+    stop();
+    if (mutex) {
+        vSemaphoreDelete(mutex);
+    }
+    if (kick) {
+        vSemaphoreDelete(kick);
+    }
+}
+
+void UploadScheduler::configure(bool enable, UploadOrder uploadOrder, uint32_t rateBps,
+                                uint32_t interactiveRateBps) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        order = uploadOrder;
+        backgroundBps = rateBps;
+        interactiveBps = interactiveRateBps;
+        enabled = enable;
+        backoffMs = 0;
+        if (backgroundActive) {
+            uploader.setSessionRate(rateForLocked(true));
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    ESP_LOGI(TAG, "Background upload %s: %s first, %lu B/s (%lu B/s while streaming)",
+             enable ? "on" : "off", uploadOrder == UploadOrder::NEWEST_FIRST ? "newest" : "oldest",
+             rateBps, interactiveRateBps);
+    notify();
+}
+
+esp_err_t UploadScheduler::start() {
+    if (taskHandle != nullptr) {
+        return ESP_OK;
+    }
+
+    running = true;
+    BaseType_t ret = xTaskCreate(
+        taskFunc,
+        "upload_sched",
+        4096,
+        this,
+        PRIORITY_UPLOAD_TASK,
+        &taskHandle
+    );
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create scheduler task");
+        running = false;
+        taskHandle = nullptr;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+void UploadScheduler::stop() {
+    if (taskHandle == nullptr) {
+        return;
+    }
+
+    // Upload đang chạy dừng ở frame/range kế tiếp (shouldYield)
+    running = false;
+    notify();
+
+    for (int i = 0; i < 100 && taskHandle != nullptr; i++) {
+        vTaskDelay(pdMS_TO_TICKS(100));
+    }
+    if (taskHandle != nullptr) {
+        ESP_LOGW(TAG, "Scheduler task did not stop in time");
+    }
+}
+
+void UploadScheduler::notify() {
+    if (kick) {
+        xSemaphoreGive(kick);
+    }
+}
+
+// ==================== Rate / yield ====================
+
+uint32_t UploadScheduler::rateForLocked(bool background) const {
+    uint32_t rate = background ? backgroundBps : 0;
+    if (interactive && interactiveBps > 0 && (rate == 0 || rate > interactiveBps)) {
+        rate = interactiveBps;
+    }
+    return rate;
+}
+
+uint32_t UploadScheduler::rateFor(bool background) const {
+    uint32_t rate = 0;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        rate = rateForLocked(background);
+        xSemaphoreGive(mutex);
+    }
+    return rate;
+}
+
+void UploadScheduler::setInteractive(bool active) {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        interactive = active;
+        // Session đang chạy (nền hoặc readVideo) đổi tốc độ từ chunk kế tiếp
+        uploader.setSessionRate(rateForLocked(backgroundActive));
+        xSemaphoreGive(mutex);
+    }
+    ESP_LOGI(TAG, "Live view/recording %s", active ? "active, upload throttled" : "idle");
+}
+
+void UploadScheduler::pollInteractive(bool force) {
+    if (!interactiveCheck) {
+        return;
+    }
+    int64_t nowUs = esp_timer_get_time();
+    if (!force && nowUs - lastPollUs < INTERACTIVE_POLL_US) {
+        return;
+    }
+    lastPollUs = nowUs;
+
+    bool active = interactiveCheck();
+    if (active != interactive) {
+        setInteractive(active);
+    }
+}
+
+void UploadScheduler::beginForeground() {
+    // readVideo lấy rateFor() ngay sau đây → trạng thái viewer phải mới
+    pollInteractive(true);
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        foregroundCount = foregroundCount + 1;
+        xSemaphoreGive(mutex);
+    }
+}
+
+void UploadScheduler::endForeground() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (foregroundCount > 0) {
+            foregroundCount = foregroundCount - 1;
+        }
+        xSemaphoreGive(mutex);
+    }
+    notify();
+}
+
+bool UploadScheduler::shouldYield() {
+    pollInteractive(false);
+    return foregroundCount > 0 || !running || !enabled;
+}
+
+// ==================== Scheduler task ====================
+
+bool UploadScheduler::pickNext(CatalogEntry& entry) {
+    std::vector<CatalogEntry> pending = catalog.pendingUploads();
+    if (pending.empty()) {
+        deferred.clear();
+        return false;
+    }
+    if (order == UploadOrder::NEWEST_FIRST) {
+        std::reverse(pending.begin(), pending.end());
+    }
+
+    for (const CatalogEntry& candidate : pending) {
+        if (std::find(deferred.begin(), deferred.end(), candidate.name) == deferred.end()) {
+            entry = candidate;
+            return true;
+        }
+    }
+
+    // Tất cả đều đã lỗi (thường là mất mạng) → xoay vòng lại từ đầu
+    deferred.clear();
+    entry = pending.front();
+    return true;
+}
+
+// Upload 1 recording, trả về thời gian chờ trước lần kế tiếp
+uint32_t UploadScheduler::runOnce() {
+    if (!enabled || !uploadFn) {
+        return IDLE_POLL_MS;
+    }
+    if (foregroundCount > 0) {
+        return YIELD_RETRY_MS;
+    }
+
+    CatalogEntry entry;
+    if (!pickNext(entry)) {
+        return IDLE_POLL_MS;
+    }
+    pollInteractive(true);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        backgroundActive = true;
+        xSemaphoreGive(mutex);
+    }
+
+    ESP_LOGI(TAG, "Uploading %s in background", entry.name);
+    esp_err_t ret = uploadFn(entry);
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        backgroundActive = false;
+        xSemaphoreGive(mutex);
+    }
+
+    if (ret == ESP_OK) {
+        uploadedCount++;
+        backoffMs = 0;
+        lastFailedAttempts = 0;
+        return 0;
+    }
+
+    if (ret == ESP_ERR_NOT_FINISHED) {
+        yieldCount++;
+        return YIELD_RETRY_MS;
+    }
+
+    failedCount++;
+    if (lastFailed == entry.name) {
+        lastFailedAttempts++;
+    } else {
+        lastFailed = entry.name;
+        lastFailedAttempts = 1;
+    }
+    if (lastFailedAttempts >= MAX_ATTEMPTS) {
+        ESP_LOGW(TAG, "%s failed %lu times, deferring", entry.name, lastFailedAttempts);
+        deferred.push_back(entry.name);
+        lastFailedAttempts = 0;
+    }
+
+    backoffMs = backoffMs ? std::min(backoffMs * 2, MAX_BACKOFF_MS) : MIN_BACKOFF_MS;
+    ESP_LOGW(TAG, "Background upload failed, retry in %lu ms", backoffMs);
+    return backoffMs;
+}
+
+void UploadScheduler::taskFunc(void* param) {
+    UploadScheduler* self = static_cast<UploadScheduler*>(param);
+
+    ESP_LOGI(TAG, "Scheduler task started");
+
+    uint32_t waitMs = IDLE_POLL_MS;
+    while (self->running) {
+        xSemaphoreTake(self->kick, pdMS_TO_TICKS(waitMs));
+        if (!self->running) {
+            break;
+        }
+        waitMs = self->runOnce();
+    }
+
+    ESP_LOGI(TAG, "Scheduler task ended");
+    self->taskHandle = nullptr;
+    vTaskDelete(nullptr);
+}
+
+UploadSchedulerStats UploadScheduler::getStats() const {
+    UploadSchedulerStats stats = {};
+
+    std::vector<CatalogEntry> pending = catalog.pendingUploads();
+    stats.queueDepth = pending.size();
+    for (const CatalogEntry& entry : pending) {
+        stats.queueBytes += entry.totalBytes;
+    }
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        stats.uploaded = uploadedCount;
+        stats.failed = failedCount;
+        stats.yields = yieldCount;
+        stats.rateBps = rateForLocked(true);
+        stats.interactive = interactive;
+        stats.active = backgroundActive;
+        xSemaphoreGive(mutex);
+    }
+
+    return stats;
+}
@@ -0,0 +1,122 @@
+#ifndef CAM_UPLOAD_SCHEDULER_HPP
+#define CAM_UPLOAD_SCHEDULER_HPP
+
+#include "CAM_catalog.hpp"
+#include "CAM_uploader.hpp"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <functional>
+
+// Thứ tự upload nền
+enum class UploadOrder : uint8_t {
+    OLDEST_FIRST = 0,   // Giải phóng dần recording cũ (retention xóa cũ nhất trước)
+    NEWEST_FIRST        // Sự kiện mới nhất lên server sớm nhất
+};
+
+struct UploadSchedulerStats {
+    uint32_t queueDepth;        // Recording hoàn tất chưa upload
+    uint64_t queueBytes;
+    uint32_t uploaded;
+    uint32_t failed;
+    uint32_t yields;            // Lần nhường kết nối cho readVideo (MQTT)
+    uint32_t rateBps;           // Giới hạn đang áp dụng cho upload nền
+    bool interactive;           // Có người xem live (/stream, /ws, RTSP) hoặc đang ghi
+    bool active;                // Đang upload 1 recording
+};
+
+// Upload Scheduler Class - upload nền các recording trong catalog
+//   - Task ưu tiên thấp, lấy recording chưa upload theo UploadOrder
+//   - Token bucket (HttpUploader session rate): backgroundBps, có người xem live hoặc đang ghi
+//     (interactiveCheck, hỏi lại mỗi INTERACTIVE_POLL_MS trong lúc upload) → interactiveBps
+//   - readVideo (MQTT) chen vào: upload nền dừng ở frame/range kế tiếp, checkpoint giữ tiến độ
+//   - Lỗi → backoff tăng dần; recording lỗi liên tục bị đẩy xuống cuối hàng
+class UploadScheduler {
+public:
+    // Upload 1 recording ở chế độ nền. ESP_ERR_NOT_FINISHED = đã nhường, chạy tiếp sau
+    using Uploader = std::function<esp_err_t(const CatalogEntry&)>;
+
+private:
+    RecordingCatalog& catalog;
+    HttpUploader& uploader;
+    Uploader uploadFn;
+    std::function<bool()> interactiveCheck;
+    int64_t lastPollUs;
+
+    UploadOrder order;
+    uint32_t backgroundBps;
+    uint32_t interactiveBps;
+    volatile bool enabled;
+    volatile bool interactive;
+    volatile bool backgroundActive;     // Session của uploader đang là upload nền
+    volatile uint32_t foregroundCount;  // readVideo đang chờ/chạy
+
+    uint32_t uploadedCount;
+    uint32_t failedCount;
+    uint32_t yieldCount;
+    std::string lastFailed;
+    uint32_t lastFailedAttempts;
+    std::vector<std::string> deferred;  // Lỗi MAX_ATTEMPTS lần → thử sau các recording khác
+    uint32_t backoffMs;
+
+    TaskHandle_t taskHandle;
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t kick;
+    volatile bool running;
+
+    static const char* TAG;
+    static constexpr uint8_t PRIORITY_UPLOAD_TASK = 2;     // Dưới write task, MQTT, stream
+    static constexpr uint32_t IDLE_POLL_MS = 60000;
+    static constexpr uint32_t YIELD_RETRY_MS = 2000;
+    static constexpr uint32_t MIN_BACKOFF_MS = 5000;
+    static constexpr uint32_t MAX_BACKOFF_MS = 5 * 60 * 1000;
+    static constexpr uint32_t MAX_ATTEMPTS = 3;
+    static constexpr int64_t INTERACTIVE_POLL_US = 500000;
+
+    static void taskFunc(void* param);
+    bool pickNext(CatalogEntry& entry);
+    uint32_t runOnce();
+    uint32_t rateForLocked(bool background) const;
+    void pollInteractive(bool force);
+
+public:
+    UploadScheduler(RecordingCatalog& cat, HttpUploader& up);
+    ~UploadScheduler();
+
+    // Disable copy
+    UploadScheduler(const UploadScheduler&) = delete;
+    UploadScheduler& operator=(const UploadScheduler&) = delete;
+
+    void setUploader(Uploader fn) { uploadFn = fn; }
+
+    // rate = 0 → không giới hạn; interactiveRate = 0 → không giảm khi stream
+    void configure(bool enable, UploadOrder uploadOrder, uint32_t rateBps, uint32_t interactiveRateBps);
+
+    esp_err_t start();
+    void stop();
+
+    // Đánh thức task (vd. recording mới hoàn tất)
+    void notify();
+
+    // true khi có client live hoặc recorder đang ghi (poll từ task upload)
+    void setInteractiveCheck(std::function<bool()> check) { interactiveCheck = check; }
+    // Live stream bật/tắt → đổi ngay tốc độ session đang chạy
+    void setInteractive(bool active);
+
+    // Giới hạn cho 1 session upload (foreground chỉ bị giới hạn khi stream chạy)
+    uint32_t rateFor(bool background) const;
+
+    // readVideo (MQTT) bao quanh upload của nó → upload nền nhường kết nối
+    void beginForeground();
+    void endForeground();
+    // Gọi mỗi frame/range của upload nền (cũng cập nhật trạng thái interactive)
+    bool shouldYield();
+
+    UploadSchedulerStats getStats() const;
+};
+
+#endif // CAM_UPLOAD_SCHEDULER_HPP
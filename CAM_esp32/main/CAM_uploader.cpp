@@ -0,0 +1,515 @@
+#include "CAM_uploader.hpp"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include <algorithm>
+#include <cstdlib>
+#include <strings.h>
+
+const char* HttpUploader::TAG = "UPLOADER";
+
+// ==================== Upload Sources ====================
+
+FileSource::~FileSource() {
+    if (file) {
+        fclose(file);
+    }
+}
+
+esp_err_t FileSource::open(const std::string& path) {
+    file = fopen(path.c_str(), "rb");
+    if (!file) {
+        ESP_LOGE("UPLOADER", "Failed to open: %s", path.c_str());
+        return ESP_FAIL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    totalBytes = fileSize > 0 ? fileSize : 0;
+    return ESP_OK;
+}
+
+esp_err_t FileSource::read(uint8_t* dst, size_t cap, size_t& len) {
+    if (!file) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    len = fread(dst, 1, cap, file);
+    if (len == 0 && ferror(file)) {
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t FileSource::seek(size_t offset) {
+    if (!file || offset > totalBytes) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return fseek(file, offset, SEEK_SET) == 0 ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t AviFrameSource::read(uint8_t* dst, size_t cap, size_t& len) {
+    if (pos >= size()) {
+        len = 0;
+        return ESP_OK;
+    }
+
+    esp_err_t ret = reader.readFrameRange(index, pos, dst, cap, len);
+    if (ret == ESP_OK) {
+        pos += len;
+    }
+    return ret;
+}
+
+esp_err_t AviFrameSource::seek(size_t offset) {
+    if (offset > size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pos = offset;
+    return ESP_OK;
+}
+
+esp_err_t RangeSource::select(size_t offset, size_t len) {
+    if (offset + len > inner.size()) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    start = offset;
+    length = len;
+    pos = 0;
+    return inner.seek(offset);
+}
+
+esp_err_t RangeSource::read(uint8_t* dst, size_t cap, size_t& len) {
+    len = 0;
+    if (pos >= length) {
+        return ESP_OK;
+    }
+
+    esp_err_t ret = inner.read(dst, std::min(cap, length - pos), len);
+    if (ret == ESP_OK) {
+        pos += len;
+    }
+    return ret;
+}
+
+esp_err_t RangeSource::seek(size_t offset) {
+    if (offset > length) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t ret = inner.seek(start + offset);
+    if (ret == ESP_OK) {
+        pos = offset;
+    }
+    return ret;
+}
+
+// ==================== HTTP Uploader ====================
+
+HttpUploader::HttpUploader(const std::string& serverUrl)
+    : baseUrl(serverUrl), sessionClient(nullptr), sessionOwner(nullptr), sessionConnected(false),
+      sessionRateBps(0), tokens(0), lastRefillUs(0), readerHandle(nullptr),
+      abortRead(false), responseAck(-1), stats() {
+
+    for (int i = 0; i < 2; i++) {
+        chunks[i].data = nullptr;
+        chunks[i].len = 0;
+        chunks[i].err = ESP_OK;
+    }
+
+    freeQueue = xQueueCreate(2, sizeof(uint8_t));
+    fullQueue = xQueueCreate(2, sizeof(uint8_t));
+    jobQueue = xQueueCreate(1, sizeof(UploadSource*));
+    mutex = xSemaphoreCreateMutex();
+    statsMutex = xSemaphoreCreateMutex();
+    if (freeQueue == nullptr || fullQueue == nullptr || jobQueue == nullptr ||
+        mutex == nullptr || statsMutex == nullptr) {
+        ESP_LOGE(TAG, "Failed to create queues");
+    }
+}
+
+HttpUploader::~HttpUploader() {
+    if (sessionClient != nullptr) {
+        esp_http_client_cleanup(sessionClient);
+    }
+    if (readerHandle != nullptr) {
+        UploadSource* stop = nullptr;
+        xQueueSend(jobQueue, &stop, portMAX_DELAY);
+        for (int i = 0; i < 20 && readerHandle != nullptr; i++) {
+            vTaskDelay(pdMS_TO_TICKS(50));
+        }
+    }
+
+    for (int i = 0; i < 2; i++) {
+        heap_caps_free(chunks[i].data);
+    }
+    if (freeQueue) vQueueDelete(freeQueue);
+    if (fullQueue) vQueueDelete(fullQueue);
+    if (jobQueue) vQueueDelete(jobQueue);
+    if (mutex) vSemaphoreDelete(mutex);
+    if (statsMutex) vSemaphoreDelete(statsMutex);
+}
+
+esp_err_t HttpUploader::init() {
+    if (readerHandle != nullptr) {
+        return ESP_OK;
+    }
+
+    // RAM nội: lwIP copy từ đây nhanh hơn PSRAM, 2 x 8 KB cố định
+    for (int i = 0; i < 2; i++) {
+        chunks[i].data = (uint8_t*)heap_caps_malloc(CHUNK_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+        if (chunks[i].data == nullptr) {
+            ESP_LOGE(TAG, "Failed to allocate %u byte chunk", CHUNK_BYTES);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    BaseType_t ret = xTaskCreate(
+        readerTaskFunc,
+        "upload_read",
+        4096,
+        this,
+        PRIORITY_READER_TASK,
+        &readerHandle
+    );
+
+    if (ret != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create reader task");
+        readerHandle = nullptr;
+        return ESP_FAIL;
+    }
+
+    return ESP_OK;
+}
+
+void HttpUploader::readerTaskFunc(void* param) {
+    HttpUploader* self = static_cast<HttpUploader*>(param);
+
+    ESP_LOGI(TAG, "Reader task started");
+
+    while (true) {
+        UploadSource* source = nullptr;
+        if (xQueueReceive(self->jobQueue, &source, portMAX_DELAY) != pdTRUE) {
+            continue;
+        }
+        if (source == nullptr) {
+            break;
+        }
+        self->readJob(source);
+    }
+
+    ESP_LOGI(TAG, "Reader task ended");
+    self->readerHandle = nullptr;
+    vTaskDelete(nullptr);
+}
+
+void HttpUploader::readJob(UploadSource* source) {
+    uint8_t idx = 0;
+
+    // Đọc trước vào chunk trống trong lúc sender gửi chunk còn lại
+    while (!abortRead) {
+        xQueueReceive(freeQueue, &idx, portMAX_DELAY);
+
+        Chunk& chunk = chunks[idx];
+        chunk.err = source->read(chunk.data, CHUNK_BYTES, chunk.len);
+        if (chunk.err != ESP_OK) {
+            chunk.len = 0;
+        }
+        xQueueSend(fullQueue, &idx, portMAX_DELAY);
+        if (chunk.len == 0) {
+            return;     // Chunk rỗng = marker kết thúc
+        }
+    }
+
+    // Sender đã dừng: vẫn gửi marker kết thúc để sender thoát vòng chờ
+    xQueueReceive(freeQueue, &idx, portMAX_DELAY);
+    chunks[idx].len = 0;
+    chunks[idx].err = ESP_OK;
+    xQueueSend(fullQueue, &idx, portMAX_DELAY);
+}
+
+// Token bucket: nạp theo thời gian, gửi trước rồi trả nợ bằng cách chờ
+void HttpUploader::throttle(size_t bytes) {
+    uint32_t rate = sessionRateBps;
+    if (rate == 0 || !ownsSession()) {
+        return;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    tokens += (nowUs - lastRefillUs) * rate / 1000000;
+    if (tokens > BURST_BYTES) {
+        tokens = BURST_BYTES;
+    }
+    lastRefillUs = nowUs;
+    tokens -= bytes;
+
+    if (tokens < 0) {
+        int64_t waitUs = -tokens * 1000000 / rate;
+        vTaskDelay(pdMS_TO_TICKS(waitUs / 1000) + 1);
+
+        if (xSemaphoreTake(statsMutex, portMAX_DELAY) == pdTRUE) {
+            stats.throttleUs += esp_timer_get_time() - nowUs;
+            xSemaphoreGive(statsMutex);
+        }
+    }
+}
+
+esp_err_t HttpUploader::sendBody(esp_http_client_handle_t client, UploadSource& source, size_t& sent) {
+    esp_err_t ret = ESP_OK;
+    sent = 0;
+
+    xQueueReset(freeQueue);
+    xQueueReset(fullQueue);
+    for (uint8_t i = 0; i < 2; i++) {
+        xQueueSend(freeQueue, &i, 0);
+    }
+    abortRead = false;
+
+    UploadSource* job = &source;
+    xQueueSend(jobQueue, &job, portMAX_DELAY);
+
+    // Luôn nhận tới marker kết thúc → reader không bao giờ còn giữ source sau khi trả về
+    uint32_t stallUs = 0;
+    while (true) {
+        uint8_t idx = 0;
+        int64_t waitStartUs = esp_timer_get_time();
+        xQueueReceive(fullQueue, &idx, portMAX_DELAY);
+        if (sent > 0) {
+            stallUs += esp_timer_get_time() - waitStartUs;
+        }
+
+        Chunk& chunk = chunks[idx];
+        if (chunk.len == 0) {
+            if (chunk.err != ESP_OK && ret == ESP_OK) {
+                ret = chunk.err;
+            }
+            break;
+        }
+
+        throttle(chunk.len);
+
+        // esp_http_client_write có thể ghi thiếu → gửi tới hết chunk
+        size_t offset = 0;
+        while (ret == ESP_OK && offset < chunk.len) {
+            int written = esp_http_client_write(client, (const char*)chunk.data + offset,
+                                                chunk.len - offset);
+            if (written <= 0) {
+                ret = ESP_ERR_HTTP_WRITE_DATA;
+                abortRead = true;
+                break;
+            }
+            offset += written;
+        }
+        sent += offset;
+
+        xQueueSend(freeQueue, &idx, portMAX_DELAY);
+    }
+
+    if (xSemaphoreTake(statsMutex, portMAX_DELAY) == pdTRUE) {
+        stats.readStallUs += stallUs;
+        xSemaphoreGive(statsMutex);
+    }
+
+    if (ret == ESP_OK && sent != source.size()) {
+        ESP_LOGE(TAG, "Source ended early (%u/%u bytes)", sent, source.size());
+        ret = ESP_ERR_INVALID_SIZE;
+    }
+    return ret;
+}
+
+// Response header chỉ đọc được qua event (esp_http_client_get_header là header request)
+esp_err_t HttpUploader::eventHandler(esp_http_client_event_t* evt) {
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && strcasecmp(evt->header_key, ACK_HEADER) == 0) {
+        HttpUploader* self = static_cast<HttpUploader*>(evt->user_data);
+        self->responseAck = strtoll(evt->header_value, nullptr, 10);
+    }
+    return ESP_OK;
+}
+
+esp_http_client_handle_t HttpUploader::createClient(bool keepAlive) {
+    esp_http_client_config_t config = {};
+    config.url = baseUrl.c_str();
+    config.method = HTTP_METHOD_POST;
+    config.timeout_ms = TIMEOUT_MS;
+    config.keep_alive_enable = keepAlive;
+    config.event_handler = eventHandler;
+    config.user_data = this;
+
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == nullptr) {
+        ESP_LOGE(TAG, "Failed to create HTTP client");
+    }
+    return client;
+}
+
+bool HttpUploader::ownsSession() const {
+    return sessionClient != nullptr && sessionOwner == xTaskGetCurrentTaskHandle();
+}
+
+esp_err_t HttpUploader::beginSession(uint32_t rateBps) {
+    if (readerHandle == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (ownsSession()) {
+        return ESP_OK;
+    }
+
+    // Session giữ mutex tới endSession() → upload khác phải chờ hết batch
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    sessionClient = createClient(true);
+    if (sessionClient == nullptr) {
+        xSemaphoreGive(mutex);
+        return ESP_FAIL;
+    }
+    sessionOwner = xTaskGetCurrentTaskHandle();
+    sessionConnected = false;
+    sessionRateBps = rateBps;
+    tokens = BURST_BYTES;
+    lastRefillUs = esp_timer_get_time();
+    return ESP_OK;
+}
+
+void HttpUploader::endSession() {
+    if (!ownsSession()) {
+        return;
+    }
+
+    esp_http_client_close(sessionClient);
+    esp_http_client_cleanup(sessionClient);
+    sessionClient = nullptr;
+    sessionOwner = nullptr;
+    sessionRateBps = 0;
+    xSemaphoreGive(mutex);
+}
+
+esp_err_t HttpUploader::request(esp_http_client_handle_t client, UploadSource& source,
+                                size_t& sent, int& status) {
+    sent = 0;
+    status = 0;
+    responseAck = -1;
+
+    // Kết nối còn mở (keep-alive) thì esp_http_client_open() dùng lại, không connect
+    esp_err_t ret = esp_http_client_open(client, source.size());
+    if (ret != ESP_OK) {
+        ESP_LOGE(TAG, "Connect failed: %s", esp_err_to_name(ret));
+        return ret;
+    }
+
+    ret = sendBody(client, source, sent);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+
+    if (esp_http_client_fetch_headers(client) < 0) {
+        return ESP_ERR_HTTP_FETCH_HEADER;
+    }
+    status = esp_http_client_get_status_code(client);
+
+    // Đọc hết response body → kết nối sẵn sàng cho request kế tiếp
+    esp_http_client_flush_response(client, nullptr);
+    return ESP_OK;
+}
+
+esp_err_t HttpUploader::upload(UploadSource& source, const char* path, const char* contentType,
+                               const std::string& label, const std::vector<UploadHeader>& headers,
+                               UploadResult* result) {
+    if (readerHandle == nullptr) {
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    bool inSession = ownsSession();
+    if (!inSession && xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return ESP_FAIL;
+    }
+
+    esp_http_client_handle_t client = inSession ? sessionClient : createClient(false);
+    if (client == nullptr) {
+        if (!inSession) {
+            xSemaphoreGive(mutex);
+        }
+        return ESP_FAIL;
+    }
+    std::string url = baseUrl + path;
+    esp_http_client_set_url(client, url.c_str());
+    esp_http_client_set_header(client, "Content-Type", contentType);
+    for (const UploadHeader& header : headers) {
+        esp_http_client_set_header(client, header.key, header.value.c_str());
+    }
+
+    int64_t startUs = esp_timer_get_time();
+    size_t sent = 0;
+    int status = 0;
+    uint32_t connects = (inSession && sessionConnected) ? 0 : 1;
+
+    esp_err_t ret = request(client, source, sent, status);
+
+    // Server đã đóng kết nối keep-alive lúc rảnh → mở lại và gửi lại từ đầu 1 lần
+    if (ret != ESP_OK && inSession && sessionConnected && source.seek(0) == ESP_OK) {
+        ESP_LOGW(TAG, "Session connection lost, reconnecting");
+        esp_http_client_close(client);
+        ret = request(client, source, sent, status);
+        connects++;
+    }
+
+    uint32_t kbps = 0;
+    if (ret == ESP_OK) {
+        int64_t elapsedUs = esp_timer_get_time() - startUs;
+        kbps = elapsedUs > 0 ? (uint32_t)(sent * 1000000ULL / 1024 / elapsedUs) : 0;
+        ESP_LOGI(TAG, "Uploaded: %s - Status: %d (%u bytes, %lu KB/s)",
+                 label.c_str(), status, sent, kbps);
+
+        if (status < 200 || status >= 300) {
+            ret = ESP_FAIL;
+        }
+    }
+
+    if (result) {
+        result->status = status;
+        result->ackBytes = responseAck;
+    }
+
+    if (inSession) {
+        // Header riêng của request này không được gửi kèm request kế tiếp
+        for (const UploadHeader& header : headers) {
+            esp_http_client_delete_header(client, header.key);
+        }
+
+        // Lỗi giữa chừng → đóng socket, request kế tiếp tự connect lại
+        sessionConnected = (ret == ESP_OK);
+        if (ret != ESP_OK) {
+            esp_http_client_close(client);
+        }
+    } else {
+        esp_http_client_close(client);
+        esp_http_client_cleanup(client);
+        xSemaphoreGive(mutex);
+    }
+
+    if (xSemaphoreTake(statsMutex, portMAX_DELAY) == pdTRUE) {
+        stats.uploads++;
+        stats.bytes += sent;
+        stats.connects += connects;
+        if (ret != ESP_OK) {
+            stats.failures++;
+        } else {
+            stats.lastKBps = kbps;
+        }
+        xSemaphoreGive(statsMutex);
+    }
+
+    return ret;
+}
+
+UploadStats HttpUploader::getStats() const {
+    UploadStats snapshot = {};
+
+    if (xSemaphoreTake(statsMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        snapshot = stats;
+        xSemaphoreGive(statsMutex);
+    }
+
+    return snapshot;
+}
@@ -0,0 +1,178 @@
+#ifndef CAM_UPLOADER_HPP
+#define CAM_UPLOADER_HPP
+
+#include "CAM_aviFile.hpp"
+#include "esp_err.h"
+#include "esp_http_client.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Nguồn dữ liệu upload: biết trước tổng dung lượng (Content-Length), đọc tuần tự theo đoạn
+class UploadSource {
+public:
+    virtual ~UploadSource() = default;
+    virtual size_t size() const = 0;
+    // Đọc đoạn kế tiếp vào dst (len = 0 → hết dữ liệu)
+    virtual esp_err_t read(uint8_t* dst, size_t cap, size_t& len) = 0;
+    // Đọc lại từ offset (gửi lại sau khi kết nối keep-alive bị đóng)
+    virtual esp_err_t seek(size_t offset) = 0;
+};
+
+// Toàn bộ 1 file trên SD (vd. JPEG của recording dạng folder)
+class FileSource : public UploadSource {
+private:
+    FILE* file;
+    size_t totalBytes;
+
+public:
+    FileSource() : file(nullptr), totalBytes(0) {}
+    ~FileSource() override;
+
+    // Disable copy
+    FileSource(const FileSource&) = delete;
+    FileSource& operator=(const FileSource&) = delete;
+
+    esp_err_t open(const std::string& path);
+    size_t size() const override { return totalBytes; }
+    esp_err_t read(uint8_t* dst, size_t cap, size_t& len) override;
+    esp_err_t seek(size_t offset) override;
+};
+
+// 1 frame JPEG trong file AVI (đọc thẳng từ movi, không copy cả frame)
+class AviFrameSource : public UploadSource {
+private:
+    AviReader& reader;
+    uint32_t index;
+    uint32_t pos;
+
+public:
+    AviFrameSource(AviReader& avi, uint32_t frameIndex) : reader(avi), index(frameIndex), pos(0) {}
+
+    size_t size() const override { return reader.getFrame(index).size; }
+    esp_err_t read(uint8_t* dst, size_t cap, size_t& len) override;
+    esp_err_t seek(size_t offset) override;
+};
+
+// Đoạn [start, start + length) của source khác (upload resume theo range)
+class RangeSource : public UploadSource {
+private:
+    UploadSource& inner;
+    size_t start;
+    size_t length;
+    size_t pos;
+
+public:
+    explicit RangeSource(UploadSource& source) : inner(source), start(0), length(0), pos(0) {}
+
+    // Chọn đoạn cho request kế tiếp (length = 0 → request rỗng, dùng để hỏi server offset)
+    esp_err_t select(size_t offset, size_t len);
+    size_t size() const override { return length; }
+    esp_err_t read(uint8_t* dst, size_t cap, size_t& len) override;
+    esp_err_t seek(size_t offset) override;
+};
+
+// Header thêm vào 1 request
+struct UploadHeader {
+    const char* key;
+    std::string value;
+};
+
+// Phản hồi của server cho 1 request
+struct UploadResult {
+    int status;
+    int64_t ackBytes;           // Header X-Upload-Ack (-1 = server không gửi)
+};
+
+struct UploadStats {
+    uint32_t uploads;
+    uint32_t failures;
+    uint64_t bytes;
+    uint32_t readStallUs;       // Socket phải chờ SD (prefetch không kịp)
+    uint32_t lastKBps;
+    uint32_t connects;          // Số lần mở TCP (keep-alive → ít hơn uploads nhiều)
+    uint32_t throttleUs;        // Thời gian chờ token bucket (session giới hạn tốc độ)
+};
+
+// HTTP Uploader Class - POST theo chunk qua esp_http_client_open/write
+//   - 2 buffer cố định (double buffering): reader task đọc SD vào buffer này
+//     trong lúc task gọi upload() gửi buffer kia → bộ nhớ đỉnh không phụ thuộc kích thước file
+//   - Mỗi lần chỉ 1 upload (mutex)
+//   - Session: giữ 1 kết nối keep-alive cho cả batch (folder/AVI), không handshake mỗi frame.
+//     Backpressure lấy từ socket (esp_http_client_write block khi TCP window đầy)
+//   - Session có thể giới hạn tốc độ (token bucket theo chunk) để nhường băng thông
+class HttpUploader {
+private:
+    struct Chunk {
+        uint8_t* data;
+        size_t len;             // 0 = hết dữ liệu (hoặc lỗi, xem err)
+        esp_err_t err;
+    };
+
+    std::string baseUrl;        // http://host:port (mọi request cùng host → dùng chung kết nối)
+    Chunk chunks[2];
+    QueueHandle_t freeQueue;    // Index chunk trống → reader
+    QueueHandle_t fullQueue;    // Index chunk đã đọc → sender
+    QueueHandle_t jobQueue;     // UploadSource* cần đọc (nullptr = dừng task)
+    SemaphoreHandle_t mutex;        // Giữ suốt 1 upload (hoặc cả session)
+    SemaphoreHandle_t statsMutex;
+    esp_http_client_handle_t sessionClient;
+    TaskHandle_t sessionOwner;
+    bool sessionConnected;          // false → request kế tiếp mở TCP mới
+    volatile uint32_t sessionRateBps;   // 0 = không giới hạn
+    int64_t tokens;                 // Byte được gửi ngay (âm = đang nợ)
+    int64_t lastRefillUs;
+    TaskHandle_t readerHandle;
+    volatile bool abortRead;
+    int64_t responseAck;        // X-Upload-Ack của response đang đọc (event handler)
+    UploadStats stats;
+
+    static const char* TAG;
+    static constexpr size_t CHUNK_BYTES = 8 * 1024;
+    static constexpr uint8_t PRIORITY_READER_TASK = 4;
+    static constexpr int TIMEOUT_MS = 10000;
+    static constexpr int64_t BURST_BYTES = 2 * CHUNK_BYTES;
+
+    static esp_err_t eventHandler(esp_http_client_event_t* evt);
+    static void readerTaskFunc(void* param);
+    void readJob(UploadSource* source);
+    void throttle(size_t bytes);
+    esp_err_t sendBody(esp_http_client_handle_t client, UploadSource& source, size_t& sent);
+    esp_err_t request(esp_http_client_handle_t client, UploadSource& source, size_t& sent, int& status);
+    esp_http_client_handle_t createClient(bool keepAlive);
+    bool ownsSession() const;
+
+public:
+    explicit HttpUploader(const std::string& serverUrl);
+    ~HttpUploader();
+
+    // Disable copy
+    HttpUploader(const HttpUploader&) = delete;
+    HttpUploader& operator=(const HttpUploader&) = delete;
+
+    esp_err_t init();
+    bool isInitialized() const { return readerHandle != nullptr; }
+
+    static constexpr const char* ACK_HEADER = "X-Upload-Ack";
+    
+    // headers: thêm cho request này (resume id/offset), result: status + ack của server
+    esp_err_t upload(UploadSource& source, const char* path, const char* contentType,
+                     const std::string& label, const std::vector<UploadHeader>& headers = {},
+                     UploadResult* result = nullptr);
+    
+    // Batch upload trên 1 kết nối: begin → upload()... → end (cùng 1 task)
+    // rateBps: giới hạn tốc độ gửi của session (0 = theo socket)
+    esp_err_t beginSession(uint32_t rateBps = 0);
+    void endSession();
+    // Đổi giới hạn giữa session (gọi được từ task khác), có hiệu lực từ chunk kế tiếp
+    void setSessionRate(uint32_t rateBps) { sessionRateBps = rateBps; }
+
+    UploadStats getStats() const;
+};
+
+#endif // CAM_UPLOADER_HPP
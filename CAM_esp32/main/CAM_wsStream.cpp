@@ -0,0 +1,383 @@
+#include "CAM_wsStream.hpp"
+#include "sdkconfig.h"
+
+// Cần CONFIG_HTTPD_WS_SUPPORT (sdkconfig.defaults)
+#if CONFIG_HTTPD_WS_SUPPORT
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+const char* WsStreamManager::TAG = "WS_STREAM";
+
+// Global instance for static callback
+static WsStreamManager* g_wsStreamMgr = nullptr;
+
+WsStreamManager::WsStreamManager(FrameBroker& frameBroker) : broker(frameBroker) {
+    for (Client& client : clients) {
+        client = {};
+        client.owner = this;
+        client.fd = -1;
+        client.consumer = -1;
+    }
+
+    mutex = xSemaphoreCreateMutex();
+    clientsDone = xSemaphoreCreateBinary();
+    if (mutex == nullptr || clientsDone == nullptr) {
+        ESP_LOGE(TAG, "Failed to create mutex");
+    }
+
+    g_wsStreamMgr = this;
+}
+
+WsStreamManager::~WsStreamManager() {
+    g_wsStreamMgr = nullptr;
+    stop();
+
+    if (mutex != nullptr) {
+        vSemaphoreDelete(mutex);
+    }
+    if (clientsDone != nullptr) {
+        vSemaphoreDelete(clientsDone);
+    }
+}
+
+void WsStreamManager::stop() {
+    if (xSemaphoreTake(mutex, portMAX_DELAY) != pdTRUE) {
+        return;
+    }
+
+    xSemaphoreTake(clientsDone, 0);
+
+    // Đánh thức client đang chờ frame hoặc chờ credit
+    uint8_t active = 0;
+    for (Client& client : clients) {
+        if (client.fd >= 0) {
+            client.stop = true;
+            broker.cancel(client.consumer);
+            if (client.task) {
+                xTaskNotifyGive(client.task);
+            }
+            active++;
+        }
+    }
+
+    xSemaphoreGive(mutex);
+
+    if (active > 0 && xSemaphoreTake(clientsDone, pdMS_TO_TICKS(STOP_TIMEOUT_MS)) != pdTRUE) {
+        ESP_LOGW(TAG, "Timeout waiting for %u client(s) to stop", active);
+    }
+}
+
+esp_err_t WsStreamManager::handleRequest(httpd_req_t* req) {
+    // httpd gọi handler với GET sau khi đã trả handshake 101
+    if (req->method == HTTP_GET) {
+        return openClient(req);
+    }
+    return receive(req);
+}
+
+esp_err_t WsStreamManager::openClient(httpd_req_t* req) {
+    int fd = httpd_req_to_sockfd(req);
+
+    Client* client = nullptr;
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        for (Client& slot : clients) {
+            if (slot.fd < 0) {
+                client = &slot;
+                client->fd = fd;
+                client->server = req->handle;
+                client->stop = false;
+                client->credits = INITIAL_CREDITS;
+                client->seq = 0;
+                client->frames = 0;
+                client->bytes = 0;
+                client->stalls = 0;
+                client->latencyUs = 0;
+                client->startUs = esp_timer_get_time();
+                break;
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    if (client == nullptr) {
+        // ESP_FAIL → httpd đóng kết nối vừa upgrade
+        ESP_LOGW(TAG, "Too many WebSocket clients (max %u)", MAX_CLIENTS);
+        return ESP_FAIL;
+    }
+
+    client->consumer = broker.subscribe("ws", WS_FPS, QueueDropPolicy::DROP_OLDEST);
+    if (client->consumer < 0) {
+        releaseClient(*client, false);
+        return ESP_FAIL;
+    }
+
+    // Gửi trên task riêng thẳng lên socket (httpd_socket_send), httpd chỉ nhận message credit/ack
+    if (xTaskCreate(clientTaskFunc, "ws_client", 4096, client, PRIORITY_CLIENT_TASK, &client->task) != pdPASS) {
+        ESP_LOGE(TAG, "Failed to create client task");
+        releaseClient(*client, false);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "WebSocket client %d connected", fd);
+    return ESP_OK;
+}
+
+esp_err_t WsStreamManager::receive(httpd_req_t* req) {
+    uint8_t message[MAX_MESSAGE_BYTES];
+    httpd_ws_frame_t frame = {};
+
+    // Lần đầu len = 0 → chỉ đọc header để biết độ dài payload
+    esp_err_t ret = httpd_ws_recv_frame(req, &frame, 0);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    if (frame.len >= sizeof(message)) {
+        ESP_LOGW(TAG, "Message too large (%u bytes)", frame.len);
+        return ESP_FAIL;
+    }
+
+    frame.payload = message;
+    ret = httpd_ws_recv_frame(req, &frame, frame.len);
+    if (ret != ESP_OK) {
+        return ret;
+    }
+    message[frame.len] = '\0';
+
+    if (frame.type != HTTPD_WS_TYPE_TEXT) {
+        return ESP_OK;
+    }
+
+    // {"credit":N} hoặc {"ack":seq}
+    const char* credit = strstr((const char*)message, "\"credit\"");
+    const char* ack = strstr((const char*)message, "\"ack\"");
+    const char* colon = credit ? strchr(credit, ':') : (ack ? strchr(ack, ':') : nullptr);
+    if (colon == nullptr) {
+        return ESP_OK;
+    }
+    uint32_t value = strtoul(colon + 1, nullptr, 10);
+
+    int fd = httpd_req_to_sockfd(req);
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        for (Client& client : clients) {
+            if (client.fd != fd) {
+                continue;
+            }
+
+            if (credit) {
+                client.credits = std::min(client.credits + value, MAX_CREDITS);
+            } else {
+                client.credits = std::min(client.credits + 1, MAX_CREDITS);
+                // Seq còn trong lịch sử → độ trễ gửi → render
+                if (value < client.seq && client.seq - value <= ACK_HISTORY) {
+                    client.latencyUs = esp_timer_get_time() - client.sentUs[value % ACK_HISTORY];
+                }
+            }
+            // Task có thể chưa kịp tạo xong (message đến ngay sau handshake)
+            if (client.task) {
+                xTaskNotifyGive(client.task);
+            }
+            break;
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    return ESP_OK;
+}
+
+void WsStreamManager::clientTaskFunc(void* param) {
+    Client* client = static_cast<Client*>(param);
+    client->owner->streamTo(*client);
+
+    vTaskDelete(nullptr);
+}
+
+bool WsStreamManager::takeCredit(Client& client) {
+    bool ok = false;
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        if (client.credits > 0) {
+            client.credits--;
+            ok = true;
+        } else {
+            client.stalls++;
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    return ok;
+}
+
+// Gửi hết len byte trong task của client (socket blocking → send trả về khi TCP nhận được)
+esp_err_t WsStreamManager::sendAll(Client& client, const uint8_t* data, size_t len) {
+    while (len > 0) {
+        int sent = httpd_socket_send(client.server, client.fd, (const char*)data, len, 0);
+        if (sent <= 0) {
+            return ESP_FAIL;
+        }
+        data += sent;
+        len -= sent;
+    }
+    return ESP_OK;
+}
+
+void WsStreamManager::streamTo(Client& client) {
+    // WS frame header + header ứng dụng, gửi 1 lần trước JPEG
+    uint8_t header[WS_FRAME_HEADER_MAX + WS_HEADER_BYTES];
+    bool failed = false;
+
+    while (!client.stop) {
+        // Hết credit → chờ ack/credit; định kỳ kiểm tra client còn kết nối
+        if (!takeCredit(client)) {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CREDIT_WAIT_MS));
+            if (httpd_ws_get_fd_info(client.server, client.fd) != HTTPD_WS_CLIENT_WEBSOCKET) {
+                break;
+            }
+            continue;
+        }
+
+        // Frame mới nhất trong mailbox (frame cũ đã bị thay trong lúc chờ credit)
+        FrameHandle frame;
+        if (!broker.acquire(client.consumer, frame, pdMS_TO_TICKS(FRAME_TIMEOUT_MS))) {
+            if (!client.stop) {
+                ESP_LOGE(TAG, "Camera capture failed");
+                failed = true;
+            }
+            break;
+        }
+
+        uint32_t seq = client.seq;
+        uint16_t width = frame.width();
+        uint16_t height = frame.height();
+        uint64_t captureUs = frame.timestampUs();
+        std::span<const uint8_t> jpeg = frame.data();
+        uint64_t payloadLen = WS_HEADER_BYTES + jpeg.size();
+
+        // RFC 6455: FIN + binary, độ dài 7 bit / 16 bit / 64 bit (big-endian), không mask
+        size_t pos = 0;
+        header[pos++] = 0x80 | HTTPD_WS_TYPE_BINARY;
+        if (payloadLen < 126) {
+            header[pos++] = payloadLen;
+        } else if (payloadLen <= 0xFFFF) {
+            header[pos++] = 126;
+            header[pos++] = payloadLen >> 8;
+            header[pos++] = payloadLen & 0xFF;
+        } else {
+            header[pos++] = 127;
+            for (int shift = 56; shift >= 0; shift -= 8) {
+                header[pos++] = (payloadLen >> shift) & 0xFF;
+            }
+        }
+        memcpy(header + pos, &seq, 4);
+        memcpy(header + pos + 4, &width, 2);
+        memcpy(header + pos + 6, &height, 2);
+        memcpy(header + pos + 8, &captureUs, 8);
+        pos += WS_HEADER_BYTES;
+
+        int64_t sendUs = esp_timer_get_time();
+        bool sent = sendAll(client, header, pos) == ESP_OK && sendAll(client, jpeg.data(), jpeg.size()) == ESP_OK;
+        size_t frameBytes = frame.size();
+        // Trả frame trước khi chờ credit kế tiếp
+        broker.release(client.consumer, frame);
+        if (!sent) {
+            failed = true;
+            break;
+        }
+
+        if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+            client.sentUs[seq % ACK_HISTORY] = sendUs;
+            client.seq = seq + 1;
+            client.frames++;
+            client.bytes += WS_HEADER_BYTES + frameBytes;
+            xSemaphoreGive(mutex);
+        }
+    }
+
+    releaseClient(client, failed);
+}
+
+void WsStreamManager::releaseClient(Client& client, bool closeSocket) {
+    if (client.consumer >= 0) {
+        BrokerConsumerStats stats = broker.getStats(client.consumer);
+        ESP_LOGI(TAG, "WebSocket client %d ended: %lu frames, %llu KB, %lu stalls, %lu skipped",
+                 client.fd, client.frames, client.bytes / 1024, client.stalls, stats.dropped);
+        broker.unsubscribe(client.consumer);
+    }
+
+    // Gửi lỗi giữa message → socket không còn dùng được
+    if (closeSocket) {
+        httpd_sess_trigger_close(client.server, client.fd);
+    }
+
+    if (xSemaphoreTake(mutex, portMAX_DELAY) == pdTRUE) {
+        client.consumer = -1;
+        client.fd = -1;
+        client.task = nullptr;
+
+        bool last = true;
+        for (const Client& other : clients) {
+            last = last && other.fd < 0;
+        }
+        if (last) {
+            xSemaphoreGive(clientsDone);
+        }
+        xSemaphoreGive(mutex);
+    }
+}
+
+uint8_t WsStreamManager::getClientCount() const {
+    uint8_t count = 0;
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) == pdTRUE) {
+        for (const Client& client : clients) {
+            if (client.fd >= 0) {
+                count++;
+            }
+        }
+        xSemaphoreGive(mutex);
+    }
+
+    return count;
+}
+
+std::vector<WsClientStats> WsStreamManager::getClientStats() const {
+    std::vector<WsClientStats> result;
+
+    if (xSemaphoreTake(mutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+        return result;
+    }
+
+    int64_t nowUs = esp_timer_get_time();
+    for (const Client& client : clients) {
+        if (client.fd < 0) {
+            continue;
+        }
+
+        WsClientStats stats = {};
+        stats.fd = client.fd;
+        stats.frames = client.frames;
+        stats.bytes = client.bytes;
+        stats.credits = client.credits;
+        stats.stalls = client.stalls;
+        stats.latencyMs = client.latencyUs / 1000;
+        stats.connectedMs = (nowUs - client.startUs) / 1000;
+        result.push_back(stats);
+    }
+
+    xSemaphoreGive(mutex);
+    return result;
+}
+
+esp_err_t WsStreamManager::wsHandlerWrapper(httpd_req_t* req) {
+    if (g_wsStreamMgr == nullptr) {
+        ESP_LOGE(TAG, "WebSocket stream manager not initialized");
+        return ESP_FAIL;
+    }
+
+    return g_wsStreamMgr->handleRequest(req);
+}
+
+#endif // CONFIG_HTTPD_WS_SUPPORT
@@ -0,0 +1,106 @@
+#ifndef CAM_WS_STREAM_HPP
+#define CAM_WS_STREAM_HPP
+
+#include "CAM_frameBroker.hpp"
+#include "esp_http_server.h"
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include <vector>
+#include <cstdint>
+
+// Counter của 1 client /ws
+struct WsClientStats {
+    int fd;
+    uint32_t frames;
+    uint64_t bytes;
+    uint32_t credits;           // Credit còn lại
+    uint32_t stalls;            // Số lần hết credit (client chưa render xong)
+    uint32_t latencyMs;         // Gửi frame → nhận ack của frame đó (lần gần nhất)
+    uint32_t connectedMs;
+};
+
+// WebSocket Stream Manager Class - /ws, JPEG dạng binary message có flow control từ client
+//   - Mỗi message: header WS_HEADER_BYTES (little-endian: seq u32, width u16, height u16,
+//     captureUs u64) + JPEG, 1 binary message (FIN) gửi thẳng lên socket từ task của client bằng
+//     httpd_socket_send: WS frame header dựng tại chỗ, JPEG zero-copy từ buffer driver.
+//     httpd_ws_send_data không dùng được vì nó chuyển việc gửi sang task httpd (httpd_queue_work)
+//     → 1 client /ws chậm sẽ chặn mọi request HTTP
+//   - Client → server (text): {"credit":N} cấp thêm N frame, {"ack":seq} = đã render seq (+1 credit)
+//   - Chỉ gửi khi còn credit → tối đa MAX_CREDITS frame trên đường truyền, độ trễ ~1 frame
+//     dù socket/mạng có buffer lớn. Hết credit: frame mới vẫn thay frame cũ trong mailbox
+//   - Cùng FrameBroker với /stream và RTSP → chạy song song, capture 1 lần
+class WsStreamManager {
+private:
+    static constexpr uint8_t ACK_HISTORY = 8;
+
+    struct Client {
+        WsStreamManager* owner;
+        int fd;                 // -1 = slot trống
+        httpd_handle_t server;
+        int consumer;
+        TaskHandle_t task;
+        volatile bool stop;
+
+        uint32_t credits;
+        uint32_t seq;           // Seq của frame kế tiếp
+        int64_t sentUs[ACK_HISTORY];
+
+        uint32_t frames;
+        uint64_t bytes;
+        uint32_t stalls;
+        uint32_t latencyUs;
+        int64_t startUs;
+    };
+
+    FrameBroker& broker;
+    SemaphoreHandle_t mutex;
+    SemaphoreHandle_t clientsDone;  // Client cuối cùng kết thúc (stop() chờ)
+
+    static const char* TAG;
+    static constexpr uint8_t MAX_CLIENTS = 2;
+    static constexpr uint8_t WS_FPS = 20;
+    static constexpr uint32_t INITIAL_CREDITS = 1;      // Client đơn giản chỉ cần ack từng frame
+    static constexpr uint32_t MAX_CREDITS = 4;
+    static constexpr size_t WS_HEADER_BYTES = 16;
+    static constexpr size_t WS_FRAME_HEADER_MAX = 10;   // RFC 6455, server → client không mask
+    static constexpr size_t MAX_MESSAGE_BYTES = 64;     // Message điều khiển từ client
+    static constexpr uint32_t CREDIT_WAIT_MS = 1000;    // Kiểm tra kết nối khi chờ credit
+    static constexpr uint32_t FRAME_TIMEOUT_MS = 2000;
+    static constexpr uint32_t STOP_TIMEOUT_MS = 1000;
+    static constexpr uint8_t PRIORITY_CLIENT_TASK = 5;  // = /stream client
+
+    Client clients[MAX_CLIENTS];
+
+    static void clientTaskFunc(void* param);
+
+    esp_err_t openClient(httpd_req_t* req);
+    esp_err_t receive(httpd_req_t* req);
+    void streamTo(Client& client);
+    bool takeCredit(Client& client);
+    esp_err_t sendAll(Client& client, const uint8_t* data, size_t len);
+    void releaseClient(Client& client, bool closeSocket);
+
+public:
+    explicit WsStreamManager(FrameBroker& frameBroker);
+    ~WsStreamManager();
+
+    // Disable copy
+    WsStreamManager(const WsStreamManager&) = delete;
+    WsStreamManager& operator=(const WsStreamManager&) = delete;
+
+    void stop();
+
+    uint8_t getTargetFps() const { return WS_FPS; }
+    uint8_t getClientCount() const;
+    std::vector<WsClientStats> getClientStats() const;
+
+    // HTTP handler - GET = handshake xong (client mới), còn lại = message từ client
+    esp_err_t handleRequest(httpd_req_t* req);
+
+    // Static wrapper for HTTP server callback (uri "/ws", is_websocket = true)
+    static esp_err_t wsHandlerWrapper(httpd_req_t* req);
+};
+
+#endif // CAM_WS_STREAM_HPP
@@ -1,6 +1,12 @@
 #include "CAM_sensorRead.hpp"
 #include "CAM_memorFunc.hpp"
 #include "CAM_HTTPstream.hpp"
+#include "CAM_playback.hpp"
+#include "CAM_download.hpp"
+#include "CAM_snapshot.hpp"
+#include "CAM_rtsp.hpp"
+#include "CAM_wsStream.hpp"
+#include "CAM_motion.hpp"
 #include "CAM_mqttApi.hpp"
 #include "CAM_WiFi.hpp"
 #include "CAM_NVS.hpp"
@@ -9,15 +15,23 @@
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "esp_http_server.h"
+#include "sdkconfig.h"
 
 static const char* TAG = "MAIN";
 
 // Global managers
 static SensorManager* sensorMgr = nullptr;
 static SdCardManager* sdCardMgr = nullptr;
+static FrameBroker* frameBroker = nullptr;
 static VideoManager* videoMgr = nullptr;
 static VideoWriteTimer* videoWriteTimer = nullptr;
 static HttpStreamManager* streamMgr = nullptr;
+static PlaybackManager* playbackMgr = nullptr;
+static DownloadManager* downloadMgr = nullptr;
+static SnapshotCache* snapshotCache = nullptr;
+static RtspServer* rtspServer = nullptr;
+static WsStreamManager* wsStreamMgr = nullptr;
+static MotionVerifier* motionVerifier = nullptr;
 static MqttApiManager* mqttApi = nullptr;
 static WiFiConnectionManager* wifiMgr = nullptr;
 static httpd_handle_t httpServer = nullptr;
@@ -31,12 +45,31 @@ static esp_err_t streamHandler(httpd_req_t* req) {
     return HttpStreamManager::streamHandlerWrapper(req);
 }
 
+static esp_err_t playbackHandler(httpd_req_t* req) {
+    return PlaybackManager::playbackHandlerWrapper(req);
+}
+
+static esp_err_t downloadHandler(httpd_req_t* req) {
+    return DownloadManager::downloadHandlerWrapper(req);
+}
+
+static esp_err_t captureHandler(httpd_req_t* req) {
+    return SnapshotCache::captureHandlerWrapper(req);
+}
+
+#if CONFIG_HTTPD_WS_SUPPORT
+static esp_err_t wsHandler(httpd_req_t* req) {
+    return WsStreamManager::wsHandlerWrapper(req);
+}
+#endif
+
 static esp_err_t initHttpServer() {
     httpd_config_t config = HTTPD_DEFAULT_CONFIG();
     config.server_port = 80;
     config.ctrl_port = 32768;
     config.max_open_sockets = 7;
     config.lru_purge_enable = true;
+    config.uri_match_fn = httpd_uri_match_wildcard;   // /recordings/<name>
     
     if (httpd_start(&httpServer, &config) != ESP_OK) {
         ESP_LOGE(TAG, "Failed to start HTTP server");
@@ -52,6 +85,53 @@ static esp_err_t initHttpServer() {
     
     httpd_register_uri_handler(httpServer, &stream_uri);
     
+    // /playback?folder=<recording>&speed=<0.25..16>&t=<giây>
+    httpd_uri_t playback_uri = {
+        .uri = "/playback",
+        .method = HTTP_GET,
+        .handler = playbackHandler,
+        .user_ctx = nullptr
+    };
+    
+    httpd_register_uri_handler(httpServer, &playback_uri);
+    
+    // /recordings (danh sách), /recordings/<name> (Range, ETag)
+    httpd_uri_t download_uri = {
+        .uri = "/recordings*",
+        .method = HTTP_GET,
+        .handler = downloadHandler,
+        .user_ctx = nullptr
+    };
+    
+    httpd_register_uri_handler(httpServer, &download_uri);
+    
+    // /capture (ảnh mới nhất từ cache), /capture?fresh=1 (chờ frame mới)
+    httpd_uri_t capture_uri = {
+        .uri = "/capture",
+        .method = HTTP_GET,
+        .handler = captureHandler,
+        .user_ctx = nullptr
+    };
+    
+    httpd_register_uri_handler(httpServer, &capture_uri);
+    
+#if CONFIG_HTTPD_WS_SUPPORT
+    // /ws: JPEG qua WebSocket, client gửi credit/ack
+    httpd_uri_t ws_uri = {
+        .uri = "/ws",
+        .method = HTTP_GET,
+        .handler = wsHandler,
+        .user_ctx = nullptr,
+        .is_websocket = true,
+        .handle_ws_control_frames = false,
+        .supported_subprotocol = nullptr
+    };
+    
+    httpd_register_uri_handler(httpServer, &ws_uri);
+#else
+    ESP_LOGW(TAG, "CONFIG_HTTPD_WS_SUPPORT disabled, /ws not available");
+#endif
+    
     ESP_LOGI(TAG, "HTTP server started on port %u", config.server_port);
     return ESP_OK;
 }
@@ -63,41 +143,69 @@ static void pirMonitorTask(void* param) {
     PirSensor& pir = sensorMgr->getPir();
     RtcDS3231& rtc = sensorMgr->getRtc();
     
+    // Ngắt cạnh lên đánh thức task trực tiếp; không bật được ngắt → poll 200 ms như cũ
+    bool interruptMode = pir.enableInterrupt(xTaskGetCurrentTaskHandle()) == ESP_OK;
+    
     bool lastMotionState = false;
+    TickType_t lastExtend = 0;
     
     while (pirTaskRunning) {
-        bool motionDetected = pir.detectMotion();
+        int64_t edgeUs = 0;
+        bool triggered;
         
-        if (motionDetected && !lastMotionState) {
-            ESP_LOGI(TAG, "Motion detected!");
-            
-            // Check if write is allowed
-            if (mqttApi->canWriteVideo()) {
-                // Wait for permission (non-blocking check)
-                if (mqttApi->waitForWritePermission(100) == ESP_OK) {
-                    RtcTime timestamp;
-                    if (rtc.readTime(timestamp) == ESP_OK) {
-                        // Start or reset write timer
-                        if (videoWriteTimer->isActive()) {
-                            videoWriteTimer->reset();
-                            ESP_LOGI(TAG, "Write timer reset");
-                        } else {
-                            videoWriteTimer->start(timestamp, 30000, 10); // 30s, 10fps
-                            ESP_LOGI(TAG, "Write timer started");
-                        }
-                    }
+        if (interruptMode) {
+            // Ngủ tới cạnh kế tiếp (cạnh trong hold-off cũng đánh thức → nhánh kéo dài bên dưới);
+            // thức mỗi giây khi PIR giữ mức cao trong lúc đang ghi
+            bool holding = pir.detectMotion() && videoWriteTimer->isActive();
+            triggered = pir.waitForMotion(holding ? pdMS_TO_TICKS(1000) : portMAX_DELAY, edgeUs);
+        } else {
+            bool motionDetected = pir.detectMotion();
+            triggered = motionDetected && !lastMotionState;
+            lastMotionState = motionDetected;
+            if (!triggered) {
+                vTaskDelay(pdMS_TO_TICKS(200));
+            }
+        }
+        
+        if (!triggered) {
+            // Motion kéo dài (PIR giữ mức cao) → tiếp tục kéo dài recording mỗi giây
+            if (pir.detectMotion() && videoWriteTimer->isActive() &&
+                xTaskGetTickCount() - lastExtend >= pdMS_TO_TICKS(1000)) {
+                videoWriteTimer->reset();
+                lastExtend = xTaskGetTickCount();
+            }
+            continue;
+        }
+        
+        ESP_LOGI(TAG, "Motion detected!");
+        lastExtend = xTaskGetTickCount();
+        
+        // Upload/stream không chặn ghi (file đang đọc được pin trong catalog)
+        if (mqttApi->waitForWritePermission(100) == ESP_OK) {
+            RtcTime timestamp;
+            if (rtc.readTime(timestamp) == ESP_OK) {
+                // Start or reset write timer
+                if (videoWriteTimer->isActive()) {
+                    videoWriteTimer->reset();
+                    ESP_LOGI(TAG, "Recording extended");
                 } else {
-                    ESP_LOGW(TAG, "Cannot write - resource busy");
+                    // 10s post-roll, 10fps; edgeUs → đo độ trễ cạnh PIR → frame đầu tiên
+                    if (videoWriteTimer->start(timestamp, 10000, 10, edgeUs) == ESP_OK &&
+                        motionVerifier) {
+                        // Ghi ngay (không mất frame đầu), không thấy pixel đổi → bỏ recording
+                        motionVerifier->arm(edgeUs);
+                    }
+                    ESP_LOGI(TAG, "Recording started");
                 }
-            } else {
-                ESP_LOGW(TAG, "Write blocked by stream/memory task");
             }
+        } else {
+            ESP_LOGW(TAG, "Cannot write - resource busy");
         }
-        
-        lastMotionState = motionDetected;
-        vTaskDelay(pdMS_TO_TICKS(200));
     }
     
+    if (interruptMode) {
+        pir.disableInterrupt();
+    }
     ESP_LOGI(TAG, "PIR monitor task ended");
     vTaskDelete(nullptr);
 }
@@ -131,6 +239,13 @@ extern "C" void app_main(void) {
             esp_restart();
         }
     
+    // Camera capture 1 lần, chia frame cho recorder + stream
+    frameBroker = new FrameBroker(sensorMgr->getCamera());
+    if (frameBroker->start() != ESP_OK) {
+        ESP_LOGE(TAG, "Frame broker start failed!");
+        esp_restart();
+    }
+    
     // ========== 2. Initialize SD Card ==========
         ESP_LOGI(TAG, "Step 2: Initializing SD Card");
         sdCardMgr = new SdCardManager("/sdcard");
@@ -142,13 +257,18 @@ extern "C" void app_main(void) {
     
     // ========== 3. Initialize Video Manager ==========
     ESP_LOGI(TAG, "Step 3: Initializing Video Manager");
-    videoMgr = new VideoManager(*sdCardMgr, "/sdcard/videos");
+    videoMgr = new VideoManager(*sdCardMgr, *frameBroker, "/sdcard/videos");
+    
+    videoMgr->setPreRoll(3000, 10);  // 3s pre-roll trước mỗi PIR event
+    videoMgr->setMaxSegmentMs(60000);  // Motion liên tục → mỗi file tối đa 60s
     
     if (videoMgr->init() != ESP_OK) {
         ESP_LOGE(TAG, "Video Manager init failed!");
         esp_restart();
     }
     
+    videoMgr->setStorageQuota(0, 90, 80);  // Toàn bộ thẻ, xóa cũ nhất khi > 90% → 80%
+    
     // ========== 4. Initialize WiFi Manager ==========
     ESP_LOGI(TAG, "Step 4: Initializing WiFi Manager");
     wifiMgr = new WiFiConnectionManager();
@@ -200,7 +320,40 @@ extern "C" void app_main(void) {
     
     // ========== 6. Initialize Stream Manager ==========
     ESP_LOGI(TAG, "Step 6: Initializing Stream Manager");
-    streamMgr = new HttpStreamManager(sensorMgr->getCamera());
+    streamMgr = new HttpStreamManager(*frameBroker, sensorMgr->getCamera());
+    streamMgr->setRateHoldCheck([]() { return videoMgr->isRecording(); });
+    // Recording bắt đầu: bỏ mức nén của stream ngay (frame size không bao giờ đổi)
+    videoMgr->setRecordingPrepare([]() { streamMgr->holdRate(); });
+    
+    // Playback recording từ SD (không bắt buộc → lỗi chỉ tắt /playback)
+    playbackMgr = new PlaybackManager(*videoMgr);
+    if (playbackMgr->init() != ESP_OK) {
+        ESP_LOGW(TAG, "Playback init failed, /playback disabled");
+    }
+    downloadMgr = new DownloadManager(*videoMgr);
+    snapshotCache = new SnapshotCache(*frameBroker);
+    if (snapshotCache->start() != ESP_OK) {
+        ESP_LOGW(TAG, "Snapshot cache start failed, /capture disabled");
+    }
+    
+#if CONFIG_HTTPD_WS_SUPPORT
+    wsStreamMgr = new WsStreamManager(*frameBroker);
+#endif
+    
+    // RTSP cho NVR (rtsp://[ESP32_IP]:554/), không phụ thuộc trạng thái stream MQTT
+    rtspServer = new RtspServer(*frameBroker);
+    if (rtspServer->start() != ESP_OK) {
+        ESP_LOGW(TAG, "RTSP server start failed");
+    }
+    
+    // Upload nền nhường băng thông khi có người xem live (bất kỳ giao thức nào)
+    videoMgr->setViewerCheck([]() {
+        uint8_t viewers = streamMgr->getClientCount() + rtspServer->getPlayingCount();
+#if CONFIG_HTTPD_WS_SUPPORT
+        viewers += wsStreamMgr->getClientCount();
+#endif
+        return viewers > 0;
+    });
     
     // ========== 7. Initialize MQTT API ==========
     ESP_LOGI(TAG, "Step 7: Initializing MQTT API");
@@ -229,6 +382,9 @@ extern "C" void app_main(void) {
     
     ESP_LOGI(TAG, "MQTT connected successfully!");
     
+    // Upload nền: 64 KB/s khi rảnh, 16 KB/s khi live stream, cũ nhất trước
+    videoMgr->setBackgroundUpload(true, UploadOrder::OLDEST_FIRST, 64 * 1024, 16 * 1024);
+    
     // ========== 8. Initialize Video Write Timer ==========
     ESP_LOGI(TAG, "Step 8: Initializing Video Write Timer");
     videoWriteTimer = new VideoWriteTimer(*videoMgr);
@@ -239,6 +395,19 @@ extern "C" void app_main(void) {
         mqttApi->publishFolderName(folderName);
     });
     
+    // Xác nhận PIR bằng thay đổi pixel (core 1); không chạy được → giữ mọi recording như cũ
+    motionVerifier = new MotionVerifier(*frameBroker);
+    motionVerifier->setOnVerdict([](bool confirmed, const MotionResult& result) {
+        if (!confirmed) {
+            videoWriteTimer->discard();
+        }
+    });
+    if (motionVerifier->start() != ESP_OK) {
+        ESP_LOGW(TAG, "Motion verifier start failed, PIR triggers not verified");
+        delete motionVerifier;
+        motionVerifier = nullptr;
+    }
+    
     // ========== 9. Initialize HTTP Server ==========
     ESP_LOGI(TAG, "Step 9: Initializing HTTP Server");
     if (initHttpServer() != ESP_OK) {
@@ -275,16 +444,75 @@ extern "C" void app_main(void) {
         ESP_LOGI(TAG, "WiFi: %s", wifiMgr->isConnected() ? "Connected" : "Disconnected");
         ESP_LOGI(TAG, "MQTT: %s", mqttApi->isConnected() ? "Connected" : "Disconnected");
         ESP_LOGI(TAG, "Stream: %s", streamMgr->isActive() ? "Active" : "Idle");
+        StreamRateStats rate = streamMgr->getRateStats();
+        ESP_LOGI(TAG, "  Rate: level %u/%u (framesize %d, q%u), send %lu/%lu us, down %lu, up %lu%s",
+                 rate.level, rate.levelCount - 1, rate.frameSize, rate.quality, rate.avgSendUs,
+                 rate.budgetUs, rate.downgrades, rate.upgrades, rate.held ? " (held: recording)" : "");
+        for (const StreamClientStats& client : streamMgr->getClientStats()) {
+            ESP_LOGI(TAG, "  Client %d: %lu frames, %llu KB, %.1f/%u fps (max %u), %lu dropped, %lu s",
+                     client.fd, client.frames, client.bytes / 1024, client.fps, client.targetFps,
+                     streamMgr->getTargetFps(), client.dropped, client.connectedMs / 1000);
+        }
+        ESP_LOGI(TAG, "Camera: %.1f/%u fps, frames held %lu (peak %lu)",
+                 frameBroker->getAchievedFps(), frameBroker->getCaptureFps(),
+                 FrameHandle::outstanding(), FrameHandle::peakOutstanding());
         ESP_LOGI(TAG, "Write Timer: %s", videoWriteTimer->isActive() ? "Active" : "Idle");
+        PirStats pirStats = sensorMgr->getPir().getStats();
+        LatencyStat trigger = videoMgr->getPipelineStats().trigger;
+        ESP_LOGI(TAG, "PIR: %lu edges, %lu triggers, %lu held off, %lu glitches, wake max %lu us, "
+                 "edge → first frame %lu/%lu us (avg/max)",
+                 pirStats.edges, pirStats.triggers, pirStats.heldOff, pirStats.glitches,
+                 pirStats.maxWakeUs, trigger.avgUs(), trigger.maxUs);
+        if (motionVerifier) {
+            MotionStats motion = motionVerifier->getStats();
+            ESP_LOGI(TAG, "Motion: %lu confirmed, %lu rejected (%lu recordings, %llu KB discarded), "
+                     "%lu lighting resets, last %u/%u blocks",
+                     motion.confirmed, motion.rejected, videoMgr->getDiscardedCount(),
+                     videoMgr->getDiscardedBytes() / 1024, motion.lightingResets,
+                     motion.last.changedBlocks, motion.last.totalBlocks);
+            ESP_LOGI(TAG, "  Cost: decode %lu/%lu us, analyze %lu/%lu us (avg/max), %u fps, "
+                     "%lu over budget, %lu dropped, %lu decode errors",
+                     motion.decodeAvgUs, motion.decodeMaxUs, motion.analyzeAvgUs, motion.analyzeMaxUs,
+                     motion.fps, motion.overBudget, motion.dropped, motion.decodeErrors);
+        }
+        
+        DownloadStats downloads = downloadMgr->getStats();
+        ESP_LOGI(TAG, "Downloads: %lu requests (%lu partial, %lu not modified), %llu KB",
+                 downloads.requests, downloads.partial, downloads.notModified, downloads.bytes / 1024);
+        SnapshotStats snapshots = snapshotCache->getStats();
+        ESP_LOGI(TAG, "Capture: %lu requests (%lu cached, %lu fresh, %lu not modified), %lu updates",
+                 snapshots.requests, snapshots.cacheHits, snapshots.fresh, snapshots.notModified,
+                 snapshots.updates);
+#if CONFIG_HTTPD_WS_SUPPORT
+        for (const WsClientStats& client : wsStreamMgr->getClientStats()) {
+            ESP_LOGI(TAG, "  WS client %d: %lu frames, %llu KB, %lu credits, %lu stalls, latency %lu ms, %lu s",
+                     client.fd, client.frames, client.bytes / 1024, client.credits, client.stalls,
+                     client.latencyMs, client.connectedMs / 1000);
+        }
+#endif
+        for (const RtspSessionStats& session : rtspServer->getSessionStats()) {
+            ESP_LOGI(TAG, "RTSP %08lX (%s, %s): %lu frames, %lu packets, %llu KB, %lu dropped, %lu send errors",
+                     session.id, session.tcp ? "TCP" : "UDP", session.playing ? "playing" : "ready",
+                     session.frames, session.packets, session.bytes / 1024, session.dropped,
+                     session.sendErrors);
+        }
         ESP_LOGI(TAG, "Stream State: %d", static_cast<int>(mqttApi->getStreamState()));
         ESP_LOGI(TAG, "Memory State: %d", static_cast<int>(mqttApi->getMemoryState()));
         ESP_LOGI(TAG, "Write State: %d", static_cast<int>(mqttApi->getWriteState()));
         
-        // Print SD Card info
-        sdCardMgr->printInfo();
+        // Storage usage (đếm tăng dần, không đọc FAT)
+        RetentionStats storage = videoMgr->getRetentionStats();
+        ESP_LOGI(TAG, "Storage: %llu / %llu MB, evicted %lu, refused %lu, shortened %lu",
+                 storage.usedBytes / (1024 * 1024), storage.budgetBytes / (1024 * 1024),
+                 storage.evictedCount, storage.refusedCount, storage.shortenedCount);
+        
+        // Video count từ catalog (không quét SD)
+        ESP_LOGI(TAG, "Total videos: %lu (%llu KB)",
+                 videoMgr->getVideoCount(), videoMgr->getVideoBytes() / 1024);
         
-        // Print video list
-        auto videos = videoMgr->listVideos();
-        ESP_LOGI(TAG, "Total videos: %zu", videos.size());
+        UploadSchedulerStats uploads = videoMgr->getUploadSchedulerStats();
+        ESP_LOGI(TAG, "Upload queue: %lu (%llu KB), uploaded %lu, failed %lu, yielded %lu, %lu B/s%s",
+                 uploads.queueDepth, uploads.queueBytes / 1024, uploads.uploaded, uploads.failed,
+                 uploads.yields, uploads.rateBps, uploads.interactive ? " (streaming)" : "");
     }
 }
\ No newline at end of file
@@ -0,0 +1,238 @@
+#!/usr/bin/env python3
+"""Local upload receiver for CAM_esp32.
+
+Accepts the uploads VideoManager::readVideo sends:
+  POST /upload          one JPEG per request (UploadMode::PER_FRAME)
+  POST /upload/bundle   whole recording, application/x-cam-bundle (UploadMode::BUNDLE)
+
+Bundles are parsed while they stream in. Every frame CRC32 is checked, and
+the receiver reports throughput per request. See main/CAM_bundle.hpp for the
+format.
+
+Resumable uploads (main/CAM_uploadCheckpoint.hpp):
+  Bundles carrying X-Upload-Id / X-Upload-Offset / X-Upload-Total arrive as
+  byte ranges. Every byte that reaches the receiver is kept, even when the
+  connection drops mid-range, and each reply reports the stored length in
+  X-Upload-Ack. A range that does not start at the stored length is answered
+  with 409 and the same header, so the camera continues from there. The bundle
+  is verified once all bytes are in.
+  Per-frame uploads carry X-Recording / X-Frame-Index; frames sent twice after
+  a resume are acknowledged and logged as duplicates. AVI frames also carry
+  X-Timestamp / X-Frame-Duration (ms), since repeated AVI index entries are
+  sent once and the gap is only visible in the timing.
+
+  python3 bundle_receiver.py --port 80 --out ./received
+"""
+
+import argparse
+import io
+import os
+import struct
+import sys
+import time
+import zlib
+import threading
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+BUNDLE_MAGIC = 0x424D4143  # "CAMB"
+HEADER = struct.Struct("<IHHII16s")
+FRAME_HEADER = struct.Struct("<IIQ")
+FRAME_TRAILER = struct.Struct("<I")
+ACK_HEADER = "X-Upload-Ack"
+READ_CHUNK = 64 * 1024
+
+
+class BundleError(Exception):
+    pass
+
+
+class BodyReader:
+    """Reads exactly Content-Length bytes from the request stream."""
+
+    def __init__(self, stream, length):
+        self.stream = stream
+        self.remaining = length
+
+    def read(self, n):
+        if n > self.remaining:
+            raise BundleError("bundle longer than Content-Length")
+        data = bytearray()
+        while len(data) < n:
+            chunk = self.stream.read(n - len(data))
+            if not chunk:
+                raise BundleError("connection closed mid-bundle")
+            data += chunk
+        self.remaining -= n
+        return bytes(data)
+
+
+def parse_bundle(body, out_dir=None):
+    magic, version, header_size, frame_count, interval_us, name = HEADER.unpack(body.read(HEADER.size))
+    if magic != BUNDLE_MAGIC:
+        raise BundleError("bad magic 0x%08x" % magic)
+    if version != 1 or header_size < HEADER.size:
+        raise BundleError("unsupported version %d / header %d" % (version, header_size))
+    body.read(header_size - HEADER.size)
+    name = name.split(b"\0", 1)[0].decode("ascii", "replace")
+
+    target = None
+    if out_dir:
+        target = os.path.join(out_dir, name or "bundle")
+        os.makedirs(target, exist_ok=True)
+
+    for expected in range(frame_count):
+        index, length, timestamp_us = FRAME_HEADER.unpack(body.read(FRAME_HEADER.size))
+        if index != expected:
+            raise BundleError("frame %d out of order (got %d)" % (expected, index))
+        jpeg = body.read(length)
+        (crc,) = FRAME_TRAILER.unpack(body.read(FRAME_TRAILER.size))
+        if zlib.crc32(jpeg) != crc:
+            raise BundleError("frame %d CRC mismatch" % index)
+        if jpeg[:2] != b"\xff\xd8":
+            raise BundleError("frame %d is not a JPEG" % index)
+        if target:
+            with open(os.path.join(target, "%04d.jpg" % (index + 1)), "wb") as f:
+                f.write(jpeg)
+
+    if body.remaining:
+        raise BundleError("%d trailing bytes" % body.remaining)
+    return name, frame_count, interval_us
+
+
+class Uploads:
+    """Partial resumable bundles, by X-Upload-Id."""
+
+    def __init__(self):
+        self.lock = threading.Lock()
+        self.partial = {}    # id -> bytearray
+        self.completed = {}  # id -> total
+        self.frames = set()  # (recording, index) seen in per-frame mode
+
+    def stored(self, upload_id):
+        with self.lock:
+            if upload_id in self.completed:
+                return self.completed[upload_id]
+            return len(self.partial.get(upload_id, b""))
+
+
+class Handler(BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"  # keep-alive, giống HttpUploader session
+    out_dir = None
+    uploads = Uploads()
+
+    def reply(self, code, text, ack=None):
+        payload = (text + "\n").encode()
+        self.send_response(code)
+        self.send_header("Content-Type", "text/plain")
+        self.send_header("Content-Length", str(len(payload)))
+        if ack is not None:
+            self.send_header(ACK_HEADER, str(ack))
+        self.end_headers()
+        self.wfile.write(payload)
+
+    def do_ranged_bundle(self, upload_id, length):
+        offset = int(self.headers["X-Upload-Offset"])
+        total = int(self.headers["X-Upload-Total"])
+        uploads = self.uploads
+        stored = uploads.stored(upload_id)
+
+        if offset != stored or offset + length > total:
+            # Range lệch (ack bị mất, hoặc camera có checkpoint cũ) → báo offset thật
+            if length:
+                self.rfile.read(length)
+            self.log_message("range %s @%d rejected, have %d", upload_id, offset, stored)
+            self.reply(409, "offset mismatch", ack=stored)
+            return
+
+        with uploads.lock:
+            data = uploads.partial.setdefault(upload_id, bytearray())
+            uploads.completed.pop(upload_id, None)
+        remaining = length
+        while remaining:
+            chunk = self.rfile.read(min(remaining, READ_CHUNK))
+            if not chunk:
+                # Giữ phần đã nhận: lần resume sau hỏi lại qua request rỗng
+                self.log_message("range %s cut at %d", upload_id, len(data))
+                self.close_connection = True
+                return
+            data += chunk
+            remaining -= len(chunk)
+
+        if len(data) < total:
+            self.reply(200, "partial", ack=len(data))
+            return
+
+        with uploads.lock:
+            uploads.partial.pop(upload_id, None)
+        try:
+            name, frames, interval_us = parse_bundle(BodyReader(io.BytesIO(bytes(data)), total), self.out_dir)
+        except (BundleError, struct.error) as err:
+            self.log_message("REJECTED %s: %s", upload_id, err)
+            self.reply(400, str(err), ack=0)
+            return
+        with uploads.lock:
+            uploads.completed[upload_id] = total
+        self.log_message("bundle %s: %d frames, %d us/frame, %d bytes (resumable)",
+                         name, frames, interval_us, total)
+        self.reply(200, "OK", ack=total)
+
+    def do_POST(self):
+        length = int(self.headers.get("Content-Length", 0))
+        body = BodyReader(self.rfile, length)
+        start = time.monotonic()
+
+        upload_id = self.headers.get("X-Upload-Id")
+        if self.path == "/upload/bundle" and upload_id:
+            self.do_ranged_bundle(upload_id, length)
+            return
+
+        try:
+            if self.path == "/upload/bundle":
+                name, frames, interval_us = parse_bundle(body, self.out_dir)
+                summary = "bundle %s: %d frames, %d us/frame" % (name, frames, interval_us)
+            elif self.path == "/upload":
+                jpeg = body.read(length)
+                if jpeg[:2] != b"\xff\xd8":
+                    raise BundleError("not a JPEG")
+                summary = "jpeg"
+                recording = self.headers.get("X-Recording")
+                if recording:
+                    key = (recording, int(self.headers.get("X-Frame-Index", -1)))
+                    with self.uploads.lock:
+                        duplicate = key in self.uploads.frames
+                        self.uploads.frames.add(key)
+                    summary = "%s frame %d%s" % (key[0], key[1], " (duplicate)" if duplicate else "")
+            else:
+                self.reply(404, "unknown path")
+                return
+        except (BundleError, struct.error) as err:
+            # Bỏ phần body còn lại để kết nối keep-alive dùng tiếp được
+            if body.remaining:
+                self.rfile.read(body.remaining)
+            self.log_message("REJECTED %s: %s", self.path, err)
+            self.reply(400, str(err))
+            return
+
+        elapsed = max(time.monotonic() - start, 1e-6)
+        self.log_message("%s, %d bytes in %.2f s (%.1f KB/s)",
+                         summary, length, elapsed, length / 1024 / elapsed)
+        self.reply(200, "OK")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--port", type=int, default=80)
+    parser.add_argument("--out", help="write received frames under this directory")
+    args = parser.parse_args()
+
+    Handler.out_dir = args.out
+    server = ThreadingHTTPServer(("", args.port), Handler)
+    print("Listening on :%d" % args.port, file=sys.stderr)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()